@@ -1,60 +1,331 @@
 #include "IR_Gen_Context.h"
+#include "IR_Widen.h"
+#include "SC_Target.h"
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Linker.h>
+#include <llvm/Analysis/InlineCost.h>
+#include <llvm/Support/CallSite.h>
+#include <llvm/Support/InstIterator.h>
+#include <llvm/Transforms/Vectorize.h>
+#include <algorithm>
 
 namespace SC {
 
-llvm::IRBuilder<> CG_Context::sBuilder(getGlobalContext());
+llvm::IRBuilder<> CG_Context::sGlobalBuilder(getGlobalContext());
 llvm::Module* CG_Context::TheModule = NULL;
 llvm::ExecutionEngine* CG_Context::TheExecutionEngine = NULL;
-llvm::FunctionPassManager* CG_Context::TheFPM = NULL;
 llvm::DataLayout* CG_Context::TheDataLayout = NULL;
 std::hash_map<std::string, void*> CG_Context::sGlobalFuncSymbols;
+std::vector<std::string> CG_Context::sExternalBitcode;
+std::hash_map<std::string, int> CG_Context::sExternalBitcodeFuncs;
+llvm::sys::Mutex CG_Context::sGlobalFuncSymbolsLock;
+std::hash_map<llvm::Type*, llvm::Type*> CG_Context::sGlobalPackedStructTypes;
+
+SC_THREAD_LOCAL CG_Session* CG_Session::s_pCurrent = NULL;
+// The execution engines are created by different sessions, the creation is serialized to be safe with the 
+// target registry of LLVM.
+static llvm::sys::Mutex s_engineCreationLock;
+
+// The predefined functions are JIT-ed by the global engine, the functions they call outside are the host ones(e.g. the
+// C runtime functions of the scalar built-in math) only.
+static void* ResolveGlobalExternalFunction(const std::string& funcName)
+{
+	return CG_Context::FindGlobalFuncSymbol(funcName);
+}
 
 bool InitializeCodeGen()
 {
+	// The compiling sessions run on multiple threads, the LLVM global states(e.g. the pass registry) need the locks.
+	llvm::llvm_start_multithreaded();
 	llvm::InitializeNativeTarget();
 	LLVMContext &llvmCtx = llvm::getGlobalContext();
 	CG_Context::TheModule = new Module("Kai's Shader Compiler", llvmCtx);
+	// The target is fixed from now on, the engines of the modules are created for the same one.
+	Target::Resolve();
 	std::string ErrStr;
-	CG_Context::TheExecutionEngine = EngineBuilder(CG_Context::TheModule).setErrorStr(&ErrStr).create();
+	EngineBuilder builder(CG_Context::TheModule);
+	builder.setErrorStr(&ErrStr);
+	Target::Apply(builder);
+	CG_Context::TheExecutionEngine = builder.create();
 	if (!CG_Context::TheExecutionEngine) {
 		return false;
 	}
 
-	CG_Context::TheFPM = new llvm::FunctionPassManager(CG_Context::TheModule);
-
-	// Set up the optimizer pipeline.  Start with registering info about how the
-	// target lays out data structures.
+	// Keep a copy of how the target lays out data structures, the optimizer and the structure 
+	// description both need it.
 	CG_Context::TheDataLayout = new DataLayout(*CG_Context::TheExecutionEngine->getDataLayout());
-	CG_Context::TheFPM->add(CG_Context::TheDataLayout);
-	// Provide basic AliasAnalysis support for GVN.
-	CG_Context::TheFPM->add(createBasicAliasAnalysisPass());
-	// Promote allocas to registers.
-	CG_Context::TheFPM->add(createPromoteMemoryToRegisterPass());
-	// Do simple "peephole" optimizations and bit-twiddling optzns.
-	CG_Context::TheFPM->add(createInstructionCombiningPass());
-	// Reassociate expressions.
-	CG_Context::TheFPM->add(createReassociatePass());
-	// Eliminate Common SubExpressions.
-	CG_Context::TheFPM->add(createGVNPass());
-	// Simplify the control flow graph (deleting unreachable blocks, etc).
-	CG_Context::TheFPM->add(createCFGSimplificationPass());
-
-	CG_Context::TheFPM->doInitialization();
-
 
 	// Set up the executing engine
 	//
-	// the sybmoll searching(e.g. for standard CRT) is disabled
+	// the sybmoll searching(e.g. for standard CRT) is disabled, the external functions are the registered ones
 	CG_Context::TheExecutionEngine->DisableSymbolSearching(true);
+	CG_Context::TheExecutionEngine->InstallLazyFunctionCreator(ResolveGlobalExternalFunction);
+
 
+	return true;
+}
+
+// The functions declared in the compiled modules but implemented outside are resolved by name when they get JIT-ed,
+// they are either the predefined functions JIT-ed by the global engine or the external functions of the host.
+static void* ResolveExternalFunction(const std::string& funcName)
+{
+	llvm::Function* F = CG_Context::TheModule->getFunction(funcName);
+	if (F)
+		return CG_Context::TheExecutionEngine->getPointerToFunction(F);
+	else
+		return CG_Context::FindGlobalFuncSymbol(funcName);
+}
+
+CG_Session::CG_Session() :
+	mBuilder(mLLVMContext)
+{
+	mpModule = NULL;
+	mpEngine = NULL;
+	mpDataLayout = NULL;
+}
+
+CG_Session::~CG_Session()
+{
+	// The engine owns the llvm module, its machine code is freed with it.
+	delete mpDataLayout;
+	delete mpEngine;
+}
+
+bool CG_Session::Initialize(std::string& errMsg, llvm::Module* pModule)
+{
+	mpModule = pModule ? pModule : new Module("KSC Module", mLLVMContext);
+	{
+		llvm::MutexGuard locked(s_engineCreationLock);
+		EngineBuilder builder(mpModule);
+		builder.setErrorStr(&errMsg);
+		Target::Apply(builder);
+		mpEngine = builder.create();
+	}
+	if (!mpEngine) {
+		delete mpModule;
+		mpModule = NULL;
+		return false;
+	}
+	mpEngine->DisableSymbolSearching(true);
+	mpEngine->InstallLazyFunctionCreator(ResolveExternalFunction);
 
+	mpDataLayout = new DataLayout(*mpEngine->getDataLayout());
+	mpModule->setDataLayout(mpDataLayout->getStringRepresentation());
 	return true;
 }
 
+CG_Session* CG_Session::GetCurrent()
+{
+	return s_pCurrent;
+}
+
+CG_Session::Scope::Scope(CG_Session* pSession)
+{
+	mpPrevSession = s_pCurrent;
+	s_pCurrent = pSession;
+}
+
+CG_Session::Scope::~Scope()
+{
+	s_pCurrent = mpPrevSession;
+}
+
 void DestoryCodeGen()
 {
-	delete CG_Context::TheFPM;
+	delete CG_Context::TheDataLayout;
 	delete CG_Context::TheExecutionEngine;
+
+	// The bitcode of the host is added again after the next initialization
+	llvm::MutexGuard locked(CG_Context::sGlobalFuncSymbolsLock);
+	CG_Context::sExternalBitcode.clear();
+	CG_Context::sExternalBitcodeFuncs.clear();
+}
+
+bool OptimizeFunction(llvm::Function* F, int optLevel)
+{
+	if (!F || F->isDeclaration())
+		return false;
+	if (optLevel <= 0)
+		return true;
+
+	llvm::PassManagerBuilder builder;
+	builder.OptLevel = optLevel > 3 ? 3 : optLevel;
+	builder.SizeLevel = 0;
+
+	llvm::FunctionPassManager fpm(F->getParent());
+	fpm.add(new DataLayout(*CG_Context::GetDataLayout()));
+	builder.populateFunctionPassManager(fpm);
+	fpm.doInitialization();
+	fpm.run(*F);
+	fpm.doFinalization();
+	return true;
+}
+
+// The inline thresholds of the levels, they are shared by the module inliner and the inlining of the lazy mode
+#define INLINE_THRESHOLD_O2 225
+#define INLINE_THRESHOLD_O3 275
+
+// O1 : scalar clean-up(mem2reg, instcombine, reassociate, CFG simplification, etc), no inlining or unrolling.
+// O2 : plus function inlining, LICM, loop unrolling and the loop vectorizer.
+// O3 : plus more aggressive inlining and the basic-block(SLP) vectorizer.
+//
+static void SetupPassBuilder(llvm::PassManagerBuilder& builder, int optLevel)
+{
+	builder.OptLevel = optLevel;
+	builder.SizeLevel = 0;
+	builder.DisableUnrollLoops = (optLevel < 2);
+	builder.LoopVectorize = (optLevel >= 2);
+	builder.Vectorize = (optLevel >= 3);
+	if (optLevel >= 2)
+		builder.Inliner = llvm::createFunctionInliningPass(optLevel >= 3 ? INLINE_THRESHOLD_O3 : INLINE_THRESHOLD_O2);
+}
+
+// Runs the per-function pipeline on the given functions, it promotes the allocas of local variables
+// to registers so the inliner sees the real cost of each callee.
+static void RunFunctionPasses(llvm::Module* M, const std::vector<llvm::Function*>& funcs, llvm::PassManagerBuilder& builder)
+{
+	llvm::FunctionPassManager fpm(M);
+	fpm.add(new DataLayout(*CG_Context::GetDataLayout()));
+	builder.populateFunctionPassManager(fpm);
+	fpm.doInitialization();
+	for (int i = 0; i < (int)funcs.size(); ++i) {
+		if (!funcs[i]->isDeclaration())
+			fpm.run(*funcs[i]);
+	}
+	fpm.doFinalization();
+}
+
+bool OptimizeModule(KSC_ModuleDesc& moduleDesc, int optLevel)
+{
+	if (optLevel <= 0)
+		return true;
+	if (optLevel > 3)
+		optLevel = 3;
+
+	std::vector<llvm::Function*> funcs;
+	std::hash_map<std::string, KSC_FunctionDesc*>::iterator it = moduleDesc.mFunctionDesc.begin();
+	for (; it != moduleDesc.mFunctionDesc.end(); ++it) {
+		if (it->second->F)
+			funcs.push_back(it->second->F);
+	}
+
+	llvm::PassManagerBuilder builder;
+	SetupPassBuilder(builder, optLevel);
+	llvm::Module* M = moduleDesc.mpSession->mpModule;
+	RunFunctionPasses(M, funcs, builder);
+
+	// Then the inter-procedural passes(inliner, loop passes and vectorizers) over the module.
+	llvm::PassManager mpm;
+	mpm.add(new DataLayout(*CG_Context::GetDataLayout()));
+	builder.populateModulePassManager(mpm);
+	mpm.run(*M);
+	return true;
+}
+
+// Inlines the calls to the functions defined in the module into the given functions, the other functions are not 
+// touched. The functions are visited from the last one, so a callee generated together with its caller(they are in the
+// order of the call graph) has its own calls inlined before it is inlined into the caller.
+//
+static void InlineCalls(const std::vector<llvm::Function*>& funcs, int threshold)
+{
+	llvm::InlineCostAnalyzer costAnalyzer;
+	costAnalyzer.setDataLayout(CG_Context::GetDataLayout());
+	for (int i = (int)funcs.size() - 1; i >= 0; --i) {
+		llvm::Function* F = funcs[i];
+		if (F->isDeclaration())
+			continue;
+
+		std::vector<llvm::CallInst*> calls;
+		for (llvm::inst_iterator it = llvm::inst_begin(F); it != llvm::inst_end(F); ++it) {
+			llvm::CallInst* pCall = llvm::dyn_cast<llvm::CallInst>(&*it);
+			llvm::Function* pCallee = pCall ? pCall->getCalledFunction() : NULL;
+			if (pCallee && pCallee != F && !pCallee->isDeclaration())
+				calls.push_back(pCall);
+		}
+		for (int ci = 0; ci < (int)calls.size(); ++ci) {
+			if (costAnalyzer.getInlineCost(llvm::CallSite(calls[ci]), threshold)) {
+				llvm::InlineFunctionInfo inlineInfo(NULL, CG_Context::GetDataLayout());
+				llvm::InlineFunction(calls[ci], inlineInfo);
+			}
+		}
+	}
+}
+
+// The passes of the module pipeline after the inliner which work on one function at a time, 
+// see PassManagerBuilder::populateModulePassManager.
+static void AddPostInlinePasses(llvm::FunctionPassManager& fpm, const llvm::PassManagerBuilder& builder)
+{
+	fpm.add(llvm::createScalarReplAggregatesPass(-1, false));
+	fpm.add(llvm::createEarlyCSEPass());
+	fpm.add(llvm::createJumpThreadingPass());
+	fpm.add(llvm::createCorrelatedValuePropagationPass());
+	fpm.add(llvm::createCFGSimplificationPass());
+	fpm.add(llvm::createInstructionCombiningPass());
+	fpm.add(llvm::createTailCallEliminationPass());
+	fpm.add(llvm::createCFGSimplificationPass());
+	fpm.add(llvm::createReassociatePass());
+	fpm.add(llvm::createLoopRotatePass());
+	fpm.add(llvm::createLICMPass());
+	fpm.add(llvm::createLoopUnswitchPass(builder.OptLevel < 3));
+	fpm.add(llvm::createInstructionCombiningPass());
+	fpm.add(llvm::createIndVarSimplifyPass());
+	fpm.add(llvm::createLoopIdiomPass());
+	fpm.add(llvm::createLoopDeletionPass());
+	if (builder.LoopVectorize)
+		fpm.add(llvm::createLoopVectorizePass());
+	if (!builder.DisableUnrollLoops)
+		fpm.add(llvm::createLoopUnrollPass());
+	if (builder.OptLevel > 1)
+		fpm.add(llvm::createGVNPass());
+	fpm.add(llvm::createMemCpyOptPass());
+	fpm.add(llvm::createSCCPPass());
+	fpm.add(llvm::createInstructionCombiningPass());
+	fpm.add(llvm::createJumpThreadingPass());
+	fpm.add(llvm::createCorrelatedValuePropagationPass());
+	fpm.add(llvm::createDeadStoreEliminationPass());
+	if (builder.Vectorize) {
+		fpm.add(llvm::createBBVectorizePass());
+		fpm.add(llvm::createInstructionCombiningPass());
+		if (builder.OptLevel > 1)
+			fpm.add(llvm::createGVNPass());
+	}
+	fpm.add(llvm::createAggressiveDCEPass());
+	fpm.add(llvm::createCFGSimplificationPass());
+	fpm.add(llvm::createInstructionCombiningPass());
+}
+
+bool OptimizeFunctions(llvm::Module* M, const std::vector<llvm::Function*>& funcs, int optLevel)
+{
+	if (optLevel <= 0)
+		return true;
+	if (optLevel > 3)
+		optLevel = 3;
+
+	// The module passes are not run here, otherwise each lookup in lazy mode would optimize all the functions
+	// compiled so far again. Besides, the code generation context keeps the declarations of the functions not 
+	// called yet, which the module passes(e.g. the stripping of dead prototypes) would delete. So the inlining 
+	// and the passes following it are done on the new functions only.
+	//
+	llvm::PassManagerBuilder builder;
+	SetupPassBuilder(builder, optLevel);
+	RunFunctionPasses(M, funcs, builder);
+	if (optLevel < 2)
+		return true;
+
+	InlineCalls(funcs, optLevel >= 3 ? INLINE_THRESHOLD_O3 : INLINE_THRESHOLD_O2);
+	llvm::FunctionPassManager fpm(M);
+	fpm.add(new DataLayout(*CG_Context::GetDataLayout()));
+	AddPostInlinePasses(fpm, builder);
+	fpm.doInitialization();
+	for (int i = 0; i < (int)funcs.size(); ++i) {
+		if (!funcs[i]->isDeclaration())
+			fpm.run(*funcs[i]);
+	}
+	fpm.doFinalization();
+	return true;
 }
 
 
@@ -76,6 +347,117 @@ CG_Context* CG_Context::CreateChildContext(Function* pCurFunc, llvm::BasicBlock*
 	return pRet;
 }
 
+llvm::LLVMContext& CG_Context::GetLLVMContext()
+{
+	CG_Session* pSession = CG_Session::GetCurrent();
+	return pSession ? pSession->mLLVMContext : getGlobalContext();
+}
+
+llvm::IRBuilder<>& CG_Context::GetBuilder()
+{
+	CG_Session* pSession = CG_Session::GetCurrent();
+	return pSession ? pSession->mBuilder : sGlobalBuilder;
+}
+
+llvm::Module* CG_Context::GetModule()
+{
+	CG_Session* pSession = CG_Session::GetCurrent();
+	return pSession ? pSession->mpModule : TheModule;
+}
+
+llvm::ExecutionEngine* CG_Context::GetExecutionEngine()
+{
+	CG_Session* pSession = CG_Session::GetCurrent();
+	return pSession ? pSession->mpEngine : TheExecutionEngine;
+}
+
+llvm::DataLayout* CG_Context::GetDataLayout()
+{
+	CG_Session* pSession = CG_Session::GetCurrent();
+	return pSession ? pSession->mpDataLayout : TheDataLayout;
+}
+
+std::hash_map<llvm::Type*, llvm::Type*>& CG_Context::GetPackedStructTypes()
+{
+	CG_Session* pSession = CG_Session::GetCurrent();
+	return pSession ? pSession->mPackedStructTypes : sGlobalPackedStructTypes;
+}
+
+void CG_Context::AddGlobalFuncSymbol(const std::string& funcName, void* funcPtr)
+{
+	llvm::MutexGuard locked(sGlobalFuncSymbolsLock);
+	sGlobalFuncSymbols[funcName] = funcPtr;
+}
+
+void* CG_Context::FindGlobalFuncSymbol(const std::string& funcName)
+{
+	llvm::MutexGuard locked(sGlobalFuncSymbolsLock);
+	std::hash_map<std::string, void*>::iterator it = sGlobalFuncSymbols.find(funcName);
+	return it != sGlobalFuncSymbols.end() ? it->second : NULL;
+}
+
+bool CG_Context::AddExternalBitcode(const void* bitcode, size_t len, std::string& errMsg)
+{
+	std::string code((const char*)bitcode, len);
+
+	// Parse it once to validate it and find the functions it defines, the modules link their own copies later.
+	llvm::LLVMContext C;
+	llvm::OwningPtr<llvm::MemoryBuffer> buffer(llvm::MemoryBuffer::getMemBuffer(code, "", false));
+	llvm::OwningPtr<llvm::Module> M(llvm::ParseBitcodeFile(buffer.get(), C, &errMsg));
+	if (!M)
+		return false;
+
+	llvm::MutexGuard locked(sGlobalFuncSymbolsLock);
+	int bitcodeIdx = (int)sExternalBitcode.size();
+	sExternalBitcode.push_back(code);
+	for (llvm::Module::iterator it = M->begin(); it != M->end(); ++it) {
+		if (!it->isDeclaration() && !it->hasLocalLinkage())
+			sExternalBitcodeFuncs[it->getName().str()] = bitcodeIdx;
+	}
+	return true;
+}
+
+llvm::Function* CG_Context::LinkExternalFunction(const std::string& funcName, llvm::FunctionType* funcType)
+{
+	std::string code;
+	{
+		llvm::MutexGuard locked(sGlobalFuncSymbolsLock);
+		std::hash_map<std::string, int>::iterator it = sExternalBitcodeFuncs.find(funcName);
+		if (it == sExternalBitcodeFuncs.end())
+			return NULL;
+		code = sExternalBitcode[it->second];
+	}
+
+	// The bitcode is linked already if another function of it was declared before
+	llvm::Module* M = GetModule();
+	llvm::Function* F = M->getFunction(funcName);
+	if (!F || F->isDeclaration()) {
+		std::string errMsg;
+		llvm::OwningPtr<llvm::MemoryBuffer> buffer(llvm::MemoryBuffer::getMemBuffer(code, "", false));
+		llvm::Module* pSrcModule = llvm::ParseBitcodeFile(buffer.get(), GetLLVMContext(), &errMsg);
+		if (!pSrcModule)
+			return NULL;
+		// The declaration in KSCL must agree with the definition, otherwise it's left to the host symbols
+		llvm::Function* pSrcF = pSrcModule->getFunction(funcName);
+		bool linked = pSrcF && pSrcF->getFunctionType() == funcType;
+		// The other functions of the bitcode may clash with the ones of the module, i.e. the KSCL functions of the same 
+		// name or the external functions declared with another type. They are kept private to the bitcode, the linker
+		// renames them instead of resolving the module's functions to them.
+		//
+		for (llvm::Module::iterator it = pSrcModule->begin(); linked && it != pSrcModule->end(); ++it) {
+			llvm::Function* pDestF = M->getFunction(it->getName());
+			if (!it->isDeclaration() && pDestF && (!pDestF->isDeclaration() || pDestF->getFunctionType() != it->getFunctionType()))
+				it->setLinkage(llvm::GlobalValue::InternalLinkage);
+		}
+		linked = linked && !llvm::Linker::LinkModules(M, pSrcModule, llvm::Linker::DestroySource, &errMsg);
+		delete pSrcModule;
+		if (!linked)
+			return NULL;
+		F = M->getFunction(funcName);
+	}
+	return (F && !F->isDeclaration() && F->getFunctionType() == funcType) ? F : NULL;
+}
+
 Function* CG_Context::GetCurrentFunc()
 {
 	return mpCurFunction;
@@ -118,9 +500,9 @@ llvm::Type* CG_Context::ConvertToLLVMType(VarType tp)
 	case VarType::kBoolean:
 		return SC_INT_TYPE; // Use integer to represent boolean value
 	case VarType::kExternType:
-		return llvm::PointerType::get(Type::getInt8Ty(getGlobalContext()), 0);
+		return llvm::PointerType::get(Type::getInt8Ty(GetLLVMContext()), 0);
 	case VarType::kVoid:
-		return Type::getVoidTy(getGlobalContext());
+		return Type::getVoidTy(GetLLVMContext());
 	}
 
 	return NULL;
@@ -130,14 +512,14 @@ int CG_Context::GetSizeOfLLVMType(VarType tp)
 {
 	llvm::Type* type = ConvertToLLVMType(tp);
 	assert(type);
-	return (int)TheDataLayout->getTypeAllocSize(type);
+	return (int)GetDataLayout()->getTypeAllocSize(type);
 }
 
 int CG_Context::GetAlignmentOfLLVMType(VarType tp)
 {
 	llvm::Type* type = ConvertToLLVMType(tp);
 	assert(type);
-	return (int)TheDataLayout->getABITypeAlignment(type);
+	return (int)GetDataLayout()->getABITypeAlignment(type);
 }
 
 llvm::Type* CG_Context::ConvertToPackedType(llvm::Type* srcType)
@@ -156,12 +538,20 @@ llvm::Type* CG_Context::ConvertToPackedType(llvm::Type* srcType)
 		destType = llvm::ArrayType::get(elemType, elemCnt);
 	}
 	else if (srcActualType->isStructTy()) {
-		llvm::StructType* structType = dyn_cast<llvm::StructType>(srcActualType);
-		std::vector<llvm::Type*> newTypes;
-		for (unsigned int i = 0; i < structType->getNumElements(); ++i) {
-			newTypes.push_back(ConvertToPackedType(structType->getElementType(i)));
+		// The packed structure types are created once for each session
+		std::hash_map<llvm::Type*, llvm::Type*>& packedTypes = GetPackedStructTypes();
+		std::hash_map<llvm::Type*, llvm::Type*>::iterator it = packedTypes.find(srcActualType);
+		if (it != packedTypes.end())
+			destType = it->second;
+		else {
+			llvm::StructType* structType = dyn_cast<llvm::StructType>(srcActualType);
+			std::vector<llvm::Type*> newTypes;
+			for (unsigned int i = 0; i < structType->getNumElements(); ++i) {
+				newTypes.push_back(ConvertToPackedType(structType->getElementType(i)));
+			}
+			destType = llvm::StructType::create(GetLLVMContext(), newTypes);
+			packedTypes[srcActualType] = destType;
 		}
-		destType = llvm::StructType::create(getGlobalContext(), newTypes);
 	}
 	else if (srcActualType->isArrayTy()) {
 		llvm::ArrayType* arrayType = dyn_cast<llvm::ArrayType>(srcActualType);
@@ -178,141 +568,161 @@ llvm::Type* CG_Context::ConvertToPackedType(llvm::Type* srcType)
 		return destType;
 }
 
-void CG_Context::ConvertValueToPacked(llvm::Value* srcValue, llvm::Value* destPtr)
+static bool IsPackedType(llvm::Type* type)
 {
-	llvm::Type* srcType = NULL;
-	llvm::Value* srcActualValue = NULL;
-	if (srcValue->getType()->isPointerTy()) {
-		llvm::PointerType* srcPtrType = dyn_cast<llvm::PointerType>(srcValue->getType());
-		srcType = srcPtrType->getElementType();
-		srcActualValue = sBuilder.CreateLoad(srcValue);
-	}
-	else {
-		srcType = srcValue->getType();
-		srcActualValue = srcValue;
-	}
-
-	llvm::Value* destValuePtr = destPtr;
-
-	if (srcType->isVectorTy()) {
-
-		llvm::VectorType* vType = dyn_cast<llvm::VectorType>(srcType);
-		for (unsigned int i = 0; i < vType->getNumElements(); ++i) {
-			llvm::Value* idx = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)i));
-			llvm::Value* elemValue = sBuilder.CreateExtractElement(srcActualValue, idx);
-			std::vector<llvm::Value*> indices(2);
-			indices[1] = idx;
-			indices[0] = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)0));
-			llvm::Value* elemPtr = sBuilder.CreateGEP(destValuePtr, indices);
-			sBuilder.CreateStore(elemValue, elemPtr);
+	if (type->isPointerTy())
+		return IsPackedType(dyn_cast<llvm::PointerType>(type)->getElementType());
+	else if (type->isVectorTy())
+		return false;
+	else if (type->isStructTy()) {
+		llvm::StructType* structType = dyn_cast<llvm::StructType>(type);
+		for (unsigned int i = 0; i < structType->getNumElements(); ++i) {
+			if (!IsPackedType(structType->getElementType(i)))
+				return false;
 		}
-		
+		return true;
 	}
-	else if (srcType->isArrayTy() || srcType->isStructTy()) {
-
-		llvm::CompositeType* pCompType = dyn_cast<llvm::CompositeType>(srcType);
-		unsigned int Idx = 0;
-		while (1) {
-			if (!pCompType->indexValid(Idx))
-				break;
-
-			llvm::Value* destIdx = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)Idx));
-			std::vector<llvm::Value*> indices(2);
-			indices[1] = destIdx;
-			indices[0] = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)0));
-			llvm::Value* destElemPtr = sBuilder.CreateGEP(destValuePtr, indices);
+	else if (type->isArrayTy())
+		return IsPackedType(dyn_cast<llvm::ArrayType>(type)->getElementType());
+	else
+		return true;
+}
 
-			std::vector<unsigned int> srcIdx(1);
-			srcIdx[0] = Idx;
-			llvm::Value* srcElemValue = sBuilder.CreateExtractValue(srcActualValue, srcIdx);
+bool CG_Context::NeedPackedWrapper(const KSC_FunctionDesc& fDesc)
+{
+	for (int i = 0; i < (int)fDesc.needJITPacked.size(); ++i) {
+		if (fDesc.needJITPacked[i])
+			return true;
+	}
+	return !IsPackedType(fDesc.F->getReturnType());
+}
 
-			ConvertValueToPacked(srcElemValue, destElemPtr);
+// The packed data is only aligned to its scalar elements, e.g. float4 is passed by the host as float[4].
+static unsigned int PackedElementAlignment(llvm::Type* type)
+{
+	while (type->isVectorTy() || type->isArrayTy())
+		type = dyn_cast<llvm::SequentialType>(type)->getElementType();
+	return CG_Context::GetDataLayout()->getABITypeAlignment(type);
+}
 
-			++Idx;
-		}
+// Copies the packed data to the memory of KSC layout. The vectors are loaded as a whole with unaligned loads,
+// the data without any vector inside has the same layout on both sides so it is copied in bulk.
+//
+static void CopyFromPacked(llvm::Value* srcPtr, llvm::Value* destPtr)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::Type* destType = dyn_cast<llvm::PointerType>(destPtr->getType())->getElementType();
+	if (destType->isVectorTy()) {
+		llvm::LoadInst* vecValue = builder.CreateLoad(builder.CreateBitCast(srcPtr, destType->getPointerTo()));
+		vecValue->setAlignment(PackedElementAlignment(destType));
+		builder.CreateStore(vecValue, destPtr);
+	}
+	else if (!destType->isAggregateType())
+		builder.CreateStore(builder.CreateLoad(srcPtr), destPtr);
+	else if (IsPackedType(destType)) {
+		llvm::DataLayout* pDataLayout = CG_Context::GetDataLayout();
+		builder.CreateMemCpy(destPtr, srcPtr, pDataLayout->getTypeAllocSize(destType), pDataLayout->getABITypeAlignment(destType));
+	}
+	else {
+		llvm::CompositeType* pCompType = dyn_cast<llvm::CompositeType>(destType);
+		for (unsigned int i = 0; pCompType->indexValid(i); ++i)
+			CopyFromPacked(builder.CreateConstGEP2_32(srcPtr, 0, i), builder.CreateConstGEP2_32(destPtr, 0, i));
+	}
+}
 
+// The reverse of CopyFromPacked
+static void CopyToPacked(llvm::Value* srcPtr, llvm::Value* destPtr)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::Type* srcType = dyn_cast<llvm::PointerType>(srcPtr->getType())->getElementType();
+	if (srcType->isVectorTy()) {
+		llvm::StoreInst* storeInst = builder.CreateStore(builder.CreateLoad(srcPtr), builder.CreateBitCast(destPtr, srcType->getPointerTo()));
+		storeInst->setAlignment(PackedElementAlignment(srcType));
+	}
+	else if (!srcType->isAggregateType())
+		builder.CreateStore(builder.CreateLoad(srcPtr), destPtr);
+	else if (IsPackedType(srcType)) {
+		llvm::DataLayout* pDataLayout = CG_Context::GetDataLayout();
+		builder.CreateMemCpy(destPtr, srcPtr, pDataLayout->getTypeAllocSize(srcType), pDataLayout->getABITypeAlignment(srcType));
 	}
 	else {
-		sBuilder.CreateStore(srcActualValue, destValuePtr);
+		llvm::CompositeType* pCompType = dyn_cast<llvm::CompositeType>(srcType);
+		for (unsigned int i = 0; pCompType->indexValid(i); ++i)
+			CopyToPacked(builder.CreateConstGEP2_32(srcPtr, 0, i), builder.CreateConstGEP2_32(destPtr, 0, i));
 	}
 }
 
-llvm::Value* CG_Context::ConvertValueFromPacked(llvm::Value* srcValue, llvm::Type* destType)
+void CG_Context::ConvertValueToPacked(llvm::Value* srcValue, llvm::Value* destPtr)
 {
-	llvm::Type* srcType = NULL;
-	llvm::Value* srcActualValue = NULL;
 	if (srcValue->getType()->isPointerTy()) {
-		llvm::PointerType* srcPtrType = dyn_cast<llvm::PointerType>(srcValue->getType());
-		srcType = srcPtrType->getElementType();
-		srcActualValue = sBuilder.CreateLoad(srcValue);
+		CopyToPacked(srcValue, destPtr);
+		return;
+	}
+
+	llvm::Type* srcType = srcValue->getType();
+	if (srcType->isVectorTy()) {
+		// Store the whole vector to the packed array
+		llvm::StoreInst* storeInst = GetBuilder().CreateStore(srcValue, GetBuilder().CreateBitCast(destPtr, srcType->getPointerTo()));
+		storeInst->setAlignment(PackedElementAlignment(srcType));
+	}
+	else if (srcType->isArrayTy() || srcType->isStructTy()) {
+		llvm::CompositeType* pCompType = dyn_cast<llvm::CompositeType>(srcType);
+		for (unsigned int Idx = 0; pCompType->indexValid(Idx); ++Idx) {
+			llvm::Value* destElemPtr = GetBuilder().CreateConstGEP2_32(destPtr, 0, Idx);
+			std::vector<unsigned int> srcIdx(1, Idx);
+			ConvertValueToPacked(GetBuilder().CreateExtractValue(srcValue, srcIdx), destElemPtr);
+		}
 	}
 	else {
-		srcType = srcValue->getType();
-		srcActualValue = srcValue;
+		GetBuilder().CreateStore(srcValue, destPtr);
 	}
+}
 
+llvm::Value* CG_Context::ConvertValueFromPacked(llvm::Value* srcValue, llvm::Type* destType)
+{
 	llvm::Type* destActualType = destType;
 	if (destType->isPointerTy()) {
 		llvm::PointerType* destPtrType = dyn_cast<llvm::PointerType>(destType);
 		destActualType = destPtrType->getElementType();
 	}
-	llvm::Value* destValuePtr = sBuilder.CreateAlloca(destActualType);
 
-	if (destActualType->isVectorTy()) {
+	if (srcValue->getType()->isPointerTy()) {
+		// The packed data of the same layout is used in place, otherwise it is copied to a local variable.
+		if (IsPackedType(destActualType))
+			return GetBuilder().CreateBitCast(srcValue, destActualType->getPointerTo());
+		// The local variable goes to the entry block, the conversion may be done inside a loop.
+		llvm::Function* curFunc = GetBuilder().GetInsertBlock()->getParent();
+		IRBuilder<> entryBuilder(&curFunc->getEntryBlock(), curFunc->getEntryBlock().begin());
+		llvm::Value* destValuePtr = entryBuilder.CreateAlloca(destActualType);
+		CopyFromPacked(srcValue, destValuePtr);
+		return destValuePtr;
+	}
 
+	if (destActualType->isVectorTy()) {
 		llvm::Value* newVecValue = llvm::UndefValue::get(destActualType);
 		llvm::VectorType* vType = dyn_cast<llvm::VectorType>(destActualType);
-		assert(vType);
-		assert(srcType->isArrayTy());
+		assert(srcValue->getType()->isArrayTy());
 		for (unsigned int i = 0; i < vType->getNumElements(); ++i) {
 			llvm::Value* idx = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)i));
-			std::vector<llvm::Value*> indices(2);
-			indices[1] = idx;
-			indices[0] = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)0));
-
-			std::vector<unsigned int> srcIdx(1);
-			srcIdx[0] = i;
-			llvm::Value* elemValue = sBuilder.CreateExtractValue(srcActualValue, srcIdx);
-
-			newVecValue = sBuilder.CreateInsertElement(newVecValue, elemValue, idx);
-			
+			std::vector<unsigned int> srcIdx(1, i);
+			llvm::Value* elemValue = GetBuilder().CreateExtractValue(srcValue, srcIdx);
+			newVecValue = GetBuilder().CreateInsertElement(newVecValue, elemValue, idx);
 		}
-		sBuilder.CreateStore(newVecValue, destValuePtr);
+		return newVecValue;
 	}
 	else if (destActualType->isStructTy() || destActualType->isArrayTy()) {
-
 		llvm::CompositeType* pCompType = dyn_cast<llvm::CompositeType>(destActualType);
-		unsigned int Idx = 0;
-		while (1) {
-			if (!pCompType->indexValid(Idx))
-				break;
-
-			llvm::Value* destIdx = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)Idx));
-			std::vector<llvm::Value*> indices(2);
-			indices[1] = destIdx;
-			indices[0] = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)0));
-			llvm::Value* destElemPtr = sBuilder.CreateGEP(destValuePtr, indices);
-			llvm::PointerType* destElemPtrType = dyn_cast<llvm::PointerType>(destElemPtr->getType());
-
-			std::vector<unsigned int> srcIdx(1);
-			srcIdx[0] = Idx;
-			llvm::Value* srcElemValue = sBuilder.CreateExtractValue(srcActualValue, srcIdx);
-
-			llvm::Value* convertedSrcValue = ConvertValueFromPacked(srcElemValue, destElemPtrType->getElementType());
-			sBuilder.CreateStore(convertedSrcValue, destElemPtr);
-
-			++Idx;
+		llvm::Value* newValue = llvm::UndefValue::get(destActualType);
+		for (unsigned int Idx = 0; pCompType->indexValid(Idx); ++Idx) {
+			std::vector<unsigned int> elemIdx(1, Idx);
+			llvm::Value* srcElemValue = GetBuilder().CreateExtractValue(srcValue, elemIdx);
+			llvm::Value* convertedValue = ConvertValueFromPacked(srcElemValue, pCompType->getTypeAtIndex(Idx));
+			newValue = GetBuilder().CreateInsertValue(newValue, convertedValue, elemIdx);
 		}
-
-	}
-	else {
-		sBuilder.CreateStore(srcActualValue, destValuePtr);
+		return newValue;
 	}
-
-	if (srcValue->getType()->isPointerTy())
-		return destValuePtr;
 	else
-		return sBuilder.CreateLoad(destValuePtr);
+		return srcValue;
 }
 
 llvm::Function* CG_Context::CreateFunctionWithPackedArguments(const KSC_FunctionDesc& fDesc)
@@ -328,10 +738,10 @@ llvm::Function* CG_Context::CreateFunctionWithPackedArguments(const KSC_Function
 		
 	}
 	FunctionType *FT = FunctionType::get(SC::CG_Context::ConvertToPackedType(fDesc.F->getReturnType()), wrapperF_argTypes, false);
-	wrapperF = Function::Create(FT, Function::ExternalLinkage, fDesc.F->getName() + "_packed", CG_Context::TheModule);
+	wrapperF = Function::Create(FT, Function::ExternalLinkage, fDesc.F->getName() + "_packed", fDesc.F->getParent());
 
-	BasicBlock *BB = BasicBlock::Create(getGlobalContext(), "entry_packed", wrapperF);
-	sBuilder.SetInsertPoint(BB);
+	BasicBlock *BB = BasicBlock::Create(GetLLVMContext(), "entry_packed", wrapperF);
+	GetBuilder().SetInsertPoint(BB);
 
 	std::vector<llvm::Value*> args;
 	// Convert the non-packed arguments to packed ones
@@ -342,39 +752,377 @@ llvm::Function* CG_Context::CreateFunctionWithPackedArguments(const KSC_Function
 	}
 	// Invoke the target function
 	//
-	llvm::Value* retValue = sBuilder.CreateCall(fDesc.F, args);
+	llvm::Value* retValue = GetBuilder().CreateCall(fDesc.F, args);
 	// Convert back the packed arguments to non-packed ones(if they're passed-by-reference)
 	//
 	Idx = 0;
 	for (Function::arg_iterator wrapperAI = wrapperF->arg_begin(); wrapperAI != wrapperF->arg_end(); ++wrapperAI, ++Idx) {
 		if (wrapperAI->getType()->isPointerTy()) {
 			assert(args[Idx]->getType()->isPointerTy());
-			if (fDesc.needJITPacked[Idx])
-				ConvertValueToPacked(sBuilder.CreateLoad(args[Idx]), wrapperAI);
+			// Nothing to write back for the packed data used in place
+			if (fDesc.needJITPacked[Idx] && args[Idx]->stripPointerCasts() != wrapperAI)
+				ConvertValueToPacked(args[Idx], wrapperAI);
 		}
 	}
 
 	if (!fDesc.F->getReturnType()->isVoidTy()) {
-		llvm::Value* retValuePtr = sBuilder.CreateAlloca(wrapperF->getReturnType());
+		llvm::Value* retValuePtr = GetBuilder().CreateAlloca(wrapperF->getReturnType());
 		ConvertValueToPacked(retValue, retValuePtr);
 	
-		sBuilder.CreateRet(sBuilder.CreateLoad(retValuePtr));
+		GetBuilder().CreateRet(GetBuilder().CreateLoad(retValuePtr));
 	}
 	else
-		sBuilder.CreateRetVoid();
+		GetBuilder().CreateRetVoid();
 
 	return wrapperF;
 }
 
-llvm::Value* CG_Context::GetVariableValue(const std::string& name, bool includeParent)
+// The address of the element "idx" of the strided array. The byte offset is computed in the pointer width, 
+// idx * stride goes beyond 32 bits on the large batches.
+static llvm::Value* StridedElementAddress(llvm::IRBuilder<>& builder, llvm::Value* base, llvm::Value* idx, llvm::Value* stride)
+{
+	llvm::Type* intPtrType = CG_Context::GetDataLayout()->getIntPtrType(builder.getContext());
+	llvm::Value* offset = builder.CreateMul(builder.CreateSExt(idx, intPtrType), builder.CreateSExt(stride, intPtrType));
+	return builder.CreateGEP(base, offset);
+}
+
+llvm::Function* CG_Context::CreateBatchFunction(const KSC_FunctionDesc& fDesc)
+{
+	llvm::LLVMContext& llvmCtx = GetLLVMContext();
+	llvm::Type* bytePtrType = Type::getInt8PtrTy(llvmCtx);
+	std::vector<llvm::Type*> batchF_argTypes;
+	batchF_argTypes.push_back(bytePtrType->getPointerTo());	// argPtrs
+	batchF_argTypes.push_back(SC_INT_TYPE->getPointerTo());		// argStrides
+	batchF_argTypes.push_back(bytePtrType);						// retPtr
+	batchF_argTypes.push_back(SC_INT_TYPE);						// retStride
+	batchF_argTypes.push_back(SC_INT_TYPE);						// count
+	FunctionType* FT = FunctionType::get(Type::getVoidTy(llvmCtx), batchF_argTypes, false);
+	llvm::Function* batchF = Function::Create(FT, Function::ExternalLinkage, fDesc.F->getName() + "_batch", fDesc.F->getParent());
+
+	Function::arg_iterator AI = batchF->arg_begin();
+	llvm::Value* argPtrs = AI++;
+	llvm::Value* argStrides = AI++;
+	llvm::Value* retPtr = AI++;
+	llvm::Value* retStride = AI++;
+	llvm::Value* count = AI++;
+
+	BasicBlock* entryBB = BasicBlock::Create(llvmCtx, "entry_batch", batchF);
+	BasicBlock* loopBB = BasicBlock::Create(llvmCtx, "loop_batch", batchF);
+	BasicBlock* exitBB = BasicBlock::Create(llvmCtx, "exit_batch", batchF);
+
+	// The base pointers and the strides are loaded once before the loop
+	//
+	GetBuilder().SetInsertPoint(entryBB);
+	int argCnt = (int)fDesc.F->arg_size();
+	std::vector<llvm::Value*> argBases(argCnt);
+	std::vector<llvm::Value*> strides(argCnt);
+	for (int i = 0; i < argCnt; ++i) {
+		argBases[i] = GetBuilder().CreateLoad(GetBuilder().CreateConstGEP1_32(argPtrs, i));
+		strides[i] = GetBuilder().CreateLoad(GetBuilder().CreateConstGEP1_32(argStrides, i));
+	}
+	llvm::Value* zero = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)0));
+	llvm::Value* one = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)1));
+	GetBuilder().CreateCondBr(GetBuilder().CreateICmpSGT(count, zero), loopBB, exitBB);
+
+	// The loop body converts the arguments of the current element the same way as the packed wrapper does
+	//
+	GetBuilder().SetInsertPoint(loopBB);
+	llvm::PHINode* idx = GetBuilder().CreatePHI(SC_INT_TYPE, 2);
+	idx->addIncoming(zero, entryBB);
+
+	std::vector<llvm::Value*> args(argCnt);
+	std::vector<llvm::Value*> packedPtrs(argCnt, (llvm::Value*)NULL);
+	int Idx = 0;
+	for (AI = fDesc.F->arg_begin(); AI != fDesc.F->arg_end(); ++AI, ++Idx) {
+		llvm::Type* argType = AI->getType();
+		llvm::Value* elemAddr = StridedElementAddress(GetBuilder(), argBases[Idx], idx, strides[Idx]);
+		if (!argType->isPointerTy()) {
+			// The argument passed by value is read from the packed data
+			llvm::Value* packedPtr = GetBuilder().CreateBitCast(elemAddr, ConvertToPackedType(argType)->getPointerTo());
+			args[Idx] = GetBuilder().CreateLoad(ConvertValueFromPacked(packedPtr, argType->getPointerTo()));
+		}
+		else if (fDesc.needJITPacked[Idx]) {
+			packedPtrs[Idx] = GetBuilder().CreateBitCast(elemAddr, ConvertToPackedType(argType));
+			args[Idx] = ConvertValueFromPacked(packedPtrs[Idx], argType);
+		}
+		else
+			args[Idx] = GetBuilder().CreateBitCast(elemAddr, argType);
+	}
+
+	llvm::CallInst* retValue = GetBuilder().CreateCall(fDesc.F, args);
+	for (Idx = 0; Idx < argCnt; ++Idx) {
+		if (packedPtrs[Idx] && args[Idx]->stripPointerCasts() != packedPtrs[Idx]->stripPointerCasts())
+			ConvertValueToPacked(args[Idx], packedPtrs[Idx]);
+	}
+	if (!fDesc.F->getReturnType()->isVoidTy()) {
+		llvm::Value* retAddr = StridedElementAddress(GetBuilder(), retPtr, idx, retStride);
+		ConvertValueToPacked(retValue, GetBuilder().CreateBitCast(retAddr, ConvertToPackedType(fDesc.F->getReturnType())->getPointerTo()));
+	}
+
+	llvm::Value* nextIdx = GetBuilder().CreateAdd(idx, one);
+	idx->addIncoming(nextIdx, GetBuilder().GetInsertBlock());
+	GetBuilder().CreateCondBr(GetBuilder().CreateICmpSLT(nextIdx, count), loopBB, exitBB);
+
+	GetBuilder().SetInsertPoint(exitBB);
+	GetBuilder().CreateRetVoid();
+
+	// Inline the callee so the optimizer sees the whole loop
+	llvm::InlineFunctionInfo inlineInfo;
+	llvm::InlineFunction(retValue, inlineInfo);
+	return batchF;
+}
+
+// The lane function takes all the arguments by value and returns the return value together with the final values of
+// the arguments passed by reference, so nothing is left in memory once the callee is inlined and the locals are promoted.
+//
+static llvm::Function* CreateLaneFunction(const KSC_FunctionDesc& fDesc)
+{
+	llvm::LLVMContext& llvmCtx = CG_Context::GetLLVMContext();
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	std::vector<llvm::Type*> laneArgTypes;
+	std::vector<llvm::Type*> laneRetTypes;
+	if (!fDesc.F->getReturnType()->isVoidTy())
+		laneRetTypes.push_back(fDesc.F->getReturnType());
+	for (Function::arg_iterator AI = fDesc.F->arg_begin(); AI != fDesc.F->arg_end(); ++AI) {
+		llvm::Type* argType = AI->getType();
+		if (argType->isPointerTy()) {
+			argType = dyn_cast<llvm::PointerType>(argType)->getElementType();
+			laneRetTypes.push_back(argType);
+		}
+		laneArgTypes.push_back(argType);
+	}
+	llvm::StructType* laneRetType = llvm::StructType::get(llvmCtx, laneRetTypes);
+	FunctionType* FT = FunctionType::get(laneRetType, laneArgTypes, false);
+	llvm::Function* laneF = Function::Create(FT, Function::InternalLinkage, fDesc.F->getName() + "_lane", fDesc.F->getParent());
+
+	BasicBlock* BB = BasicBlock::Create(llvmCtx, "entry_lane", laneF);
+	builder.SetInsertPoint(BB);
+	std::vector<llvm::Value*> args;
+	std::vector<llvm::Value*> refPtrs;
+	Function::arg_iterator laneAI = laneF->arg_begin();
+	for (Function::arg_iterator AI = fDesc.F->arg_begin(); AI != fDesc.F->arg_end(); ++AI, ++laneAI) {
+		if (AI->getType()->isPointerTy()) {
+			llvm::Value* refPtr = builder.CreateAlloca(laneAI->getType());
+			builder.CreateStore(laneAI, refPtr);
+			refPtrs.push_back(refPtr);
+			args.push_back(refPtr);
+		}
+		else
+			args.push_back(laneAI);
+	}
+	llvm::CallInst* retValue = builder.CreateCall(fDesc.F, args);
+	llvm::Value* laneRet = llvm::UndefValue::get(laneRetType);
+	unsigned int retIdx = 0;
+	if (!fDesc.F->getReturnType()->isVoidTy())
+		laneRet = builder.CreateInsertValue(laneRet, retValue, retIdx++);
+	for (int i = 0; i < (int)refPtrs.size(); ++i)
+		laneRet = builder.CreateInsertValue(laneRet, builder.CreateLoad(refPtrs[i]), retIdx++);
+	builder.CreateRet(laneRet);
+
+	// Inline everything the function calls(the functions not inlined by the optimizer), the calls left are
+	// run lane by lane. The recursive calls are left after a number of rounds.
+	// No lifetime markers, they would be left as memory access if the promotion misses them.
+	//
+	llvm::InlineFunctionInfo inlineInfo;
+	llvm::InlineFunction(retValue, inlineInfo, false);
+	for (int round = 0; round < 8; ++round) {
+		std::vector<llvm::CallInst*> calls;
+		for (Function::iterator laneBB = laneF->begin(); laneBB != laneF->end(); ++laneBB) {
+			for (BasicBlock::iterator I = laneBB->begin(); I != laneBB->end(); ++I) {
+				llvm::CallInst* CI = dyn_cast<llvm::CallInst>(I);
+				if (CI && CI->getCalledFunction() && !CI->getCalledFunction()->isDeclaration())
+					calls.push_back(CI);
+			}
+		}
+		if (calls.empty())
+			break;
+		for (int i = 0; i < (int)calls.size(); ++i)
+			llvm::InlineFunction(calls[i], inlineInfo, false);
+	}
+
+	llvm::FunctionPassManager fpm(laneF->getParent());
+	fpm.add(new DataLayout(*CG_Context::GetDataLayout()));
+	fpm.add(llvm::createScalarReplAggregatesPass());
+	fpm.add(llvm::createEarlyCSEPass());
+	fpm.add(llvm::createInstructionCombiningPass());
+	fpm.add(llvm::createCFGSimplificationPass());
+	fpm.doInitialization();
+	fpm.run(*laneF);
+	fpm.doFinalization();
+	return laneF;
+}
+
+// The lanes of the element data are gathered from and scattered to the strided memory one by one
+static llvm::Value* ExtractLane(const FunctionWidener::Leaves& leaves, int leafIdx, int leafCnt, llvm::Type* type, int lane)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	FunctionWidener::Leaves laneLeaves;
+	for (int k = 0; k < leafCnt; ++k)
+		laneLeaves.push_back(builder.CreateExtractElement(leaves[leafIdx + k], builder.getInt32(lane)));
+	int laneLeafIdx = 0;
+	return FunctionWidener::BuildFromLeaves(type, laneLeaves, laneLeafIdx);
+}
+
+llvm::Function* CG_Context::CreateSIMDFunction(const KSC_FunctionDesc& fDesc, int width, std::string& errMsg)
+{
+	llvm::Function* laneF = CreateLaneFunction(fDesc);
+	FunctionWidener widener(laneF, width);
+	if (!widener.Analyze(errMsg)) {
+		laneF->eraseFromParent();
+		return NULL;
+	}
+
+	llvm::LLVMContext& llvmCtx = GetLLVMContext();
+	llvm::IRBuilder<>& builder = GetBuilder();
+	llvm::Type* bytePtrType = Type::getInt8PtrTy(llvmCtx);
+	std::vector<llvm::Type*> simdF_argTypes;
+	simdF_argTypes.push_back(bytePtrType->getPointerTo());	// argPtrs
+	simdF_argTypes.push_back(SC_INT_TYPE->getPointerTo());		// argStrides
+	simdF_argTypes.push_back(bytePtrType);						// retPtr
+	simdF_argTypes.push_back(SC_INT_TYPE);						// retStride
+	simdF_argTypes.push_back(SC_INT_TYPE);						// count
+	FunctionType* FT = FunctionType::get(Type::getVoidTy(llvmCtx), simdF_argTypes, false);
+	llvm::Function* simdF = Function::Create(FT, Function::ExternalLinkage, fDesc.F->getName() + "_simd" + llvm::Twine(width), fDesc.F->getParent());
+
+	Function::arg_iterator AI = simdF->arg_begin();
+	llvm::Value* argPtrs = AI++;
+	llvm::Value* argStrides = AI++;
+	llvm::Value* retPtr = AI++;
+	llvm::Value* retStride = AI++;
+	llvm::Value* count = AI++;
+
+	BasicBlock* entryBB = BasicBlock::Create(llvmCtx, "entry_simd", simdF);
+	BasicBlock* loopBB = BasicBlock::Create(llvmCtx, "loop_simd", simdF);
+	BasicBlock* exitBB = BasicBlock::Create(llvmCtx, "exit_simd", simdF);
+
+	builder.SetInsertPoint(entryBB);
+	int argCnt = (int)fDesc.F->arg_size();
+	std::vector<llvm::Value*> argBases(argCnt);
+	std::vector<llvm::Value*> strides(argCnt);
+	for (int i = 0; i < argCnt; ++i) {
+		argBases[i] = builder.CreateLoad(builder.CreateConstGEP1_32(argPtrs, i));
+		strides[i] = builder.CreateLoad(builder.CreateConstGEP1_32(argStrides, i));
+	}
+	llvm::Value* zero = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)0));
+	llvm::Value* one = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)1));
+	llvm::Value* lastIdx = builder.CreateSub(count, one);
+	builder.CreateCondBr(builder.CreateICmpSGT(count, zero), loopBB, exitBB);
+
+	// Each iteration runs "width" elements, the lanes past the end read the last element and their results are dropped
+	//
+	builder.SetInsertPoint(loopBB);
+	llvm::PHINode* groupIdx = builder.CreatePHI(SC_INT_TYPE, 2);
+	groupIdx->addIncoming(zero, entryBB);
+	llvm::Value* laneMask = llvm::UndefValue::get(llvm::VectorType::get(Type::getInt1Ty(llvmCtx), width));
+	std::vector<llvm::Value*> isLaneActive(width);
+	std::vector<llvm::Value*> laneIndices(width);
+	for (int lane = 0; lane < width; ++lane) {
+		llvm::Value* idx = builder.CreateAdd(groupIdx, Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)lane)));
+		isLaneActive[lane] = builder.CreateICmpSLT(idx, count);
+		laneIndices[lane] = builder.CreateSelect(isLaneActive[lane], idx, lastIdx);
+		laneMask = builder.CreateInsertElement(laneMask, isLaneActive[lane], builder.getInt32(lane));
+	}
+
+	FunctionWidener::Leaves argLeaves;
+	std::vector<int> argLeafIndices(argCnt);
+	std::vector<std::vector<llvm::Value*> > elemAddrs(argCnt);
+	int Idx = 0;
+	for (AI = fDesc.F->arg_begin(); AI != fDesc.F->arg_end(); ++AI, ++Idx) {
+		llvm::Type* argType = AI->getType();
+		llvm::Type* laneType = argType->isPointerTy() ? dyn_cast<llvm::PointerType>(argType)->getElementType() : argType;
+		std::vector<llvm::Type*> leafTypes;
+		FunctionWidener::LeafTypes(laneType, leafTypes);
+		FunctionWidener::Leaves wideLeaves;
+		for (int k = 0; k < (int)leafTypes.size(); ++k)
+			wideLeaves.push_back(llvm::UndefValue::get(llvm::VectorType::get(leafTypes[k], width)));
+
+		for (int lane = 0; lane < width; ++lane) {
+			llvm::Value* elemAddr = StridedElementAddress(builder, argBases[Idx], laneIndices[lane], strides[Idx]);
+			elemAddrs[Idx].push_back(elemAddr);
+			llvm::Value* laneValue = NULL;
+			if (!argType->isPointerTy() || fDesc.needJITPacked[Idx]) {
+				llvm::Value* packedPtr = builder.CreateBitCast(elemAddr, ConvertToPackedType(laneType)->getPointerTo());
+				laneValue = builder.CreateLoad(ConvertValueFromPacked(packedPtr, laneType->getPointerTo()));
+			}
+			else
+				laneValue = builder.CreateLoad(builder.CreateBitCast(elemAddr, argType));
+			FunctionWidener::Leaves laneLeaves;
+			FunctionWidener::SplitToLeaves(laneValue, laneLeaves);
+			for (int k = 0; k < (int)laneLeaves.size(); ++k)
+				wideLeaves[k] = builder.CreateInsertElement(wideLeaves[k], laneLeaves[k], builder.getInt32(lane));
+		}
+		argLeafIndices[Idx] = (int)argLeaves.size();
+		argLeaves.insert(argLeaves.end(), wideLeaves.begin(), wideLeaves.end());
+	}
+
+	FunctionWidener::Leaves retLeaves;
+	widener.Emit(laneMask, argLeaves, retLeaves);
+
+	// The arguments passed by reference are written back only if the function changes them
+	//
+	llvm::Type* retType = fDesc.F->getReturnType();
+	int retLeafCnt = FunctionWidener::LeafCount(retType);
+	std::vector<int> refLeafIndices(argCnt, -1);
+	int leafIdx = retLeafCnt;
+	Idx = 0;
+	for (AI = fDesc.F->arg_begin(); AI != fDesc.F->arg_end(); ++AI, ++Idx) {
+		if (!AI->getType()->isPointerTy())
+			continue;
+		int leafCnt = FunctionWidener::LeafCount(dyn_cast<llvm::PointerType>(AI->getType())->getElementType());
+		for (int k = 0; k < leafCnt; ++k) {
+			if (retLeaves[leafIdx + k] != argLeaves[argLeafIndices[Idx] + k]) {
+				refLeafIndices[Idx] = leafIdx;
+				break;
+			}
+		}
+		leafIdx += leafCnt;
+	}
+
+	for (int lane = 0; lane < width; ++lane) {
+		BasicBlock* storeBB = BasicBlock::Create(llvmCtx, "store_lane", simdF);
+		BasicBlock* nextBB = BasicBlock::Create(llvmCtx, "next_lane", simdF);
+		builder.CreateCondBr(isLaneActive[lane], storeBB, nextBB);
+		builder.SetInsertPoint(storeBB);
+		if (!retType->isVoidTy()) {
+			llvm::Value* retAddr = StridedElementAddress(builder, retPtr, laneIndices[lane], retStride);
+			llvm::Value* laneValue = ExtractLane(retLeaves, 0, retLeafCnt, retType, lane);
+			ConvertValueToPacked(laneValue, builder.CreateBitCast(retAddr, ConvertToPackedType(retType)->getPointerTo()));
+		}
+		Idx = 0;
+		for (AI = fDesc.F->arg_begin(); AI != fDesc.F->arg_end(); ++AI, ++Idx) {
+			if (refLeafIndices[Idx] < 0)
+				continue;
+			llvm::Type* laneType = dyn_cast<llvm::PointerType>(AI->getType())->getElementType();
+			llvm::Value* laneValue = ExtractLane(retLeaves, refLeafIndices[Idx], FunctionWidener::LeafCount(laneType), laneType, lane);
+			if (fDesc.needJITPacked[Idx])
+				ConvertValueToPacked(laneValue, builder.CreateBitCast(elemAddrs[Idx][lane], ConvertToPackedType(laneType)->getPointerTo()));
+			else
+				builder.CreateStore(laneValue, builder.CreateBitCast(elemAddrs[Idx][lane], AI->getType()));
+		}
+		builder.CreateBr(nextBB);
+		builder.SetInsertPoint(nextBB);
+	}
+
+	llvm::Value* nextIdx = builder.CreateAdd(groupIdx, Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)width)));
+	groupIdx->addIncoming(nextIdx, builder.GetInsertBlock());
+	builder.CreateCondBr(builder.CreateICmpSLT(nextIdx, count), loopBB, exitBB);
+
+	builder.SetInsertPoint(exitBB);
+	builder.CreateRetVoid();
+
+	laneF->eraseFromParent();
+	return simdF;
+}
+
+llvm::Value* CG_Context::GetVariableValue(SymbolID name, bool includeParent)
 {
 	llvm::Value* ptr = GetVariablePtr(name, includeParent);
-	return ptr ? sBuilder.CreateLoad(ptr, name) : NULL;
+	return ptr ? GetBuilder().CreateLoad(ptr, ptr->getName()) : NULL;
 }
 
-llvm::Value* CG_Context::GetVariablePtr(const std::string& name, bool includeParent)
+llvm::Value* CG_Context::GetVariablePtr(SymbolID name, bool includeParent)
 {
-	std::hash_map<std::string, llvm::Value*>::iterator it = mVariables.find(name);
+	std::hash_map<SymbolID, llvm::Value*>::iterator it = mVariables.find(name);
 	if (it == mVariables.end() && includeParent)
 		return mpParent ? mpParent->GetVariablePtr(name, true) : NULL;
 	else
@@ -384,9 +1132,10 @@ llvm::Value* CG_Context::GetVariablePtr(const std::string& name, bool includePar
 llvm::Value* CG_Context::NewVariable(const Exp_VarDef* pVarDef, llvm::Value* pRefPtr)
 {
 	assert(mpCurFunction);
-	std::string name = pVarDef->GetVarName().ToStdString();
-	if (mVariables.find(name) != mVariables.end())
+	SymbolID symbol = pVarDef->GetVarName().GetSymbol();
+	if (mVariables.find(symbol) != mVariables.end())
 		return NULL;
+	std::string name = pVarDef->GetVarName().ToStdString();
 	IRBuilder<> TmpB(&mpCurFunction->getEntryBlock(),
                  mpCurFunction->getEntryBlock().begin());
 	llvm::Value* ret = pRefPtr;
@@ -417,7 +1166,7 @@ llvm::Value* CG_Context::NewVariable(const Exp_VarDef* pVarDef, llvm::Value* pRe
 
 	}
 	
-	if (ret) mVariables[name] = ret;
+	if (ret) mVariables[symbol] = ret;
 	return ret;
 }
 
@@ -450,36 +1199,73 @@ llvm::Type* CG_Context::NewStructType(const Exp_StructDef* pStructDef)
 	}
 	ArrayRef<Type*> typeArray(&elemTypes[0], elemCnt);
 
-	llvm::Type* ret = StructType::create(getGlobalContext(), typeArray, pStructDef->GetStructureName().c_str());
+	llvm::Type* ret = StructType::create(GetLLVMContext(), typeArray, pStructDef->GetStructureName().c_str());
 	mStructTypes[pStructDef] = ret;
 	return ret;
 }
 
-void CG_Context::AddFunctionDecl(const std::string& funcName, llvm::Function* pF)
+void CG_Context::AddFunctionDecl(SymbolID funcName, llvm::Function* pF)
 {
 	assert(mFuncDecls.find(funcName) == mFuncDecls.end());
 	mFuncDecls[funcName] = pF;
 }
 
-llvm::Function* CG_Context::GetFuncDeclByName(const std::string& funcName)
+void CG_Context::RemoveFunctionDecl(llvm::Function* pF)
 {
-	if (mFuncDecls.find(funcName) != mFuncDecls.end())
-		return mFuncDecls[funcName];
+	std::hash_map<SymbolID, llvm::Function*>::iterator it = mFuncDecls.begin();
+	for (; it != mFuncDecls.end(); ++it) {
+		if (it->second == pF) {
+			mFuncDecls.erase(it);
+			return;
+		}
+	}
+}
+
+llvm::Function* CG_Context::GetFuncDeclByName(SymbolID funcName)
+{
+	std::hash_map<SymbolID, llvm::Function*>::iterator it = mFuncDecls.find(funcName);
+	if (it != mFuncDecls.end())
+		return it->second;
 	else
 		return mpParent ? mpParent->GetFuncDeclByName(funcName) : NULL;
 }
 
-bool RootDomain::CompileToIR(CG_Context* pPredefine, KSC_ModuleDesc& mouduleDesc)
+bool RootDomain::CompileToIR(KSC_ModuleDesc& mouduleDesc, bool lazyCodeGen)
 {
-	CG_Context* cgCtx = pPredefine->CreateChildContext(pPredefine->GetCurrentFunc(), pPredefine->GetFuncRetBlk(), pPredefine->GetRetValuePtr());
-	for (int i = 0; i < (int)mExpressions.size(); ++i) {
-		llvm::Value* value = mExpressions[i]->GenerateCode(cgCtx);
+	// The module is compiled in its own session, which must be installed for the current thread.
+	assert(CG_Session::GetCurrent() == mouduleDesc.mpSession);
+	CG_Context* cgCtx = new CG_Context();
+
+	// The predefined structures and functions are generated with the global LLVM context, which cannot be referenced
+	// by this session. So they are declared again in this session, the JIT resolves the functions by name.
+	//
+	std::vector<CodeDomain*> refDomains;
+	for (CodeDomain* pDomain = GetParent(); pDomain; pDomain = pDomain->GetParent())
+		refDomains.push_back(pDomain);
+	for (int di = (int)refDomains.size() - 1; di >= 0; --di) {
+		for (int i = 0; i < refDomains[di]->GetExpressionCnt(); ++i) {
+			Expression* pExp = refDomains[di]->GetExpression(i);
+			Exp_FunctionDecl* pFuncDecl = dynamic_cast<Exp_FunctionDecl*>(pExp);
+			if (pFuncDecl)
+				pFuncDecl->GeneratePrototype(cgCtx);
+			else if (dynamic_cast<Exp_StructDef*>(pExp))
+				pExp->GenerateCode(cgCtx);
+		}
+	}
 
+	for (int i = 0; i < (int)mExpressions.size(); ++i) {
 		Exp_FunctionDecl* pFuncDecl = dynamic_cast<Exp_FunctionDecl*>(mExpressions[i]);
+		// In lazy mode the functions are left to CompileFunctionToIR
+		llvm::Value* value = NULL;
+		if (!pFuncDecl || !lazyCodeGen)
+			value = mExpressions[i]->GenerateCode(cgCtx);
+
 		if (pFuncDecl && pFuncDecl->HasBody()) {
 			llvm::Function* funcValue = llvm::dyn_cast_or_null<llvm::Function>(value);
 			KSC_FunctionDesc* pFuncDesc = new KSC_FunctionDesc;
 			pFuncDesc->F = funcValue;
+			pFuncDesc->mpModule = &mouduleDesc;
+			pFuncDesc->mpFuncDecl = pFuncDecl;
 			for (int ai = 0; ai < pFuncDecl->GetArgumentCnt(); ++ai)
 				pFuncDesc->needJITPacked.push_back(pFuncDecl->GetArgumentDesc(ai)->needJITPacked ? 1 : 0);
 			pFuncDecl->ConvertToDescription(*pFuncDesc, *cgCtx);
@@ -493,11 +1279,86 @@ bool RootDomain::CompileToIR(CG_Context* pPredefine, KSC_ModuleDesc& mouduleDesc
 			mouduleDesc.mGlobalStructures[pStructDef->GetStructureName()] = pStructDesc;
 		}
 	}
-	delete cgCtx;
-	CG_Context::TheModule->dump();
+
+	if (lazyCodeGen) {
+		mouduleDesc.mLazyCodeGen = true;
+		mouduleDesc.mpCG_Ctx = cgCtx;
+	}
+	else
+		delete cgCtx;
 	return true;
 }
 
+bool RootDomain::CompileFunctionToIR(KSC_FunctionDesc& funcDesc, KSC_ModuleDesc& mouduleDesc, std::vector<llvm::Function*>& newFuncs)
+{
+	CG_Context* cgCtx = mouduleDesc.mpCG_Ctx;
+	if (!cgCtx || !funcDesc.mpFuncDecl)
+		return false;
+
+	// Collect the functions in the call graph of the requested one, the functions which are already
+	// declared in the context(including the predefined ones) are generated before so they are skipped.
+	//
+	std::vector<Exp_FunctionDecl*> pendingFuncs;
+	std::hash_set<Exp_FunctionDecl*> visited;
+	std::vector<Exp_FunctionDecl*> funcStack(1, funcDesc.mpFuncDecl);
+	while (!funcStack.empty()) {
+		Exp_FunctionDecl* pFuncDecl = funcStack.back();
+		funcStack.pop_back();
+		if (visited.find(pFuncDecl) != visited.end() || cgCtx->GetFuncDeclByName(pFuncDecl->GetFunctionSymbol()))
+			continue;
+		visited.insert(pFuncDecl);
+		pendingFuncs.push_back(pFuncDecl);
+		for (int i = 0; i < pFuncDecl->GetCalleeCnt(); ++i)
+			funcStack.push_back(pFuncDecl->GetCallee(i));
+	}
+
+	// Declare all the pending functions before generating any function body, so the calls can be resolved
+	// no matter in which order the functions call each other.
+	// The functions without body are external functions, they are mapped to the host symbols here.
+	//
+	// The functions are returned as soon as they are declared, so they can be discarded if anything fails later.
+	//
+	std::vector<llvm::Function*> pendingValues(pendingFuncs.size(), NULL);
+	for (int i = 0; i < (int)pendingFuncs.size(); ++i) {
+		if (pendingFuncs[i]->HasBody()) {
+			pendingValues[i] = pendingFuncs[i]->GeneratePrototype(cgCtx);
+			if (pendingValues[i])
+				newFuncs.push_back(pendingValues[i]);
+		}
+		else
+			pendingFuncs[i]->GenerateCode(cgCtx);
+	}
+
+	for (int i = 0; i < (int)pendingFuncs.size(); ++i) {
+		if (!pendingValues[i])
+			continue;
+		pendingFuncs[i]->GenerateBody(cgCtx, pendingValues[i]);
+
+		std::hash_map<std::string, KSC_FunctionDesc*>::iterator it = mouduleDesc.mFunctionDesc.find(pendingFuncs[i]->GetFunctionName());
+		if (it != mouduleDesc.mFunctionDesc.end())
+			it->second->F = pendingValues[i];
+	}
+
+	return funcDesc.F != NULL;
+}
+
+void RootDomain::DiscardFunctionIR(KSC_ModuleDesc& mouduleDesc, const std::vector<llvm::Function*>& funcs)
+{
+	std::hash_map<std::string, KSC_FunctionDesc*>::iterator it = mouduleDesc.mFunctionDesc.begin();
+	for (; it != mouduleDesc.mFunctionDesc.end(); ++it) {
+		if (std::find(funcs.begin(), funcs.end(), it->second->F) != funcs.end())
+			it->second->F = NULL;
+	}
+	for (int i = 0; i < (int)funcs.size(); ++i) {
+		if (mouduleDesc.mpCG_Ctx)
+			mouduleDesc.mpCG_Ctx->RemoveFunctionDecl(funcs[i]);
+		// The functions may call each other, all the references are dropped before any of them is erased.
+		funcs[i]->dropAllReferences();
+	}
+	for (int i = 0; i < (int)funcs.size(); ++i)
+		funcs[i]->eraseFromParent();
+}
+
 llvm::Value* CG_Context::CastValueType(llvm::Value* srcValue, VarType srcType, VarType destType)
 {
 
@@ -513,14 +1374,14 @@ llvm::Value* CG_Context::CastValueType(llvm::Value* srcValue, VarType srcType, V
 		if (srcType == VarType::kBoolean && destType == VarType::kBoolean) {
 			llvm::Value* falseValue = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)0));
 			llvm::Value* trueValue = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)1));
-			return sBuilder.CreateSelect(srcValue, trueValue, falseValue);
+			return GetBuilder().CreateSelect(srcValue, trueValue, falseValue);
 		}
 
 		if (srcIorF != destIorF) {
 			if (destIorF)
-				return sBuilder.CreateFPToSI(srcValue, SC_INT_TYPE);
+				return GetBuilder().CreateFPToSI(srcValue, SC_INT_TYPE);
 			else
-				return sBuilder.CreateSIToFP(srcValue, SC_FLOAT_TYPE);
+				return GetBuilder().CreateSIToFP(srcValue, SC_FLOAT_TYPE);
 		}
 		else
 			return srcValue;
@@ -533,11 +1394,11 @@ llvm::Value* CG_Context::CastValueType(llvm::Value* srcValue, VarType srcType, V
 		if (srcIorF != destIorF) {
 			if (destIorF) {
 				llvm::Type* destType = ConvertToLLVMType(MakeType(destIorF, destElemCnt));
-				return sBuilder.CreateFPToSI(srcValue, destType);
+				return GetBuilder().CreateFPToSI(srcValue, destType);
 			}
 			else {
 				llvm::Type* destType = ConvertToLLVMType(MakeType(destIorF, destElemCnt));
-				return sBuilder.CreateSIToFP(srcValue, destType);
+				return GetBuilder().CreateSIToFP(srcValue, destType);
 			}
 		}
 		else {
@@ -554,16 +1415,16 @@ llvm::Value* CG_Context::CastValueType(llvm::Value* srcValue, VarType srcType, V
 		llvm::Type* destType = ConvertToLLVMType(MakeType(destIorF, destElemCnt));
 		llvm::SmallVector<Constant*, 4> Idxs;
 		for (int i = 0; i < destElemCnt; ++i) 
-			Idxs.push_back(sBuilder.getInt32(i));
-		llvm::Value* truncatedValue = sBuilder.CreateShuffleVector(srcValue, llvm::UndefValue::get(srcValue->getType()), llvm::ConstantVector::get(Idxs));
+			Idxs.push_back(GetBuilder().getInt32(i));
+		llvm::Value* truncatedValue = GetBuilder().CreateShuffleVector(srcValue, llvm::UndefValue::get(srcValue->getType()), llvm::ConstantVector::get(Idxs));
 		if (srcIorF != destIorF) {
 			if (destIorF) {
 				llvm::Type* destType = ConvertToLLVMType(MakeType(destIorF, destElemCnt));
-				return sBuilder.CreateFPToSI(truncatedValue, destType);
+				return GetBuilder().CreateFPToSI(truncatedValue, destType);
 			}
 			else {
 				llvm::Type* destType = ConvertToLLVMType(MakeType(destIorF, destElemCnt));
-				return sBuilder.CreateSIToFP(truncatedValue, destType);
+				return GetBuilder().CreateSIToFP(truncatedValue, destType);
 			}
 		}
 		else
@@ -575,60 +1436,63 @@ llvm::Value* CG_Context::CastValueType(llvm::Value* srcValue, VarType srcType, V
 		return srcValue;
 }
 
-llvm::Value* CG_Context::CreateBinaryExpression(const std::string& opStr, 
+// The instruction of each binary operator, indexed by the opcode and the type class of the operands.
+// The vector types use the same instructions as their scalar types, and the boolean values are treated
+// as i1 integer.
+//
+enum BinaryInstKind {
+	kInst_None,
+	kInst_BinOp,
+	kInst_ICmp,
+	kInst_FCmp
+};
+
+enum OperandTypeClass {
+	kTypeClass_Float,
+	kTypeClass_Int,
+	kTypeClass_Cnt
+};
+
+struct BinaryInstDesc {
+	BinaryInstKind kind;
+	unsigned opcode;  // llvm::Instruction::BinaryOps or llvm::CmpInst::Predicate depending on the kind
+};
+
+static const BinaryInstDesc s_BinaryInsts[kOpCodeCnt][kTypeClass_Cnt] = {
+	/* kOpAssign */			{{kInst_None, 0},						{kInst_None, 0}},
+	/* kOpLogicOr */		{{kInst_None, 0},						{kInst_BinOp, llvm::Instruction::Or}},
+	/* kOpLogicAnd */		{{kInst_None, 0},						{kInst_BinOp, llvm::Instruction::And}},
+	/* kOpEqual */			{{kInst_FCmp, llvm::CmpInst::FCMP_OEQ},	{kInst_ICmp, llvm::CmpInst::ICMP_EQ}},
+	/* kOpGreaterEqual */	{{kInst_FCmp, llvm::CmpInst::FCMP_OGE},	{kInst_ICmp, llvm::CmpInst::ICMP_SGE}},
+	/* kOpLessEqual */		{{kInst_FCmp, llvm::CmpInst::FCMP_OLE},	{kInst_ICmp, llvm::CmpInst::ICMP_SLE}},
+	/* kOpGreater */		{{kInst_FCmp, llvm::CmpInst::FCMP_OGT},	{kInst_ICmp, llvm::CmpInst::ICMP_SGT}},
+	/* kOpLess */			{{kInst_FCmp, llvm::CmpInst::FCMP_OLT},	{kInst_ICmp, llvm::CmpInst::ICMP_SLT}},
+	/* kOpBitOr */			{{kInst_None, 0},						{kInst_BinOp, llvm::Instruction::Or}},
+	/* kOpBitAnd */			{{kInst_None, 0},						{kInst_BinOp, llvm::Instruction::And}},
+	/* kOpAdd */			{{kInst_BinOp, llvm::Instruction::FAdd},	{kInst_BinOp, llvm::Instruction::Add}},
+	/* kOpSub */			{{kInst_BinOp, llvm::Instruction::FSub},	{kInst_BinOp, llvm::Instruction::Sub}},
+	/* kOpMul */			{{kInst_BinOp, llvm::Instruction::FMul},	{kInst_BinOp, llvm::Instruction::Mul}},
+	/* kOpDiv */			{{kInst_BinOp, llvm::Instruction::FDiv},	{kInst_BinOp, llvm::Instruction::SDiv}},
+	/* kOpNot */			{{kInst_None, 0},						{kInst_None, 0}},
+	/* kOpNeg */			{{kInst_None, 0},						{kInst_None, 0}}
+};
+
+llvm::Value* CG_Context::CreateBinaryExpression(OpCode op, 
 		llvm::Value* pL, llvm::Value* pR, VarType Ltype, VarType Rtype)
 {
 	llvm::Value* R_Value = CastValueType(pR, Rtype, Ltype);
 	assert(R_Value);
-	if (IsFloatType(Ltype)) {
-		// Generate instruction for float type
-		if (opStr == "+") 
-			return sBuilder.CreateFAdd(pL, R_Value);
-		else if (opStr == "-") 
-			return sBuilder.CreateFSub(pL, R_Value);
-		else if (opStr == "*") 
-			return sBuilder.CreateFMul(pL, R_Value);
-		else if (opStr == "/") 
-			return sBuilder.CreateFDiv(pL, R_Value);
-		else if (opStr == ">") 
-			return sBuilder.CreateFCmpOGT(pL, R_Value);
-		else if (opStr == ">=") 
-			return sBuilder.CreateFCmpOGE(pL, R_Value);
-		else if (opStr == "<") 
-			return sBuilder.CreateFCmpOLT(pL, R_Value);
-		else if (opStr == "<=") 
-			return sBuilder.CreateFCmpOLE(pL, R_Value);
-		else if (opStr == "==") 
-			return sBuilder.CreateFCmpOEQ(pL, R_Value);
-	}
-	else {
-		// Generate instruction for integer type
-		if (opStr == "+") 
-			return sBuilder.CreateAdd(pL, R_Value);
-		else if (opStr == "-") 
-			return sBuilder.CreateSub(pL, R_Value);
-		else if (opStr == "*") 
-			return sBuilder.CreateMul(pL, R_Value);
-		else if (opStr == "/") 
-			return sBuilder.CreateSDiv(pL, R_Value);
-		else if (opStr == ">") 
-			return sBuilder.CreateICmpSGT(pL, R_Value);
-		else if (opStr == ">=") 
-			return sBuilder.CreateICmpSGE(pL, R_Value);
-		else if (opStr == "<") 
-			return sBuilder.CreateICmpSLT(pL, R_Value);
-		else if (opStr == "<=") 
-			return sBuilder.CreateICmpSLE(pL, R_Value);
-		else if (opStr == "==") 
-			return sBuilder.CreateICmpEQ(pL, R_Value);
-		else if (opStr == "||" || opStr == "|") 
-			return sBuilder.CreateOr(pL, R_Value); // boolean values are treated as i1 integer
-		else if (opStr == "&&" || opStr == "&") 
-			return sBuilder.CreateAnd(pL, R_Value); // boolean values are treated as i1 integer
-
+	const BinaryInstDesc& inst = s_BinaryInsts[op][IsFloatType(Ltype) ? kTypeClass_Float : kTypeClass_Int];
+	switch (inst.kind) {
+	case kInst_BinOp:
+		return GetBuilder().CreateBinOp((llvm::Instruction::BinaryOps)inst.opcode, pL, R_Value);
+	case kInst_ICmp:
+		return GetBuilder().CreateICmp((llvm::CmpInst::Predicate)inst.opcode, pL, R_Value);
+	case kInst_FCmp:
+		return GetBuilder().CreateFCmp((llvm::CmpInst::Predicate)inst.opcode, pL, R_Value);
+	default:
+		return NULL;
 	}
-	
-	return NULL;
 }
 
 }
\ No newline at end of file
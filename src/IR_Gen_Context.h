@@ -14,23 +14,72 @@
 #include <llvm/Analysis/Passes.h>
 #include <llvm/DataLayout.h>
 #include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Intrinsics.h>
+#include <llvm/Support/Mutex.h>
+#include <llvm/Support/MutexGuard.h>
+#include <llvm/Support/Threading.h>
 
 using namespace llvm;
 
 #ifdef WANT_DOUBLE_FLOAT
-#define SC_FLOAT_TYPE Type::getDoubleTy(getGlobalContext())
+#define SC_FLOAT_TYPE Type::getDoubleTy(SC::CG_Context::GetLLVMContext())
 #else
-#define SC_FLOAT_TYPE Type::getFloatTy(getGlobalContext())
+#define SC_FLOAT_TYPE Type::getFloatTy(SC::CG_Context::GetLLVMContext())
 #endif
 
-#define SC_INT_TYPE Type::getInt32Ty(getGlobalContext())
+#define SC_INT_TYPE Type::getInt32Ty(SC::CG_Context::GetLLVMContext())
 
 namespace SC {
 
 bool InitializeCodeGen();
 void DestoryCodeGen();
+// Runs the optimization pipeline of the given level(0 ~ 3) on the functions compiled for the module.
+bool OptimizeModule(KSC_ModuleDesc& moduleDesc, int optLevel);
+// Optimizes the functions generated on demand in lazy mode, the other functions of the module are left untouched.
+bool OptimizeFunctions(llvm::Module* M, const std::vector<llvm::Function*>& funcs, int optLevel);
+bool OptimizeFunction(llvm::Function* F, int optLevel);
+
+// The code generation states of one compiled module: the LLVM context, the IR builder, the llvm module and
+// the execution engine JIT-ing it. The sessions share nothing with each other, so the modules can be compiled
+// on different threads at the same time.
+// The session of the current thread is installed by CG_Session::Scope, without it the code generation falls back to
+// the global states, which are only used for the predefined functions in KSC_Initialize.
+//
+class CG_Session
+{
+public:
+	llvm::LLVMContext mLLVMContext;
+	llvm::IRBuilder<> mBuilder;
+	llvm::Module* mpModule;				// owned by the execution engine
+	llvm::ExecutionEngine* mpEngine;
+	llvm::DataLayout* mpDataLayout;
+	// Serializes the code generation and the JIT requests on this module once it is compiled, 
+	// e.g. the lazy code generation and the creation of the wrapper functions.
+	llvm::sys::Mutex mLock;
+	// The packed types of the structures, see CG_Context::ConvertToPackedType
+	std::hash_map<llvm::Type*, llvm::Type*> mPackedStructTypes;
+
+	CG_Session();
+	~CG_Session();
+	// The llvm module loaded from the cache(created with mLLVMContext) is taken over if it is given.
+	bool Initialize(std::string& errMsg, llvm::Module* pModule = NULL);
+
+	class Scope
+	{
+	private:
+		CG_Session* mpPrevSession;
+	public:
+		Scope(CG_Session* pSession);
+		~Scope();
+	};
+
+	static CG_Session* GetCurrent();
+private:
+	static SC_THREAD_LOCAL CG_Session* s_pCurrent;
+};
 
 class CG_Context
 {
@@ -40,19 +89,42 @@ private:
 	llvm::BasicBlock* mpCurFuncRetBlk;
 	llvm::Value* mpRetValuePtr;
 
-	std::hash_map<std::string, llvm::Value*> mVariables;
-	std::hash_map<std::string, llvm::Function*> mFuncDecls;
+	std::hash_map<SymbolID, llvm::Value*> mVariables;
+	std::hash_map<SymbolID, llvm::Function*> mFuncDecls;
 	std::hash_map<const Exp_StructDef*, llvm::Type*> mStructTypes;
 	
 public:
+	// The global states are used by the predefined functions only, each compiled KSC module has its own CG_Session.
 	static llvm::Module *TheModule;
 	static llvm::ExecutionEngine* TheExecutionEngine;
-	static llvm::FunctionPassManager* TheFPM;
 	static llvm::DataLayout* TheDataLayout;
-	static llvm::IRBuilder<> sBuilder;
+	static llvm::IRBuilder<> sGlobalBuilder;
 	static std::hash_map<std::string, void*> sGlobalFuncSymbols;
+	// The bitcode of the host(see KSC_AddExternalBitcode) and the index of the bitcode defining each function,
+	// they are guarded by the lock of the global function symbols too.
+	static std::vector<std::string> sExternalBitcode;
+	static std::hash_map<std::string, int> sExternalBitcodeFuncs;
+	static llvm::sys::Mutex sGlobalFuncSymbolsLock;
+	// The packed structure types of the global context, see GetPackedStructTypes
+	static std::hash_map<llvm::Type*, llvm::Type*> sGlobalPackedStructTypes;
 
 public:
+	// The states of the current session, or the global states if no session is installed in this thread.
+	static llvm::LLVMContext& GetLLVMContext();
+	static llvm::IRBuilder<>& GetBuilder();
+	static llvm::Module* GetModule();
+	static llvm::ExecutionEngine* GetExecutionEngine();
+	static llvm::DataLayout* GetDataLayout();
+	// The packed structure type created for each structure type of the current session
+	static std::hash_map<llvm::Type*, llvm::Type*>& GetPackedStructTypes();
+
+	static void AddGlobalFuncSymbol(const std::string& funcName, void* funcPtr);
+	static void* FindGlobalFuncSymbol(const std::string& funcName);
+	static bool AddExternalBitcode(const void* bitcode, size_t len, std::string& errMsg);
+	// Links the bitcode defining the external function into the module of the current session, the other functions
+	// of the bitcode come along. NULL is returned if no bitcode defines the function with the given type.
+	static llvm::Function* LinkExternalFunction(const std::string& funcName, llvm::FunctionType* funcType);
+
 	static llvm::Type* ConvertToLLVMType(VarType tp);
 	static int GetSizeOfLLVMType(VarType tp);
 	static int GetAlignmentOfLLVMType(VarType tp);
@@ -60,24 +132,33 @@ public:
 	static void ConvertValueToPacked(llvm::Value* srcValue, llvm::Value* destPtr);
 	static llvm::Value* ConvertValueFromPacked(llvm::Value* srcValue, llvm::Type* destType);
 	static llvm::Function* CreateFunctionWithPackedArguments(const KSC_FunctionDesc& fDesc);
+	// Creates the function running the given function over a range of elements, see KSC_GetBatchFunctionPtr.
+	static llvm::Function* CreateBatchFunction(const KSC_FunctionDesc& fDesc);
+	// Creates the function running "width" elements at once with the given function widened to vectors, see
+	// KSC_GetSIMDFunctionPtr. NULL is returned if the function can't be widened.
+	static llvm::Function* CreateSIMDFunction(const KSC_FunctionDesc& fDesc, int width, std::string& errMsg);
+	// Returns false if the function can be called by the host directly, i.e. none of its arguments
+	// and its return value contains any vector type.
+	static bool NeedPackedWrapper(const KSC_FunctionDesc& fDesc);
 
 	CG_Context();
 	llvm::Function* GetCurrentFunc();
 	llvm::BasicBlock* GetFuncRetBlk();
 	llvm::Value* GetRetValuePtr();
 
-	llvm::Value* GetVariableValue(const std::string& name, bool includeParent);
-	llvm::Value* GetVariablePtr(const std::string& name, bool includeParent);
+	llvm::Value* GetVariableValue(SymbolID name, bool includeParent);
+	llvm::Value* GetVariablePtr(SymbolID name, bool includeParent);
 	llvm::Value* NewVariable(const Exp_VarDef* pVarDef, llvm::Value* pRefPtr);
 	llvm::Type* GetStructType(const Exp_StructDef* pStructDef);
 	llvm::Type* NewStructType(const Exp_StructDef* pStructDef);
-	void AddFunctionDecl(const std::string& funcName, llvm::Function* pF);
-	llvm::Function* GetFuncDeclByName(const std::string& funcName);
+	void AddFunctionDecl(SymbolID funcName, llvm::Function* pF);
+	llvm::Function* GetFuncDeclByName(SymbolID funcName);
+	void RemoveFunctionDecl(llvm::Function* pF);
 	CG_Context* CreateChildContext(Function* pCurFunc, llvm::BasicBlock* pRetBlk, llvm::Value* pRetValuePtr);
 
 	llvm::Value* CastValueType(llvm::Value* srcValue, VarType srcType, VarType destType);
 
-	llvm::Value* CreateBinaryExpression(const std::string& opStr, 
+	llvm::Value* CreateBinaryExpression(OpCode op, 
 		llvm::Value* pL, llvm::Value* pR, VarType Ltype, VarType Rtype);
 };
 
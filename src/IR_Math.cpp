@@ -0,0 +1,381 @@
+#include "IR_Math.h"
+
+namespace SC {
+
+static llvm::Intrinsic::ID BuiltInIntrinsic(BuiltInFunc func)
+{
+	switch (func) {
+	case kBuiltInSin:	return llvm::Intrinsic::sin;
+	case kBuiltInCos:	return llvm::Intrinsic::cos;
+	case kBuiltInExp:	return llvm::Intrinsic::exp;
+	case kBuiltInLog:	return llvm::Intrinsic::log;
+	case kBuiltInPow:	return llvm::Intrinsic::pow;
+	case kBuiltInSqrt:	return llvm::Intrinsic::sqrt;
+	case kBuiltInFabs:	return llvm::Intrinsic::fabs;
+	default:			return llvm::Intrinsic::not_intrinsic;
+	}
+}
+
+llvm::Value* SplatValue(llvm::Value* scalar, int elemCnt)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::Type* vecType = llvm::VectorType::get(scalar->getType(), elemCnt);
+	llvm::Value* vec = builder.CreateInsertElement(llvm::UndefValue::get(vecType), scalar, builder.getInt32(0));
+	llvm::Type* maskType = llvm::VectorType::get(builder.getInt32Ty(), elemCnt);
+	return builder.CreateShuffleVector(vec, llvm::UndefValue::get(vecType), llvm::Constant::getNullValue(maskType));
+}
+
+static llvm::Value* CallIntrinsic(llvm::Intrinsic::ID id, llvm::Value* const* args, int argCnt)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::Module* M = builder.GetInsertBlock()->getParent()->getParent();
+	llvm::Function* F = llvm::Intrinsic::getDeclaration(M, id, args[0]->getType());
+	std::vector<llvm::Value*> callArgs(args, args + argCnt);
+	return builder.CreateCall(F, callArgs);
+}
+
+static llvm::Value* Shuffle(llvm::Value* v1, llvm::Value* v2, const int* indices, int cnt)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::SmallVector<llvm::Constant*, 8> idxs;
+	for (int i = 0; i < cnt; ++i)
+		idxs.push_back(builder.getInt32(indices[i]));
+	return builder.CreateShuffleVector(v1, v2, llvm::ConstantVector::get(idxs));
+}
+
+// Sums up the elements of the vector, the upper half is added to the lower half until two elements are left.
+static llvm::Value* HorizontalAdd(llvm::Value* v)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::VectorType* vecType = dyn_cast<llvm::VectorType>(v->getType());
+	if (!vecType)
+		return v;
+
+	// Pad float3 with zero to float4
+	int elemCnt = vecType->getNumElements();
+	int indices[8];
+	if (elemCnt == 3) {
+		int padIndices[4] = {0, 1, 2, 3};
+		v = Shuffle(v, llvm::Constant::getNullValue(vecType), padIndices, 4);
+		elemCnt = 4;
+	}
+	for (; elemCnt > 2; elemCnt /= 2) {
+		int half = elemCnt / 2;
+		for (int i = 0; i < half; ++i)
+			indices[i] = i;
+		llvm::Value* lo = Shuffle(v, llvm::UndefValue::get(v->getType()), indices, half);
+		for (int i = 0; i < half; ++i)
+			indices[i] = half + i;
+		llvm::Value* hi = Shuffle(v, llvm::UndefValue::get(v->getType()), indices, half);
+		v = builder.CreateFAdd(lo, hi);
+	}
+	llvm::Value* ret = builder.CreateExtractElement(v, builder.getInt32(0));
+	if (elemCnt == 2)
+		ret = builder.CreateFAdd(ret, builder.CreateExtractElement(v, builder.getInt32(1)));
+	return ret;
+}
+
+static llvm::Value* Dot(llvm::Value* a, llvm::Value* b)
+{
+	return HorizontalAdd(CG_Context::GetBuilder().CreateFMul(a, b));
+}
+
+static bool IsFloatValue(llvm::Value* v)
+{
+	return v->getType()->getScalarType()->isFloatingPointTy();
+}
+
+// The compare and select of the same order as minps/maxps, so it's matched to them
+static llvm::Value* MinMax(llvm::Value* a, llvm::Value* b, bool isMax)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::Value* cond = NULL;
+	if (IsFloatValue(a))
+		cond = isMax ? builder.CreateFCmpOGT(a, b) : builder.CreateFCmpOLT(a, b);
+	else
+		cond = isMax ? builder.CreateICmpSGT(a, b) : builder.CreateICmpSLT(a, b);
+	return builder.CreateSelect(cond, a, b);
+}
+
+static llvm::Value* MulAdd(llvm::Value* a, llvm::Value* b, llvm::Value* c)
+{
+	if (!IsFloatValue(a)) {
+		llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+		return builder.CreateAdd(builder.CreateMul(a, b), c);
+	}
+	llvm::Value* args[3] = {a, b, c};
+	return CallIntrinsic(llvm::Intrinsic::fmuladd, args, 3);
+}
+
+static llvm::Value* BroadcastLike(llvm::Value* scalar, llvm::Value* v)
+{
+	llvm::VectorType* vecType = dyn_cast<llvm::VectorType>(v->getType());
+	return vecType ? SplatValue(scalar, vecType->getNumElements()) : scalar;
+}
+
+llvm::Value* EmitBuiltInFunc(BuiltInFunc func, llvm::Value* const* args)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::Type* argType = args[0]->getType();
+
+	switch (func) {
+	case kBuiltInDot:
+		return Dot(args[0], args[1]);
+	case kBuiltInCross:
+		{
+			// a.yzx * b.zxy - a.zxy * b.yzx
+			static const int yzx[3] = {1, 2, 0};
+			static const int zxy[3] = {2, 0, 1};
+			llvm::Value* undef = llvm::UndefValue::get(argType);
+			llvm::Value* l = builder.CreateFMul(Shuffle(args[0], undef, yzx, 3), Shuffle(args[1], undef, zxy, 3));
+			llvm::Value* r = builder.CreateFMul(Shuffle(args[0], undef, zxy, 3), Shuffle(args[1], undef, yzx, 3));
+			return builder.CreateFSub(l, r);
+		}
+	case kBuiltInLength:
+		{
+			llvm::Value* lenSqr = Dot(args[0], args[0]);
+			return CallIntrinsic(llvm::Intrinsic::sqrt, &lenSqr, 1);
+		}
+	case kBuiltInNormalize:
+		{
+			llvm::Value* lenSqr = Dot(args[0], args[0]);
+			llvm::Value* len = CallIntrinsic(llvm::Intrinsic::sqrt, &lenSqr, 1);
+			llvm::Value* invLen = builder.CreateFDiv(llvm::ConstantFP::get(len->getType(), 1.0), len);
+			return builder.CreateFMul(args[0], BroadcastLike(invLen, args[0]));
+		}
+	case kBuiltInLerp:
+		return MulAdd(builder.CreateFSub(args[1], args[0]), args[2], args[0]);
+	case kBuiltInSaturate:
+		{
+			llvm::Value* ret = MinMax(args[0], llvm::ConstantFP::get(argType, 0.0), true);
+			return MinMax(ret, llvm::ConstantFP::get(argType, 1.0), false);
+		}
+	case kBuiltInMin:
+		return MinMax(args[0], args[1], false);
+	case kBuiltInMax:
+		return MinMax(args[0], args[1], true);
+	case kBuiltInMad:
+		return MulAdd(args[0], args[1], args[2]);
+	default:
+		break;
+	}
+
+	llvm::Intrinsic::ID id = BuiltInIntrinsic(func);
+	llvm::Value* ret = EmitVectorMath(id, args);
+	if (ret)
+		return ret;
+	return CallIntrinsic(id, args, GetBuiltInFuncArgCnt(func));
+}
+
+//
+// The polynomial approximations below work on the bits of the IEEE single precision float, the integer vector of the
+// same width holds the bits.
+//
+
+static llvm::Value* ConstF(llvm::Type* type, double v)
+{
+	return llvm::ConstantFP::get(type, v);
+}
+
+static llvm::Value* ConstI(llvm::Type* type, int v)
+{
+	return llvm::ConstantInt::get(type, (uint64_t)(int64_t)v, true);
+}
+
+// Evaluates c[0]*x^(n-1) + c[1]*x^(n-2) + ... + c[n-1]
+static llvm::Value* Polynomial(llvm::Value* x, const double* c, int n)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::Value* r = ConstF(x->getType(), c[0]);
+	for (int i = 1; i < n; ++i)
+		r = builder.CreateFAdd(builder.CreateFMul(r, x), ConstF(x->getType(), c[i]));
+	return r;
+}
+
+static llvm::Value* EmitSinCos(llvm::Value* x, bool isCos)
+{
+	static const double sinCoefs[] = {-1.9515295891E-4, 8.3321608736E-3, -1.6666654611E-1};
+	static const double cosCoefs[] = {2.443315711809948E-005, -1.388731625493765E-003, 4.166664568298827E-002};
+
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::Type* fType = x->getType();
+	llvm::Type* iType = llvm::VectorType::getInteger(cast<llvm::VectorType>(fType));
+
+	// Work on |x|, sin takes its sign back at the end
+	llvm::Value* xBits = builder.CreateBitCast(x, iType);
+	llvm::Value* signBit = builder.CreateAnd(xBits, ConstI(iType, 0x80000000));
+	x = builder.CreateBitCast(builder.CreateAnd(xBits, ConstI(iType, 0x7fffffff)), fType);
+
+	// The octant j rounded up to even, x is reduced to [-PI/4, PI/4] around j*PI/4 with PI/4 in three parts for
+	// the extra precision.
+	//
+	llvm::Value* j = builder.CreateFPToSI(builder.CreateFMul(x, ConstF(fType, 1.27323954473516)), iType);
+	j = builder.CreateAnd(builder.CreateAdd(j, ConstI(iType, 1)), ConstI(iType, ~1));
+	llvm::Value* y = builder.CreateSIToFP(j, fType);
+	x = builder.CreateFSub(x, builder.CreateFMul(y, ConstF(fType, 0.78515625)));
+	x = builder.CreateFSub(x, builder.CreateFMul(y, ConstF(fType, 2.4187564849853515625e-4)));
+	x = builder.CreateFSub(x, builder.CreateFMul(y, ConstF(fType, 3.77489497744594108e-8)));
+
+	// cos(x) is sin(x + PI/2), i.e. two octants ahead
+	if (isCos) {
+		j = builder.CreateSub(j, ConstI(iType, 2));
+		signBit = builder.CreateShl(builder.CreateAnd(builder.CreateNot(j), ConstI(iType, 4)), ConstI(iType, 29));
+	}
+	else
+		signBit = builder.CreateXor(signBit, builder.CreateShl(builder.CreateAnd(j, ConstI(iType, 4)), ConstI(iType, 29)));
+	llvm::Value* useSinPoly = builder.CreateICmpEQ(builder.CreateAnd(j, ConstI(iType, 2)), ConstI(iType, 0));
+
+	llvm::Value* z = builder.CreateFMul(x, x);
+	llvm::Value* sinPoly = builder.CreateFMul(Polynomial(z, sinCoefs, 3), builder.CreateFMul(z, x));
+	sinPoly = builder.CreateFAdd(sinPoly, x);
+	llvm::Value* cosPoly = builder.CreateFMul(Polynomial(z, cosCoefs, 3), builder.CreateFMul(z, z));
+	cosPoly = builder.CreateFSub(cosPoly, builder.CreateFMul(z, ConstF(fType, 0.5)));
+	cosPoly = builder.CreateFAdd(cosPoly, ConstF(fType, 1.0));
+
+	llvm::Value* ret = builder.CreateSelect(useSinPoly, sinPoly, cosPoly);
+	ret = builder.CreateXor(builder.CreateBitCast(ret, iType), signBit);
+	return builder.CreateBitCast(ret, fType);
+}
+
+static llvm::Value* EmitExp(llvm::Value* x)
+{
+	static const double expCoefs[] = {1.9875691500E-4, 1.3981999507E-3, 8.3334519073E-3, 4.1665795894E-2, 1.6666665459E-1, 5.0000001201E-1};
+
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::Type* fType = x->getType();
+	llvm::Type* iType = llvm::VectorType::getInteger(cast<llvm::VectorType>(fType));
+
+	// The results beyond the float range become 0 or inf
+	llvm::Value* xIn = x;
+	llvm::Value* hi = ConstF(fType, 88.72283905206835);
+	llvm::Value* lo = ConstF(fType, -103.972077083991796);
+	x = builder.CreateSelect(builder.CreateFCmpOGT(x, hi), hi, x);
+	x = builder.CreateSelect(builder.CreateFCmpOLT(x, lo), lo, x);
+
+	// exp(x) = 2^n * exp(r), n = floor(x/ln2 + 0.5), r = x - n*ln2 with ln2 in two parts
+	llvm::Value* fn = builder.CreateFAdd(builder.CreateFMul(x, ConstF(fType, 1.44269504088896341)), ConstF(fType, 0.5));
+	llvm::Value* n = builder.CreateFPToSI(fn, iType);
+	llvm::Value* truncated = builder.CreateSIToFP(n, fType);
+	llvm::Value* roundedUp = builder.CreateFCmpOGT(truncated, fn);
+	n = builder.CreateSelect(roundedUp, builder.CreateSub(n, ConstI(iType, 1)), n);
+	fn = builder.CreateSIToFP(n, fType);
+	x = builder.CreateFSub(x, builder.CreateFMul(fn, ConstF(fType, 0.693359375)));
+	x = builder.CreateFSub(x, builder.CreateFMul(fn, ConstF(fType, -2.12194440e-4)));
+
+	llvm::Value* z = builder.CreateFMul(x, x);
+	llvm::Value* y = builder.CreateFMul(Polynomial(x, expCoefs, 6), z);
+	y = builder.CreateFAdd(builder.CreateFAdd(y, x), ConstF(fType, 1.0));
+
+	// 2^n is built in the exponent bits, in two halves since n may go beyond the exponent range near the ends
+	llvm::Value* n0 = builder.CreateAShr(n, ConstI(iType, 1));
+	llvm::Value* n1 = builder.CreateSub(n, n0);
+	llvm::Value* pow2n0 = builder.CreateShl(builder.CreateAdd(n0, ConstI(iType, 127)), ConstI(iType, 23));
+	llvm::Value* pow2n1 = builder.CreateShl(builder.CreateAdd(n1, ConstI(iType, 127)), ConstI(iType, 23));
+	y = builder.CreateFMul(builder.CreateFMul(y, builder.CreateBitCast(pow2n0, fType)), builder.CreateBitCast(pow2n1, fType));
+	y = builder.CreateSelect(builder.CreateFCmpOLT(xIn, lo), ConstF(fType, 0.0), y);
+	return builder.CreateSelect(builder.CreateFCmpOGT(xIn, hi), llvm::ConstantFP::getInfinity(fType), y);
+}
+
+static llvm::Value* EmitLog(llvm::Value* x)
+{
+	static const double logCoefs[] = {7.0376836292E-2, -1.1514610310E-1, 1.1676998740E-1, -1.2420140846E-1, 1.4249322787E-1,
+		-1.6668057665E-1, 2.0000714765E-1, -2.4999993993E-1, 3.3333331174E-1};
+
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::Type* fType = x->getType();
+	llvm::Type* iType = llvm::VectorType::getInteger(cast<llvm::VectorType>(fType));
+	llvm::Value* xIn = x;
+
+	// x = m * 2^e with m in [0.5, 1), the denormals are flushed to the smallest normal
+	x = builder.CreateSelect(builder.CreateFCmpOLT(x, ConstF(fType, 1.17549435e-38)), ConstF(fType, 1.17549435e-38), x);
+	llvm::Value* xBits = builder.CreateBitCast(x, iType);
+	llvm::Value* e = builder.CreateSub(builder.CreateLShr(xBits, ConstI(iType, 23)), ConstI(iType, 126));
+	llvm::Value* m = builder.CreateOr(builder.CreateAnd(xBits, ConstI(iType, ~0x7f800000)), ConstI(iType, 0x3f000000));
+	m = builder.CreateBitCast(m, fType);
+
+	// Keep m in [sqrt(0.5), sqrt(2)) so log(m) is small, then take log(1 + x)
+	llvm::Value* isSmall = builder.CreateFCmpOLT(m, ConstF(fType, 0.707106781186547524));
+	e = builder.CreateSelect(isSmall, builder.CreateSub(e, ConstI(iType, 1)), e);
+	m = builder.CreateSelect(isSmall, builder.CreateFAdd(m, m), m);
+	x = builder.CreateFSub(m, ConstF(fType, 1.0));
+	llvm::Value* fe = builder.CreateSIToFP(e, fType);
+
+	llvm::Value* z = builder.CreateFMul(x, x);
+	llvm::Value* y = builder.CreateFMul(Polynomial(x, logCoefs, 9), builder.CreateFMul(z, x));
+	y = builder.CreateFAdd(y, builder.CreateFMul(fe, ConstF(fType, -2.12194440e-4)));
+	y = builder.CreateFSub(y, builder.CreateFMul(z, ConstF(fType, 0.5)));
+	llvm::Value* ret = builder.CreateFAdd(builder.CreateFAdd(x, y), builder.CreateFMul(fe, ConstF(fType, 0.693359375)));
+
+	// log(0) is -inf, log(inf) is inf, the negative values and NaN get NaN
+	llvm::Value* inf = llvm::ConstantFP::getInfinity(fType);
+	ret = builder.CreateSelect(builder.CreateFCmpOEQ(xIn, ConstF(fType, 0.0)), llvm::ConstantFP::getInfinity(fType, true), ret);
+	ret = builder.CreateSelect(builder.CreateFCmpOEQ(xIn, inf), inf, ret);
+	return builder.CreateSelect(builder.CreateFCmpULT(xIn, ConstF(fType, 0.0)), llvm::ConstantFP::getNaN(fType), ret);
+}
+
+// pow(x, y) is exp(y * log(|x|)), the sign and the special cases follow the C runtime: the negative x takes the sign
+// of the odd integer y and gets NaN for the non-integer y, pow(x, 0) and pow(1, y) are 1 even for NaN.
+//
+static llvm::Value* EmitPow(llvm::Value* x, llvm::Value* y)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::Type* fType = x->getType();
+	llvm::Type* iType = llvm::VectorType::getInteger(cast<llvm::VectorType>(fType));
+	llvm::Type* bType = llvm::VectorType::get(builder.getInt1Ty(), cast<llvm::VectorType>(fType)->getNumElements());
+	llvm::Value* trueVec = llvm::ConstantInt::getTrue(bType);
+	llvm::Value* falseVec = llvm::ConstantInt::getFalse(bType);
+
+	llvm::Value* xBits = builder.CreateBitCast(x, iType);
+	llvm::Value* xSign = builder.CreateAnd(xBits, ConstI(iType, 0x80000000));
+	llvm::Value* absX = builder.CreateBitCast(builder.CreateAnd(xBits, ConstI(iType, 0x7fffffff)), fType);
+	llvm::Value* absY = builder.CreateBitCast(builder.CreateAnd(builder.CreateBitCast(y, iType), ConstI(iType, 0x7fffffff)), fType);
+	llvm::Value* ret = EmitExp(builder.CreateFMul(y, EmitLog(absX)));
+
+	// The floats from 2^23 are all integers and the ones from 2^24 are even. The conversion of y is taken only
+	// below these bounds, where it is exact.
+	//
+	llvm::Value* yInt = builder.CreateFPToSI(y, iType);
+	llvm::Value* isExact = builder.CreateFCmpOEQ(builder.CreateSIToFP(yInt, fType), y);
+	llvm::Value* isInt = builder.CreateSelect(builder.CreateFCmpOGE(absY, ConstF(fType, 8388608.0)), trueVec, isExact);
+	llvm::Value* isOddBit = builder.CreateICmpNE(builder.CreateAnd(yInt, ConstI(iType, 1)), ConstI(iType, 0));
+	llvm::Value* isOdd = builder.CreateSelect(builder.CreateFCmpOLT(absY, ConstF(fType, 16777216.0)), isOddBit, falseVec);
+	isOdd = builder.CreateSelect(isExact, isOdd, falseVec);
+	llvm::Value* sign = builder.CreateSelect(isOdd, xSign, ConstI(iType, 0));
+	ret = builder.CreateBitCast(builder.CreateOr(builder.CreateBitCast(ret, iType), sign), fType);
+
+	// The finite negative x with the non-integer y has no real result
+	llvm::Value* isFiniteNeg = builder.CreateAnd(builder.CreateFCmpOLT(x, ConstF(fType, 0.0)),
+		builder.CreateFCmpONE(x, llvm::ConstantFP::getInfinity(fType, true)));
+	llvm::Value* isNaN = builder.CreateAnd(isFiniteNeg, builder.CreateNot(isInt));
+	ret = builder.CreateSelect(isNaN, llvm::ConstantFP::getNaN(fType), ret);
+
+	// pow(-1, +-inf) is 1 as well, y * log(1) would be NaN for it
+	llvm::Value* isOne = builder.CreateOr(builder.CreateFCmpOEQ(y, ConstF(fType, 0.0)), builder.CreateFCmpOEQ(x, ConstF(fType, 1.0)));
+	isOne = builder.CreateOr(isOne, builder.CreateAnd(builder.CreateFCmpOEQ(absX, ConstF(fType, 1.0)),
+		builder.CreateFCmpOEQ(absY, llvm::ConstantFP::getInfinity(fType))));
+	return builder.CreateSelect(isOne, ConstF(fType, 1.0), ret);
+}
+
+llvm::Value* EmitVectorMath(llvm::Intrinsic::ID id, llvm::Value* const* args)
+{
+	llvm::VectorType* vecType = dyn_cast<llvm::VectorType>(args[0]->getType());
+	if (!vecType || !vecType->getElementType()->isFloatTy())
+		return NULL;
+
+	switch (id) {
+	case llvm::Intrinsic::sin:
+		return EmitSinCos(args[0], false);
+	case llvm::Intrinsic::cos:
+		return EmitSinCos(args[0], true);
+	case llvm::Intrinsic::exp:
+		return EmitExp(args[0]);
+	case llvm::Intrinsic::log:
+		return EmitLog(args[0]);
+	case llvm::Intrinsic::pow:
+		return EmitPow(args[0], args[1]);
+	default:
+		return NULL;
+	}
+}
+
+} // namespace SC
@@ -0,0 +1,26 @@
+#pragma once
+#include "IR_Gen_Context.h"
+
+namespace SC {
+
+	// Emits the built-in function(see BuiltInFunc) on the scalar or vector arguments, all of the same type.
+	// The math functions on scalars go to the LLVM intrinsics, which become instructions(sqrt, fabs) or the calls to the
+	// C runtime(sin, cos, exp, log, pow). The float vectors get the polynomial approximations of EmitVectorMath instead of
+	// being split into one call for each element.
+	// The vector functions work on the whole vectors: the products of dot are summed up by halving the vector with the
+	// shuffles, cross is two shuffled products, min and max are compare and select(minps/maxps on x86) and mad is the
+	// llvm.fmuladd intrinsic, which becomes FMA when the target has it.
+	llvm::Value* EmitBuiltInFunc(BuiltInFunc func, llvm::Value* const* args);
+
+	// Emits the polynomial approximation of the intrinsic(sin, cos, exp, log or pow) on the float vector arguments in
+	// plain vector arithmetic, it returns NULL for the other intrinsics or types. The approximations are the ones of
+	// Cephes, they are within 2 ulps for |x| < 8192 of sin and cos and over the float range of exp and log. pow(x, y) is
+	// exp(y * log(|x|)), so it loses a few more bits when the result is far from 1, the signs and the special cases
+	// (e.g. the negative x, pow(0, 0)) are the same as the C runtime.
+	// It is used by the widening of the SIMD functions as well.
+	llvm::Value* EmitVectorMath(llvm::Intrinsic::ID id, llvm::Value* const* args);
+
+	// Broadcasts the scalar to a vector of the element count.
+	llvm::Value* SplatValue(llvm::Value* scalar, int elemCnt);
+
+} // namespace SC
@@ -0,0 +1,1085 @@
+#include "IR_Widen.h"
+#include "IR_Math.h"
+#include <llvm/IntrinsicInst.h>
+#include <llvm/Support/CFG.h>
+#include <algorithm>
+
+namespace SC {
+
+static bool IsAllTrue(llvm::Value* mask)
+{
+	llvm::Constant* C = dyn_cast<llvm::Constant>(mask);
+	return C && C->isAllOnesValue();
+}
+
+static llvm::Value* AndMask(llvm::Value* a, llvm::Value* b)
+{
+	if (IsAllTrue(a))
+		return b;
+	if (IsAllTrue(b))
+		return a;
+	return CG_Context::GetBuilder().CreateAnd(a, b);
+}
+
+static llvm::Value* OrMask(llvm::Value* a, llvm::Value* b)
+{
+	return a ? CG_Context::GetBuilder().CreateOr(a, b) : b;
+}
+
+// True if any lane is set in the mask
+static llvm::Value* AnyLane(llvm::Value* mask, int width)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::Value* ret = builder.CreateExtractElement(mask, builder.getInt32(0));
+	for (int i = 1; i < width; ++i)
+		ret = builder.CreateOr(ret, builder.CreateExtractElement(mask, builder.getInt32(i)));
+	return ret;
+}
+
+// The elements of the vector operations working on each element independently, they are widened by operating on
+// the vectors of lanes directly.
+//
+static bool IsElementwiseIntrinsic(unsigned int id)
+{
+	switch (id) {
+	case llvm::Intrinsic::sqrt:
+	case llvm::Intrinsic::sin:
+	case llvm::Intrinsic::cos:
+	case llvm::Intrinsic::pow:
+	case llvm::Intrinsic::exp:
+	case llvm::Intrinsic::exp2:
+	case llvm::Intrinsic::log:
+	case llvm::Intrinsic::log2:
+	case llvm::Intrinsic::log10:
+	case llvm::Intrinsic::fabs:
+	case llvm::Intrinsic::floor:
+	case llvm::Intrinsic::fma:
+	case llvm::Intrinsic::fmuladd:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// The leaf index of the element of an aggregate, e.g. the indices of the extractvalue instruction
+static int LeafOffset(llvm::Type* type, llvm::ArrayRef<unsigned int> indices)
+{
+	int offset = 0;
+	for (unsigned int i = 0; i < indices.size(); ++i) {
+		if (llvm::StructType* pStructType = dyn_cast<llvm::StructType>(type)) {
+			for (unsigned int j = 0; j < indices[i]; ++j)
+				offset += FunctionWidener::LeafCount(pStructType->getElementType(j));
+			type = pStructType->getElementType(indices[i]);
+		}
+		else {
+			llvm::ArrayType* pArrayType = dyn_cast<llvm::ArrayType>(type);
+			offset += indices[i] * FunctionWidener::LeafCount(pArrayType->getElementType());
+			type = pArrayType->getElementType();
+		}
+	}
+	return offset;
+}
+
+void FunctionWidener::LeafTypes(llvm::Type* type, std::vector<llvm::Type*>& leafTypes)
+{
+	if (llvm::VectorType* pVecType = dyn_cast<llvm::VectorType>(type)) {
+		for (unsigned int i = 0; i < pVecType->getNumElements(); ++i)
+			leafTypes.push_back(pVecType->getElementType());
+	}
+	else if (llvm::StructType* pStructType = dyn_cast<llvm::StructType>(type)) {
+		for (unsigned int i = 0; i < pStructType->getNumElements(); ++i)
+			LeafTypes(pStructType->getElementType(i), leafTypes);
+	}
+	else if (llvm::ArrayType* pArrayType = dyn_cast<llvm::ArrayType>(type)) {
+		for (unsigned int i = 0; i < pArrayType->getNumElements(); ++i)
+			LeafTypes(pArrayType->getElementType(), leafTypes);
+	}
+	else if (!type->isVoidTy())
+		leafTypes.push_back(type);
+}
+
+int FunctionWidener::LeafCount(llvm::Type* type)
+{
+	std::vector<llvm::Type*> leafTypes;
+	LeafTypes(type, leafTypes);
+	return (int)leafTypes.size();
+}
+
+void FunctionWidener::SplitToLeaves(llvm::Value* value, Leaves& leaves)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::Type* type = value->getType();
+	if (llvm::VectorType* pVecType = dyn_cast<llvm::VectorType>(type)) {
+		for (unsigned int i = 0; i < pVecType->getNumElements(); ++i)
+			leaves.push_back(builder.CreateExtractElement(value, builder.getInt32(i)));
+	}
+	else if (type->isStructTy() || type->isArrayTy()) {
+		unsigned int elemCnt = type->isStructTy() ? type->getStructNumElements() : type->getArrayNumElements();
+		for (unsigned int i = 0; i < elemCnt; ++i)
+			SplitToLeaves(builder.CreateExtractValue(value, i), leaves);
+	}
+	else if (!type->isVoidTy())
+		leaves.push_back(value);
+}
+
+llvm::Value* FunctionWidener::BuildFromLeaves(llvm::Type* type, const Leaves& leaves, int& leafIdx)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	if (llvm::VectorType* pVecType = dyn_cast<llvm::VectorType>(type)) {
+		llvm::Value* ret = llvm::UndefValue::get(type);
+		for (unsigned int i = 0; i < pVecType->getNumElements(); ++i)
+			ret = builder.CreateInsertElement(ret, leaves[leafIdx++], builder.getInt32(i));
+		return ret;
+	}
+	else if (llvm::StructType* pStructType = dyn_cast<llvm::StructType>(type)) {
+		llvm::Value* ret = llvm::UndefValue::get(type);
+		for (unsigned int i = 0; i < pStructType->getNumElements(); ++i)
+			ret = builder.CreateInsertValue(ret, BuildFromLeaves(pStructType->getElementType(i), leaves, leafIdx), i);
+		return ret;
+	}
+	else if (llvm::ArrayType* pArrayType = dyn_cast<llvm::ArrayType>(type)) {
+		llvm::Value* ret = llvm::UndefValue::get(type);
+		for (unsigned int i = 0; i < pArrayType->getNumElements(); ++i)
+			ret = builder.CreateInsertValue(ret, BuildFromLeaves(pArrayType->getElementType(), leaves, leafIdx), i);
+		return ret;
+	}
+	else
+		return leaves[leafIdx++];
+}
+
+FunctionWidener::FunctionWidener(llvm::Function* laneF, int width)
+{
+	mpLaneF = laneF;
+	mWidth = width;
+}
+
+FunctionWidener::~FunctionWidener()
+{
+	for (int i = 0; i < (int)mLoops.size(); ++i)
+		delete mLoops[i];
+}
+
+bool FunctionWidener::CheckType(llvm::Type* type, bool allowVoid)
+{
+	if (type->isVoidTy())
+		return allowVoid;
+	std::vector<llvm::Type*> leafTypes;
+	LeafTypes(type, leafTypes);
+	for (int i = 0; i < (int)leafTypes.size(); ++i) {
+		if (!llvm::VectorType::isValidElementType(leafTypes[i]) || leafTypes[i]->isPointerTy())
+			return false;
+	}
+	return true;
+}
+
+bool FunctionWidener::CheckInstruction(llvm::Instruction* I, std::string& errMsg)
+{
+	bool isSupported = true;
+	switch (I->getOpcode()) {
+	case llvm::Instruction::Br:
+	case llvm::Instruction::Switch:
+	case llvm::Instruction::Ret:
+	case llvm::Instruction::Unreachable:
+	case llvm::Instruction::PHI:
+	case llvm::Instruction::Select:
+	case llvm::Instruction::ICmp:
+	case llvm::Instruction::FCmp:
+	case llvm::Instruction::ExtractElement:
+	case llvm::Instruction::InsertElement:
+	case llvm::Instruction::ShuffleVector:
+	case llvm::Instruction::ExtractValue:
+	case llvm::Instruction::InsertValue:
+		break;
+	case llvm::Instruction::Call:
+		{
+			llvm::CallInst* CI = dyn_cast<llvm::CallInst>(I);
+			if (!CI->getCalledFunction()) {
+				errMsg = "Indirect function call can't be widened.";
+				return false;
+			}
+			if (isa<llvm::DbgInfoIntrinsic>(CI))
+				return true;
+			for (unsigned int i = 0; i < CI->getNumArgOperands(); ++i) {
+				if (!CheckType(CI->getArgOperand(i)->getType(), false))
+					isSupported = false;
+			}
+		}
+		break;
+	case llvm::Instruction::PtrToInt:
+	case llvm::Instruction::IntToPtr:
+		isSupported = false;
+		break;
+	default:
+		if (I->isBinaryOp())
+			break;
+		if (I->isCast()) {
+			// The casts between the vectors of different sizes mix the leaves
+			isSupported = (LeafCount(I->getType()) == LeafCount(I->getOperand(0)->getType()));
+			break;
+		}
+		// Alloca, load, store, GEP, etc.
+		errMsg = "The function accesses the memory(e.g. indexes an array with a variable) which can't be widened.";
+		return false;
+	}
+
+	if (!isSupported || !CheckType(I->getType(), true)) {
+		errMsg = std::string("The instruction can't be widened: ") + I->getOpcodeName();
+		return false;
+	}
+	return true;
+}
+
+bool FunctionWidener::Analyze(std::string& errMsg)
+{
+	for (llvm::Function::arg_iterator AI = mpLaneF->arg_begin(); AI != mpLaneF->arg_end(); ++AI) {
+		if (!CheckType(AI->getType(), false)) {
+			errMsg = "The argument type can't be widened.";
+			return false;
+		}
+	}
+	if (!CheckType(mpLaneF->getReturnType(), true)) {
+		errMsg = "The return type can't be widened.";
+		return false;
+	}
+	for (llvm::Function::iterator BB = mpLaneF->begin(); BB != mpLaneF->end(); ++BB) {
+		for (llvm::BasicBlock::iterator I = BB->begin(); I != BB->end(); ++I) {
+			if (!CheckInstruction(I, errMsg))
+				return false;
+		}
+	}
+
+	if (!FindLoops(errMsg))
+		return false;
+	FindVaryingValues();
+
+	for (int i = 0; i < (int)mLoops.size(); ++i) {
+		WideLoop* L = mLoops[i];
+		std::set<llvm::BasicBlock*>::iterator it = L->blocks.begin();
+		for (; it != L->blocks.end(); ++it) {
+			llvm::TerminatorInst* term = (*it)->getTerminator();
+			for (unsigned int j = 0; j < term->getNumSuccessors(); ++j) {
+				Edge exitEdge(*it, term->getSuccessor(j));
+				if (!L->blocks.count(exitEdge.second) && std::find(L->exits.begin(), L->exits.end(), exitEdge) == L->exits.end())
+					L->exits.push_back(exitEdge);
+			}
+			for (llvm::BasicBlock::iterator I = (*it)->begin(); I != (*it)->end(); ++I) {
+				for (llvm::Value::use_iterator UI = I->use_begin(); UI != I->use_end(); ++UI) {
+					llvm::Instruction* user = dyn_cast<llvm::Instruction>(*UI);
+					if (user && !L->blocks.count(user->getParent()) && mReachable.count(user->getParent())) {
+						L->liveOuts.push_back(I);
+						break;
+					}
+				}
+			}
+		}
+
+		// The loop of the uniform exit condition runs as it is, e.g. the loop of a constant iteration count.
+		L->isUniform = false;
+		if (L->latches.size() == 1 && L->exits.size() == 1 && L->exits[0].first == L->latches[0]) {
+			llvm::BranchInst* br = dyn_cast<llvm::BranchInst>(L->latches[0]->getTerminator());
+			L->isUniform = (br && br->isConditional() && !mVarying.count(br->getCondition()));
+		}
+	}
+	return true;
+}
+
+bool FunctionWidener::FindLoops(std::string& errMsg)
+{
+	// The depth-first search finds the back edges, i.e. the edges to the blocks on the search stack
+	//
+	std::vector<std::pair<llvm::BasicBlock*, unsigned int> > stack;
+	std::set<llvm::BasicBlock*> onStack;
+	std::vector<llvm::BasicBlock*> postOrder;
+	llvm::BasicBlock* entryBB = &mpLaneF->getEntryBlock();
+	mReachable.insert(entryBB);
+	onStack.insert(entryBB);
+	stack.push_back(std::make_pair(entryBB, 0u));
+	while (!stack.empty()) {
+		llvm::BasicBlock* BB = stack.back().first;
+		llvm::TerminatorInst* term = BB->getTerminator();
+		if (stack.back().second < term->getNumSuccessors()) {
+			llvm::BasicBlock* succ = term->getSuccessor(stack.back().second++);
+			if (onStack.count(succ))
+				mBackEdges.insert(Edge(BB, succ));
+			else if (mReachable.insert(succ).second) {
+				onStack.insert(succ);
+				stack.push_back(std::make_pair(succ, 0u));
+			}
+		}
+		else {
+			onStack.erase(BB);
+			postOrder.push_back(BB);
+			stack.pop_back();
+		}
+	}
+
+	// The successors come before the block in post order once the back edges are ignored
+	for (int i = 0; i < (int)postOrder.size(); ++i) {
+		llvm::BasicBlock* BB = postOrder[i];
+		std::set<llvm::BasicBlock*>& reach = mForwardReach[BB];
+		reach.insert(BB);
+		llvm::TerminatorInst* term = BB->getTerminator();
+		for (unsigned int j = 0; j < term->getNumSuccessors(); ++j) {
+			llvm::BasicBlock* succ = term->getSuccessor(j);
+			if (!mBackEdges.count(Edge(BB, succ)))
+				reach.insert(mForwardReach[succ].begin(), mForwardReach[succ].end());
+		}
+	}
+
+	// Each loop is made of the blocks reaching its latches without going through its header
+	//
+	std::map<llvm::BasicBlock*, WideLoop*> headerLoops;
+	for (std::set<Edge>::iterator it = mBackEdges.begin(); it != mBackEdges.end(); ++it) {
+		WideLoop*& L = headerLoops[it->second];
+		if (!L) {
+			L = new WideLoop();
+			L->header = it->second;
+			L->parent = NULL;
+			L->isUniform = false;
+			L->blocks.insert(it->second);
+			mLoops.push_back(L);
+		}
+		L->latches.push_back(it->first);
+	}
+	for (int i = 0; i < (int)mLoops.size(); ++i) {
+		WideLoop* L = mLoops[i];
+		std::vector<llvm::BasicBlock*> workList;
+		for (int j = 0; j < (int)L->latches.size(); ++j) {
+			if (L->blocks.insert(L->latches[j]).second)
+				workList.push_back(L->latches[j]);
+		}
+		while (!workList.empty()) {
+			llvm::BasicBlock* BB = workList.back();
+			workList.pop_back();
+			for (llvm::pred_iterator PI = llvm::pred_begin(BB); PI != llvm::pred_end(BB); ++PI) {
+				if (mReachable.count(*PI) && L->blocks.insert(*PI).second)
+					workList.push_back(*PI);
+			}
+		}
+
+		// The loop entered other than from its header can't be handled
+		std::set<llvm::BasicBlock*>::iterator it = L->blocks.begin();
+		for (; it != L->blocks.end(); ++it) {
+			if (*it == L->header)
+				continue;
+			for (llvm::pred_iterator PI = llvm::pred_begin(*it); PI != llvm::pred_end(*it); ++PI) {
+				if (mReachable.count(*PI) && !L->blocks.count(*PI)) {
+					errMsg = "The function has irreducible control flow which can't be widened.";
+					return false;
+				}
+			}
+		}
+	}
+
+	// The parent of a loop is the smallest other loop containing its header
+	//
+	for (int i = 0; i < (int)mLoops.size(); ++i) {
+		for (int j = 0; j < (int)mLoops.size(); ++j) {
+			WideLoop* pOther = mLoops[j];
+			if (i == j || !pOther->blocks.count(mLoops[i]->header))
+				continue;
+			if (!mLoops[i]->parent || pOther->blocks.size() < mLoops[i]->parent->blocks.size())
+				mLoops[i]->parent = pOther;
+		}
+		std::set<llvm::BasicBlock*>::iterator it = mLoops[i]->blocks.begin();
+		for (; it != mLoops[i]->blocks.end(); ++it) {
+			WideLoop*& innermost = mInnermostLoops[*it];
+			if (!innermost || mLoops[i]->blocks.size() < innermost->blocks.size())
+				innermost = mLoops[i];
+		}
+	}
+	return true;
+}
+
+void FunctionWidener::FindVaryingValues()
+{
+	// The arguments are the source of everything varying, the rest is found iteratively since the varying
+	// branches make the values merged after them varying too.
+	//
+	for (llvm::Function::arg_iterator AI = mpLaneF->arg_begin(); AI != mpLaneF->arg_end(); ++AI)
+		mVarying.insert(AI);
+	bool isChanged = true;
+	while (isChanged) {
+		isChanged = false;
+		for (llvm::Function::iterator BB = mpLaneF->begin(); BB != mpLaneF->end(); ++BB) {
+			if (!mReachable.count(BB))
+				continue;
+			for (llvm::BasicBlock::iterator I = BB->begin(); I != BB->end(); ++I) {
+				if (!mVarying.count(I) && IsVarying(I)) {
+					mVarying.insert(I);
+					isChanged = true;
+				}
+			}
+		}
+	}
+}
+
+bool FunctionWidener::IsVarying(llvm::Instruction* I)
+{
+	llvm::PHINode* phi = dyn_cast<llvm::PHINode>(I);
+	for (unsigned int i = 0; i < I->getNumOperands(); ++i) {
+		llvm::Value* op = I->getOperand(i);
+		if (mVarying.count(op))
+			return true;
+		// The value taken after a loop differs between the lanes leaving the loop at different iterations
+		llvm::BasicBlock* useBB = phi ? phi->getIncomingBlock(i) : I->getParent();
+		llvm::Instruction* opInst = dyn_cast<llvm::Instruction>(op);
+		if (opInst && LeavesDivergentLoop(opInst->getParent(), useBB))
+			return true;
+		if (phi && LeavesDivergentLoop(useBB, I->getParent()))
+			return true;
+	}
+
+	// The external functions may return different values for the same arguments
+	llvm::CallInst* CI = dyn_cast<llvm::CallInst>(I);
+	if (CI && !CI->getCalledFunction()->isIntrinsic())
+		return true;
+	return phi && IsDivergentJoin(I->getParent());
+}
+
+bool FunctionWidener::IsVaryingTerminator(llvm::BasicBlock* BB)
+{
+	llvm::TerminatorInst* term = BB->getTerminator();
+	if (llvm::BranchInst* br = dyn_cast<llvm::BranchInst>(term))
+		return br->isConditional() && mVarying.count(br->getCondition());
+	if (llvm::SwitchInst* sw = dyn_cast<llvm::SwitchInst>(term))
+		return mVarying.count(sw->getCondition()) != 0;
+	return false;
+}
+
+bool FunctionWidener::IsDivergentJoin(llvm::BasicBlock* BB)
+{
+	std::vector<llvm::BasicBlock*> preds;
+	for (llvm::pred_iterator PI = llvm::pred_begin(BB); PI != llvm::pred_end(BB); ++PI) {
+		if (mReachable.count(*PI) && std::find(preds.begin(), preds.end(), *PI) == preds.end())
+			preds.push_back(*PI);
+	}
+	if (preds.size() < 2)
+		return false;
+
+	// The lanes split by a varying branch arrive from different predecessors
+	//
+	for (std::set<llvm::BasicBlock*>::iterator it = mReachable.begin(); it != mReachable.end(); ++it) {
+		llvm::BasicBlock* branchBB = *it;
+		if (!IsVaryingTerminator(branchBB))
+			continue;
+		llvm::TerminatorInst* term = branchBB->getTerminator();
+		for (unsigned int s0 = 0; s0 < term->getNumSuccessors(); ++s0) {
+			for (unsigned int s1 = 0; s1 < term->getNumSuccessors(); ++s1) {
+				llvm::BasicBlock* succ0 = term->getSuccessor(s0);
+				llvm::BasicBlock* succ1 = term->getSuccessor(s1);
+				if (succ0 == succ1)
+					continue;
+				for (int p0 = 0; p0 < (int)preds.size(); ++p0) {
+					if (!(succ0 == BB && preds[p0] == branchBB) && !mForwardReach[succ0].count(preds[p0]))
+						continue;
+					for (int p1 = 0; p1 < (int)preds.size(); ++p1) {
+						if (p0 != p1 && ((succ1 == BB && preds[p1] == branchBB) || mForwardReach[succ1].count(preds[p1])))
+							return true;
+					}
+				}
+			}
+		}
+	}
+	return false;
+}
+
+bool FunctionWidener::IsDivergentLoop(WideLoop* L)
+{
+	// The lanes leave at different iterations if any exit condition is varying, or the lanes can be
+	// split to different exits.
+	int exitingCnt = 0;
+	bool hasVaryingBranch = false;
+	std::set<llvm::BasicBlock*>::iterator it = L->blocks.begin();
+	for (; it != L->blocks.end(); ++it) {
+		bool isVarying = IsVaryingTerminator(*it);
+		hasVaryingBranch |= isVarying;
+		llvm::TerminatorInst* term = (*it)->getTerminator();
+		for (unsigned int i = 0; i < term->getNumSuccessors(); ++i) {
+			if (!L->blocks.count(term->getSuccessor(i))) {
+				if (isVarying)
+					return true;
+				++exitingCnt;
+				break;
+			}
+		}
+	}
+	return exitingCnt > 1 && hasVaryingBranch;
+}
+
+bool FunctionWidener::LeavesDivergentLoop(llvm::BasicBlock* defBB, llvm::BasicBlock* useBB)
+{
+	std::map<llvm::BasicBlock*, WideLoop*>::iterator it = mInnermostLoops.find(defBB);
+	for (WideLoop* L = (it != mInnermostLoops.end() ? it->second : NULL); L; L = L->parent) {
+		if (L->blocks.count(useBB))
+			break;
+		if (IsDivergentLoop(L))
+			return true;
+	}
+	return false;
+}
+
+FunctionWidener::WideLoop* FunctionWidener::ChildLoopOf(llvm::BasicBlock* BB, WideLoop* region)
+{
+	std::map<llvm::BasicBlock*, WideLoop*>::iterator it = mInnermostLoops.find(BB);
+	WideLoop* L = (it != mInnermostLoops.end() ? it->second : NULL);
+	while (L && L->parent != region)
+		L = L->parent;
+	return L;
+}
+
+void FunctionWidener::RegionSuccessors(llvm::BasicBlock* node, WideLoop* region, std::vector<llvm::BasicBlock*>& succs)
+{
+	std::vector<llvm::BasicBlock*> targets;
+	WideLoop* pChild = ChildLoopOf(node, region);
+	if (pChild) {
+		for (int i = 0; i < (int)pChild->exits.size(); ++i)
+			targets.push_back(pChild->exits[i].second);
+	}
+	else {
+		llvm::TerminatorInst* term = node->getTerminator();
+		for (unsigned int i = 0; i < term->getNumSuccessors(); ++i)
+			targets.push_back(term->getSuccessor(i));
+	}
+
+	// The back edges and the exits of the region are not in the order
+	for (int i = 0; i < (int)targets.size(); ++i) {
+		if (region && (targets[i] == region->header || !region->blocks.count(targets[i])))
+			continue;
+		WideLoop* pTargetLoop = ChildLoopOf(targets[i], region);
+		succs.push_back(pTargetLoop ? pTargetLoop->header : targets[i]);
+	}
+}
+
+void FunctionWidener::RegionOrder(llvm::BasicBlock* node, WideLoop* region, std::set<llvm::BasicBlock*>& visited, std::vector<llvm::BasicBlock*>& postOrder)
+{
+	visited.insert(node);
+	std::vector<llvm::BasicBlock*> succs;
+	RegionSuccessors(node, region, succs);
+	for (int i = 0; i < (int)succs.size(); ++i) {
+		if (!visited.count(succs[i]))
+			RegionOrder(succs[i], region, visited, postOrder);
+	}
+	postOrder.push_back(node);
+}
+
+void FunctionWidener::WidenConstant(llvm::Constant* C, Leaves& leaves)
+{
+	llvm::Type* type = C->getType();
+	if (type->isVectorTy() || type->isStructTy() || type->isArrayTy()) {
+		std::vector<llvm::Type*> elemTypes;
+		if (llvm::VectorType* pVecType = dyn_cast<llvm::VectorType>(type))
+			elemTypes.assign(pVecType->getNumElements(), pVecType->getElementType());
+		else if (llvm::StructType* pStructType = dyn_cast<llvm::StructType>(type))
+			elemTypes.assign(pStructType->element_begin(), pStructType->element_end());
+		else
+			elemTypes.assign(type->getArrayNumElements(), type->getArrayElementType());
+		for (unsigned int i = 0; i < elemTypes.size(); ++i) {
+			llvm::Constant* elem = C->getAggregateElement(i);
+			WidenConstant(elem ? elem : llvm::UndefValue::get(elemTypes[i]), leaves);
+		}
+	}
+	else
+		leaves.push_back(llvm::ConstantVector::getSplat(mWidth, C));
+}
+
+FunctionWidener::Leaves FunctionWidener::GetLeaves(llvm::Value* value)
+{
+	std::map<llvm::Value*, Leaves>::iterator it = mValues.find(value);
+	if (it != mValues.end())
+		return it->second;
+
+	Leaves leaves;
+	if (llvm::Constant* C = dyn_cast<llvm::Constant>(value))
+		WidenConstant(C, leaves);
+	else {
+		// The values of the unreachable blocks
+		std::vector<llvm::Type*> leafTypes;
+		LeafTypes(value->getType(), leafTypes);
+		for (int i = 0; i < (int)leafTypes.size(); ++i)
+			leaves.push_back(llvm::UndefValue::get(llvm::VectorType::get(leafTypes[i], mWidth)));
+	}
+	return leaves;
+}
+
+FunctionWidener::Leaves FunctionWidener::GetIncomingLeaves(llvm::Value* value, llvm::BasicBlock* fromBB, llvm::BasicBlock* toBB)
+{
+	std::map<Edge, std::map<llvm::Value*, Leaves> >::iterator it = mExitValues.find(Edge(fromBB, toBB));
+	if (it != mExitValues.end() && it->second.count(value))
+		return it->second[value];
+	return GetLeaves(value);
+}
+
+llvm::Value* FunctionWidener::GetEdgeMask(llvm::BasicBlock* fromBB, llvm::BasicBlock* toBB)
+{
+	std::map<Edge, llvm::Value*>::iterator it = mEdgeMasks.find(Edge(fromBB, toBB));
+	if (it != mEdgeMasks.end())
+		return it->second;
+	return llvm::Constant::getNullValue(llvm::VectorType::get(llvm::Type::getInt1Ty(mpLaneF->getContext()), mWidth));
+}
+
+void FunctionWidener::AddEdgeMask(llvm::BasicBlock* fromBB, llvm::BasicBlock* toBB, llvm::Value* mask)
+{
+	llvm::Value*& edgeMask = mEdgeMasks[Edge(fromBB, toBB)];
+	edgeMask = OrMask(edgeMask, mask);
+}
+
+FunctionWidener::Leaves FunctionWidener::BlendPhi(llvm::PHINode* phi, WideLoop* L, bool fromInside)
+{
+	// Each lane takes the value of the edge it arrives from
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	Leaves ret;
+	std::set<llvm::BasicBlock*> visitedPreds;
+	for (unsigned int i = 0; i < phi->getNumIncomingValues(); ++i) {
+		llvm::BasicBlock* predBB = phi->getIncomingBlock(i);
+		if (!mReachable.count(predBB) || !visitedPreds.insert(predBB).second)
+			continue;
+		if (L && L->blocks.count(predBB) != (fromInside ? 1 : 0))
+			continue;
+		Leaves value = GetIncomingLeaves(phi->getIncomingValue(i), predBB, phi->getParent());
+		if (ret.empty()) {
+			ret = value;
+			continue;
+		}
+		llvm::Value* edgeMask = GetEdgeMask(predBB, phi->getParent());
+		for (int k = 0; k < (int)ret.size(); ++k)
+			ret[k] = builder.CreateSelect(edgeMask, value[k], ret[k]);
+	}
+	if (ret.empty())
+		ret = GetLeaves(llvm::UndefValue::get(phi->getType()));
+	return ret;
+}
+
+void FunctionWidener::Emit(llvm::Value* laneMask, const Leaves& argLeaves, Leaves& retLeaves)
+{
+	int leafIdx = 0;
+	for (llvm::Function::arg_iterator AI = mpLaneF->arg_begin(); AI != mpLaneF->arg_end(); ++AI) {
+		int leafCnt = LeafCount(AI->getType());
+		mValues[AI] = Leaves(argLeaves.begin() + leafIdx, argLeaves.begin() + leafIdx + leafCnt);
+		leafIdx += leafCnt;
+	}
+	mBlockMasks[&mpLaneF->getEntryBlock()] = laneMask;
+	mRetLeaves.clear();
+	EmitRegion(NULL);
+
+	retLeaves = mRetLeaves;
+	if (retLeaves.empty())
+		retLeaves = GetLeaves(llvm::UndefValue::get(mpLaneF->getReturnType()));
+}
+
+void FunctionWidener::EmitRegion(WideLoop* region)
+{
+	// The blocks and the inner loops of the region are emitted one after another in topological order,
+	// so the code emitted for each of them dominates everything emitted after it.
+	//
+	llvm::BasicBlock* entryBB = region ? region->header : &mpLaneF->getEntryBlock();
+	std::set<llvm::BasicBlock*> visited;
+	std::vector<llvm::BasicBlock*> postOrder;
+	RegionOrder(entryBB, region, visited, postOrder);
+	for (int i = (int)postOrder.size() - 1; i >= 0; --i) {
+		WideLoop* pChild = ChildLoopOf(postOrder[i], region);
+		if (pChild)
+			EmitLoop(pChild);
+		else
+			EmitBlock(postOrder[i], postOrder[i] == entryBB && region);
+	}
+}
+
+void FunctionWidener::EmitLoop(WideLoop* L)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::LLVMContext& llvmCtx = mpLaneF->getContext();
+	llvm::Type* maskType = llvm::VectorType::get(llvm::Type::getInt1Ty(llvmCtx), mWidth);
+	llvm::BasicBlock* headerBB = L->header;
+
+	// The lanes entering the loop and the initial values of the header phis
+	//
+	llvm::Value* entryMask = NULL;
+	std::set<llvm::BasicBlock*> visitedPreds;
+	for (llvm::pred_iterator PI = llvm::pred_begin(headerBB); PI != llvm::pred_end(headerBB); ++PI) {
+		if (mReachable.count(*PI) && !L->blocks.count(*PI) && visitedPreds.insert(*PI).second)
+			entryMask = OrMask(entryMask, GetEdgeMask(*PI, headerBB));
+	}
+	std::vector<llvm::PHINode*> headerPhis;
+	std::vector<Leaves> initValues;
+	for (llvm::BasicBlock::iterator I = headerBB->begin(); isa<llvm::PHINode>(I); ++I) {
+		headerPhis.push_back(dyn_cast<llvm::PHINode>(I));
+		initValues.push_back(BlendPhi(headerPhis.back(), L, false));
+	}
+
+	llvm::Function* curFunc = builder.GetInsertBlock()->getParent();
+	llvm::BasicBlock* preBB = builder.GetInsertBlock();
+	llvm::BasicBlock* loopBB = llvm::BasicBlock::Create(llvmCtx, "simd_loop", curFunc);
+	llvm::BasicBlock* afterBB = llvm::BasicBlock::Create(llvmCtx, "simd_loop_end", curFunc);
+	builder.CreateBr(loopBB);
+	builder.SetInsertPoint(loopBB);
+
+	llvm::PHINode* activeMask = builder.CreatePHI(maskType, 2);
+	activeMask->addIncoming(entryMask, preBB);
+	std::vector<std::vector<llvm::PHINode*> > headerPhiLeaves(headerPhis.size());
+	for (int i = 0; i < (int)headerPhis.size(); ++i) {
+		Leaves& leaves = mValues[headerPhis[i]];
+		leaves.clear();
+		for (int k = 0; k < (int)initValues[i].size(); ++k) {
+			llvm::PHINode* leafPhi = builder.CreatePHI(initValues[i][k]->getType(), 2);
+			leafPhi->addIncoming(initValues[i][k], preBB);
+			headerPhiLeaves[i].push_back(leafPhi);
+			leaves.push_back(leafPhi);
+		}
+	}
+
+	// The lanes leave a varying loop at different iterations, the exit masks and the values taken by the
+	// exits are accumulated over the iterations.
+	//
+	std::vector<llvm::PHINode*> exitMaskPhis;
+	std::vector<std::map<llvm::Value*, std::vector<llvm::PHINode*> > > exitValuePhis(L->exits.size());
+	std::vector<std::vector<llvm::PHINode*> > liveOutPhis(L->liveOuts.size());
+	if (!L->isUniform) {
+		for (int i = 0; i < (int)L->exits.size(); ++i) {
+			llvm::PHINode* maskPhi = builder.CreatePHI(maskType, 2);
+			maskPhi->addIncoming(llvm::Constant::getNullValue(maskType), preBB);
+			exitMaskPhis.push_back(maskPhi);
+
+			llvm::BasicBlock* exitBB = L->exits[i].second;
+			for (llvm::BasicBlock::iterator I = exitBB->begin(); isa<llvm::PHINode>(I); ++I) {
+				llvm::PHINode* phi = dyn_cast<llvm::PHINode>(I);
+				llvm::Value* value = phi->getIncomingValueForBlock(L->exits[i].first);
+				std::vector<llvm::PHINode*>& valuePhis = exitValuePhis[i][value];
+				if (!valuePhis.empty())
+					continue;
+				std::vector<llvm::Type*> leafTypes;
+				LeafTypes(value->getType(), leafTypes);
+				for (int k = 0; k < (int)leafTypes.size(); ++k) {
+					llvm::Type* wideType = llvm::VectorType::get(leafTypes[k], mWidth);
+					valuePhis.push_back(builder.CreatePHI(wideType, 2));
+					valuePhis.back()->addIncoming(llvm::UndefValue::get(wideType), preBB);
+				}
+			}
+		}
+		for (int i = 0; i < (int)L->liveOuts.size(); ++i) {
+			std::vector<llvm::Type*> leafTypes;
+			LeafTypes(L->liveOuts[i]->getType(), leafTypes);
+			for (int k = 0; k < (int)leafTypes.size(); ++k) {
+				llvm::Type* wideType = llvm::VectorType::get(leafTypes[k], mWidth);
+				liveOutPhis[i].push_back(builder.CreatePHI(wideType, 2));
+				liveOutPhis[i].back()->addIncoming(llvm::UndefValue::get(wideType), preBB);
+			}
+		}
+	}
+
+	mBlockMasks[headerBB] = activeMask;
+	EmitRegion(L);
+
+	// The end of the iteration, the lanes going back to the header continue
+	//
+	llvm::BasicBlock* latchBB = builder.GetInsertBlock();
+	llvm::Value* continueMask = NULL;
+	for (int i = 0; i < (int)L->latches.size(); ++i)
+		continueMask = OrMask(continueMask, GetEdgeMask(L->latches[i], headerBB));
+	std::vector<Leaves> nextValues;
+	for (int i = 0; i < (int)headerPhis.size(); ++i)
+		nextValues.push_back(BlendPhi(headerPhis[i], L, true));
+	for (int i = 0; i < (int)headerPhis.size(); ++i) {
+		for (int k = 0; k < (int)headerPhiLeaves[i].size(); ++k)
+			headerPhiLeaves[i][k]->addIncoming(nextValues[i][k], latchBB);
+	}
+	activeMask->addIncoming(continueMask, latchBB);
+
+	llvm::Value* isContinued = NULL;
+	if (L->isUniform) {
+		llvm::BranchInst* br = dyn_cast<llvm::BranchInst>(L->latches[0]->getTerminator());
+		isContinued = builder.CreateExtractElement(GetLeaves(br->getCondition())[0], builder.getInt32(0));
+		if (br->getSuccessor(0) != headerBB)
+			isContinued = builder.CreateNot(isContinued);
+	}
+	else {
+		llvm::Value* leavingMask = NULL;
+		std::vector<llvm::Value*> exitMasks;
+		for (int i = 0; i < (int)L->exits.size(); ++i) {
+			exitMasks.push_back(GetEdgeMask(L->exits[i].first, L->exits[i].second));
+			leavingMask = OrMask(leavingMask, exitMasks[i]);
+		}
+		for (int i = 0; i < (int)L->exits.size(); ++i) {
+			llvm::Value* accMask = builder.CreateOr(exitMaskPhis[i], exitMasks[i]);
+			exitMaskPhis[i]->addIncoming(accMask, latchBB);
+			mEdgeMasks[L->exits[i]] = accMask;
+
+			std::map<llvm::Value*, std::vector<llvm::PHINode*> >::iterator it = exitValuePhis[i].begin();
+			for (; it != exitValuePhis[i].end(); ++it) {
+				Leaves value = GetIncomingLeaves(it->first, L->exits[i].first, L->exits[i].second);
+				Leaves& accValue = mExitValues[L->exits[i]][it->first];
+				accValue.clear();
+				for (int k = 0; k < (int)it->second.size(); ++k) {
+					accValue.push_back(builder.CreateSelect(exitMasks[i], value[k], it->second[k]));
+					it->second[k]->addIncoming(accValue.back(), latchBB);
+				}
+			}
+		}
+		std::vector<Leaves> liveOutValues;
+		for (int i = 0; i < (int)L->liveOuts.size(); ++i) {
+			Leaves value = GetLeaves(L->liveOuts[i]);
+			for (int k = 0; k < (int)value.size(); ++k) {
+				value[k] = builder.CreateSelect(leavingMask, value[k], liveOutPhis[i][k]);
+				liveOutPhis[i][k]->addIncoming(value[k], latchBB);
+			}
+			liveOutValues.push_back(value);
+		}
+		// The code after the loop sees the values of each lane when it left
+		for (int i = 0; i < (int)L->liveOuts.size(); ++i)
+			mValues[L->liveOuts[i]] = liveOutValues[i];
+		isContinued = AnyLane(continueMask, mWidth);
+	}
+
+	builder.CreateCondBr(isContinued, loopBB, afterBB);
+	builder.SetInsertPoint(afterBB);
+}
+
+void FunctionWidener::EmitBlock(llvm::BasicBlock* BB, bool isRegionHeader)
+{
+	llvm::Value* mask = mBlockMasks[BB];
+	if (!mask) {
+		std::set<llvm::BasicBlock*> visitedPreds;
+		for (llvm::pred_iterator PI = llvm::pred_begin(BB); PI != llvm::pred_end(BB); ++PI) {
+			if (mReachable.count(*PI) && visitedPreds.insert(*PI).second)
+				mask = OrMask(mask, GetEdgeMask(*PI, BB));
+		}
+		mBlockMasks[BB] = mask;
+	}
+
+	// The phis of the loop header are set up by EmitLoop
+	llvm::BasicBlock::iterator I = BB->begin();
+	for (; isa<llvm::PHINode>(I); ++I) {
+		if (!isRegionHeader)
+			mValues[I] = BlendPhi(dyn_cast<llvm::PHINode>(I), NULL, false);
+	}
+	for (; I != BB->end(); ++I) {
+		if (!isa<llvm::TerminatorInst>(I))
+			EmitInstruction(I, mask);
+	}
+	EmitTerminator(BB, mask);
+}
+
+void FunctionWidener::EmitInstruction(llvm::Instruction* I, llvm::Value* mask)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	Leaves result;
+	if (llvm::BinaryOperator* binOp = dyn_cast<llvm::BinaryOperator>(I)) {
+		Leaves lhs = GetLeaves(I->getOperand(0));
+		Leaves rhs = GetLeaves(I->getOperand(1));
+		llvm::Instruction::BinaryOps opcode = binOp->getOpcode();
+		// The inactive lanes must not trap on the integer division
+		bool isIntDiv = (opcode == llvm::Instruction::SDiv || opcode == llvm::Instruction::UDiv ||
+			opcode == llvm::Instruction::SRem || opcode == llvm::Instruction::URem);
+		for (int k = 0; k < (int)lhs.size(); ++k) {
+			llvm::Value* divisor = rhs[k];
+			if (isIntDiv && !IsAllTrue(mask))
+				divisor = builder.CreateSelect(mask, divisor, llvm::ConstantInt::get(divisor->getType(), 1));
+			result.push_back(builder.CreateBinOp(opcode, lhs[k], divisor));
+		}
+	}
+	else if (llvm::CmpInst* cmp = dyn_cast<llvm::CmpInst>(I)) {
+		Leaves lhs = GetLeaves(I->getOperand(0));
+		Leaves rhs = GetLeaves(I->getOperand(1));
+		for (int k = 0; k < (int)lhs.size(); ++k) {
+			if (isa<llvm::ICmpInst>(cmp))
+				result.push_back(builder.CreateICmp(cmp->getPredicate(), lhs[k], rhs[k]));
+			else
+				result.push_back(builder.CreateFCmp(cmp->getPredicate(), lhs[k], rhs[k]));
+		}
+	}
+	else if (llvm::SelectInst* sel = dyn_cast<llvm::SelectInst>(I)) {
+		Leaves cond = GetLeaves(sel->getCondition());
+		Leaves trueValue = GetLeaves(sel->getTrueValue());
+		Leaves falseValue = GetLeaves(sel->getFalseValue());
+		for (int k = 0; k < (int)trueValue.size(); ++k)
+			result.push_back(builder.CreateSelect(cond.size() == 1 ? cond[0] : cond[k], trueValue[k], falseValue[k]));
+	}
+	else if (llvm::CastInst* castInst = dyn_cast<llvm::CastInst>(I)) {
+		Leaves src = GetLeaves(I->getOperand(0));
+		std::vector<llvm::Type*> destTypes;
+		LeafTypes(I->getType(), destTypes);
+		for (int k = 0; k < (int)src.size(); ++k)
+			result.push_back(builder.CreateCast(castInst->getOpcode(), src[k], llvm::VectorType::get(destTypes[k], mWidth)));
+	}
+	else if (isa<llvm::ExtractElementInst>(I)) {
+		Leaves vec = GetLeaves(I->getOperand(0));
+		llvm::Value* idx = I->getOperand(1);
+		if (llvm::ConstantInt* constIdx = dyn_cast<llvm::ConstantInt>(idx)) {
+			uint64_t i = constIdx->getZExtValue();
+			result.push_back(i < vec.size() ? vec[(int)i] : llvm::UndefValue::get(vec[0]->getType()));
+		}
+		else {
+			// Each lane picks the element of its own index
+			llvm::Value* wideIdx = GetLeaves(idx)[0];
+			llvm::Value* elem = vec[0];
+			for (int i = 1; i < (int)vec.size(); ++i) {
+				llvm::Value* isPicked = builder.CreateICmpEQ(wideIdx, GetLeaves(llvm::ConstantInt::get(idx->getType(), i))[0]);
+				elem = builder.CreateSelect(isPicked, vec[i], elem);
+			}
+			result.push_back(elem);
+		}
+	}
+	else if (isa<llvm::InsertElementInst>(I)) {
+		result = GetLeaves(I->getOperand(0));
+		llvm::Value* elem = GetLeaves(I->getOperand(1))[0];
+		llvm::Value* idx = I->getOperand(2);
+		if (llvm::ConstantInt* constIdx = dyn_cast<llvm::ConstantInt>(idx)) {
+			uint64_t i = constIdx->getZExtValue();
+			if (i < result.size())
+				result[(int)i] = elem;
+		}
+		else {
+			llvm::Value* wideIdx = GetLeaves(idx)[0];
+			for (int i = 0; i < (int)result.size(); ++i) {
+				llvm::Value* isPicked = builder.CreateICmpEQ(wideIdx, GetLeaves(llvm::ConstantInt::get(idx->getType(), i))[0]);
+				result[i] = builder.CreateSelect(isPicked, elem, result[i]);
+			}
+		}
+	}
+	else if (llvm::ShuffleVectorInst* shuffle = dyn_cast<llvm::ShuffleVectorInst>(I)) {
+		Leaves lhs = GetLeaves(I->getOperand(0));
+		Leaves rhs = GetLeaves(I->getOperand(1));
+		int resultCnt = LeafCount(I->getType());
+		for (int i = 0; i < resultCnt; ++i) {
+			int maskValue = shuffle->getMaskValue(i);
+			if (maskValue < 0)
+				result.push_back(llvm::UndefValue::get(lhs[0]->getType()));
+			else
+				result.push_back(maskValue < (int)lhs.size() ? lhs[maskValue] : rhs[maskValue - lhs.size()]);
+		}
+	}
+	else if (llvm::ExtractValueInst* extractInst = dyn_cast<llvm::ExtractValueInst>(I)) {
+		Leaves agg = GetLeaves(extractInst->getAggregateOperand());
+		int offset = LeafOffset(extractInst->getAggregateOperand()->getType(), extractInst->getIndices());
+		result.assign(agg.begin() + offset, agg.begin() + offset + LeafCount(I->getType()));
+	}
+	else if (llvm::InsertValueInst* insertInst = dyn_cast<llvm::InsertValueInst>(I)) {
+		result = GetLeaves(insertInst->getAggregateOperand());
+		Leaves elem = GetLeaves(insertInst->getInsertedValueOperand());
+		int offset = LeafOffset(I->getType(), insertInst->getIndices());
+		std::copy(elem.begin(), elem.end(), result.begin() + offset);
+	}
+	else if (llvm::CallInst* CI = dyn_cast<llvm::CallInst>(I)) {
+		if (isa<llvm::DbgInfoIntrinsic>(CI))
+			return;
+		EmitCall(CI, mask, result);
+	}
+	mValues[I] = result;
+}
+
+void FunctionWidener::EmitCall(llvm::CallInst* CI, llvm::Value* mask, Leaves& result)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::Function* callee = CI->getCalledFunction();
+	std::vector<Leaves> args;
+	for (unsigned int i = 0; i < CI->getNumArgOperands(); ++i)
+		args.push_back(GetLeaves(CI->getArgOperand(i)));
+
+	if (IsElementwiseIntrinsic(callee->getIntrinsicID())) {
+		llvm::Intrinsic::ID id = (llvm::Intrinsic::ID)callee->getIntrinsicID();
+		std::vector<llvm::Type*> leafTypes;
+		LeafTypes(CI->getType(), leafTypes);
+		for (int k = 0; k < (int)leafTypes.size(); ++k) {
+			std::vector<llvm::Value*> wideArgs;
+			for (int i = 0; i < (int)args.size(); ++i)
+				wideArgs.push_back(args[i][k]);
+			// The transcendental functions get the polynomials, the vector intrinsics would be split into the calls
+			llvm::Value* wideValue = EmitVectorMath(id, &wideArgs[0]);
+			if (!wideValue) {
+				llvm::Type* wideType = llvm::VectorType::get(leafTypes[k], mWidth);
+				llvm::Function* wideF = llvm::Intrinsic::getDeclaration(callee->getParent(), id, wideType);
+				wideValue = builder.CreateCall(wideF, wideArgs);
+			}
+			result.push_back(wideValue);
+		}
+		return;
+	}
+
+	// The other functions are called lane by lane, the external functions are called only for the active lanes since
+	// they may have side effects.
+	//
+	llvm::LLVMContext& llvmCtx = mpLaneF->getContext();
+	llvm::Function* curFunc = builder.GetInsertBlock()->getParent();
+	bool isGuarded = !callee->isIntrinsic() && !IsAllTrue(mask);
+	result = GetLeaves(llvm::UndefValue::get(CI->getType()));
+	for (int lane = 0; lane < mWidth; ++lane) {
+		llvm::Value* laneIdx = builder.getInt32(lane);
+		llvm::BasicBlock* prevBB = builder.GetInsertBlock();
+		llvm::BasicBlock* callBB = NULL;
+		llvm::BasicBlock* nextBB = NULL;
+		if (isGuarded) {
+			callBB = llvm::BasicBlock::Create(llvmCtx, "simd_lane_call", curFunc);
+			nextBB = llvm::BasicBlock::Create(llvmCtx, "simd_lane_next", curFunc);
+			builder.CreateCondBr(builder.CreateExtractElement(mask, laneIdx), callBB, nextBB);
+			builder.SetInsertPoint(callBB);
+		}
+
+		std::vector<llvm::Value*> laneArgs;
+		for (int i = 0; i < (int)args.size(); ++i) {
+			Leaves laneLeaves;
+			for (int k = 0; k < (int)args[i].size(); ++k)
+				laneLeaves.push_back(builder.CreateExtractElement(args[i][k], laneIdx));
+			int leafIdx = 0;
+			laneArgs.push_back(BuildFromLeaves(CI->getArgOperand(i)->getType(), laneLeaves, leafIdx));
+		}
+		llvm::CallInst* laneCall = builder.CreateCall(callee, laneArgs);
+		laneCall->setCallingConv(CI->getCallingConv());
+		laneCall->setAttributes(CI->getAttributes());
+
+		Leaves laneResult;
+		SplitToLeaves(laneCall, laneResult);
+		Leaves nextResult(result.size());
+		for (int k = 0; k < (int)result.size(); ++k)
+			nextResult[k] = builder.CreateInsertElement(result[k], laneResult[k], laneIdx);
+
+		if (isGuarded) {
+			builder.CreateBr(nextBB);
+			builder.SetInsertPoint(nextBB);
+			for (int k = 0; k < (int)result.size(); ++k) {
+				llvm::PHINode* phi = builder.CreatePHI(result[k]->getType(), 2);
+				phi->addIncoming(nextResult[k], callBB);
+				phi->addIncoming(result[k], prevBB);
+				nextResult[k] = phi;
+			}
+		}
+		result = nextResult;
+	}
+}
+
+void FunctionWidener::EmitTerminator(llvm::BasicBlock* BB, llvm::Value* mask)
+{
+	llvm::IRBuilder<>& builder = CG_Context::GetBuilder();
+	llvm::TerminatorInst* term = BB->getTerminator();
+	if (llvm::BranchInst* br = dyn_cast<llvm::BranchInst>(term)) {
+		if (br->isUnconditional() || br->getSuccessor(0) == br->getSuccessor(1))
+			AddEdgeMask(BB, br->getSuccessor(0), mask);
+		else {
+			llvm::Value* cond = GetLeaves(br->getCondition())[0];
+			AddEdgeMask(BB, br->getSuccessor(0), AndMask(mask, cond));
+			AddEdgeMask(BB, br->getSuccessor(1), AndMask(mask, builder.CreateNot(cond)));
+		}
+	}
+	else if (llvm::SwitchInst* sw = dyn_cast<llvm::SwitchInst>(term)) {
+		llvm::Value* cond = GetLeaves(sw->getCondition())[0];
+		llvm::Value* isAnyCase = NULL;
+		for (llvm::SwitchInst::CaseIt it = sw->case_begin(); it != sw->case_end(); ++it) {
+			llvm::Value* isCase = builder.CreateICmpEQ(cond, GetLeaves(it.getCaseValue())[0]);
+			isAnyCase = OrMask(isAnyCase, isCase);
+			AddEdgeMask(BB, it.getCaseSuccessor(), AndMask(mask, isCase));
+		}
+		AddEdgeMask(BB, sw->getDefaultDest(), isAnyCase ? AndMask(mask, builder.CreateNot(isAnyCase)) : mask);
+	}
+	else if (llvm::ReturnInst* ret = dyn_cast<llvm::ReturnInst>(term)) {
+		if (!ret->getReturnValue())
+			return;
+		Leaves value = GetLeaves(ret->getReturnValue());
+		if (mRetLeaves.empty())
+			mRetLeaves = value;
+		else {
+			for (int k = 0; k < (int)value.size(); ++k)
+				mRetLeaves[k] = builder.CreateSelect(mask, value[k], mRetLeaves[k]);
+		}
+	}
+}
+
+} // namespace SC
@@ -0,0 +1,104 @@
+#pragma once
+#include "IR_Gen_Context.h"
+#include <map>
+#include <set>
+
+namespace SC {
+
+	// Widens a scalar function so it runs a number of invocations(the lanes) at once, each scalar value of the function
+	// becomes a vector with one element for each lane, see KSC_GetSIMDFunctionPtr.
+	// The function must be free of memory access, i.e. it takes everything by value and returns all its results, which
+	// is what a KSCL function becomes after inlining and mem2reg. The branches on the values varying between the lanes
+	// are linearized with the execution masks of the lanes, the loops run until all the lanes leave. The loops whose
+	// exit condition is uniform(the same for all the lanes) run as they are.
+	//
+	class FunctionWidener
+	{
+	public:
+		// The scalar leaves of a value, each widened to a vector of lanes
+		typedef std::vector<llvm::Value*> Leaves;
+
+	private:
+		typedef std::pair<llvm::BasicBlock*, llvm::BasicBlock*> Edge;
+
+		struct WideLoop
+		{
+			llvm::BasicBlock* header;
+			std::set<llvm::BasicBlock*> blocks;
+			std::vector<llvm::BasicBlock*> latches;
+			WideLoop* parent;
+			// The edges leaving the loop, including the ones from the inner loops
+			std::vector<Edge> exits;
+			// The values defined in the loop and used after it
+			std::vector<llvm::Instruction*> liveOuts;
+			// All the lanes leave the loop together from its only latch
+			bool isUniform;
+		};
+
+		llvm::Function* mpLaneF;
+		int mWidth;
+
+		// The analysis of the scalar function
+		std::vector<WideLoop*> mLoops;
+		std::map<llvm::BasicBlock*, WideLoop*> mInnermostLoops;
+		std::set<llvm::BasicBlock*> mReachable;
+		std::set<Edge> mBackEdges;
+		// The blocks reachable from each block without going through any back edge, including itself
+		std::map<llvm::BasicBlock*, std::set<llvm::BasicBlock*> > mForwardReach;
+		std::set<llvm::Value*> mVarying;
+
+		// The states of the emission
+		std::map<llvm::Value*, Leaves> mValues;
+		std::map<llvm::BasicBlock*, llvm::Value*> mBlockMasks;
+		std::map<Edge, llvm::Value*> mEdgeMasks;
+		// The values of the phi nodes on the loop exits, taken when each lane leaves the loop
+		std::map<Edge, std::map<llvm::Value*, Leaves> > mExitValues;
+		Leaves mRetLeaves;
+
+		bool CheckType(llvm::Type* type, bool allowVoid);
+		bool CheckInstruction(llvm::Instruction* I, std::string& errMsg);
+		bool FindLoops(std::string& errMsg);
+		void FindVaryingValues();
+		bool IsVarying(llvm::Instruction* I);
+		bool IsVaryingTerminator(llvm::BasicBlock* BB);
+		bool IsDivergentJoin(llvm::BasicBlock* BB);
+		bool IsDivergentLoop(WideLoop* L);
+		bool LeavesDivergentLoop(llvm::BasicBlock* defBB, llvm::BasicBlock* useBB);
+
+		WideLoop* ChildLoopOf(llvm::BasicBlock* BB, WideLoop* region);
+		void RegionSuccessors(llvm::BasicBlock* node, WideLoop* region, std::vector<llvm::BasicBlock*>& succs);
+		void RegionOrder(llvm::BasicBlock* node, WideLoop* region, std::set<llvm::BasicBlock*>& visited, std::vector<llvm::BasicBlock*>& postOrder);
+
+		Leaves GetLeaves(llvm::Value* value);
+		Leaves GetIncomingLeaves(llvm::Value* value, llvm::BasicBlock* fromBB, llvm::BasicBlock* toBB);
+		void WidenConstant(llvm::Constant* C, Leaves& leaves);
+		llvm::Value* GetEdgeMask(llvm::BasicBlock* fromBB, llvm::BasicBlock* toBB);
+		void AddEdgeMask(llvm::BasicBlock* fromBB, llvm::BasicBlock* toBB, llvm::Value* mask);
+		Leaves BlendPhi(llvm::PHINode* phi, WideLoop* L, bool fromInside);
+
+		void EmitRegion(WideLoop* region);
+		void EmitLoop(WideLoop* L);
+		void EmitBlock(llvm::BasicBlock* BB, bool isRegionHeader);
+		void EmitInstruction(llvm::Instruction* I, llvm::Value* mask);
+		void EmitCall(llvm::CallInst* CI, llvm::Value* mask, Leaves& result);
+		void EmitTerminator(llvm::BasicBlock* BB, llvm::Value* mask);
+
+	public:
+		FunctionWidener(llvm::Function* laneF, int width);
+		~FunctionWidener();
+
+		// Checks the function can be widened, finds its loops and the varying values.
+		bool Analyze(std::string& errMsg);
+		// Emits the widened function at the insert point of the builder, which is left at the end of the emitted code.
+		// The arguments and the return value are given as their leaves(see LeafTypes) in order, the lanes not set in the
+		// mask get undefined results.
+		void Emit(llvm::Value* laneMask, const Leaves& argLeaves, Leaves& retLeaves);
+
+		// The scalar leaves of a type, e.g. struct {float3, int} has the leaves of float, float, float and int.
+		static void LeafTypes(llvm::Type* type, std::vector<llvm::Type*>& leafTypes);
+		static int LeafCount(llvm::Type* type);
+		static void SplitToLeaves(llvm::Value* value, Leaves& leaves);
+		static llvm::Value* BuildFromLeaves(llvm::Type* type, const Leaves& leaves, int& leafIdx);
+	};
+
+} // namespace SC
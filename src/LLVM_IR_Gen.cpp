@@ -1,5 +1,6 @@
 #include "parser_AST_Gen.h"
 #include "IR_Gen_Context.h"
+#include "IR_Math.h"
 
 #include <llvm/DerivedTypes.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
@@ -7,6 +8,7 @@
 #include <llvm/IRBuilder.h>
 #include <llvm/LLVMContext.h>
 #include <llvm/Module.h>
+#include <llvm/Metadata.h>
 #include <llvm/PassManager.h>
 #include <llvm/Analysis/Verifier.h>
 #include <llvm/Analysis/Passes.h>
@@ -16,6 +18,10 @@
 
 using namespace llvm;
 
+// The most expensive expression(see GetSpeculationCost) evaluated without a branch, for the right side of "&&" and "||"
+// and for the branches of the if-conversion.
+#define MAX_SPECULATION_COST 16
+
 namespace SC {
 
 llvm::Value* Expression::GenerateCode(CG_Context* context) const
@@ -28,18 +34,17 @@ llvm::Value* Expression::GenerateCode(CG_Context* context) const
 llvm::Value* Exp_Constant::GenerateCode(CG_Context* context) const
 {
 	if (mIsFromFloat) 
-		return ConstantFP::get(getGlobalContext(), APFloat((Float)mValue));
+		return ConstantFP::get(CG_Context::GetLLVMContext(), APFloat((Float)mValue));
 	else
 		return Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)mValue, true));
 }
 
 llvm::Value* Exp_VarDef::GenerateCode(CG_Context* context) const
 {
-	std::string varName = mVarName.ToStdString();
 	llvm::Value* varPtr = context->NewVariable(this, NULL);
 	if (mpInitValue) {
 		llvm::Value* initValue = context->CastValueType(mpInitValue->GenerateCode(context), mpInitValue->GetCachedTypeInfo().type, mVarType);
-		CG_Context::sBuilder.CreateStore(initValue, varPtr);
+		CG_Context::GetBuilder().CreateStore(initValue, varPtr);
 	}
 	return varPtr;
 }
@@ -58,21 +63,22 @@ llvm::Value* Exp_TrueOrFalse::GenerateCode(CG_Context* context) const
 llvm::Value* Exp_VariableRef::GenerateCode(CG_Context* context) const
 {
 	if (mpDef->GetVarType() == VarType::kBoolean) {
-		llvm::Value* intValue = context->GetVariableValue(mVariable.ToStdString(), true);
+		llvm::Value* intValue = context->GetVariableValue(mVariable.GetSymbol(), true);
 		llvm::Value* falseValue = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)0));
-		return CG_Context::sBuilder.CreateICmpNE(intValue, falseValue);
+		return CG_Context::GetBuilder().CreateICmpNE(intValue, falseValue);
 	}
 	else
-		return context->GetVariableValue(mVariable.ToStdString(), true);
+		return context->GetVariableValue(mVariable.GetSymbol(), true);
 }
 
 llvm::Value* Exp_UnaryOp::GenerateCode(CG_Context* context) const
 {
-	if (mOpType == "!")
-		return CG_Context::sBuilder.CreateNot(mpExpr->GenerateCode(context));
-	else if (mOpType == "-")
-		return CG_Context::sBuilder.CreateNeg(mpExpr->GenerateCode(context));
-	else {
+	switch (mOpType) {
+	case kOpNot:
+		return CG_Context::GetBuilder().CreateNot(mpExpr->GenerateCode(context));
+	case kOpNeg:
+		return CG_Context::GetBuilder().CreateNeg(mpExpr->GenerateCode(context));
+	default:
 		assert(0);
 		return NULL;
 	}
@@ -81,24 +87,31 @@ llvm::Value* Exp_UnaryOp::GenerateCode(CG_Context* context) const
 
 void Exp_VariableRef::GenerateAssignCode(CG_Context* context, llvm::Value* pValue) const
 {
-	llvm::Value* varPtr = context->GetVariablePtr(mpDef->GetVarName().ToStdString(), true);
+	llvm::Value* varPtr = context->GetVariablePtr(mpDef->GetVarName().GetSymbol(), true);
 	if (mpDef->GetVarType() == VarType::kBoolean) {
 		llvm::Value* falseValue = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)0));
 		llvm::Value* trueValue = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)1));
-		llvm::Value* thisBoolValue = CG_Context::sBuilder.CreateSelect(pValue, trueValue, falseValue);
-		CG_Context::sBuilder.CreateStore(thisBoolValue, varPtr);
+		llvm::Value* thisBoolValue = CG_Context::GetBuilder().CreateSelect(pValue, trueValue, falseValue);
+		CG_Context::GetBuilder().CreateStore(thisBoolValue, varPtr);
 	}
 	else
-		CG_Context::sBuilder.CreateStore(pValue, varPtr);
+		CG_Context::GetBuilder().CreateStore(pValue, varPtr);
 }
 
 
 llvm::Value* Exp_BinaryOp::GenerateCode(CG_Context* context) const
 {
+	if (mOperator == kOpLogicAnd || mOperator == kOpLogicOr) {
+		// The right side that is cheap and has no side effect is evaluated anyway, which needs no branch
+		int rightCost = mpRightExp->GetSpeculationCost();
+		if (rightCost < 0 || rightCost > MAX_SPECULATION_COST)
+			return GenerateShortCircuitCode(context);
+	}
+
 	llvm::Value* VR = mpRightExp->GenerateCode(context);
 	if (!VR)
 		return NULL;
-	if (mOperator == "=") {
+	if (mOperator == kOpAssign) {
 		llvm::Value* castedValue = context->CastValueType(VR, mpRightExp->GetCachedTypeInfo().type, mpLeftExp->GetCachedTypeInfo().type);
 		mpLeftExp->GenerateAssignCode(context, castedValue);
 		llvm::Value* VL = mpLeftExp->GenerateCode(context);
@@ -117,11 +130,71 @@ llvm::Value* Exp_BinaryOp::GenerateCode(CG_Context* context) const
 	return NULL;
 }
 
-llvm::Value* Exp_FunctionDecl::GenerateCode(CG_Context* context) const
+llvm::Value* Exp_BinaryOp::GenerateShortCircuitCode(CG_Context* context) const
+{
+	bool isAnd = (mOperator == kOpLogicAnd);
+	llvm::Value* VL = mpLeftExp->GenerateCode(context);
+	llvm::BasicBlock* pLeftBB = CG_Context::GetBuilder().GetInsertBlock();
+	llvm::Function* pCurFunc = context->GetCurrentFunc();
+	llvm::BasicBlock* pRightBB = llvm::BasicBlock::Create(CG_Context::GetLLVMContext(), isAnd ? "and.rhs" : "or.rhs", pCurFunc);
+	llvm::BasicBlock* pMergeBB = llvm::BasicBlock::Create(CG_Context::GetLLVMContext(), isAnd ? "and.end" : "or.end");
+	if (isAnd)
+		CG_Context::GetBuilder().CreateCondBr(VL, pRightBB, pMergeBB);
+	else
+		CG_Context::GetBuilder().CreateCondBr(VL, pMergeBB, pRightBB);
+
+	CG_Context::GetBuilder().SetInsertPoint(pRightBB);
+	llvm::Value* VR = mpRightExp->GenerateCode(context);
+	// Codegen of the right side can change the current block
+	pRightBB = CG_Context::GetBuilder().GetInsertBlock();
+	CG_Context::GetBuilder().CreateBr(pMergeBB);
+
+	pCurFunc->getBasicBlockList().push_back(pMergeBB);
+	CG_Context::GetBuilder().SetInsertPoint(pMergeBB);
+	llvm::PHINode* PN = CG_Context::GetBuilder().CreatePHI(VL->getType(), 2, isAnd ? "and" : "or");
+	PN->addIncoming(isAnd ? CG_Context::GetBuilder().getFalse() : CG_Context::GetBuilder().getTrue(), pLeftBB);
+	PN->addIncoming(VR, pRightBB);
+	return PN;
+}
+
+int Exp_BinaryOp::GetSelectAssignCost(CG_Context* context) const
+{
+	if (mOperator != kOpAssign)
+		return -1;
+	Exp_ValueEval::TypeInfo LtypeInfo = mpLeftExp->GetCachedTypeInfo();
+	if (LtypeInfo.type == VarType::kStructure || LtypeInfo.arraySize > 0)
+		return -1;
+
+	// The variable must be a local one, the reference arguments are not written when the branch isn't taken.
+	const Exp_ValueEval* pTarget = mpLeftExp;
+	while (const Exp_DotOp* pDotOp = dynamic_cast<const Exp_DotOp*>(pTarget))
+		pTarget = pDotOp->GetParentExp();
+	const Exp_VariableRef* pVarRef = dynamic_cast<const Exp_VariableRef*>(pTarget);
+	if (!pVarRef || !isa<llvm::AllocaInst>(context->GetVariablePtr(pVarRef->GetVarDef()->GetVarName().GetSymbol(), true)))
+		return -1;
+
+	int targetCost = mpLeftExp->GetSpeculationCost();
+	int valueCost = mpRightExp->GetSpeculationCost();
+	if (targetCost < 0 || valueCost < 0)
+		return -1;
+	return targetCost + valueCost + 1;
+}
+
+void Exp_BinaryOp::GenerateSelectAssignCode(CG_Context* context, llvm::Value* pCond, bool assignOnTrue) const
+{
+	llvm::Value* VR = mpRightExp->GenerateCode(context);
+	llvm::Value* newValue = context->CastValueType(VR, mpRightExp->GetCachedTypeInfo().type, mpLeftExp->GetCachedTypeInfo().type);
+	llvm::Value* oldValue = mpLeftExp->GenerateCode(context);
+	llvm::Value* value = assignOnTrue ? 
+		CG_Context::GetBuilder().CreateSelect(pCond, newValue, oldValue) : 
+		CG_Context::GetBuilder().CreateSelect(pCond, oldValue, newValue);
+	mpLeftExp->GenerateAssignCode(context, value);
+}
+
+llvm::Function* Exp_FunctionDecl::GeneratePrototype(CG_Context* context) const
 {
 	// handle the argument types
-	Function *F = context->GetFuncDeclByName(mFuncName);
-	llvm::Type* retType = NULL;
+	Function *F = context->GetFuncDeclByName(mFuncSymbol);
 	if (!F) {
 		std::vector<llvm::Type*> funcArgTypes(mArgments.size());
 		for (int i = 0; i < (int)mArgments.size(); ++i) {
@@ -141,6 +214,7 @@ llvm::Value* Exp_FunctionDecl::GenerateCode(CG_Context* context) const
 		}
 
 		// handle the return type
+		llvm::Type* retType = NULL;
 		if (mReturnType == VarType::kStructure) {
 			retType = context->GetStructType(mpRetStruct);
 		}
@@ -148,26 +222,22 @@ llvm::Value* Exp_FunctionDecl::GenerateCode(CG_Context* context) const
 			retType = context->ConvertToLLVMType(mReturnType);
 
 		FunctionType *FT = FunctionType::get(retType, funcArgTypes, false);
-		F = Function::Create(FT, Function::ExternalLinkage, mFuncName, CG_Context::TheModule);
+		// The external function defined in the bitcode of the host is linked into the module, so it can be inlined.
+		if (!mHasBody)
+			F = CG_Context::LinkExternalFunction(mFuncName, FT);
+		if (!F)
+			F = Function::Create(FT, Function::ExternalLinkage, mFuncName, context->GetModule());
 	}
 
 	if (F) {
-		context->AddFunctionDecl(mFuncName, F);
-	}
-	else {
-		return NULL;
+		context->AddFunctionDecl(mFuncSymbol, F);
 	}
+	return F;
+}
 
-	if (!mHasBody) {
-		// Function doens't have the body, so it must be an external function.
-		if (CG_Context::sGlobalFuncSymbols.find(mFuncName) != CG_Context::sGlobalFuncSymbols.end()) {
-			CG_Context::TheExecutionEngine->addGlobalMapping(F, CG_Context::sGlobalFuncSymbols[mFuncName]);
-			return F;
-		}
-		else {
-			return NULL;
-		}
-	}
+void Exp_FunctionDecl::GenerateBody(CG_Context* context, llvm::Function* F) const
+{
+	llvm::Type* retType = F->getReturnType();
 
 	// set names for all arguments
 	{
@@ -177,13 +247,13 @@ llvm::Value* Exp_FunctionDecl::GenerateCode(CG_Context* context) const
 	}
 	
 	// Create a new basic block to start insertion into, this basic blokc is a must for a function.
-	BasicBlock *BB = BasicBlock::Create(getGlobalContext(), mFuncName + "_entry", F);
+	BasicBlock *BB = BasicBlock::Create(CG_Context::GetLLVMContext(), mFuncName + "_entry", F);
 
 	// Create the basic block for exiting code which handles the return value, it will be inserted into function body later.
-	BasicBlock *retBB = BasicBlock::Create(getGlobalContext(), mFuncName + "_exit");
+	BasicBlock *retBB = BasicBlock::Create(CG_Context::GetLLVMContext(), mFuncName + "_exit");
 	
-	CG_Context::sBuilder.SetInsertPoint(BB);
-	llvm::Value* pRetValuePtr = mReturnType == VarType::kVoid ? NULL : CG_Context::sBuilder.CreateAlloca(retType, 0, mFuncName + "_retValue");
+	CG_Context::GetBuilder().SetInsertPoint(BB);
+	llvm::Value* pRetValuePtr = mReturnType == VarType::kVoid ? NULL : CG_Context::GetBuilder().CreateAlloca(retType, 0, mFuncName + "_retValue");
 	CG_Context* funcGC_ctx = context->CreateChildContext(F, retBB, pRetValuePtr);
 
 	Function::arg_iterator AI = F->arg_begin();
@@ -197,7 +267,7 @@ llvm::Value* Exp_FunctionDecl::GenerateCode(CG_Context* context) const
 		else {
 			llvm::Value* funcArg = funcGC_ctx->NewVariable(pVarDef, NULL);
 			// Store the input argument's value in the the local variables.
-			CG_Context::sBuilder.CreateStore(AI, funcArg);
+			CG_Context::GetBuilder().CreateStore(AI, funcArg);
 		}
 	}
 
@@ -208,17 +278,39 @@ llvm::Value* Exp_FunctionDecl::GenerateCode(CG_Context* context) const
 
 	// Now insert the exit basic block
 	F->getBasicBlockList().push_back(retBB);
-	CG_Context::sBuilder.CreateBr(retBB);
+	CG_Context::GetBuilder().CreateBr(retBB);
 
-	assert(retType);
-	CG_Context::sBuilder.SetInsertPoint(retBB);
+	CG_Context::GetBuilder().SetInsertPoint(retBB);
 	if (mReturnType == VarType::kVoid)
-		CG_Context::sBuilder.CreateRetVoid();
+		CG_Context::GetBuilder().CreateRetVoid();
 	else
-		CG_Context::sBuilder.CreateRet(CG_Context::sBuilder.CreateLoad(pRetValuePtr));
+		CG_Context::GetBuilder().CreateRet(CG_Context::GetBuilder().CreateLoad(pRetValuePtr));
 
 
 	delete funcGC_ctx;
+}
+
+llvm::Value* Exp_FunctionDecl::GenerateCode(CG_Context* context) const
+{
+	Function *F = GeneratePrototype(context);
+	if (!F)
+		return NULL;
+
+	if (!mHasBody) {
+		// Function doens't have the body, so it must be an external function.
+		if (!F->isDeclaration())
+			return F; // Linked from the bitcode
+		void* funcPtr = CG_Context::FindGlobalFuncSymbol(mFuncName);
+		if (funcPtr) {
+			CG_Context::GetExecutionEngine()->addGlobalMapping(F, funcPtr);
+			return F;
+		}
+		else {
+			return NULL;
+		}
+	}
+
+	GenerateBody(context, F);
 	return F;
 }
 
@@ -237,7 +329,7 @@ llvm::Value* Exp_FuncRet::GenerateCode(CG_Context* context) const
 	if (mpRetValue) {
 		llvm::Value* retVal = mpRetValue->GenerateCode(context);
 		assert(retVal);
-		return CG_Context::sBuilder.CreateStore(retVal, context->GetRetValuePtr());
+		return CG_Context::GetBuilder().CreateStore(retVal, context->GetRetValuePtr());
 	}
 	return NULL;
 }
@@ -250,16 +342,16 @@ void Exp_DotOp::GenerateAssignCode(CG_Context* context, llvm::Value* pValue) con
 		if (GetCachedTypeInfo().type == VarType::kBoolean) {
 			llvm::Value* falseValue = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)0));
 			llvm::Value* trueValue = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)1));
-			llvm::Value* intValue = CG_Context::sBuilder.CreateSelect(pValue, trueValue, falseValue);
-			CG_Context::sBuilder.CreateStore(intValue, valuePtrInfo.valuePtr);
+			llvm::Value* intValue = CG_Context::GetBuilder().CreateSelect(pValue, trueValue, falseValue);
+			CG_Context::GetBuilder().CreateStore(intValue, valuePtrInfo.valuePtr);
 		}
 		else
-			CG_Context::sBuilder.CreateStore(pValue, valuePtrInfo.valuePtr);
+			CG_Context::GetBuilder().CreateStore(pValue, valuePtrInfo.valuePtr);
 	}
 	else {
 		llvm::Value* idx = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)valuePtrInfo.vecElemIdx));
-		llvm::Value* updatedValue = CG_Context::sBuilder.CreateInsertElement(CG_Context::sBuilder.CreateLoad(valuePtrInfo.valuePtr), pValue, idx);
-		CG_Context::sBuilder.CreateStore(updatedValue, valuePtrInfo.valuePtr);
+		llvm::Value* updatedValue = CG_Context::GetBuilder().CreateInsertElement(CG_Context::GetBuilder().CreateLoad(valuePtrInfo.valuePtr), pValue, idx);
+		CG_Context::GetBuilder().CreateStore(updatedValue, valuePtrInfo.valuePtr);
 	}
 }
 
@@ -279,14 +371,14 @@ Exp_ValueEval::ValuePtrInfo Exp_DotOp::GetValuePtr(CG_Context* context) const
 		
 		int elemIdx = -1;
 		if (pParentStructDef)
-			elemIdx = pParentStructDef->GetElementIdxByName(mOpStr);
+			elemIdx = pParentStructDef->GetElementIdxByName(mOpSymbol);
 
 		if (elemIdx != -1) {
 			// It's accessing structure member
 			std::vector<llvm::Value*> indices(2);
 			indices[0] = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)0));
 			indices[1] = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)elemIdx));
-			llvm::Value* structElemPtr = CG_Context::sBuilder.CreateGEP(parentPtrInfo.valuePtr, indices);
+			llvm::Value* structElemPtr = CG_Context::GetBuilder().CreateGEP(parentPtrInfo.valuePtr, indices);
 			retValuePtr.valuePtr = structElemPtr;
 			retValuePtr.belongToVector = false;
 			return retValuePtr;
@@ -317,10 +409,10 @@ llvm::Value* Exp_DotOp::GenerateCode(CG_Context* context) const
 	Exp_ValueEval::ValuePtrInfo valuePtrInfo = GetValuePtr(context);
 	if (valuePtrInfo.valuePtr) {
 		
-		llvm::Value* ret = CG_Context::sBuilder.CreateLoad(valuePtrInfo.valuePtr);
+		llvm::Value* ret = CG_Context::GetBuilder().CreateLoad(valuePtrInfo.valuePtr);
 		if  (valuePtrInfo.belongToVector) {
 			llvm::Value* idx = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)valuePtrInfo.vecElemIdx));
-			ret = CG_Context::sBuilder.CreateExtractElement(ret, idx);
+			ret = CG_Context::GetBuilder().CreateExtractElement(ret, idx);
 		}
 		return ret;
 	}
@@ -330,9 +422,9 @@ llvm::Value* Exp_DotOp::GenerateCode(CG_Context* context) const
 		int elemCnt = ConvertSwizzle(mOpStr.c_str(), swizzleIdx);
 		llvm::SmallVector<Constant*, 4> Idxs;
 		for (int i = 0; i < elemCnt; ++i) 
-			Idxs.push_back(CG_Context::sBuilder.getInt32(swizzleIdx[i]));
+			Idxs.push_back(CG_Context::GetBuilder().getInt32(swizzleIdx[i]));
 		llvm::Value* srcValue = mpExp->GenerateCode(context);
-		llvm::Value* swizzledValue = CG_Context::sBuilder.CreateShuffleVector(srcValue, llvm::UndefValue::get(srcValue->getType()), llvm::ConstantVector::get(Idxs));
+		llvm::Value* swizzledValue = CG_Context::GetBuilder().CreateShuffleVector(srcValue, llvm::UndefValue::get(srcValue->getType()), llvm::ConstantVector::get(Idxs));
 		return swizzledValue;
 	}
 }
@@ -360,11 +452,11 @@ llvm::Value* Exp_BuiltInInitializer::GenerateCode(CG_Context* context) const
 			if (subElemCnt > 1) {
 				for (int i = 0; i < subElemCnt; ++i) {
 					llvm::Value* idx = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)i));
-					llvm::Value* elemValue = CG_Context::sBuilder.CreateExtractElement(tmpVar, idx);
+					llvm::Value* elemValue = CG_Context::GetBuilder().CreateExtractElement(tmpVar, idx);
 					elemValue = context->CastValueType(elemValue, srcElemType, destElemType);
 
 					idx = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)elemIdx++));
-					outVar = CG_Context::sBuilder.CreateInsertElement(outVar, elemValue, idx);
+					outVar = CG_Context::GetBuilder().CreateInsertElement(outVar, elemValue, idx);
 				}
 			}
 			else {
@@ -372,7 +464,7 @@ llvm::Value* Exp_BuiltInInitializer::GenerateCode(CG_Context* context) const
 				llvm::Value* elemValue = tmpVar;
 				elemValue = context->CastValueType(elemValue, subType, destElemType);
 
-				outVar = CG_Context::sBuilder.CreateInsertElement(outVar, elemValue, idx);
+				outVar = CG_Context::GetBuilder().CreateInsertElement(outVar, elemValue, idx);
 			}
 		}
 		
@@ -384,7 +476,7 @@ Exp_ValueEval::ValuePtrInfo Exp_VariableRef::GetValuePtr(CG_Context* context) co
 {
 	Exp_ValueEval::ValuePtrInfo retValuePtr;
 	retValuePtr.belongToVector = false;
-	retValuePtr.valuePtr = context->GetVariablePtr(mpDef->GetVarName().ToStdString(), true);
+	retValuePtr.valuePtr = context->GetVariablePtr(mpDef->GetVarName().GetSymbol(), true);
 	retValuePtr.vecElemIdx = -1;
 	return retValuePtr;
 }
@@ -393,7 +485,7 @@ llvm::Value* Exp_Indexer::GenerateCode(CG_Context* context) const
 {
 	Exp_ValueEval::ValuePtrInfo ptrInfo = GetValuePtr(context);
 	assert(ptrInfo.belongToVector == false);
-	return CG_Context::sBuilder.CreateLoad(ptrInfo.valuePtr);
+	return CG_Context::GetBuilder().CreateLoad(ptrInfo.valuePtr);
 }
 
 Exp_ValueEval::ValuePtrInfo Exp_Indexer::GetValuePtr(CG_Context* context) const
@@ -408,7 +500,7 @@ Exp_ValueEval::ValuePtrInfo Exp_Indexer::GetValuePtr(CG_Context* context) const
 	std::vector<llvm::Value*> indices(2);
 	indices[1] = idx;
 	indices[0] = Constant::getIntegerValue(SC_INT_TYPE, APInt(sizeof(Int)*8, (uint64_t)0));
-	retValuePtr.valuePtr = CG_Context::sBuilder.CreateGEP(parentPtrInfo.valuePtr, indices);
+	retValuePtr.valuePtr = CG_Context::GetBuilder().CreateGEP(parentPtrInfo.valuePtr, indices);
 	return retValuePtr;
 }
 
@@ -416,12 +508,12 @@ void Exp_Indexer::GenerateAssignCode(CG_Context* context, llvm::Value* pValue) c
 {
 	Exp_ValueEval::ValuePtrInfo ptrInfo = GetValuePtr(context);
 	assert(ptrInfo.belongToVector == false);
-	CG_Context::sBuilder.CreateStore(pValue, ptrInfo.valuePtr);
+	CG_Context::GetBuilder().CreateStore(pValue, ptrInfo.valuePtr);
 }
 
 llvm::Value* Exp_FunctionCall::GenerateCode(CG_Context* context) const
 {
-	llvm::Function* pF = context->GetFuncDeclByName(mpFuncDef->GetFunctionName());
+	llvm::Function* pF = context->GetFuncDeclByName(mpFuncDef->GetFunctionSymbol());
 	assert(pF);
 	std::vector<llvm::Value*> args;
 	for (int i = 0; i < (int)mInputArgs.size(); ++i) {
@@ -436,10 +528,46 @@ llvm::Value* Exp_FunctionCall::GenerateCode(CG_Context* context) const
 			args.push_back(argValue);
 		}
 	}
-	return CG_Context::sBuilder.CreateCall(pF, args);
+	return CG_Context::GetBuilder().CreateCall(pF, args);
 }
 
 
+llvm::Value* Exp_BuiltInFuncCall::GenerateCode(CG_Context* context) const
+{
+	int elemCnt = TypeElementCnt(mArgType);
+	std::vector<llvm::Value*> args;
+	for (int i = 0; i < (int)mInputArgs.size(); ++i) {
+		VarType argType = mInputArgs[i]->GetCachedTypeInfo().type;
+		llvm::Value* argValue = mInputArgs[i]->GenerateCode(context);
+		if (TypeElementCnt(argType) == 1 && elemCnt > 1) {
+			argValue = context->CastValueType(argValue, argType, MakeType(IsIntegerType(mArgType), 1));
+			argValue = SplatValue(argValue, elemCnt);
+		}
+		else
+			argValue = context->CastValueType(argValue, argType, mArgType);
+		args.push_back(argValue);
+	}
+	return EmitBuiltInFunc(mFunc, &args[0]);
+}
+
+bool Exp_If::IsSelectConvertible(CG_Context* context) const
+{
+	int totalCost = 0;
+	CodeDomain* domains[2] = {mpIfDomain, mpElseDomain};
+	for (int i = 0; i < 2; ++i) {
+		if (!domains[i])
+			continue;
+		for (int j = 0; j < domains[i]->GetExpressionCnt(); ++j) {
+			Exp_BinaryOp* pAssign = dynamic_cast<Exp_BinaryOp*>(domains[i]->GetExpression(j));
+			int cost = pAssign ? pAssign->GetSelectAssignCost(context) : -1;
+			if (cost < 0)
+				return false;
+			totalCost += cost;
+		}
+	}
+	return totalCost <= MAX_SPECULATION_COST;
+}
+
 llvm::Value* Exp_If::GenerateCode(CG_Context* context) const
 {
 	llvm::Value* condValue = mpCondValue->GenerateCode(context);
@@ -447,16 +575,32 @@ llvm::Value* Exp_If::GenerateCode(CG_Context* context) const
 	Function *pCurFunc = context->GetCurrentFunc();
 	assert(pCurFunc);
 
+	if (IsSelectConvertible(context)) {
+		// The assignments of both branches are done in order, each one keeps the old value unless its branch is taken.
+		// The else branch sees the values the if branch leaves, which are the old ones when it's taken.
+		//
+		CodeDomain* domains[2] = {mpIfDomain, mpElseDomain};
+		for (int i = 0; i < 2; ++i) {
+			if (!domains[i])
+				continue;
+			for (int j = 0; j < domains[i]->GetExpressionCnt(); ++j) {
+				Exp_BinaryOp* pAssign = dynamic_cast<Exp_BinaryOp*>(domains[i]->GetExpression(j));
+				pAssign->GenerateSelectAssignCode(context, condValue, i == 0);
+			}
+		}
+		return NULL;
+	}
+
 	// Create blocks for the then and else cases.  Insert the 'then' block at the
 	// end of the function.
-	BasicBlock* pThenBB = BasicBlock::Create(getGlobalContext(), "then", pCurFunc);
-	BasicBlock* pElseBB = BasicBlock::Create(getGlobalContext(), "else");
-	BasicBlock* pMergeBB = BasicBlock::Create(getGlobalContext(), "ifcont");
+	BasicBlock* pThenBB = BasicBlock::Create(CG_Context::GetLLVMContext(), "then", pCurFunc);
+	BasicBlock* pElseBB = BasicBlock::Create(CG_Context::GetLLVMContext(), "else");
+	BasicBlock* pMergeBB = BasicBlock::Create(CG_Context::GetLLVMContext(), "ifcont");
   
-	CG_Context::sBuilder.CreateCondBr(condValue, pThenBB, pElseBB);
+	CG_Context::GetBuilder().CreateCondBr(condValue, pThenBB, pElseBB);
   
 	// Emit then value.
-	CG_Context::sBuilder.SetInsertPoint(pThenBB);
+	CG_Context::GetBuilder().SetInsertPoint(pThenBB);
   
 	if (mpIfDomain) {
 		// Code gen for if block
@@ -465,13 +609,11 @@ llvm::Value* Exp_If::GenerateCode(CG_Context* context) const
 		delete childCtx;
 	}
   
-	CG_Context::sBuilder.CreateBr(pMergeBB);
-	// Codegen of 'Then' can change the current block, update ThenBB for the PHI.
-	pThenBB = CG_Context::sBuilder.GetInsertBlock();
+	CG_Context::GetBuilder().CreateBr(pMergeBB);
   
 	// Emit else block.
 	pCurFunc->getBasicBlockList().push_back(pElseBB);
-	CG_Context::sBuilder.SetInsertPoint(pElseBB);
+	CG_Context::GetBuilder().SetInsertPoint(pElseBB);
   
 	if (mpElseDomain) {
 		// Code gen for else block
@@ -480,69 +622,75 @@ llvm::Value* Exp_If::GenerateCode(CG_Context* context) const
 		delete childCtx;
 	}
   
-	CG_Context::sBuilder.CreateBr(pMergeBB);
-	// Codegen of 'Else' can change the current block, update ElseBB for the PHI.
-	pElseBB = CG_Context::sBuilder.GetInsertBlock();
+	CG_Context::GetBuilder().CreateBr(pMergeBB);
   
 	// Emit merge block.
 	pCurFunc->getBasicBlockList().push_back(pMergeBB);
-	CG_Context::sBuilder.SetInsertPoint(pMergeBB);
-	llvm::Type* phiRetTy = SC_INT_TYPE;
-	llvm::PHINode *PN = CG_Context::sBuilder.CreatePHI(phiRetTy, 2, "iftmp");
-  
-	llvm::Value* voidUndef = llvm::UndefValue::get(phiRetTy);
-	PN->addIncoming(voidUndef, pThenBB);
-	PN->addIncoming(voidUndef, pElseBB);
+	CG_Context::GetBuilder().SetInsertPoint(pMergeBB);
 	return NULL;
 }
 
-llvm::Value* Exp_For::GenerateCode(CG_Context* context) const
+// Tags the back edge of the loop with the "llvm.loop" metadata carrying the hint, e.g. "llvm.loop.unroll.disable".
+// The loop ID is the self-referencing node LLVM identifies the loop with.
+// The unroller of LLVM 3.2 doesn't read the hints, they take effect only with the later LLVM versions. Until then
+// [loop] and [unroll] leave the unrolling to the optimizer as if there were no attribute.
+//
+static void SetLoopHint(llvm::BranchInst* pBackEdge, const char* hint)
 {
-	llvm::Type* phiRetTy = SC_INT_TYPE;
-	llvm::Value* voidUndef = llvm::UndefValue::get(phiRetTy);
+	llvm::LLVMContext& C = CG_Context::GetLLVMContext();
+	llvm::Value* hintOps[1] = {llvm::MDString::get(C, hint)};
+	llvm::MDNode* pTempID = llvm::MDNode::getTemporary(C, llvm::ArrayRef<llvm::Value*>());
+	llvm::Value* loopIDOps[2] = {pTempID, llvm::MDNode::get(C, hintOps)};
+	llvm::MDNode* pLoopID = llvm::MDNode::get(C, loopIDOps);
+	pLoopID->replaceOperandWith(0, pLoopID);
+	llvm::MDNode::deleteTemporary(pTempID);
+	pBackEdge->setMetadata("llvm.loop", pLoopID);
+}
 
+llvm::Value* Exp_For::GenerateCode(CG_Context* context) const
+{
+	// The loop is generated in the rotated form the loop passes expect: the condition is checked in the preheader to
+	// guard the loop and again at the end of the body for the back edge, so the body is never run when the condition
+	// is false from the start. The loop variables are the allocas of the entry block, SROA promotes them to the PHIs
+	// of the induction variables.
+	//
 	CG_Context* pForCtx = context->CreateChildContext(context->GetCurrentFunc(), context->GetFuncRetBlk(), context->GetRetValuePtr());
 	mStartStepCond->GetExpression(0)->GenerateCode(pForCtx);
-	// Make the new basic block for the loop header, inserting after current block.
 	llvm::Function* pCurFunc = pForCtx->GetCurrentFunc();
-	llvm::BasicBlock *PreheaderBB = CG_Context::sBuilder.GetInsertBlock();
-	llvm::BasicBlock *LoopBB = llvm::BasicBlock::Create(getGlobalContext(), "loop", pCurFunc);
-  
-	// Insert an explicit fall through from the current block to the LoopBB.
-	CG_Context::sBuilder.CreateBr(LoopBB);
-
-	// Start insertion in LoopBB.
-	CG_Context::sBuilder.SetInsertPoint(LoopBB);
-  
-	// Start the PHI node with an entry for Start.
-	PHINode *PN = CG_Context::sBuilder.CreatePHI(phiRetTy, 2);
-	PN->addIncoming(voidUndef, PreheaderBB);
-  
-	// Emit the body of the loop.  This, like any other expr, can change the
-	// current BB.  Note that we ignore the value computed by the body, but don't
-	// allow an error.
-	mForBody->GenerateCode(pForCtx);
-  
-	// Emit the step.
-	mStartStepCond->GetExpression(2)->GenerateCode(pForCtx);
-  
-	// Compute the end condition.
-	Value *contCond = mStartStepCond->GetExpression(1)->GenerateCode(pForCtx);
-	assert(contCond);
-  
-	// Create the "after loop" block and insert it.
-	BasicBlock *LoopEndBB = CG_Context::sBuilder.GetInsertBlock();
-	BasicBlock *AfterBB = BasicBlock::Create(getGlobalContext(), "afterloop", pCurFunc);
-  
-	// Insert the conditional branch into the end of LoopEndBB.
-	CG_Context::sBuilder.CreateCondBr(contCond, LoopBB, AfterBB);
-  
-	// Any new code will be inserted in AfterBB.
-	CG_Context::sBuilder.SetInsertPoint(AfterBB);
-  
-	// Add a new entry to the PHI node for the backedge.
-	PN->addIncoming(voidUndef, LoopEndBB);
-
+	llvm::BasicBlock* pLoopBB = llvm::BasicBlock::Create(CG_Context::GetLLVMContext(), "loop", pCurFunc);
+	llvm::BasicBlock* pAfterBB = llvm::BasicBlock::Create(CG_Context::GetLLVMContext(), "afterloop");
+
+	// The guard in the preheader
+	llvm::Value* pContCond = mStartStepCond->GetExpression(1)->GenerateCode(pForCtx);
+	assert(pContCond);
+	CG_Context::GetBuilder().CreateCondBr(pContCond, pLoopBB, pAfterBB);
+	CG_Context::GetBuilder().SetInsertPoint(pLoopBB);
+
+	// [unroll(N)] puts N copies of the body in each iteration with the condition checked between them. LLVM 3.2 has
+	// no unroll hints, so the unrolling is done here. The optimizer of LLVM 3.2 may still unroll the resulting loop
+	// at O2 and above, the hint against it works only with the later versions.
+	//
+	int copyCnt = (mLoopAttr == kLoopAttrUnroll && mUnrollCount > 1) ? mUnrollCount : 1;
+	for (int i = 0; i < copyCnt; ++i) {
+		if (i > 0) {
+			llvm::BasicBlock* pCopyBB = llvm::BasicBlock::Create(CG_Context::GetLLVMContext(), "loop.unrolled", pCurFunc);
+			CG_Context::GetBuilder().CreateCondBr(pContCond, pCopyBB, pAfterBB);
+			CG_Context::GetBuilder().SetInsertPoint(pCopyBB);
+		}
+		mForBody->GenerateCode(pForCtx);
+		mStartStepCond->GetExpression(2)->GenerateCode(pForCtx);
+		pContCond = mStartStepCond->GetExpression(1)->GenerateCode(pForCtx);
+		assert(pContCond);
+	}
+	llvm::BranchInst* pBackEdge = CG_Context::GetBuilder().CreateCondBr(pContCond, pLoopBB, pAfterBB);
+	if (mLoopAttr == kLoopAttrLoop || mUnrollCount > 0)
+		SetLoopHint(pBackEdge, "llvm.loop.unroll.disable");
+	else if (mLoopAttr == kLoopAttrUnroll)
+		SetLoopHint(pBackEdge, "llvm.loop.unroll.full");
+
+	pCurFunc->getBasicBlockList().push_back(pAfterBB);
+	CG_Context::GetBuilder().SetInsertPoint(pAfterBB);
+	delete pForCtx;
 	return NULL;
 }
 
@@ -555,7 +703,7 @@ llvm::Value* Exp_ConstString::GenerateCode(CG_Context* context) const
 int Exp_StructDef::GetStructSize() const
 {
 	int totalSize = 0;
-	std::hash_map<std::string, Exp_VarDef*>::const_iterator it = mDefinedVariables.begin();
+	std::hash_map<SymbolID, Exp_VarDef*>::const_iterator it = mDefinedVariables.begin();
 	for (; it != mDefinedVariables.end(); ++it) {
 		int curSize = 0;
 		Exp_VarDef* pVarDef = it->second;
@@ -575,8 +723,8 @@ void Exp_StructDef::ConvertToDescription(KSC_StructDesc& ref, CG_Context& ctx) c
 	ref.clear();
 	ref.mMemberIndices.clear();
 	llvm::Type* structType = ctx.GetStructType(this);
-	ref.mStructSize = CG_Context::TheDataLayout->getTypeAllocSize(structType);
-	int structAlignment = CG_Context::TheDataLayout->getPrefTypeAlignment(structType);
+	ref.mStructSize = CG_Context::GetDataLayout()->getTypeAllocSize(structType);
+	int structAlignment = CG_Context::GetDataLayout()->getPrefTypeAlignment(structType);
 
 	const Exp_StructDef* childStruct;
 	int arraySize;
@@ -594,7 +742,7 @@ void Exp_StructDef::ConvertToDescription(KSC_StructDesc& ref, CG_Context& ctx) c
 			childStruct->ConvertToDescription(*pStructDesc, ctx);
 			hStruct = (StructHandle)pStructDesc;
 			typeSize = pStructDesc->mStructSize;
-			typeAlignment = CG_Context::TheDataLayout->getPrefTypeAlignment(ctx.GetStructType(childStruct));
+			typeAlignment = CG_Context::GetDataLayout()->getPrefTypeAlignment(ctx.GetStructType(childStruct));
 		}
 		else {
 			typeSize = CG_Context::GetSizeOfLLVMType(type);
@@ -633,7 +781,7 @@ void Exp_FunctionDecl::ConvertToDescription(KSC_FunctionDesc& desc, CG_Context&
 			mArgments[i].typeInfo.pStructDef->ConvertToDescription(*pStructDesc, ctx);
 			kscType.hStruct = pStructDesc;
 			typeSize = pStructDesc->mStructSize;
-			typeAlignment = CG_Context::TheDataLayout->getPrefTypeAlignment(ctx.GetStructType(mArgments[i].typeInfo.pStructDef));
+			typeAlignment = CG_Context::GetDataLayout()->getPrefTypeAlignment(ctx.GetStructType(mArgments[i].typeInfo.pStructDef));
 		}
 		else {
 			typeSize = CG_Context::GetSizeOfLLVMType(mArgments[i].typeInfo.type);
@@ -1,20 +1,84 @@
 #include "SC_API.h"
 #include "IR_Gen_Context.h"
 #include "parser_AST_Gen.h"
+#include "SC_TaskPool.h"
+#include "SC_Dispatcher.h"
+#include "SC_ModuleCache.h"
+#include "SC_Target.h"
 #include <string>
 #include <list>
+#include <algorithm>
 #include <stdio.h>
 #include <llvm/Support/Host.h>
 
 
-static std::string			s_lastErrMsg;
 SC::RootDomain*				s_predefineDomain = NULL;
 SC::CG_Context				s_predefineCtx;
 std::list<KSC_ModuleDesc*>	s_modules;
+// Guards the module list and the error message buffers, the APIs can be invoked from multiple threads.
+static llvm::sys::Mutex		s_apiLock;
+
+// Each thread has its own last error message, so the compiling on different threads reports the errors separately.
+// The message buffers are freed in KSC_Destory, the generation tells the buffer of a thread is from the previous
+// initialization and must not be used again.
+//
+static SC_THREAD_LOCAL std::string*	s_pLastErrMsg = NULL;
+static SC_THREAD_LOCAL int			s_lastErrMsgGen = 0;
+static std::list<std::string*>		s_errMsgBuffers;
+static int							s_errMsgGen = 1;
+
+static std::string& LastErrorMsg()
+{
+	if (!s_pLastErrMsg || s_lastErrMsgGen != s_errMsgGen) {
+		llvm::MutexGuard locked(s_apiLock);
+		s_pLastErrMsg = new std::string;
+		s_lastErrMsgGen = s_errMsgGen;
+		s_errMsgBuffers.push_back(s_pLastErrMsg);
+	}
+	return *s_pLastErrMsg;
+}
 
+// The compile job submitted by KSC_CompileAsync, it is released by KSC_WaitModule or KSC_PollModule.
+struct KSC_CompileJob : public SC::TaskPool::Task
+{
+	std::string mSourceCode;
+	int mOptLevel;
+	KSC_CompileCallback mCallback;
+	void* mpUserData;
+
+	ModuleHandle mModule;
+	std::string mErrMsg;
+	bool mIsDone;
+	std::mutex mLock;
+	std::condition_variable mDoneCond;
+
+	KSC_CompileJob();
+	virtual void Run();
+	virtual void Cancel();
+	void Finish(ModuleHandle hModule, const std::string& errMsg);
+};
+
+// The modules shared by the KSC_Compile requests of the same source code and options, the NULL module means
+// it is being compiled. The waiting requests are woken up when it is done.
+//
+static std::hash_map<std::string, KSC_ModuleDesc*>	s_sharedModules;
+static std::mutex									s_sharedModulesLock;
+static std::condition_variable						s_sharedModuleReady;
+
+// The worker threads for the compile jobs, started by the first KSC_CompileAsync.
+static SC::TaskPool*		s_pCompilePool = NULL;
+static SC::Dispatcher*		s_pDispatcher = NULL;
+
+// Square-and-multiply, the negative exponents give 1 / base^-p in integer.
 int __int_pow(int base, int p)
 {
-	return _Pow_int(base, p);
+	unsigned int n = p < 0 ? -p : p;
+	int ret = 1;
+	for (; n != 0; n >>= 1, base *= base) {
+		if (n & 1)
+			ret *= base;
+	}
+	return (p < 0 && ret != 0) ? 1 / ret : ret;
 }
 
 bool KSC_Initialize(const char* sharedCode)
@@ -22,23 +86,24 @@ bool KSC_Initialize(const char* sharedCode)
 	SC::Initialize_AST_Gen();
 	bool ret = SC::InitializeCodeGen();
 	
-	printf("KSC running on CPU %s.\n", llvm::sys::getHostCPUName().c_str());
+	printf("KSC running on CPU %s, generating code for %s.\n", llvm::sys::getHostCPUName().str().c_str(),
+		SC::Target::GetDescription().c_str());
 	if (ret) {
+		SC::ModuleCache::Initialize(sharedCode);
 		SC::CompilingContext preContext(NULL);
+		// sin, cos, exp, log, pow, sqrt and fabs are the built-in functions(see SC::BuiltInFunc), the scalar ones become
+		// the calls to the C runtime in the code generation of LLVM, which are resolved here.
 		const char* intrinsicFuncDecal = 
-			"float sin(float arg);\n"
-			"float cos(float arg);\n"
-			"float pow(float base, float exp);\n"
-			"int ipow(int base, int exp);\n"
-			"float sqrt(float arg);\n"
-			"float fabs(float arg);\n";
-
-		KSC_AddExternalFunction("sin", sinf);
-		KSC_AddExternalFunction("cos", cosf);
-		KSC_AddExternalFunction("pow", powf);
+			"int ipow(int base, int exp);\n";
+
 		KSC_AddExternalFunction("ipow", __int_pow);
-		KSC_AddExternalFunction("sqrt", sqrtf);
-		KSC_AddExternalFunction("fabs", fabsf);
+		KSC_AddExternalFunction("sinf", sinf);
+		KSC_AddExternalFunction("cosf", cosf);
+		KSC_AddExternalFunction("expf", expf);
+		KSC_AddExternalFunction("logf", logf);
+		KSC_AddExternalFunction("powf", powf);
+		KSC_AddExternalFunction("sqrtf", sqrtf);
+		KSC_AddExternalFunction("fabsf", fabsf);
 
 		s_predefineDomain = new SC::RootDomain(NULL);
 		if (!preContext.ParsePartial(intrinsicFuncDecal, s_predefineDomain))
@@ -59,12 +124,58 @@ bool KSC_Initialize(const char* sharedCode)
 }
 
 
+void KSC_SetTarget(const char* cpuName, const char* features)
+{
+	SC::Target::Set(cpuName, features);
+}
+
+const char* KSC_SetTargetISALevels(const char* isaLevels)
+{
+	std::string errMsg;
+	const char* level = SC::Target::SelectISALevel(isaLevels, errMsg);
+	if (!level)
+		LastErrorMsg() = errMsg;
+	return level;
+}
+
 void KSC_Destory()
 {
-	std::list<KSC_ModuleDesc*>::iterator it = s_modules.begin();
-	for (; it != s_modules.end(); ++it) {
-		delete *it;
+	// The running jobs still use the predefined domain and add modules, so the workers are stopped first.
+	// The job handles of the cancelled jobs are still valid for KSC_WaitModule and KSC_PollModule.
+	if (s_pCompilePool) {
+		s_pCompilePool->Stop();
+		delete s_pCompilePool;
+		s_pCompilePool = NULL;
 	}
+	if (s_pDispatcher) {
+		s_pDispatcher->Stop();
+		delete s_pDispatcher;
+		s_pDispatcher = NULL;
+	}
+	{
+		llvm::MutexGuard locked(s_apiLock);
+		std::list<KSC_ModuleDesc*>::iterator it = s_modules.begin();
+		for (; it != s_modules.end(); ++it) {
+			delete *it;
+		}
+		s_modules.clear();
+		{
+			std::lock_guard<std::mutex> sharedLocked(s_sharedModulesLock);
+			s_sharedModules.clear();
+		}
+
+		std::list<std::string*>::iterator itErr = s_errMsgBuffers.begin();
+		for (; itErr != s_errMsgBuffers.end(); ++itErr) {
+			delete *itErr;
+		}
+		s_errMsgBuffers.clear();
+		++s_errMsgGen;
+	}
+	if (s_predefineDomain) {
+		delete s_predefineDomain;
+		s_predefineDomain = NULL;
+	}
+	SC::ModuleCache::Finish();
 	SC::DestoryCodeGen();
 	SC::Finish_AST_Gen();
 }
@@ -72,78 +183,495 @@ void KSC_Destory()
 
 const char* KSC_GetLastErrorMsg()
 {
-	return s_lastErrMsg.c_str();
+	return LastErrorMsg().c_str();
+}
+
+bool KSC_SetCacheDirectory(const char* cacheDir)
+{
+	if (!SC::ModuleCache::SetDirectory(cacheDir)) {
+		LastErrorMsg() = "Failed to create the cache directory.";
+		return false;
+	}
+	return true;
 }
 
 bool KSC_AddExternalFunction(const char* funcName, void* funcPtr)
 {
-	SC::CG_Context::sGlobalFuncSymbols[funcName] = funcPtr;
+	SC::CG_Context::AddGlobalFuncSymbol(funcName, funcPtr);
+	return true;
+}
+
+bool KSC_AddExternalBitcode(const void* bitcode, size_t len)
+{
+	std::string errMsg;
+	if (!SC::CG_Context::AddExternalBitcode(bitcode, len, errMsg)) {
+		LastErrorMsg() = "Invalid bitcode: " + errMsg;
+		return false;
+	}
+	SC::ModuleCache::AddExternalBitcode(bitcode, len);
 	return true;
 }
 
-ModuleHandle KSC_Compile(const char* sourceCode)
+static bool VerifyModuleFunctions(KSC_ModuleDesc& moduleDesc)
+{
+	std::hash_map<std::string, KSC_FunctionDesc*>::iterator it = moduleDesc.mFunctionDesc.begin();
+	for (; it != moduleDesc.mFunctionDesc.end(); ++it) {
+		if (!it->second->F || llvm::verifyFunction(*it->second->F, llvm::PrintMessageAction))
+			return false;
+	}
+	return true;
+}
+
+// Generates the code of the function(and the functions it calls) on its first lookup for the module compiled in lazy mode.
+static bool CompileFunctionOnDemand(KSC_FunctionDesc& funcDesc)
+{
+	KSC_ModuleDesc* pModule = funcDesc.mpModule;
+	if (!pModule || !pModule->mLazyCodeGen)
+		return funcDesc.F != NULL;
+
+	// The functions of the same module may be looked up from different threads
+	llvm::MutexGuard locked(pModule->mpSession->mLock);
+	if (funcDesc.F)
+		return true;
+
+	SC::CG_Session::Scope sessionScope(pModule->mpSession);
+	std::vector<llvm::Function*> newFuncs;
+	bool succeeded = pModule->mpRootDomain->CompileFunctionToIR(funcDesc, *pModule, newFuncs);
+	if (!succeeded)
+		LastErrorMsg() = "Failed to compile.";
+	for (int i = 0; succeeded && i < (int)newFuncs.size(); ++i) {
+		if (llvm::verifyFunction(*newFuncs[i], llvm::PrintMessageAction)) {
+			LastErrorMsg() = "Failed to verify the generated code.";
+			succeeded = false;
+		}
+	}
+	if (succeeded && !SC::OptimizeFunctions(pModule->mpSession->mpModule, newFuncs, pModule->mOptLevel)) {
+		LastErrorMsg() = "Failed to optimize.";
+		succeeded = false;
+	}
+	// The half-built functions must not be taken by the next lookup
+	if (!succeeded)
+		pModule->mpRootDomain->DiscardFunctionIR(*pModule, newFuncs);
+	return succeeded;
+}
+
+// Generates the code of the parsed module in its own session. The sessions of different modules share nothing,
+// so the modules can be compiled on different threads at the same time.
+static bool CompileModule(KSC_ModuleDesc& moduleDesc, SC::RootDomain& domain, bool lazyCodeGen)
+{
+	std::string errMsg;
+	moduleDesc.mpSession = new SC::CG_Session;
+	if (!moduleDesc.mpSession->Initialize(errMsg)) {
+		LastErrorMsg() = "Failed to create the execution engine: " + errMsg;
+		return false;
+	}
+
+	SC::CG_Session::Scope sessionScope(moduleDesc.mpSession);
+	if (!domain.CompileToIR(moduleDesc, lazyCodeGen)) {
+		LastErrorMsg() = "Failed to compile.";
+		return false;
+	}
+	if (lazyCodeGen)
+		return true;
+
+	if (!VerifyModuleFunctions(moduleDesc)) {
+		LastErrorMsg() = "Failed to verify the generated code.";
+		return false;
+	}
+	if (!SC::OptimizeModule(moduleDesc, moduleDesc.mOptLevel)) {
+		LastErrorMsg() = "Failed to optimize.";
+		return false;
+	}
+	return true;
+}
+
+// Compiles the source code to a new module, or reloads it from the on-disk cache.
+static KSC_ModuleDesc* CompileNewModule(const char* sourceCode, int optLevel, bool lazyCodeGen)
 {
 #ifdef WANT_MEM_LEAK_CHECK
-	size_t expInstCnt = SC::Expression::s_instances.size();
+	int expInstCnt = SC::Expression::s_instanceCnt;
 #endif	
 
 	KSC_ModuleDesc* ret = NULL;
 	{
+		// The module compiled before is reloaded from the cache, the lazy mode is pointless for it.
+		std::string cacheKey = lazyCodeGen ? "" : SC::ModuleCache::MakeKey(sourceCode, optLevel);
+		if (!cacheKey.empty()) {
+			KSC_ModuleDesc* pCachedDesc = new KSC_ModuleDesc;
+			pCachedDesc->mOptLevel = optLevel;
+			if (SC::ModuleCache::Load(cacheKey, sourceCode, *pCachedDesc))
+				return pCachedDesc;
+			delete pCachedDesc;
+		}
+
 		KSC_ModuleDesc* pModuleDesc = new KSC_ModuleDesc;
+		pModuleDesc->mOptLevel = optLevel;
+		// The AST outlives this call in lazy mode, so it is parsed from the copy of source code owned by the module.
+		if (lazyCodeGen) {
+			pModuleDesc->mSourceCode = sourceCode;
+			sourceCode = pModuleDesc->mSourceCode.c_str();
+		}
 		SC::CompilingContext scContext(NULL);
 		std::auto_ptr<SC::RootDomain> scDomain(scContext.Parse(sourceCode, s_predefineDomain));
 		if (scDomain.get() == NULL) {
-			scContext.PrintErrorMessage(&s_lastErrMsg);
+			scContext.PrintErrorMessage(&LastErrorMsg());
+			delete pModuleDesc;
+		}
+		else if (!CompileModule(*pModuleDesc, *scDomain, lazyCodeGen)) {
+			delete pModuleDesc;
 		}
 		else {
-			if (!scDomain->CompileToIR(&s_predefineCtx, *pModuleDesc)) {
-				delete pModuleDesc;
-				s_lastErrMsg = "Failed to compile.";
-			}
-			else{
-				s_modules.push_back(pModuleDesc);
-				ret = pModuleDesc;
-			}
+			if (lazyCodeGen)
+				pModuleDesc->mpRootDomain = scDomain.release();
+			else if (!cacheKey.empty())
+				SC::ModuleCache::Save(cacheKey, sourceCode, *pModuleDesc);
+			ret = pModuleDesc;
 		}
 	}
 
 #ifdef WANT_MEM_LEAK_CHECK
-	assert(SC::Expression::s_instances.size() == expInstCnt);
+	// The module compiled in lazy mode keeps its AST
+	assert(SC::Expression::s_instanceCnt == expInstCnt || (ret && lazyCodeGen));
 #endif
 	return ret;
 }
 
+ModuleHandle KSC_Compile(const char* sourceCode, int optLevel, bool lazyCodeGen)
+{
+	// The same source code compiled with the same options shares the module. If it is being compiled on another thread,
+	// wait for that compiling instead of doing it again.
+	//
+	char options[32];
+	sprintf(options, "O%d|L%d|", optLevel, (int)lazyCodeGen);
+	std::string sharedKey = options;
+	sharedKey += sourceCode;
+	{
+		std::unique_lock<std::mutex> locked(s_sharedModulesLock);
+		std::hash_map<std::string, KSC_ModuleDesc*>::iterator it = s_sharedModules.find(sharedKey);
+		while (it != s_sharedModules.end() && it->second == NULL) {
+			s_sharedModuleReady.wait(locked);
+			it = s_sharedModules.find(sharedKey);
+		}
+		if (it != s_sharedModules.end()) {
+			++it->second->mRefCnt;
+			return it->second;
+		}
+		s_sharedModules[sharedKey] = NULL;
+	}
+
+	KSC_ModuleDesc* pModuleDesc = CompileNewModule(sourceCode, optLevel, lazyCodeGen);
+	if (pModuleDesc) {
+		pModuleDesc->mSharedKey = sharedKey;
+		llvm::MutexGuard locked(s_apiLock);
+		s_modules.push_back(pModuleDesc);
+	}
+	{
+		// The waiting threads compile it themselves if it failed, so each of them gets the error message.
+		std::lock_guard<std::mutex> locked(s_sharedModulesLock);
+		if (pModuleDesc)
+			s_sharedModules[sharedKey] = pModuleDesc;
+		else
+			s_sharedModules.erase(sharedKey);
+	}
+	s_sharedModuleReady.notify_all();
+	return pModuleDesc;
+}
+
+bool KSC_ReleaseModule(ModuleHandle hModule)
+{
+	KSC_ModuleDesc* pModule = (KSC_ModuleDesc*)hModule;
+	{
+		llvm::MutexGuard locked(s_apiLock);
+		std::list<KSC_ModuleDesc*>::iterator it = std::find(s_modules.begin(), s_modules.end(), pModule);
+		if (it == s_modules.end()) {
+			LastErrorMsg() = "Invalid module handle.";
+			return false;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> locked(s_sharedModulesLock);
+		if (--pModule->mRefCnt > 0)
+			return true;
+		s_sharedModules.erase(pModule->mSharedKey);
+	}
+	{
+		llvm::MutexGuard locked(s_apiLock);
+		s_modules.remove(pModule);
+	}
+	delete pModule;
+	return true;
+}
+
+// JITs all the functions of the module compiled in background, so that only the wrapper of the function is left to
+// be JIT-ed when KSC_GetFunctionPtr is invoked.
+static bool JITModuleFunctions(KSC_ModuleDesc& moduleDesc)
+{
+	llvm::MutexGuard locked(moduleDesc.mpSession->mLock);
+	SC::CG_Session::Scope sessionScope(moduleDesc.mpSession);
+	std::hash_map<std::string, KSC_FunctionDesc*>::iterator it = moduleDesc.mFunctionDesc.begin();
+	for (; it != moduleDesc.mFunctionDesc.end(); ++it) {
+		void* funcPtr = moduleDesc.mpSession->mpEngine->getPointerToFunction(it->second->F);
+		if (!funcPtr) {
+			LastErrorMsg() = "Failed to JIT function " + it->first + ".";
+			return false;
+		}
+		if (!SC::CG_Context::NeedPackedWrapper(*it->second))
+			it->second->mpNativePtr = funcPtr;
+	}
+	return true;
+}
+
+KSC_CompileJob::KSC_CompileJob()
+{
+	mOptLevel = 2;
+	mCallback = NULL;
+	mpUserData = NULL;
+	mModule = NULL;
+	mIsDone = false;
+}
+
+void KSC_CompileJob::Run()
+{
+	ModuleHandle hModule = KSC_Compile(mSourceCode.c_str(), mOptLevel);
+	if (hModule && !JITModuleFunctions(*(KSC_ModuleDesc*)hModule)) {
+		std::string errMsg = LastErrorMsg();
+		KSC_ReleaseModule(hModule);
+		hModule = NULL;
+		LastErrorMsg() = errMsg;
+	}
+	Finish(hModule, hModule ? "" : LastErrorMsg());
+}
+
+void KSC_CompileJob::Cancel()
+{
+	Finish(NULL, "The compile job is cancelled.");
+}
+
+void KSC_CompileJob::Finish(ModuleHandle hModule, const std::string& errMsg)
+{
+	// The callback goes first, the job may be released by the waiting thread as soon as it is marked done.
+	if (mCallback)
+		mCallback(hModule, mpUserData);
+
+	std::lock_guard<std::mutex> locked(mLock);
+	mModule = hModule;
+	mErrMsg = errMsg;
+	mIsDone = true;
+	mDoneCond.notify_all();
+}
+
+CompileJobHandle KSC_CompileAsync(const char* sourceCode, KSC_CompileCallback callback, void* userData, int priority, int optLevel)
+{
+	if (!sourceCode) {
+		LastErrorMsg() = "Invalid source code.";
+		return NULL;
+	}
+
+	KSC_CompileJob* pJob = new KSC_CompileJob;
+	pJob->mSourceCode = sourceCode;
+	pJob->mOptLevel = optLevel;
+	pJob->mCallback = callback;
+	pJob->mpUserData = userData;
+	{
+		llvm::MutexGuard locked(s_apiLock);
+		if (!s_pCompilePool) {
+			s_pCompilePool = new SC::TaskPool;
+			s_pCompilePool->Start();
+		}
+	}
+	s_pCompilePool->Submit(pJob, priority);
+	return pJob;
+}
+
+ModuleHandle KSC_WaitModule(CompileJobHandle hJob)
+{
+	KSC_CompileJob* pJob = (KSC_CompileJob*)hJob;
+	if (!pJob)
+		return NULL;
+
+	ModuleHandle hModule = NULL;
+	std::string errMsg;
+	{
+		std::unique_lock<std::mutex> locked(pJob->mLock);
+		while (!pJob->mIsDone)
+			pJob->mDoneCond.wait(locked);
+		hModule = pJob->mModule;
+		errMsg.swap(pJob->mErrMsg);
+	}
+	delete pJob;
+
+	if (!hModule)
+		LastErrorMsg() = errMsg;
+	return hModule;
+}
+
+bool KSC_PollModule(CompileJobHandle hJob, ModuleHandle* pModule)
+{
+	KSC_CompileJob* pJob = (KSC_CompileJob*)hJob;
+	if (!pJob)
+		return false;
+	{
+		std::lock_guard<std::mutex> locked(pJob->mLock);
+		if (!pJob->mIsDone)
+			return false;
+	}
+
+	ModuleHandle hModule = KSC_WaitModule(hJob);
+	if (pModule)
+		*pModule = hModule;
+	return true;
+}
+
+int KSC_ScanTokens(const char* sourceCode)
+{
+	SC::CompilingContext scContext(NULL);
+	int tokenCnt = scContext.ScanTokens(sourceCode);
+	if (tokenCnt < 0)
+		LastErrorMsg() = "Failed to scan tokens.";
+	return tokenCnt;
+}
+
 void* KSC_GetFunctionPtr(FunctionHandle hFunc)
 {
 	KSC_FunctionDesc* pFuncDesc = (KSC_FunctionDesc*)hFunc;
-	if (!pFuncDesc || !pFuncDesc->F)
+	if (!pFuncDesc || !CompileFunctionOnDemand(*pFuncDesc))
 		return NULL;
 
+	// The wrapper is generated and JIT-ed in the session of the module, the requests on the same module are serialized.
+	KSC_ModuleDesc* pModule = pFuncDesc->mpModule;
+	llvm::MutexGuard locked(pModule->mpSession->mLock);
+	if (pFuncDesc->mpNativePtr)
+		return pFuncDesc->mpNativePtr;
+
+	SC::CG_Session::Scope sessionScope(pModule->mpSession);
+	if (!SC::CG_Context::NeedPackedWrapper(*pFuncDesc)) {
+		pFuncDesc->mpNativePtr = pModule->mpSession->mpEngine->getPointerToFunction(pFuncDesc->F);
+		return pFuncDesc->mpNativePtr;
+	}
+
 	llvm::Function* wrapperF = SC::CG_Context::CreateFunctionWithPackedArguments(*pFuncDesc);
+	if (llvm::verifyFunction(*wrapperF, llvm::PrintMessageAction)) {
+		wrapperF->eraseFromParent();
+		LastErrorMsg() = "Failed to verify the wrapper function.";
+		return NULL;
+	}
+	SC::OptimizeFunction(wrapperF, pModule->mOptLevel);
+	pFuncDesc->mpWrapperF = wrapperF;
+	pFuncDesc->mpNativePtr = pModule->mpSession->mpEngine->getPointerToFunction(wrapperF);
+	return pFuncDesc->mpNativePtr;
+}
+
+void* KSC_GetBatchFunctionPtr(FunctionHandle hFunc)
+{
+	KSC_FunctionDesc* pFuncDesc = (KSC_FunctionDesc*)hFunc;
+	if (!pFuncDesc || !CompileFunctionOnDemand(*pFuncDesc))
+		return NULL;
 
-	// The JIT-ed function should NOT have any optimized alignment, so here force it aligned to 1 byte.
-	/*std::vector<Attributes::AttrVal> attrEnumList;
-	attrEnumList.push_back(Attributes::Alignment);
+	KSC_ModuleDesc* pModule = pFuncDesc->mpModule;
+	llvm::MutexGuard locked(pModule->mpSession->mLock);
+	if (pFuncDesc->mpBatchPtr)
+		return pFuncDesc->mpBatchPtr;
 
-	std::vector<llvm::AttributeWithIndex> attrWithIdxList;
-	llvm::AttrBuilder attrBuilder;
-	attrBuilder = attrBuilder.addAlignmentAttr(1);
-	int argIdx = 0;
-	for (Function::arg_iterator AI = wrapperF->arg_begin(); AI != wrapperF->arg_end(); ++AI, ++argIdx) {
-		llvm::AttributeWithIndex attrWithIdx;
-		attrWithIdx.Attrs = llvm::Attributes::get(getGlobalContext(), attrBuilder);
-		attrWithIdx.Index = argIdx + 1;
-		attrWithIdxList.push_back(attrWithIdx);
+	SC::CG_Session::Scope sessionScope(pModule->mpSession);
+	llvm::Function* batchF = SC::CG_Context::CreateBatchFunction(*pFuncDesc);
+	if (llvm::verifyFunction(*batchF, llvm::PrintMessageAction)) {
+		batchF->eraseFromParent();
+		LastErrorMsg() = "Failed to verify the batch function.";
+		return NULL;
 	}
+	SC::OptimizeFunction(batchF, pModule->mOptLevel);
+	pFuncDesc->mpBatchPtr = pModule->mpSession->mpEngine->getPointerToFunction(batchF);
+	return pFuncDesc->mpBatchPtr;
+}
 
-	llvm::AttrListPtr attrList = llvm::AttrListPtr::get(getGlobalContext(), attrWithIdxList);
-	wrapperF->setAttributes(attrList);*/
-	wrapperF->dump();
+void* KSC_GetSIMDFunctionPtr(FunctionHandle hFunc, int simdWidth)
+{
+	int widthIdx = (simdWidth == 4 ? 0 : (simdWidth == 8 ? 1 : (simdWidth == 16 ? 2 : -1)));
+	if (widthIdx < 0) {
+		LastErrorMsg() = "The SIMD width must be 4, 8 or 16.";
+		return NULL;
+	}
+	KSC_FunctionDesc* pFuncDesc = (KSC_FunctionDesc*)hFunc;
+	if (!pFuncDesc || !CompileFunctionOnDemand(*pFuncDesc))
+		return NULL;
 
-	if (!llvm::verifyFunction(*wrapperF, llvm::PrintMessageAction))
-		return SC::CG_Context::TheExecutionEngine->getPointerToFunction(wrapperF);
-	else
+	KSC_ModuleDesc* pModule = pFuncDesc->mpModule;
+	llvm::MutexGuard locked(pModule->mpSession->mLock);
+	if (pFuncDesc->mpSIMDPtrs[widthIdx])
+		return pFuncDesc->mpSIMDPtrs[widthIdx];
+
+	SC::CG_Session::Scope sessionScope(pModule->mpSession);
+	std::string errMsg;
+	llvm::Function* simdF = SC::CG_Context::CreateSIMDFunction(*pFuncDesc, simdWidth, errMsg);
+	if (!simdF) {
+		LastErrorMsg() = errMsg;
+		return NULL;
+	}
+	if (llvm::verifyFunction(*simdF, llvm::PrintMessageAction)) {
+		simdF->eraseFromParent();
+		LastErrorMsg() = "Failed to verify the SIMD function.";
 		return NULL;
+	}
+	SC::OptimizeFunction(simdF, pModule->mOptLevel);
+	pFuncDesc->mpSIMDPtrs[widthIdx] = pModule->mpSession->mpEngine->getPointerToFunction(simdF);
+	return pFuncDesc->mpSIMDPtrs[widthIdx];
+}
+
+static SC::Dispatcher* GetDispatcher()
+{
+	llvm::MutexGuard locked(s_apiLock);
+	if (!s_pDispatcher) {
+		s_pDispatcher = new SC::Dispatcher;
+		s_pDispatcher->Start();
+	}
+	return s_pDispatcher;
+}
+
+// The batch function call of KSC_Dispatch, each chunk calls it with the pointers offset to the chunk
+struct KSC_DispatchBatch
+{
+	KSC_BatchFunction batchFunc;
+	std::vector<void*> argPtrs;
+	const int* argStrides;
+	void* retPtr;
+	int retStride;
+};
+
+static void DispatchBatchRange(int begin, int end, void* scratch, void* userData)
+{
+	KSC_DispatchBatch* pBatch = (KSC_DispatchBatch*)userData;
+	std::vector<void*> chunkArgPtrs(pBatch->argPtrs.size());
+	for (int i = 0; i < (int)chunkArgPtrs.size(); ++i)
+		chunkArgPtrs[i] = (char*)pBatch->argPtrs[i] + (ptrdiff_t)begin * pBatch->argStrides[i];
+	void* chunkRetPtr = pBatch->retPtr ? (char*)pBatch->retPtr + (ptrdiff_t)begin * pBatch->retStride : NULL;
+	pBatch->batchFunc(chunkArgPtrs.empty() ? NULL : &chunkArgPtrs[0], pBatch->argStrides, chunkRetPtr, pBatch->retStride, end - begin);
+}
+
+bool KSC_Dispatch(FunctionHandle hFunc, void* const* argPtrs, const int* argStrides, void* retPtr, int retStride, int count, int grainSize)
+{
+	KSC_FunctionDesc* pFuncDesc = (KSC_FunctionDesc*)hFunc;
+	KSC_BatchFunction batchFunc = (KSC_BatchFunction)KSC_GetBatchFunctionPtr(hFunc);
+	if (!batchFunc)
+		return false;
+
+	KSC_DispatchBatch batch;
+	batch.batchFunc = batchFunc;
+	batch.argPtrs.assign(argPtrs, argPtrs + pFuncDesc->mArgumentTypes.size());
+	batch.argStrides = argStrides;
+	batch.retPtr = retPtr;
+	batch.retStride = retStride;
+	GetDispatcher()->Run(count, grainSize, DispatchBatchRange, &batch);
+	return true;
+}
+
+void KSC_DispatchRange(int count, int grainSize, KSC_RangeFunction rangeFunc, void* userData)
+{
+	GetDispatcher()->Run(count, grainSize, rangeFunc, userData);
+}
+
+void KSC_SetDispatchScratchSize(int size)
+{
+	GetDispatcher()->SetScratchSize(size);
 }
 
 FunctionHandle KSC_GetFunctionHandleByName(const char* funcName, ModuleHandle hModule)
@@ -152,8 +680,11 @@ FunctionHandle KSC_GetFunctionHandleByName(const char* funcName, ModuleHandle hM
 	if (!pModule)
 		return NULL;
 
-	if (pModule->mFunctionDesc.find(funcName) != pModule->mFunctionDesc.end()) {
-		return pModule->mFunctionDesc[funcName];
+	std::hash_map<std::string, KSC_FunctionDesc*>::iterator it = pModule->mFunctionDesc.find(funcName);
+	if (it != pModule->mFunctionDesc.end()) {
+		if (!CompileFunctionOnDemand(*it->second))
+			return NULL;
+		return it->second;
 	}
 	else
 		return NULL;
@@ -37,6 +37,30 @@ typedef void* StructHandle;
 */
 typedef void* FunctionHandle;
 
+/**
+	The compile job handle is the representation of one module being compiled in background by "KSC_CompileAsync".
+*/
+typedef void* CompileJobHandle;
+
+/**
+	The callback invoked when the background compiling is done. The "hModule" is NULL if the compiling failed.
+*/
+typedef void (*KSC_CompileCallback)(ModuleHandle hModule, void* userData);
+
+/**
+	The function returned by "KSC_GetBatchFunctionPtr". It runs the KSCL function over "count" elements, the data of the
+	argument "i" for the element "n" is at the address of "argPtrs[i] + n * argStrides[i]"(in bytes), zero stride makes
+	the argument uniform for all the elements. The return value of the element "n" is stored at "retPtr + n * retStride",
+	"retPtr" is ignored for void functions.
+*/
+typedef void (*KSC_BatchFunction)(void* const* argPtrs, const int* argStrides, void* retPtr, int retStride, int count);
+
+/**
+	The function run by "KSC_DispatchRange" on each chunk [begin, end) of the index range. The "scratch" is the scratch
+	memory of the running thread(see "KSC_SetDispatchScratchSize"), it is used by one chunk at a time.
+*/
+typedef void (*KSC_RangeFunction)(int begin, int end, void* scratch, void* userData);
+
 namespace SC {
 	// The following are the single-value types that KSC support.
 	typedef float Float;
@@ -104,26 +128,58 @@ struct KSC_TypeInfo
 extern "C" {
 
 	/**
-		The initialization function of KSC. It should be called before any other APIs get called.
+		The initialization function of KSC. It should be called before any other APIs get called, except the ones setting the target.
 		The argument "sharedCode" is the code that will be shared between multiple modules, e.g. some global
 		functions or structure definitions. If the shared code contains bad syntax this function will fail.
+		This function and "KSC_Destory" must not be invoked while any other API is running on other threads.
 	*/
 	KSC_API bool KSC_Initialize(const char* sharedCode = NULL);
 
+	/**
+		This function sets the target machine the code is generated for, by default it is the host CPU with all its features.
+		It must be called before "KSC_Initialize", which fixes the target for all the modules compiled afterwards.
+		"cpuName" is an LLVM CPU name, e.g. "corei7-avx", NULL or empty string for the host CPU. "features" is a comma separated
+		list of the LLVM target features to enable or disable on top of the CPU, e.g. "+avx2,+fma" or "-avx", NULL for the
+		host features. The code generated for the features the host lacks crashes, this is meant for the tuning and the testing.
+	*/
+	KSC_API void KSC_SetTarget(const char* cpuName, const char* features);
+
+	/**
+		This function picks the target from a list of ISA levels, the first level in the list the host supports is taken,
+		so one setting fits all the machines the application runs on. The levels are "avx512", "avx2"(including FMA), "avx",
+		"sse4.2" and "sse2", separated by comma or semicolon, e.g. "avx2,sse4.2" caps the code at AVX2 while the hosts without
+		AVX2 still get the SSE4.2 code. The support of the OS for the wider registers is checked as well.
+		It must be called before "KSC_Initialize". It returns the name of the level taken, or NULL if the host supports
+		none of them or the list has an unknown level, the target is left unchanged then.
+	*/
+	KSC_API const char* KSC_SetTargetISALevels(const char* isaLevels);
+
 	/**
 		The destroy function of KSC. It should be called when the client application is done for KSC,
 		which means all the handles, type information as well as JIT-ed functions are invalid after
 		the invoking of this function. For applications that initialize KSC only once, there's no need
 		to call this function before exit since the resource is auto-cleaned when the application quits.
+		It waits for the running compile jobs and cancels the ones not yet started, the cancelled jobs get NULL module.
 	*/
 	KSC_API void KSC_Destory();
 
 	/**
 		If any KSC API fails for whatever reason including compiling error, call this function to retrieve
-		the error message.
+		the error message. Each thread has its own error message, which is set by the last failed API invoked on that thread.
 	*/
 	KSC_API const char* KSC_GetLastErrorMsg();
 
+	/**
+		This function sets the directory of the on-disk module cache, it is created if it doesn't exist. NULL or empty
+		directory disables the cache, which is the default.
+		With the cache enabled, the optimized code and the reflection data(structure layouts and argument types) of the 
+		modules compiled by "KSC_Compile" are stored in this directory. Compiling the same code again, even in another
+		process, reloads the module from the cache without parsing and code generation, only the JIT is left to be done.
+		The cache key covers the source code, the shared code passed to "KSC_Initialize", the target CPU and its features
+		and the optimization level. The modules compiled with "lazyCodeGen" are not cached.
+	*/
+	KSC_API bool KSC_SetCacheDirectory(const char* cacheDir);
+
 	/**
 		There're cases that the client application wants its KSC code to be able to invoke a function that is
 		implemented in hosting C++ code. Use this function to tell KSC the function pointer and its function name
@@ -133,16 +189,125 @@ extern "C" {
 	*/
 	KSC_API bool KSC_AddExternalFunction(const char* funcName, void* funcPtr);
 
+	/**
+		This function adds the LLVM bitcode of the functions implemented in C/C++, e.g. compiled by 
+		"clang -c -emit-llvm" of the same LLVM version KSC is built with. Unlike the function pointers of 
+		"KSC_AddExternalFunction", these functions are linked into the compiled modules, so they can be inlined
+		and vectorized together with the KSCL code calling them.
+		Same as the external functions, KSCL declares the function without body, its name is the C name of the 
+		function(use extern "C" in C++) and its declaration must match the LLVM function type: int is i32, the 
+		vector types are the LLVM vectors and the referenced arguments are pointers. If the declaration doesn't 
+		match, the function is looked up in the external symbols instead.
+		Call it before compiling the modules using the functions, it returns false if the bitcode is invalid.
+		The bitcode is dropped by "KSC_Destory", add it again after the next "KSC_Initialize".
+	*/
+	KSC_API bool KSC_AddExternalBitcode(const void* bitcode, size_t len);
+
 	/**
 		This function compiles the KSCL code, it will return the module handle on succeed otherwise return NULL.
+		The "optLevel" selects the optimization applied to the compiled functions before they get JIT-ed:
+		0 - no optimization, 1 - scalar clean-up(e.g. promoting local variables to registers), 
+		2 - plus inlining, loop invariant code motion, loop unrolling and loop vectorization,
+		3 - plus more aggressive inlining and SLP vectorization.
+		Each module is compiled with its own LLVM context and execution engine, so this function can be invoked from
+		multiple threads at the same time to compile different modules in parallel.
+		If "lazyCodeGen" is set, only the parsing and the semantic checks are done here. The code of a function
+		is generated and optimized when it is looked up by "KSC_GetFunctionHandleByName" for the first time,
+		together with the functions it calls. This saves the compiling time for the modules with a lot of 
+		functions of which only a few are used by the host.
+		Compiling the same source code with the same options again returns the same module handle, which is reference counted,
+		and the concurrent requests of the same source code wait for one compiling instead of compiling it again.
+	*/
+	KSC_API ModuleHandle KSC_Compile(const char* sourceCode, int optLevel = 2, bool lazyCodeGen = false);
+
+	/**
+		This function releases one reference of the module compiled by "KSC_Compile", once the last reference is released
+		the module is destroyed, including its IR, the JIT-ed machine code and all the
+		handles and type information retrieved from it. The function pointers JIT-ed from this module are invalid after
+		the invoking of this function. It returns false if the module handle is not valid(e.g. already released).
 	*/
-	KSC_API ModuleHandle KSC_Compile(const char* sourceCode);
+	KSC_API bool KSC_ReleaseModule(ModuleHandle hModule);
+
+	/**
+		This function compiles the KSCL code in background, it returns the job handle immediately. The parsing, code generation,
+		optimization and JIT of all the functions are done by a pool of worker threads, which is started on the first invoking.
+		The jobs with higher "priority" are picked up by the workers first, e.g. the code being edited interactively can
+		jump ahead of the modules compiled in advance. The jobs with the same priority are done in the submitting order.
+		The "callback" is invoked on the worker thread once the job is done, with the "userData" passed through. It must not
+		wait for any compile job.
+		The job handle must be passed to "KSC_WaitModule", or to "KSC_PollModule" until it reports the job is done,
+		to get the compiled module and release the job.
+	*/
+	KSC_API CompileJobHandle KSC_CompileAsync(const char* sourceCode, KSC_CompileCallback callback = NULL, void* userData = NULL,
+		int priority = 0, int optLevel = 2);
+
+	/**
+		This function blocks until the compile job is done, then releases the job and returns the module handle. NULL is
+		returned if the compiling failed and "KSC_GetLastErrorMsg" tells the reason.
+	*/
+	KSC_API ModuleHandle KSC_WaitModule(CompileJobHandle hJob);
+
+	/**
+		This function returns false immediately if the compile job is not done yet. Otherwise it releases the job,
+		sets the module handle to "pModule"(NULL if the compiling failed) and returns true.
+	*/
+	KSC_API bool KSC_PollModule(CompileJobHandle hJob, ModuleHandle* pModule);
+
+	/**
+		This function only runs the lexer over the KSCL code without parsing or compiling it. It returns the count of
+		the tokens on succeed otherwise returns -1. It is mainly used to measure the lexing throughput.
+	*/
+	KSC_API int KSC_ScanTokens(const char* sourceCode);
 
 	/**
 		This funtion is to JIT the function with the function handle specified.
 	*/
 	KSC_API void* KSC_GetFunctionPtr(FunctionHandle hFunc);
 
+	/**
+		This function JITs the batch version of the function with the function handle specified, which runs the function
+		over a range of elements in one call(see "KSC_BatchFunction"), the function is inlined into the generated loop.
+		The passed-by-reference arguments are laid out in memory the same as the pointers passed to the function returned
+		by "KSC_GetFunctionPtr"(see "isKSCLayout" of "KSC_TypeInfo"), and so is the return value.
+		The arguments passed by value are read from the memory of the same layout as the host C++ types, 
+		e.g. float4 is read from float[4].
+	*/
+	KSC_API void* KSC_GetBatchFunctionPtr(FunctionHandle hFunc);
+
+	/**
+		This function JITs the SIMD version of the function with the function handle specified. It has the same
+		signature and data layout as the batch function(see "KSC_BatchFunction") but runs "simdWidth"(4, 8 or 16)
+		elements at once, each scalar of the function becomes a vector with one lane for each element. The branches
+		and the loops depending on the element data run with the execution masks of the lanes.
+		NULL is returned if the function can't be widened, e.g. it indexes an array with a variable, and
+		"KSC_GetLastErrorMsg" tells the reason. The batch function can be used instead in that case.
+	*/
+	KSC_API void* KSC_GetSIMDFunctionPtr(FunctionHandle hFunc, int simdWidth);
+
+	/**
+		This function runs the KSCL function over "count" elements in parallel on the worker threads owned by the library.
+		The arguments are the same as the batch function(see "KSC_BatchFunction"). The range is split into chunks of at
+		most "grainSize" elements(zero lets the library choose), the idle threads steal the chunks from the busy ones.
+		The calling thread works on the chunks too and the function returns when all the elements are done.
+		The dispatch from a function being dispatched(by this function or "KSC_DispatchRange") is allowed, its whole
+		range runs on the calling thread, which keeps the other threads on the outer range.
+		It returns false if the batch function can't be created.
+	*/
+	KSC_API bool KSC_Dispatch(FunctionHandle hFunc, void* const* argPtrs, const int* argStrides, void* retPtr, int retStride, 
+		int count, int grainSize = 0);
+
+	/**
+		This function runs the host function over the index range [0, count) the same way as "KSC_Dispatch", e.g. to call
+		the function pointer of "KSC_GetFunctionPtr" with the arguments prepared by the host.
+	*/
+	KSC_API void KSC_DispatchRange(int count, int grainSize, KSC_RangeFunction rangeFunc, void* userData);
+
+	/**
+		This function sets the size of the scratch memory of each dispatching thread, which is passed to the range
+		function. It must not be called while any dispatch is running, including from the dispatched functions.
+	*/
+	KSC_API void KSC_SetDispatchScratchSize(int size);
+
 	/**
 		This function returns the function handle with the specified name. If the function with the name is not
 		found in the KSCL code, NULL will be returned.
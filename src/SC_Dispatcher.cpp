@@ -0,0 +1,210 @@
+#include "SC_Dispatcher.h"
+#include "parser_defines.h"
+
+namespace SC {
+
+// The dispatcher whose chunk is running on the current thread
+static SC_THREAD_LOCAL Dispatcher* s_pRunningDispatcher = NULL;
+
+Dispatcher::Dispatcher()
+{
+	mStopping = false;
+	mScratchSize = 0;
+	mJobSeq = 0;
+	mFunc = NULL;
+	mpUserData = NULL;
+	mGrainSize = 1;
+	mRemainingCnt = 0;
+}
+
+Dispatcher::~Dispatcher()
+{
+	Stop();
+}
+
+void Dispatcher::Start(int threadCnt)
+{
+	std::lock_guard<std::mutex> dispatchLocked(mDispatchLock);
+	if (!mWorkers.empty())
+		return;
+
+	if (threadCnt <= 0) {
+		threadCnt = (int)std::thread::hardware_concurrency() - 1;
+		if (threadCnt < 1)
+			threadCnt = 1;
+	}
+
+	mStopping = false;
+	for (int i = 0; i < threadCnt + 1; ++i) {
+		Worker* pWorker = new Worker;
+		pWorker->scratch = mScratchSize > 0 ? new char[mScratchSize] : NULL;
+		mWorkers.push_back(pWorker);
+	}
+	for (int i = 0; i < threadCnt; ++i)
+		mThreads.push_back(new std::thread(&Dispatcher::WorkerLoop, this, i));
+}
+
+void Dispatcher::Stop()
+{
+	std::lock_guard<std::mutex> dispatchLocked(mDispatchLock);
+	{
+		std::lock_guard<std::mutex> locked(mLock);
+		mStopping = true;
+	}
+	mJobReady.notify_all();
+
+	for (int i = 0; i < (int)mThreads.size(); ++i) {
+		mThreads[i]->join();
+		delete mThreads[i];
+	}
+	mThreads.clear();
+	for (int i = 0; i < (int)mWorkers.size(); ++i) {
+		delete[] mWorkers[i]->scratch;
+		delete mWorkers[i];
+	}
+	mWorkers.clear();
+}
+
+bool Dispatcher::IsRunning() const
+{
+	return !mWorkers.empty();
+}
+
+void Dispatcher::SetScratchSize(int size)
+{
+	std::lock_guard<std::mutex> dispatchLocked(mDispatchLock);
+	if (size == mScratchSize)
+		return;
+	mScratchSize = size;
+	// No dispatch is running, the workers don't touch their scratch memory
+	for (int i = 0; i < (int)mWorkers.size(); ++i) {
+		delete[] mWorkers[i]->scratch;
+		mWorkers[i]->scratch = size > 0 ? new char[size] : NULL;
+	}
+}
+
+void Dispatcher::Run(int count, int grainSize, RangeFunc func, void* userData)
+{
+	if (count <= 0)
+		return;
+
+	// The nested dispatch from a running chunk can't wait for the workers, which may all be busy with the outer job
+	// (this thread included), so its range runs right here. It gets its own scratch memory since the scratch of the
+	// outer chunk is still in use.
+	//
+	if (s_pRunningDispatcher == this) {
+		char* scratch = mScratchSize > 0 ? new char[mScratchSize] : NULL;
+		if (grainSize <= 0)
+			grainSize = count;
+		for (int begin = 0; begin < count; begin += grainSize) {
+			int end = count - begin > grainSize ? begin + grainSize : count;
+			func(begin, end, scratch, userData);
+		}
+		delete[] scratch;
+		return;
+	}
+
+	std::lock_guard<std::mutex> dispatchLocked(mDispatchLock);
+	int workerCnt = (int)mWorkers.size();
+	if (grainSize <= 0) {
+		// Several chunks for each worker leave room for the balancing
+		grainSize = count / (workerCnt * 8);
+		if (grainSize < 1)
+			grainSize = 1;
+	}
+
+	{
+		std::lock_guard<std::mutex> locked(mLock);
+		mFunc = func;
+		mpUserData = userData;
+		mGrainSize = grainSize;
+		mRemainingCnt = count;
+		// Each worker starts with its own span of the range
+		for (int i = 0; i < workerCnt; ++i) {
+			Range range = {(int)((long long)count * i / workerCnt), (int)((long long)count * (i + 1) / workerCnt)};
+			if (range.begin < range.end) {
+				std::lock_guard<std::mutex> workerLocked(mWorkers[i]->lock);
+				mWorkers[i]->ranges.push_back(range);
+			}
+		}
+		++mJobSeq;
+	}
+	mJobReady.notify_all();
+
+	// The dispatching thread works until everything is done, which is the completion barrier
+	while (mRemainingCnt > 0) {
+		if (!RunRange(workerCnt - 1))
+			std::this_thread::yield();
+	}
+}
+
+void Dispatcher::WorkerLoop(int workerIdx)
+{
+	unsigned int doneJobSeq = 0;
+	while (1) {
+		{
+			std::unique_lock<std::mutex> locked(mLock);
+			while (!mStopping && mJobSeq == doneJobSeq)
+				mJobReady.wait(locked);
+			if (mStopping)
+				return;
+			doneJobSeq = mJobSeq;
+		}
+		// The ranges are split while running, so the idle worker keeps stealing until the job is done
+		while (mRemainingCnt > 0) {
+			if (!RunRange(workerIdx))
+				std::this_thread::yield();
+		}
+	}
+}
+
+bool Dispatcher::RunRange(int workerIdx)
+{
+	Range range;
+	if (!PopRange(workerIdx, range) && !StealRange(workerIdx, range))
+		return false;
+
+	Worker* pWorker = mWorkers[workerIdx];
+	while (range.end - range.begin > mGrainSize) {
+		Range upper = {range.begin + (range.end - range.begin) / 2, range.end};
+		{
+			std::lock_guard<std::mutex> locked(pWorker->lock);
+			pWorker->ranges.push_back(upper);
+		}
+		range.end = upper.begin;
+	}
+	s_pRunningDispatcher = this;
+	mFunc(range.begin, range.end, pWorker->scratch, mpUserData);
+	s_pRunningDispatcher = NULL;
+	mRemainingCnt -= range.end - range.begin;
+	return true;
+}
+
+bool Dispatcher::PopRange(int workerIdx, Range& range)
+{
+	// The worker takes its latest range, which is the smallest and the most likely to be in cache
+	Worker* pWorker = mWorkers[workerIdx];
+	std::lock_guard<std::mutex> locked(pWorker->lock);
+	if (pWorker->ranges.empty())
+		return false;
+	range = pWorker->ranges.back();
+	pWorker->ranges.pop_back();
+	return true;
+}
+
+bool Dispatcher::StealRange(int workerIdx, Range& range)
+{
+	int workerCnt = (int)mWorkers.size();
+	for (int i = 1; i < workerCnt; ++i) {
+		Worker* pVictim = mWorkers[(workerIdx + i) % workerCnt];
+		std::lock_guard<std::mutex> locked(pVictim->lock);
+		if (!pVictim->ranges.empty()) {
+			range = pVictim->ranges.front();
+			pVictim->ranges.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace SC
@@ -0,0 +1,74 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+namespace SC {
+
+	// Runs a function over an index range on a pool of worker threads with work stealing. Each worker keeps a deque of
+	// sub-ranges, it splits the range it takes in halves until the grain size, running the lower half and leaving the
+	// upper half to the thieves. The idle workers steal the oldest(largest) range from the others, so the load is
+	// balanced even if the cost differs between the indices.
+	// The dispatching thread works as one of the workers and returns only when the whole range is done.
+	//
+	class Dispatcher
+	{
+	public:
+		typedef void (*RangeFunc)(int begin, int end, void* scratch, void* userData);
+
+	private:
+		struct Range {
+			int begin;
+			int end;
+		};
+
+		struct Worker {
+			std::deque<Range> ranges;
+			std::mutex lock;
+			// The scratch memory used by the chunk running on the worker
+			char* scratch;
+		};
+
+		// The last worker is the dispatching thread
+		std::vector<Worker*> mWorkers;
+		std::vector<std::thread*> mThreads;
+		std::mutex mLock;
+		std::condition_variable mJobReady;
+		bool mStopping;
+		// The dispatches from different threads run one after another
+		std::mutex mDispatchLock;
+		int mScratchSize;
+
+		// The current job
+		unsigned int mJobSeq;
+		RangeFunc mFunc;
+		void* mpUserData;
+		int mGrainSize;
+		std::atomic<int> mRemainingCnt;
+
+		void WorkerLoop(int workerIdx);
+		bool RunRange(int workerIdx);
+		bool PopRange(int workerIdx, Range& range);
+		bool StealRange(int workerIdx, Range& range);
+
+	public:
+		Dispatcher();
+		~Dispatcher();
+
+		// Zero thread count means one less than the hardware threads, the dispatching thread is the extra one.
+		void Start(int threadCnt = 0);
+		void Stop();
+		bool IsRunning() const;
+
+		// The scratch memory of each worker, it is reallocated by the next dispatch.
+		void SetScratchSize(int size);
+		// Runs the function over [0, count) in chunks of at most "grainSize" indices, zero grain size lets the dispatcher
+		// choose one. It blocks until all the chunks are done.
+		// Invoked from a running chunk, the nested range runs on the calling thread instead of the workers.
+		void Run(int count, int grainSize, RangeFunc func, void* userData);
+	};
+
+} // namespace SC
@@ -0,0 +1,370 @@
+#include "SC_ModuleCache.h"
+#include "IR_Gen_Context.h"
+#include "SC_Target.h"
+#include <stdio.h>
+#include <string.h>
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#ifdef _MSC_VER
+#include <process.h>
+#define KSC_GETPID _getpid
+#else
+#include <unistd.h>
+#define KSC_GETPID getpid
+#endif
+
+// Bump it whenever the layout of the cached files or the generated code changes.
+#define KSC_CACHE_VERSION 3
+
+namespace SC {
+
+std::string ModuleCache::sCacheDir;
+std::string ModuleCache::sEnvironmentKey;
+std::string ModuleCache::sExternalBitcodeKey;
+llvm::sys::Mutex ModuleCache::sLock;
+
+// 64-bit FNV-1a hash
+static unsigned long long HashString(const char* str, unsigned long long hash = 14695981039346656037ULL)
+{
+	for (; *str; ++str) {
+		hash ^= (unsigned char)*str;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static unsigned long long HashBytes(const void* data, size_t len, unsigned long long hash)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// 64-bit hash of the djb2 family, it is independent of FNV-1a so the cached files are checked with it.
+static unsigned long long HashStringDJB(const char* str, unsigned long long hash = 5381)
+{
+	for (; *str; ++str)
+		hash = hash * 33 + (unsigned char)*str;
+	return hash;
+}
+
+static std::string HashToString(unsigned long long hash)
+{
+	char buf[32];
+	sprintf(buf, "%016llx", hash);
+	return buf;
+}
+
+void ModuleCache::Initialize(const char* sharedCode)
+{
+	char buf[32];
+	sprintf(buf, "ksc%d|", KSC_CACHE_VERSION);
+	std::string env = buf;
+	env += llvm::sys::getDefaultTargetTriple() + "|" + Target::GetDescription();
+#ifdef WANT_DOUBLE_FLOAT
+	env += "|double";
+#endif
+
+	llvm::MutexGuard locked(sLock);
+	sEnvironmentKey = HashToString(HashString(sharedCode ? sharedCode : "", HashString(env.c_str())));
+}
+
+void ModuleCache::Finish()
+{
+	llvm::MutexGuard locked(sLock);
+	sCacheDir.clear();
+	sEnvironmentKey.clear();
+	sExternalBitcodeKey.clear();
+}
+
+void ModuleCache::AddExternalBitcode(const void* bitcode, size_t len)
+{
+	llvm::MutexGuard locked(sLock);
+	sExternalBitcodeKey = HashToString(HashBytes(bitcode, len, HashString(sExternalBitcodeKey.c_str())));
+}
+
+bool ModuleCache::SetDirectory(const char* cacheDir)
+{
+	std::string dir = cacheDir ? cacheDir : "";
+	if (!dir.empty()) {
+		bool existed = false;
+		if (llvm::sys::fs::create_directories(dir, existed))
+			return false;
+	}
+
+	llvm::MutexGuard locked(sLock);
+	sCacheDir = dir;
+	return true;
+}
+
+std::string ModuleCache::MakeKey(const char* sourceCode, int optLevel)
+{
+	llvm::MutexGuard locked(sLock);
+	if (sCacheDir.empty())
+		return "";
+
+	char buf[32];
+	sprintf(buf, "|O%d|", optLevel);
+	unsigned long long hash = HashString(buf, HashString(sExternalBitcodeKey.c_str(), HashString(sEnvironmentKey.c_str())));
+	return HashToString(HashString(sourceCode, hash));
+}
+
+std::string ModuleCache::MakeCheck(const char* sourceCode, int optLevel)
+{
+	llvm::MutexGuard locked(sLock);
+	char buf[64];
+	sprintf(buf, "|O%d|", optLevel);
+	unsigned long long hash = HashStringDJB(buf, HashStringDJB(sExternalBitcodeKey.c_str(), HashStringDJB(sEnvironmentKey.c_str())));
+	sprintf(buf, "%llu:%s", (unsigned long long)strlen(sourceCode), HashToString(HashStringDJB(sourceCode, hash)).c_str());
+	return buf;
+}
+
+std::string ModuleCache::FilePath(const std::string& key, const char* ext)
+{
+	llvm::MutexGuard locked(sLock);
+	return sCacheDir + "/" + key + ext;
+}
+
+static void RemoveFile(const std::string& path)
+{
+	bool existed = false;
+	llvm::sys::fs::remove(path, existed);
+}
+
+// The reflection data is stored as text, the names and the type strings are identifiers so they never contain white spaces.
+//
+static void WriteStructDesc(FILE* f, const KSC_StructDesc& structDesc);
+
+static void WriteTypeInfo(FILE* f, const KSC_TypeInfo& typeInfo)
+{
+	bool hasStruct = (typeInfo.type == VarType::kStructure && typeInfo.hStruct);
+	fprintf(f, "%d %d %d %d %d %d %d\n", (int)typeInfo.type, typeInfo.arraySize, typeInfo.sizeOfType, typeInfo.alignment,
+		(int)typeInfo.isRef, (int)typeInfo.isKSCLayout, (int)hasStruct);
+	if (hasStruct)
+		WriteStructDesc(f, *(const KSC_StructDesc*)typeInfo.hStruct);
+}
+
+static void WriteStructDesc(FILE* f, const KSC_StructDesc& structDesc)
+{
+	std::vector<const char*> memberNames(structDesc.size(), "");
+	std::hash_map<std::string, KSC_StructDesc::MemberInfo>::const_iterator it = structDesc.mMemberIndices.begin();
+	for (; it != structDesc.mMemberIndices.end(); ++it)
+		memberNames[it->second.idx] = it->first.c_str();
+
+	fprintf(f, "%d %d\n", structDesc.mStructSize, (int)structDesc.size());
+	for (int i = 0; i < (int)structDesc.size(); ++i) {
+		const KSC_StructDesc::MemberInfo& memberInfo = structDesc.mMemberIndices.find(memberNames[i])->second;
+		fprintf(f, "%s %d %d %s ", memberNames[i], memberInfo.mem_offset, memberInfo.mem_size, memberInfo.type_string.c_str());
+		WriteTypeInfo(f, structDesc[i]);
+	}
+}
+
+static bool ReadStructDesc(FILE* f, KSC_StructDesc& structDesc);
+
+static bool ReadTypeInfo(FILE* f, KSC_TypeInfo& typeInfo)
+{
+	int type, isRef, isKSCLayout, hasStruct;
+	if (fscanf(f, "%d %d %d %d %d %d %d", &type, &typeInfo.arraySize, &typeInfo.sizeOfType, &typeInfo.alignment,
+		&isRef, &isKSCLayout, &hasStruct) != 7)
+		return false;
+	typeInfo.type = (VarType)type;
+	typeInfo.isRef = (isRef != 0);
+	typeInfo.isKSCLayout = (isKSCLayout != 0);
+	typeInfo.hStruct = NULL;
+	if (hasStruct) {
+		// The owner deletes the structure description by its type, so it is assigned even if the reading fails
+		KSC_StructDesc* pStructDesc = new KSC_StructDesc;
+		typeInfo.hStruct = pStructDesc;
+		return ReadStructDesc(f, *pStructDesc);
+	}
+	return true;
+}
+
+static bool ReadStructDesc(FILE* f, KSC_StructDesc& structDesc)
+{
+	int memberCnt = 0;
+	if (fscanf(f, "%d %d", &structDesc.mStructSize, &memberCnt) != 2)
+		return false;
+
+	char name[MAX_TOKEN_LENGTH + 1];
+	char typeString[MAX_TOKEN_LENGTH + 1];
+	for (int i = 0; i < memberCnt; ++i) {
+		KSC_StructDesc::MemberInfo memberInfo;
+		if (fscanf(f, "%100s %d %d %100s", name, &memberInfo.mem_offset, &memberInfo.mem_size, typeString) != 4)
+			return false;
+		memberInfo.idx = i;
+		memberInfo.type_string = typeString;
+
+		KSC_TypeInfo typeInfo = {VarType::kInvalid, 0, 0, 0, NULL, NULL, false, false};
+		bool succeeded = ReadTypeInfo(f, typeInfo);
+		KSC_StructDesc::MemberInfo& storedInfo = structDesc.mMemberIndices[name];
+		storedInfo = memberInfo;
+		typeInfo.typeString = storedInfo.type_string.c_str();
+		structDesc.push_back(typeInfo);
+		if (!succeeded)
+			return false;
+	}
+	return true;
+}
+
+static bool WriteReflectionData(const char* fileName, const std::string& check, const KSC_ModuleDesc& moduleDesc)
+{
+	FILE* f = fopen(fileName, "w");
+	if (!f)
+		return false;
+
+	fprintf(f, "%s\n", check.c_str());
+	fprintf(f, "%d\n", (int)moduleDesc.mGlobalStructures.size());
+	std::hash_map<std::string, KSC_StructDesc*>::const_iterator itStruct = moduleDesc.mGlobalStructures.begin();
+	for (; itStruct != moduleDesc.mGlobalStructures.end(); ++itStruct) {
+		fprintf(f, "%s ", itStruct->first.c_str());
+		WriteStructDesc(f, *itStruct->second);
+	}
+
+	fprintf(f, "%d\n", (int)moduleDesc.mFunctionDesc.size());
+	std::hash_map<std::string, KSC_FunctionDesc*>::const_iterator itFunc = moduleDesc.mFunctionDesc.begin();
+	for (; itFunc != moduleDesc.mFunctionDesc.end(); ++itFunc) {
+		const KSC_FunctionDesc& funcDesc = *itFunc->second;
+		fprintf(f, "%s %s %d\n", itFunc->first.c_str(), funcDesc.F->getName().str().c_str(), (int)funcDesc.mArgumentTypes.size());
+		for (int i = 0; i < (int)funcDesc.mArgumentTypes.size(); ++i) {
+			fprintf(f, "%d %s ", funcDesc.needJITPacked[i], funcDesc.mArgTypeStrings[i].c_str());
+			WriteTypeInfo(f, funcDesc.mArgumentTypes[i]);
+		}
+	}
+
+	bool succeeded = !ferror(f);
+	fclose(f);
+	return succeeded;
+}
+
+static bool ReadReflectionData(const char* fileName, const std::string& check, KSC_ModuleDesc& moduleDesc, 
+	std::hash_map<std::string, std::string>& llvmFuncNames)
+{
+	FILE* f = fopen(fileName, "r");
+	if (!f)
+		return false;
+
+	bool succeeded = true;
+	char name[MAX_TOKEN_LENGTH + 1];
+	char llvmName[MAX_TOKEN_LENGTH + 1];
+	// The files of another module whose key collides with this one are not taken
+	succeeded = (fscanf(f, "%100s", name) == 1) && check == name;
+	int structCnt = 0;
+	succeeded = succeeded && (fscanf(f, "%d", &structCnt) == 1);
+	for (int i = 0; succeeded && i < structCnt; ++i) {
+		succeeded = (fscanf(f, "%100s", name) == 1);
+		if (succeeded) {
+			KSC_StructDesc* pStructDesc = new KSC_StructDesc;
+			moduleDesc.mGlobalStructures[name] = pStructDesc;
+			succeeded = ReadStructDesc(f, *pStructDesc);
+		}
+	}
+
+	int funcCnt = 0;
+	succeeded = succeeded && (fscanf(f, "%d", &funcCnt) == 1);
+	for (int i = 0; succeeded && i < funcCnt; ++i) {
+		int argCnt = 0;
+		succeeded = (fscanf(f, "%100s %100s %d", name, llvmName, &argCnt) == 3);
+		if (!succeeded)
+			break;
+
+		KSC_FunctionDesc* pFuncDesc = new KSC_FunctionDesc;
+		pFuncDesc->mpModule = &moduleDesc;
+		moduleDesc.mFunctionDesc[name] = pFuncDesc;
+		llvmFuncNames[name] = llvmName;
+
+		// The type strings of the arguments point to the strings kept in the function description
+		pFuncDesc->mArgTypeStrings.resize(argCnt);
+		pFuncDesc->needJITPacked.resize(argCnt, 0);
+		for (int ai = 0; succeeded && ai < argCnt; ++ai) {
+			KSC_TypeInfo typeInfo = {VarType::kInvalid, 0, 0, 0, NULL, NULL, false, false};
+			succeeded = (fscanf(f, "%d %100s", &pFuncDesc->needJITPacked[ai], name) == 2);
+			if (succeeded) {
+				pFuncDesc->mArgTypeStrings[ai] = name;
+				succeeded = ReadTypeInfo(f, typeInfo);
+				typeInfo.typeString = pFuncDesc->mArgTypeStrings[ai].c_str();
+			}
+			pFuncDesc->mArgumentTypes.push_back(typeInfo);
+		}
+	}
+
+	fclose(f);
+	return succeeded;
+}
+
+bool ModuleCache::Load(const std::string& key, const char* sourceCode, KSC_ModuleDesc& moduleDesc)
+{
+	if (key.empty())
+		return false;
+
+	std::hash_map<std::string, std::string> llvmFuncNames;
+	std::string check = MakeCheck(sourceCode, moduleDesc.mOptLevel);
+	if (!ReadReflectionData(FilePath(key, ".ksd").c_str(), check, moduleDesc, llvmFuncNames))
+		return false;
+
+	llvm::OwningPtr<llvm::MemoryBuffer> bitcode;
+	if (llvm::MemoryBuffer::getFile(FilePath(key, ".bc"), bitcode))
+		return false;
+
+	std::string errMsg;
+	moduleDesc.mpSession = new CG_Session;
+	llvm::Module* M = llvm::ParseBitcodeFile(bitcode.get(), moduleDesc.mpSession->mLLVMContext, &errMsg);
+	if (!M || !moduleDesc.mpSession->Initialize(errMsg, M))
+		return false;
+
+	std::hash_map<std::string, KSC_FunctionDesc*>::iterator it = moduleDesc.mFunctionDesc.begin();
+	for (; it != moduleDesc.mFunctionDesc.end(); ++it) {
+		it->second->F = M->getFunction(llvmFuncNames[it->first]);
+		if (!it->second->F || it->second->F->isDeclaration())
+			return false;
+	}
+	return true;
+}
+
+bool ModuleCache::Save(const std::string& key, const char* sourceCode, const KSC_ModuleDesc& moduleDesc)
+{
+	if (key.empty() || moduleDesc.mLazyCodeGen)
+		return false;
+
+	// Write to the temporary files first, so the other processes sharing the cache never see the partially written files.
+	// The files of the same key have the same content, so it doesn't matter which writer wins the renaming.
+	// The temporary files are named after the process and the module, so the writers never share one.
+	//
+	char tempExt[64];
+	sprintf(tempExt, ".%d.%p.tmp", (int)KSC_GETPID(), &moduleDesc);
+	std::string ksdPath = FilePath(key, ".ksd");
+	std::string bcPath = FilePath(key, ".bc");
+	std::string ksdTempPath = ksdPath + tempExt;
+	std::string bcTempPath = bcPath + tempExt;
+
+	bool succeeded = WriteReflectionData(ksdTempPath.c_str(), MakeCheck(sourceCode, moduleDesc.mOptLevel), moduleDesc);
+	if (succeeded) {
+		std::string errMsg;
+		llvm::raw_fd_ostream out(bcTempPath.c_str(), errMsg, llvm::raw_fd_ostream::F_Binary);
+		succeeded = errMsg.empty();
+		if (succeeded) {
+			llvm::WriteBitcodeToFile(moduleDesc.mpSession->mpModule, out);
+			// The short write(e.g. the disk is full) leaves the truncated bitcode, which must not get into the cache
+			out.close();
+			succeeded = !out.has_error();
+			out.clear_error();
+		}
+	}
+
+	// The bitcode goes last since the loading starts from the reflection data
+	succeeded = succeeded && !llvm::sys::fs::rename(ksdTempPath, ksdPath) && !llvm::sys::fs::rename(bcTempPath, bcPath);
+	if (!succeeded) {
+		RemoveFile(ksdTempPath);
+		RemoveFile(bcTempPath);
+	}
+	return succeeded;
+}
+
+} // namespace SC
@@ -0,0 +1,46 @@
+#pragma once
+#include "parser_defines.h"
+#include <string>
+#include <llvm/Support/Mutex.h>
+
+namespace SC {
+
+	// The on-disk cache of the compiled modules. The optimized IR of a module is stored as LLVM bitcode together with its
+	// reflection data(the structure layouts and the function argument types), so a module compiled before is reloaded
+	// without parsing and code generation, only the JIT is left to be done.
+	// The cache key covers the source code, the shared code, the bitcode of the host, the target CPU and its features as well
+	// as the compiling options.
+	//
+	class ModuleCache
+	{
+	private:
+		static std::string sCacheDir;
+		// The hash of everything other than the source code that affects the compiled code
+		static std::string sEnvironmentKey;
+		// The hash of the bitcode added by the host, which may be linked into the modules
+		static std::string sExternalBitcodeKey;
+		static llvm::sys::Mutex sLock;
+
+		static std::string FilePath(const std::string& key, const char* ext);
+		// The length of the source code and its hash by another function than the key's, it is stored with the 
+		// reflection data to tell the module of the key from another one whose key collides.
+		static std::string MakeCheck(const char* sourceCode, int optLevel);
+
+	public:
+		static void Initialize(const char* sharedCode);
+		static void Finish();
+		static void AddExternalBitcode(const void* bitcode, size_t len);
+
+		// Empty directory disables the cache.
+		static bool SetDirectory(const char* cacheDir);
+		// Returns empty string if the cache is disabled.
+		static std::string MakeKey(const char* sourceCode, int optLevel);
+
+		// Creates the session of the module with the cached bitcode and fills the reflection data.
+		// The module description is left partially filled on failure, the caller should discard it.
+		static bool Load(const std::string& key, const char* sourceCode, KSC_ModuleDesc& moduleDesc);
+		// Stores the module just compiled and optimized, it must be done before any wrapper function is added.
+		static bool Save(const std::string& key, const char* sourceCode, const KSC_ModuleDesc& moduleDesc);
+	};
+
+} // namespace SC
@@ -0,0 +1,232 @@
+#include "SC_Target.h"
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Host.h>
+#include <algorithm>
+#include <string.h>
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#define KSC_X86_CPUID
+#elif defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#define KSC_X86_CPUID
+#endif
+
+namespace SC {
+
+std::string Target::sCPU;
+std::vector<std::string> Target::sFeatures;
+bool Target::sHasCPU = false;
+bool Target::sHasFeatures = false;
+
+// The instruction sets the host supports, including the support of the OS for the wider registers
+enum {
+	ISA_SSE2 = 1 << 0,
+	ISA_SSE42 = 1 << 1,
+	ISA_POPCNT = 1 << 2,
+	ISA_AVX = 1 << 3,
+	ISA_AVX2 = 1 << 4,
+	ISA_FMA = 1 << 5,
+	ISA_AVX512F = 1 << 6
+};
+
+#ifdef KSC_X86_CPUID
+static void CPUID(int leaf, int subLeaf, int regs[4])
+{
+#ifdef _MSC_VER
+	__cpuidex(regs, leaf, subLeaf);
+#else
+	unsigned int a, b, c, d;
+	__cpuid_count(leaf, subLeaf, a, b, c, d);
+	regs[0] = a; regs[1] = b; regs[2] = c; regs[3] = d;
+#endif
+}
+
+static unsigned long long XGETBV()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int lo, hi;
+	__asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+#endif
+
+static int DetectHostISA()
+{
+	int isa = 0;
+#ifdef KSC_X86_CPUID
+	int regs[4];
+	CPUID(0, 0, regs);
+	int maxLeaf = regs[0];
+	if (maxLeaf < 1)
+		return 0;
+
+	CPUID(1, 0, regs);
+	int ecx1 = regs[2];
+	if (regs[3] & (1 << 26))	isa |= ISA_SSE2;
+	if (ecx1 & (1 << 20))		isa |= ISA_SSE42;
+	if (ecx1 & (1 << 23))		isa |= ISA_POPCNT;
+
+	// The YMM(and ZMM) registers are usable only if the OS saves them on the context switch
+	bool osSavesYMM = false;
+	bool osSavesZMM = false;
+	if (ecx1 & (1 << 27)) {
+		unsigned long long xcr0 = XGETBV();
+		osSavesYMM = (xcr0 & 0x6) == 0x6;
+		osSavesZMM = (xcr0 & 0xe6) == 0xe6;
+	}
+	if (!osSavesYMM)
+		return isa;
+	if (ecx1 & (1 << 28))		isa |= ISA_AVX;
+	if (ecx1 & (1 << 12))		isa |= ISA_FMA;
+
+	if (maxLeaf >= 7) {
+		CPUID(7, 0, regs);
+		if (regs[1] & (1 << 5))						isa |= ISA_AVX2;
+		if (osSavesZMM && (regs[1] & (1 << 16)))	isa |= ISA_AVX512F;
+	}
+#endif
+	return isa;
+}
+
+struct ISALevel
+{
+	const char* name;
+	int requiredISA;
+	const char* cpuName;
+	const char* features;
+};
+
+// The ISA levels from the best, each one is a generic CPU model of the level plus the features it lacks.
+// LLVM 3.2 has no AVX-512 code generation, so the AVX-512 hosts get the AVX2 code for now, the level is there
+// for the clients to list it ahead of the others.
+//
+static const ISALevel s_isaLevels[] = {
+	{ "avx512",	ISA_AVX512F | ISA_AVX2 | ISA_FMA | ISA_AVX | ISA_SSE42 | ISA_POPCNT,	"corei7-avx",	"+avx2,+fma" },
+	{ "avx2",	ISA_AVX2 | ISA_FMA | ISA_AVX | ISA_SSE42 | ISA_POPCNT,					"corei7-avx",	"+avx2,+fma" },
+	{ "avx",	ISA_AVX | ISA_SSE42 | ISA_POPCNT,										"corei7-avx",	"" },
+	{ "sse4.2",	ISA_SSE42 | ISA_POPCNT,													"corei7",		"" },
+	{ "sse2",	ISA_SSE2,																"x86-64",		"" }
+};
+
+static void SplitList(const char* list, const char* separators, std::vector<std::string>& items)
+{
+	std::string item;
+	for (const char* p = list; ; ++p) {
+		if (*p == '\0' || strchr(separators, *p)) {
+			if (!item.empty())
+				items.push_back(item);
+			item.clear();
+			if (*p == '\0')
+				break;
+		}
+		else if (*p != ' ' && *p != '\t')
+			item += *p;
+	}
+}
+
+void Target::Set(const char* cpuName, const char* features)
+{
+	sCPU = cpuName ? cpuName : "";
+	sHasCPU = !sCPU.empty();
+
+	sFeatures.clear();
+	sHasFeatures = (features != NULL);
+	if (features) {
+		SplitList(features, ",", sFeatures);
+		// The features without the sign are enabled
+		for (int i = 0; i < (int)sFeatures.size(); ++i) {
+			if (sFeatures[i][0] != '+' && sFeatures[i][0] != '-')
+				sFeatures[i] = "+" + sFeatures[i];
+		}
+	}
+}
+
+const char* Target::SelectISALevel(const char* isaLevels, std::string& errMsg)
+{
+	std::vector<std::string> levels;
+	SplitList(isaLevels ? isaLevels : "", ",;", levels);
+	int levelCnt = sizeof(s_isaLevels) / sizeof(s_isaLevels[0]);
+	int hostISA = DetectHostISA();
+
+	for (int i = 0; i < (int)levels.size(); ++i) {
+		const ISALevel* pLevel = NULL;
+		for (int j = 0; j < levelCnt; ++j) {
+			if (levels[i] == s_isaLevels[j].name) {
+				pLevel = &s_isaLevels[j];
+				break;
+			}
+		}
+		if (!pLevel) {
+			errMsg = "Unknown ISA level \"" + levels[i] + "\".";
+			return NULL;
+		}
+		if ((hostISA & pLevel->requiredISA) == pLevel->requiredISA) {
+			Set(pLevel->cpuName, pLevel->features);
+			return pLevel->name;
+		}
+	}
+	errMsg = "The host supports none of the ISA levels.";
+	return NULL;
+}
+
+void Target::Resolve()
+{
+	if (!sHasCPU) {
+		sCPU = llvm::sys::getHostCPUName().str();
+		sHasCPU = true;
+	}
+	if (sHasFeatures)
+		return;
+
+	// The feature map is unordered, sort the features to make the description stable
+	llvm::StringMap<bool> features;
+	if (llvm::sys::getHostCPUFeatures(features)) {
+		llvm::StringMap<bool>::iterator it = features.begin();
+		for (; it != features.end(); ++it)
+			sFeatures.push_back((it->getValue() ? "+" : "-") + it->getKey().str());
+		std::sort(sFeatures.begin(), sFeatures.end());
+	}
+	else {
+		// LLVM doesn't detect the x86 features, the CPU name alone may claim the instructions the host lacks(e.g.
+		// AVX on an OS without the YMM support), so the ones the code generation cares about are set explicitly.
+		int hostISA = DetectHostISA();
+		if (hostISA) {
+			sFeatures.push_back((hostISA & ISA_SSE42) ? "+sse42" : "-sse42");
+			sFeatures.push_back((hostISA & ISA_POPCNT) ? "+popcnt" : "-popcnt");
+			sFeatures.push_back((hostISA & ISA_AVX) ? "+avx" : "-avx");
+			sFeatures.push_back((hostISA & ISA_AVX2) ? "+avx2" : "-avx2");
+			sFeatures.push_back((hostISA & ISA_FMA) ? "+fma" : "-fma");
+		}
+	}
+	sHasFeatures = true;
+}
+
+const std::string& Target::GetCPU()
+{
+	return sCPU;
+}
+
+const std::vector<std::string>& Target::GetFeatures()
+{
+	return sFeatures;
+}
+
+std::string Target::GetDescription()
+{
+	std::string desc = sCPU;
+	for (int i = 0; i < (int)sFeatures.size(); ++i)
+		desc += sFeatures[i];
+	return desc;
+}
+
+void Target::Apply(llvm::EngineBuilder& builder)
+{
+	builder.setMCPU(sCPU);
+	builder.setMAttrs(sFeatures);
+}
+
+} // namespace SC
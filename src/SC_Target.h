@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include <vector>
+
+namespace llvm {
+	class EngineBuilder;
+}
+
+namespace SC {
+
+	// The target machine of the code generation, all the execution engines(the global one and the ones of the modules)
+	// are created for it. It is the host CPU with its features unless the client sets it before KSC_Initialize, either
+	// explicitly or by a list of ISA levels of which the best one the host supports is taken, see KSC_SetTarget.
+	//
+	class Target
+	{
+	private:
+		static std::string sCPU;
+		static std::vector<std::string> sFeatures;
+		static bool sHasCPU;
+		static bool sHasFeatures;
+
+	public:
+		// NULL or empty CPU name is the host CPU, NULL features are the host features.
+		static void Set(const char* cpuName, const char* features);
+		// Takes the first level of the list the host supports, returns its name or NULL if there's none.
+		static const char* SelectISALevel(const char* isaLevels, std::string& errMsg);
+		// Fills what is not set with the host CPU and features, it's done by InitializeCodeGen.
+		static void Resolve();
+
+		static const std::string& GetCPU();
+		static const std::vector<std::string>& GetFeatures();
+		// The CPU name followed by the features, e.g. "corei7-avx+avx+sse42", it's part of the module cache key.
+		static std::string GetDescription();
+		static void Apply(llvm::EngineBuilder& builder);
+	};
+
+} // namespace SC
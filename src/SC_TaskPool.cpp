@@ -0,0 +1,98 @@
+#include "SC_TaskPool.h"
+
+namespace SC {
+
+bool TaskPool::QueuedTask::operator < (const QueuedTask& ref) const
+{
+	// The top of the priority queue is the "largest" one, which should be the task with the highest priority,
+	// or the earliest submitted one for the same priority.
+	if (priority != ref.priority)
+		return priority < ref.priority;
+	else
+		return seq > ref.seq;
+}
+
+TaskPool::TaskPool()
+{
+	mSubmitSeq = 0;
+	mStopping = false;
+}
+
+TaskPool::~TaskPool()
+{
+	Stop();
+}
+
+void TaskPool::Start(int threadCnt)
+{
+	std::lock_guard<std::mutex> locked(mLock);
+	if (!mWorkers.empty())
+		return;
+
+	if (threadCnt <= 0) {
+		threadCnt = (int)std::thread::hardware_concurrency() - 1;
+		if (threadCnt < 1)
+			threadCnt = 1;
+	}
+
+	mStopping = false;
+	for (int i = 0; i < threadCnt; ++i)
+		mWorkers.push_back(new std::thread(&TaskPool::WorkerLoop, this));
+}
+
+void TaskPool::Stop()
+{
+	std::vector<std::thread*> workers;
+	std::vector<Task*> cancelledTasks;
+	{
+		std::lock_guard<std::mutex> locked(mLock);
+		mStopping = true;
+		workers.swap(mWorkers);
+		while (!mQueue.empty()) {
+			cancelledTasks.push_back(mQueue.top().pTask);
+			mQueue.pop();
+		}
+	}
+	mTaskReady.notify_all();
+
+	for (int i = 0; i < (int)workers.size(); ++i) {
+		workers[i]->join();
+		delete workers[i];
+	}
+	for (int i = 0; i < (int)cancelledTasks.size(); ++i)
+		cancelledTasks[i]->Cancel();
+}
+
+bool TaskPool::IsRunning() const
+{
+	return !mWorkers.empty();
+}
+
+void TaskPool::Submit(Task* pTask, int priority)
+{
+	{
+		std::lock_guard<std::mutex> locked(mLock);
+		QueuedTask newTask = {pTask, priority, mSubmitSeq++};
+		mQueue.push(newTask);
+	}
+	mTaskReady.notify_one();
+}
+
+void TaskPool::WorkerLoop()
+{
+	while (1) {
+		Task* pTask = NULL;
+		{
+			std::unique_lock<std::mutex> locked(mLock);
+			while (!mStopping && mQueue.empty())
+				mTaskReady.wait(locked);
+			if (mStopping)
+				return;
+			pTask = mQueue.top().pTask;
+			mQueue.pop();
+		}
+		pTask->Run();
+	}
+}
+
+} // namespace SC
@@ -0,0 +1,58 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace SC {
+
+	// A pool of worker threads running the submitted tasks in the background. The task with higher priority
+	// runs first, the tasks with the same priority run in the submitting order.
+	// The pool doesn't own the tasks, the submitter is responsible for deleting a task after it is finished or cancelled.
+	//
+	class TaskPool
+	{
+	public:
+		class Task
+		{
+		public:
+			virtual ~Task() {}
+			virtual void Run() = 0;
+			// Called instead of Run for the tasks still queued when the pool stops.
+			virtual void Cancel() = 0;
+		};
+
+	private:
+		struct QueuedTask {
+			Task* pTask;
+			int priority;
+			unsigned int seq;
+
+			bool operator < (const QueuedTask& ref) const;
+		};
+
+		std::priority_queue<QueuedTask> mQueue;
+		unsigned int mSubmitSeq;
+		std::vector<std::thread*> mWorkers;
+		std::mutex mLock;
+		std::condition_variable mTaskReady;
+		bool mStopping;
+
+		void WorkerLoop();
+
+	public:
+		TaskPool();
+		~TaskPool();
+
+		// Starts the worker threads, zero thread count means one less than the hardware threads so the
+		// thread submitting the tasks is not competing with the workers.
+		void Start(int threadCnt = 0);
+		// Waits for the running tasks to finish, the queued tasks are cancelled.
+		void Stop();
+		bool IsRunning() const;
+
+		void Submit(Task* pTask, int priority);
+	};
+
+} // namespace SC
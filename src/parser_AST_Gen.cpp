@@ -1,15 +1,23 @@
 #include "parser_AST_Gen.h"
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define KSC_LEX_SIMD_WIDTH 32
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define KSC_LEX_SIMD_WIDTH 16
+#endif
 
 namespace SC {
 
 Token Token::sInvalid = Token(NULL, 0, 0, Token::kUnknown);
 Token Token::sEOF = Token(NULL, -1, -1, Token::kUnknown);
 
-static std::hash_map<std::string, TypeDesc> s_BuiltInTypes;
-static std::hash_map<std::string, KeyWord> s_KeyWords;
-
 struct TypeDesc {
 	VarType type;
 	int elemCnt;
@@ -19,37 +27,85 @@ struct TypeDesc {
 	TypeDesc(VarType tp, int cnt, bool i) {type = tp; elemCnt = cnt; isInt = i;}
 };
 
-void Initialize_AST_Gen()
+// The keywords and built-in types are the reserved words of KSCL, they are recognized by a perfect hash 
+// of the first character, the last character and the length of the token, so no copy of the token is needed.
+//
+struct ReservedWord {
+	const char* name;
+	int length;
+	bool isType;
+	VarType type;
+	int elemCnt;
+	bool isInt;
+	KeyWord keyWord;
+};
+
+static const ReservedWord s_ReservedWords[] = {
+	{"float",	5, true, kFloat, 1, false, kStructDef},
+	{"float2",	6, true, kFloat2, 2, false, kStructDef},
+	{"float3",	6, true, kFloat3, 3, false, kStructDef},
+	{"float4",	6, true, kFloat4, 4, false, kStructDef},
+	{"float8",	6, true, kFloat8, 8, false, kStructDef},
+	{"int",		3, true, kInt, 1, true, kStructDef},
+	{"int2",	4, true, kInt2, 2, true, kStructDef},
+	{"int3",	4, true, kInt3, 3, true, kStructDef},
+	{"int4",	4, true, kInt4, 4, true, kStructDef},
+	{"int8",	4, true, kInt8, 8, true, kStructDef},
+	{"bool",	4, true, kBoolean, 4, true, kStructDef},
+	{"void",	4, true, kVoid, 0, true, kStructDef},
+
+	{"struct",	6, false, kInvalid, 0, false, kStructDef},
+	{"if",		2, false, kInvalid, 0, false, kIf},
+	{"else",	4, false, kInvalid, 0, false, kElse},
+	{"for",		3, false, kInvalid, 0, false, kFor},
+	{"return",	6, false, kInvalid, 0, false, kReturn},
+	{"true",	4, false, kInvalid, 0, false, kTrue},
+	{"false",	5, false, kInvalid, 0, false, kFalse},
+	{"extern",	6, false, kInvalid, 0, false, kExtern}
+};
+
+#define RESERVED_WORD_MIN_LENGTH 2
+#define RESERVED_WORD_MAX_LENGTH 6
+#define RESERVED_WORD_HASH(p, len) (((unsigned char)(p)[0] * 2 + (unsigned char)(p)[(len) - 1] * 3 + (len)) & 63)
+
+// The slots are generated offline for the words above, each slot holds the index to s_ReservedWords or -1 if it is empty.
+// Any change to the reserved words requires the hash function and this table to be re-generated so that no two words
+// share the same slot, which is verified in Initialize_AST_Gen for debug build.
+//
+static const signed char s_ReservedWordSlots[64] = {
+	18, -1, -1, -1, -1, -1, 13, -1, 12, -1, -1, -1, 10, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 19, 17, 11, -1, -1, -1,
+	-1, -1, -1, -1, -1, 15, -1, -1,  1, -1, -1,  2,  6,  0,  3,  7,
+	-1,  5,  8, -1, 16, -1, -1, -1, -1, -1,  4, -1, -1, 14,  9, -1
+};
+
+static const ReservedWord* FindReservedWord(const char* p, int len)
 {
-	s_BuiltInTypes["float"] = TypeDesc(kFloat, 1, false);
-	s_BuiltInTypes["float2"] = TypeDesc(kFloat2, 2, false);
-	s_BuiltInTypes["float3"] = TypeDesc(kFloat3, 3, false);
-	s_BuiltInTypes["float4"] = TypeDesc(kFloat4, 4, false);
-	s_BuiltInTypes["float8"] = TypeDesc(kFloat8, 8, false);
+	if (len < RESERVED_WORD_MIN_LENGTH || len > RESERVED_WORD_MAX_LENGTH)
+		return NULL;
 
-	s_BuiltInTypes["int"] = TypeDesc(kInt, 1, true);
-	s_BuiltInTypes["int2"] = TypeDesc(kInt2, 2, true);
-	s_BuiltInTypes["int3"] = TypeDesc(kInt3, 3, true);
-	s_BuiltInTypes["int4"] = TypeDesc(kInt4, 4, true);
-	s_BuiltInTypes["int8"] = TypeDesc(kInt8, 8, true);
+	int idx = s_ReservedWordSlots[RESERVED_WORD_HASH(p, len)];
+	if (idx < 0)
+		return NULL;
 
-	s_BuiltInTypes["bool"] = TypeDesc(kBoolean, 4, true);
-	s_BuiltInTypes["void"] = TypeDesc(kVoid, 0, true);
+	const ReservedWord& word = s_ReservedWords[idx];
+	if (word.length == len && memcmp(word.name, p, len) == 0)
+		return &word;
+	else
+		return NULL;
+}
 
-	s_KeyWords["struct"] = kStructDef;
-	s_KeyWords["if"] = kIf;
-	s_KeyWords["else"] = kElse;
-	s_KeyWords["for"] = kFor;
-	s_KeyWords["return"] = kFor;
-	s_KeyWords["true"] = kTrue;
-	s_KeyWords["false"] = kFalse;
-	s_KeyWords["extern"] = kFalse;
+void Initialize_AST_Gen()
+{
+#ifdef _DEBUG
+	for (int i = 0; i < (int)(sizeof(s_ReservedWords) / sizeof(s_ReservedWords[0])); ++i)
+		assert(FindReservedWord(s_ReservedWords[i].name, s_ReservedWords[i].length) == &s_ReservedWords[i]);
+#endif
 }
 
 void Finish_AST_Gen()
 {
-	s_BuiltInTypes.clear();
-	s_KeyWords.clear();
+
 }
 
 Token::Token()
@@ -57,12 +113,13 @@ Token::Token()
 	*this = sInvalid;
 }
 
-Token::Token(const char* p, int num, int line, Type tp)
+Token::Token(const char* p, int num, int line, Type tp, SymbolID symbol)
 {
 	mpData = p;
 	mNumOfChar = num;
 	mLOC = line;
 	mType = tp;
+	mSymbol = symbol;
 }
 
 Token::Token(const Token& ref)
@@ -71,6 +128,7 @@ Token::Token(const Token& ref)
 	mNumOfChar = ref.mNumOfChar;
 	mLOC = ref.mLOC;
 	mType = ref.mType;
+	mSymbol = ref.mSymbol;
 }
 
 double Token::GetConstValue() const
@@ -84,32 +142,111 @@ double Token::GetConstValue() const
 	return 0.0;
 }
 
-int Token::GetBinaryOpLevel() const
+// The binary operators supported by KSCL, the higher level means the higher priority.
+//
+struct BinaryOpInfo {
+	const char* str;
+	int length;
+	int level;
+	bool rightAssoc;
+	OpCode code;
+};
+
+static const BinaryOpInfo s_BinaryOps[] = {
+	{"=",	1, 50, true, kOpAssign},
+	{"||",	2, 70, false, kOpLogicOr},
+	{"&&",	2, 70, false, kOpLogicAnd},
+	{"==",	2, 80, false, kOpEqual},
+	{">=",	2, 80, false, kOpGreaterEqual},
+	{"<=",	2, 80, false, kOpLessEqual},
+	{">",	1, 80, false, kOpGreater},
+	{"<",	1, 80, false, kOpLess},
+	{"|",	1, 100, false, kOpBitOr},
+	{"&",	1, 100, false, kOpBitAnd},
+	{"+",	1, 100, false, kOpAdd},
+	{"-",	1, 100, false, kOpSub},
+	{"*",	1, 200, false, kOpMul},
+	{"/",	1, 200, false, kOpDiv}
+};
+
+const char* GetOpCodeString(OpCode op)
 {
-	if (mType != kBinaryOp)
-		return 0;
+	static const char* s_OpCodeStrings[kOpCodeCnt] = {
+		"=", "||", "&&", "==", ">=", "<=", ">", "<", "|", "&", "+", "-", "*", "/", "!", "-"
+	};
+	return (op >= 0 && op < kOpCodeCnt) ? s_OpCodeStrings[op] : "";
+}
+
+struct BuiltInFuncInfo {
+	const char* name;
+	int length;
+	int argCnt;
+	// The integer arguments give the integer result instead of float
+	bool keepsInt;
+	// The result is a scalar instead of the type of the arguments
+	bool isReduction;
+	// The cost of evaluating the function speculatively(see GetSpeculationCost)
+	int cost;
+};
+
+static const BuiltInFuncInfo s_BuiltInFuncs[kBuiltInFuncCnt] = {
+	{"sin",			3, 1, false, false, 8},
+	{"cos",			3, 1, false, false, 8},
+	{"exp",			3, 1, false, false, 8},
+	{"log",			3, 1, false, false, 8},
+	{"pow",			3, 2, false, false, 16},
+	{"sqrt",		4, 1, false, false, 2},
+	{"fabs",		4, 1, false, false, 1},
+	{"dot",			3, 2, false, true, 3},
+	{"cross",		5, 2, false, false, 4},
+	{"normalize",	9, 1, false, false, 6},
+	{"length",		6, 1, false, true, 4},
+	{"lerp",		4, 3, false, false, 2},
+	{"saturate",	8, 1, false, false, 2},
+	{"min",			3, 2, true, false, 1},
+	{"max",			3, 2, true, false, 1},
+	{"mad",			3, 3, true, false, 1}
+};
 
-	if (mNumOfChar == 1) {
-		switch (*mpData) {
-		case '|':
-		case '&':
-		case '+':
-		case '-':
-			return 100;
-		case '*':
-		case '/':
-			return 200;
-		case '=':
-			return 50;
+bool IsBuiltInFunction(const Token& token, BuiltInFunc* out_func)
+{
+	int len = token.GetLength();
+	for (int i = 0; i < kBuiltInFuncCnt; ++i) {
+		if (s_BuiltInFuncs[i].length == len && memcmp(s_BuiltInFuncs[i].name, token.GetRawData(), len) == 0) {
+			if (out_func) *out_func = (BuiltInFunc)i;
+			return true;
 		}
 	}
+	return false;
+}
 
-	if (IsEqual("||") || IsEqual("&&"))
-		return 70;
-	else if (IsEqual("==") || IsEqual(">=") || IsEqual(">") || IsEqual("<=") || IsEqual("<"))
-		return 80;
+const char* GetBuiltInFuncName(BuiltInFunc func)
+{
+	return (func >= 0 && func < kBuiltInFuncCnt) ? s_BuiltInFuncs[func].name : "";
+}
 
-	return 0;
+int GetBuiltInFuncArgCnt(BuiltInFunc func)
+{
+	return (func >= 0 && func < kBuiltInFuncCnt) ? s_BuiltInFuncs[func].argCnt : 0;
+}
+
+static const BinaryOpInfo* FindBinaryOp(const char* p, int len)
+{
+	for (int i = 0; i < (int)(sizeof(s_BinaryOps) / sizeof(s_BinaryOps[0])); ++i) {
+		const BinaryOpInfo& op = s_BinaryOps[i];
+		if (op.length == len && op.str[0] == p[0] && (len == 1 || op.str[1] == p[1]))
+			return &op;
+	}
+	return NULL;
+}
+
+int Token::GetBinaryOpLevel() const
+{
+	if (mType != kBinaryOp)
+		return 0;
+
+	const BinaryOpInfo* pOp = FindBinaryOp(mpData, mNumOfChar);
+	return pOp ? pOp->level : 0;
 }
 
 Token::Type Token::GetType() const
@@ -122,6 +259,16 @@ int Token::GetLOC() const
 	return mLOC;
 }
 
+SymbolID Token::GetSymbol() const
+{
+	return mSymbol;
+}
+
+int Token::GetLength() const
+{
+	return mNumOfChar;
+}
+
 bool Token::IsValid() const
 {
 	return (mpData != NULL);
@@ -178,239 +325,524 @@ std::string Token::ToStdString() const
 	return std::string(tempString);
 }
 
-static bool _isAlpha(char ch)
+SymbolTable::SymbolTable(const SymbolTable* pParent)
 {
-	return ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z'));
+	mpParent = pParent;
+	mBaseID = pParent ? pParent->GetSymbolCount() : 0;
 }
 
-static bool _isNumber(char ch)
+unsigned int SymbolTable::HashName(const char* p, int len)
+{
+	// FNV-1a
+	unsigned int hash = 2166136261u;
+	for (int i = 0; i < len; ++i) {
+		hash ^= (unsigned char)p[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+SymbolID SymbolTable::FindWithHash(const char* p, int len, unsigned int hash) const
+{
+	if (mpParent) {
+		SymbolID ret = mpParent->FindWithHash(p, len, hash);
+		if (ret != kInvalidSymbol)
+			return ret;
+	}
+
+	if (mBuckets.empty())
+		return kInvalidSymbol;
+
+	size_t mask = mBuckets.size() - 1;
+	for (size_t i = hash & mask; mBuckets[i] != kInvalidSymbol; i = (i + 1) & mask) {
+		int localIdx = mBuckets[i];
+		const std::string& name = mNames[localIdx];
+		if (mHashes[localIdx] == hash && (int)name.length() == len && memcmp(name.c_str(), p, len) == 0)
+			return mBaseID + localIdx;
+	}
+	return kInvalidSymbol;
+}
+
+void SymbolTable::InsertToBucket(int localIdx)
+{
+	size_t mask = mBuckets.size() - 1;
+	size_t i = mHashes[localIdx] & mask;
+	while (mBuckets[i] != kInvalidSymbol) 
+		i = (i + 1) & mask;
+	mBuckets[i] = localIdx;
+}
+
+SymbolID SymbolTable::Intern(const char* p, int len)
+{
+	unsigned int hash = HashName(p, len);
+	SymbolID ret = FindWithHash(p, len, hash);
+	if (ret != kInvalidSymbol)
+		return ret;
+
+	// Keep the load factor of the buckets under 0.5
+	if ((mNames.size() + 1) * 2 > mBuckets.size()) {
+		mBuckets.assign(mBuckets.empty() ? 64 : mBuckets.size() * 2, kInvalidSymbol);
+		for (int i = 0; i < (int)mNames.size(); ++i)
+			InsertToBucket(i);
+	}
+
+	mNames.push_back(std::string(p, len));
+	mHashes.push_back(hash);
+	InsertToBucket((int)mNames.size() - 1);
+	return mBaseID + (SymbolID)mNames.size() - 1;
+}
+
+SymbolID SymbolTable::Find(const char* p, int len) const
+{
+	return FindWithHash(p, len, HashName(p, len));
+}
+
+const std::string& SymbolTable::GetName(SymbolID id) const
+{
+	if (id < mBaseID)
+		return mpParent->GetName(id);
+	else
+		return mNames[id - mBaseID];
+}
+
+int SymbolTable::GetSymbolCount() const
+{
+	return mBaseID + (int)mNames.size();
+}
+
+// Character classes used by the table-driven scanner, each byte of the source is mapped 
+// to one class so the scanner decides what to do with a single table lookup.
+//
+enum LexCharClass {
+	kLex_Unknown = 0,
+	kLex_Space,
+	kLex_Alpha,		// a-z, A-Z and '_'
+	kLex_Digit,
+	kLex_Single,	// single character tokens, e.g. "{", ";"
+	kLex_Operator,	// binary operators, some of them can be followed by a second character
+	kLex_Quote,
+	kLex_End
+};
+
+struct LexTables {
+	unsigned char charClass[256];
+	// For the single character tokens, the token type of that character
+	unsigned char singleCharType[256];
+	// For the operators, the second character that forms a two-character operator(e.g. "==", "&&"), 
+	// zero if the operator has only one character.
+	char opFollow[256];
+
+	LexTables()
+	{
+		memset(charClass, kLex_Unknown, sizeof(charClass));
+		memset(singleCharType, Token::kUnknown, sizeof(singleCharType));
+		memset(opFollow, 0, sizeof(opFollow));
+
+		charClass[0] = kLex_End;
+		charClass[' '] = charClass['\t'] = charClass['\r'] = charClass['\n'] = kLex_Space;
+		for (int ch = 'a'; ch <= 'z'; ++ch) charClass[ch] = kLex_Alpha;
+		for (int ch = 'A'; ch <= 'Z'; ++ch) charClass[ch] = kLex_Alpha;
+		charClass['_'] = kLex_Alpha;
+		for (int ch = '0'; ch <= '9'; ++ch) charClass[ch] = kLex_Digit;
+		charClass['"'] = kLex_Quote;
+
+		const char* ops = "+-*/|&=><";
+		for (const char* p = ops; *p != '\0'; ++p) 
+			charClass[(unsigned char)*p] = kLex_Operator;
+		opFollow['+'] = '+';
+		opFollow['-'] = '-';
+		opFollow['|'] = '|';
+		opFollow['&'] = '&';
+		opFollow['='] = '=';
+		opFollow['>'] = '=';
+		opFollow['<'] = '=';
+
+		AddSingle('{', Token::kOpenCurly);
+		AddSingle('}', Token::kCloseCurly);
+		AddSingle('(', Token::kOpenParenthesis);
+		AddSingle(')', Token::kCloseParenthesis);
+		AddSingle('[', Token::kOpenBraket);
+		AddSingle(']', Token::kCloseBraket);
+		AddSingle(',', Token::kComma);
+		AddSingle(';', Token::kSemiColon);
+		AddSingle('.', Token::kPeriod);
+		AddSingle('!', Token::kUnaryOp);
+	}
+
+	void AddSingle(char ch, Token::Type tp)
+	{
+		charClass[(unsigned char)ch] = kLex_Single;
+		singleCharType[(unsigned char)ch] = (unsigned char)tp;
+	}
+};
+
+static const LexTables s_LexTables;
+
+static inline int _charClass(char ch)
+{
+	return s_LexTables.charClass[(unsigned char)ch];
+}
+
+static inline bool _isNumber(char ch)
 {
 	return (ch >= '0' && ch <= '9');
 }
 
-static bool _isFirstN_Equal(const char* test_str, const char* dest)
+static inline bool _isIdentChar(char ch)
 {
-	int i = 0;
-	while (test_str[i] != '\0' && dest[i] != '\0') {
-		if (test_str[i] != dest[i])
-			return false;
-		++i;
+	int cc = _charClass(ch);
+	return (cc == kLex_Alpha || cc == kLex_Digit);
+}
+
+// The white space, comment and identifier runs are scanned with SIMD compares, a block of 
+// 16(SSE2) or 32(AVX2) characters is tested at once. Only aligned blocks are loaded so the 
+// loads never cross a page boundary even if they read past the terminating '\0'.
+//
+#ifdef KSC_LEX_SIMD_WIDTH
+
+#if KSC_LEX_SIMD_WIDTH == 32
+typedef __m256i LexBlock;
+static const unsigned int LEX_FULL_MASK = 0xFFFFFFFF;
+
+static inline LexBlock _lexLoad(const char* p)
+{
+	return _mm256_load_si256((const __m256i*)p);
+}
+
+static inline unsigned int _lexEqMask(LexBlock b, char ch)
+{
+	return (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, _mm256_set1_epi8(ch)));
+}
+
+static inline unsigned int _lexRangeMask(LexBlock b, char lo, char hi)
+{
+	// The characters above 0x7F are negative in signed compare so they're always out of range.
+	__m256i outside = _mm256_or_si256(_mm256_cmpgt_epi8(b, _mm256_set1_epi8(hi)), _mm256_cmpgt_epi8(_mm256_set1_epi8(lo), b));
+	return ~(unsigned int)_mm256_movemask_epi8(outside);
+}
+#else
+typedef __m128i LexBlock;
+static const unsigned int LEX_FULL_MASK = 0xFFFF;
+
+static inline LexBlock _lexLoad(const char* p)
+{
+	return _mm_load_si128((const __m128i*)p);
+}
+
+static inline unsigned int _lexEqMask(LexBlock b, char ch)
+{
+	return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(b, _mm_set1_epi8(ch)));
+}
+
+static inline unsigned int _lexRangeMask(LexBlock b, char lo, char hi)
+{
+	// The characters above 0x7F are negative in signed compare so they're always out of range.
+	__m128i outside = _mm_or_si128(_mm_cmpgt_epi8(b, _mm_set1_epi8(hi)), _mm_cmpgt_epi8(_mm_set1_epi8(lo), b));
+	return ~(unsigned int)_mm_movemask_epi8(outside) & LEX_FULL_MASK;
+}
+#endif
+
+static inline int _lexFirstBit(unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long idx = 0;
+	_BitScanForward(&idx, mask);
+	return (int)idx;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+static inline int _lexBitCount(unsigned int mask)
+{
+	mask = mask - ((mask >> 1) & 0x55555555);
+	mask = (mask & 0x33333333) + ((mask >> 2) & 0x33333333);
+	return (int)((((mask + (mask >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+}
+
+static inline bool _lexIsAligned(const char* p)
+{
+	return ((size_t)p & (KSC_LEX_SIMD_WIDTH - 1)) == 0;
+}
+
+// Returns the pointer to the first non-white-space character, "loc" is increased by the count of new lines skipped.
+static const char* _skipSpaces(const char* p, int& loc)
+{
+	while (!_lexIsAligned(p)) {
+		if (_charClass(*p) != kLex_Space)
+			return p;
+		if (*p == '\n')
+			++loc;
+		++p;
 	}
 
-	if (test_str[i] == '\0' && dest[i] != '\0')
-		return false;
+	while (1) {
+		LexBlock b = _lexLoad(p);
+		unsigned int newLines = _lexEqMask(b, '\n');
+		unsigned int spaces = newLines | _lexEqMask(b, ' ') | _lexEqMask(b, '\t') | _lexEqMask(b, '\r');
+		if (spaces == LEX_FULL_MASK) {
+			loc += _lexBitCount(newLines);
+			p += KSC_LEX_SIMD_WIDTH;
+		}
+		else {
+			int n = _lexFirstBit(~spaces);
+			loc += _lexBitCount(newLines & ((1u << n) - 1));
+			return p + n;
+		}
+	}
+}
 
-	return true;
+// Returns the pointer to the end of line("\n" or "\0") of a line comment.
+static const char* _skipLineComment(const char* p)
+{
+	while (!_lexIsAligned(p)) {
+		if (*p == '\n' || *p == '\0')
+			return p;
+		++p;
+	}
+
+	while (1) {
+		LexBlock b = _lexLoad(p);
+		unsigned int stops = _lexEqMask(b, '\n') | _lexEqMask(b, '\0');
+		if (stops)
+			return p + _lexFirstBit(stops);
+		p += KSC_LEX_SIMD_WIDTH;
+	}
+}
+
+// Returns the pointer to the first "*" or "\0" of a block comment, "loc" is increased by the count of new lines skipped.
+static const char* _skipToAsterisk(const char* p, int& loc)
+{
+	while (!_lexIsAligned(p)) {
+		if (*p == '*' || *p == '\0')
+			return p;
+		if (*p == '\n')
+			++loc;
+		++p;
+	}
+
+	while (1) {
+		LexBlock b = _lexLoad(p);
+		unsigned int newLines = _lexEqMask(b, '\n');
+		unsigned int stops = _lexEqMask(b, '*') | _lexEqMask(b, '\0');
+		if (stops) {
+			int n = _lexFirstBit(stops);
+			loc += _lexBitCount(newLines & ((1u << n) - 1));
+			return p + n;
+		}
+		loc += _lexBitCount(newLines);
+		p += KSC_LEX_SIMD_WIDTH;
+	}
+}
+
+// Returns the pointer to the first character that cannot be part of an identifier.
+static const char* _skipIdentChars(const char* p)
+{
+	while (!_lexIsAligned(p)) {
+		if (!_isIdentChar(*p))
+			return p;
+		++p;
+	}
+
+	while (1) {
+		LexBlock b = _lexLoad(p);
+		unsigned int identChars = _lexRangeMask(b, 'a', 'z') | _lexRangeMask(b, 'A', 'Z') | 
+			_lexRangeMask(b, '0', '9') | _lexEqMask(b, '_');
+		if (identChars != LEX_FULL_MASK)
+			return p + _lexFirstBit(~identChars);
+		p += KSC_LEX_SIMD_WIDTH;
+	}
+}
+
+#else
+
+static const char* _skipSpaces(const char* p, int& loc)
+{
+	while (_charClass(*p) == kLex_Space) {
+		if (*p == '\n')
+			++loc;
+		++p;
+	}
+	return p;
 }
 
+static const char* _skipLineComment(const char* p)
+{
+	while (*p != '\n' && *p != '\0') 
+		++p;
+	return p;
+}
+
+static const char* _skipToAsterisk(const char* p, int& loc)
+{
+	while (*p != '*' && *p != '\0') {
+		if (*p == '\n')
+			++loc;
+		++p;
+	}
+	return p;
+}
+
+static const char* _skipIdentChars(const char* p)
+{
+	while (_isIdentChar(*p))
+		++p;
+	return p;
+}
+
+#endif // KSC_LEX_SIMD_WIDTH
+
 Token CompilingContext::ScanForToken(std::string& errorMsg)
 {
-	// First skip white space characters and comments
+	// First skip white space characters and comments, e.g. //... and /* ... */
 	//
 	while (1) {
-		const char* beforeSkip = mCurParsingPtr;
-		// Eat the white spaces and new line characters.
-		//
-		while (*mCurParsingPtr == ' ' || *mCurParsingPtr == '\n' || *mCurParsingPtr == '\t') {
-			if (*mCurParsingPtr == '\n')
-				++mCurParsingLOC;
-			++mCurParsingPtr;
-		}
+		mCurParsingPtr = _skipSpaces(mCurParsingPtr, mCurParsingLOC);
+		if (mCurParsingPtr[0] != '/')
+			break;
 
-		// Skip the comments, e.g. //... and /* ... */
-		//
-		if (*mCurParsingPtr == '/') {
-
-			if (*(mCurParsingPtr + 1) == '*') {
-				mCurParsingPtr += 2;
-				// Seek for the end of the comments(*/)
-				bool isLastAsterisk = false;
-				while (*mCurParsingPtr != '\0') {
-					if (isLastAsterisk && *mCurParsingPtr == '/')
-						break;
-					if (*mCurParsingPtr == '*') 
-						isLastAsterisk = true;
-					if (*mCurParsingPtr == '\n') 
-						++mCurParsingLOC;
-					++mCurParsingPtr;
-				}
-				if (*mCurParsingPtr == '\0') {
-					errorMsg = "Comments not ended - unexpected end of file.";
-					return Token::sEOF;
-				}
-				else {
-					++mCurParsingPtr; // Skip "/"
-				}
+		if (mCurParsingPtr[1] == '/') {
+			// Go to the end of the line, the new line character is eaten as white space.
+			mCurParsingPtr = _skipLineComment(mCurParsingPtr + 2);
+		}
+		else if (mCurParsingPtr[1] == '*') {
+			// Seek for the end of the comments(*/)
+			const char* p = mCurParsingPtr + 2;
+			while (1) {
+				p = _skipToAsterisk(p, mCurParsingLOC);
+				if (*p == '\0' || p[1] == '/')
+					break;
+				++p;
 			}
-			else if (*(mCurParsingPtr + 1) == '/') {
-				mCurParsingPtr += 2;
-				// Go to the end of the line
-				while (*mCurParsingPtr != '\0' && *mCurParsingPtr != '\n') 
-					++mCurParsingPtr;
-
-				if (*mCurParsingPtr == '\n') {
-					mCurParsingLOC++;
-					++mCurParsingPtr;
-				}
+			if (*p == '\0') {
+				mCurParsingPtr = p;
+				errorMsg = "Comments not ended - unexpected end of file.";
+				return Token::sEOF;
 			}
+			mCurParsingPtr = p + 2; // Skip "*/"
 		}
-
-		// Break from this loop since the pointer doesn't move forward
-		if (beforeSkip == mCurParsingPtr)
+		else
 			break;
 	}
 
-	// Then read the constant string value
-	// 
-	if (*mCurParsingPtr == '"') {
-		mCurParsingPtr++; // Skip the starting " token
-		mConstStrings.push_back("");
-		std::string& newString = mConstStrings.back();
-		while (1) {
-			if (*mCurParsingPtr != '\\' && *mCurParsingPtr != '"') {
-				newString += *mCurParsingPtr;
-				mCurParsingPtr++;
-			}
-			else if (*mCurParsingPtr == '\\') {
-				mCurParsingPtr++;
-				switch (*mCurParsingPtr) {
-				case 'n':
-					newString += "\n";
-					break;
-				default:
+	const char* pFirstCh = mCurParsingPtr;
+	switch (_charClass(*pFirstCh)) {
+	case kLex_End:
+		return Token::sEOF;  // Reach the end of the file
+
+	case kLex_Quote:
+		{
+			// Read the constant string value
+			// 
+			mCurParsingPtr++; // Skip the starting " token
+			mConstStrings.push_back("");
+			std::string& newString = mConstStrings.back();
+			while (1) {
+				if (*mCurParsingPtr != '\\' && *mCurParsingPtr != '"') {
 					newString += *mCurParsingPtr;
+					mCurParsingPtr++;
+				}
+				else if (*mCurParsingPtr == '\\') {
+					mCurParsingPtr++;
+					switch (*mCurParsingPtr) {
+					case 'n':
+						newString += "\n";
+						break;
+					default:
+						newString += *mCurParsingPtr;
+						break;
+					}
+					mCurParsingPtr++;
+				}
+				else {
+					mCurParsingPtr++;
 					break;
 				}
-				mCurParsingPtr++;
-			}
-			else {
-				mCurParsingPtr++;
-				break;
 			}
+
+			return Token(&newString[0], newString.length(), mCurParsingLOC, Token::kString);
 		}
 
-		return Token(&newString[0], newString.length(), mCurParsingLOC, Token::kString);
-	}
+	case kLex_Operator:
+		{
+			char follow = s_LexTables.opFollow[(unsigned char)*pFirstCh];
+			int len = (follow != 0 && pFirstCh[1] == follow) ? 2 : 1;
+			mCurParsingPtr += len;
+			return Token(pFirstCh, len, mCurParsingLOC, Token::kBinaryOp);
+		}
 
-	Token ret = Token::sInvalid;
-	if (*mCurParsingPtr == '\0') 
-		return Token::sEOF;  // Reach the end of the file
-	
-	// Now it is expecting a token.
-	//
-	if (_isFirstN_Equal(mCurParsingPtr, "++") ||
-		_isFirstN_Equal(mCurParsingPtr, "--") ||
-		_isFirstN_Equal(mCurParsingPtr, "||") ||
-		_isFirstN_Equal(mCurParsingPtr, "&&") ||
-		_isFirstN_Equal(mCurParsingPtr, "==") ||
-		_isFirstN_Equal(mCurParsingPtr, ">=") ||
-		_isFirstN_Equal(mCurParsingPtr, "<=") ) {
-
-		ret = Token(mCurParsingPtr, 2, mCurParsingLOC, Token::kBinaryOp);
-		mCurParsingPtr += 2;
-	}
-	else if (_isFirstN_Equal(mCurParsingPtr, "+") ||
-			 _isFirstN_Equal(mCurParsingPtr, "-") ||
-			 _isFirstN_Equal(mCurParsingPtr, "*") ||
-			 _isFirstN_Equal(mCurParsingPtr, "/") ||
-			 _isFirstN_Equal(mCurParsingPtr, "|") ||
-			 _isFirstN_Equal(mCurParsingPtr, "&") ||
-			 _isFirstN_Equal(mCurParsingPtr, "=") ||
-			 _isFirstN_Equal(mCurParsingPtr, ">") ||
-			 _isFirstN_Equal(mCurParsingPtr, "<") ) {
-
-		ret = Token(mCurParsingPtr, 1, mCurParsingLOC, Token::kBinaryOp);
-		++mCurParsingPtr;
-	}
-	else if(*mCurParsingPtr == '{') {
-		ret = Token(mCurParsingPtr, 1, mCurParsingLOC, Token::kOpenCurly);
-		++mCurParsingPtr;
-	}
-	else if(*mCurParsingPtr == '}') {
-		ret = Token(mCurParsingPtr, 1, mCurParsingLOC, Token::kCloseCurly);
-		++mCurParsingPtr;
-	}
-	else if(*mCurParsingPtr == '[') {
-		ret = Token(mCurParsingPtr, 1, mCurParsingLOC, Token::kOpenBraket);
-		++mCurParsingPtr;
-	}
-	else if(*mCurParsingPtr == ']') {
-		ret = Token(mCurParsingPtr, 1, mCurParsingLOC, Token::kCloseBraket);
-		++mCurParsingPtr;
-	}
-	else if(*mCurParsingPtr == '(') {
-		ret = Token(mCurParsingPtr, 1, mCurParsingLOC, Token::kOpenParenthesis);
-		++mCurParsingPtr;
-	}
-	else if(*mCurParsingPtr == ')') {
-		ret = Token(mCurParsingPtr, 1, mCurParsingLOC, Token::kCloseParenthesis);
-		++mCurParsingPtr;
-	}
-	else if(*mCurParsingPtr == ',') {
-		ret = Token(mCurParsingPtr, 1, mCurParsingLOC, Token::kComma);
-		++mCurParsingPtr;
-	}
-	else if(*mCurParsingPtr == ';') {
-		ret = Token(mCurParsingPtr, 1, mCurParsingLOC, Token::kSemiColon);
-		++mCurParsingPtr;
-	}
-	else if(*mCurParsingPtr == '.') {
-		ret = Token(mCurParsingPtr, 1, mCurParsingLOC, Token::kPeriod);
-		++mCurParsingPtr;
-	}
-	else if(*mCurParsingPtr == '!') {
-		ret = Token(mCurParsingPtr, 1, mCurParsingLOC, Token::kUnaryOp);
+	case kLex_Single:
 		++mCurParsingPtr;
-	}
-	else {
-		// Now handling for constants for identifiers
-		bool isFirstCharNumber = _isNumber(*mCurParsingPtr);
-		if (!isFirstCharNumber && !_isAlpha(*mCurParsingPtr) && *mCurParsingPtr != '_') {
-			// Unrecoginzed character
-			return Token(mCurParsingPtr++, 1, mCurParsingLOC, Token::kUnknown);
-		}
-
-		const char* pFirstCh = mCurParsingPtr;
-		int idLen = 0;
-		while (	*mCurParsingPtr != '\0' &&
-				(_isAlpha(*mCurParsingPtr) ||
-				_isNumber(*mCurParsingPtr) ||
-				*mCurParsingPtr == '_')) {
-			idLen++;
-			++mCurParsingPtr;
-		}
-		bool hasNonNumber = false;
-		for (int i = 0; i < idLen; ++i) {
-			if (!_isNumber(pFirstCh[i]))
-				hasNonNumber = true;
-		}
-
-		if (isFirstCharNumber && hasNonNumber) {
-			errorMsg = "Invalid identifier - ";
-			errorMsg.append(pFirstCh, idLen);
-			return Token(NULL, 0, mCurParsingLOC, Token::kUnknown);
-		}
-
-		bool isFloat = false;
-		if (isFirstCharNumber) {
-			// check for decimal point, e.g. 123.456f
-			if (*mCurParsingPtr == '.') {
+		return Token(pFirstCh, 1, mCurParsingLOC, (Token::Type)s_LexTables.singleCharType[(unsigned char)*pFirstCh]);
+
+	case kLex_Alpha:
+		{
+			mCurParsingPtr = _skipIdentChars(pFirstCh + 1);
+			int len = mCurParsingPtr - pFirstCh;
+			SymbolID symbol = mpSymbols ? mpSymbols->Intern(pFirstCh, len) : kInvalidSymbol;
+			return Token(pFirstCh, len, mCurParsingLOC, Token::kIdentifier, symbol);
+		}
+
+	case kLex_Digit:
+		{
+			// The constant number, e.g. 123 or 123.456f
+			//
+			const char* pEnd = _skipIdentChars(pFirstCh + 1);
+			for (const char* p = pFirstCh; p != pEnd; ++p) {
+				if (!_isNumber(*p)) {
+					mCurParsingPtr = pEnd;
+					errorMsg = "Invalid identifier - ";
+					errorMsg.append(pFirstCh, pEnd - pFirstCh);
+					return Token(NULL, 0, mCurParsingLOC, Token::kUnknown);
+				}
+			}
+
+			bool isFloat = false;
+			// check for decimal point
+			if (*pEnd == '.') {
 				isFloat = true;
-				mCurParsingPtr++;
-				while (_isNumber(*mCurParsingPtr)) 
-					mCurParsingPtr++;
+				pEnd++;
+				while (_isNumber(*pEnd)) 
+					pEnd++;
 			}
 
-			if (*mCurParsingPtr == 'f' || *mCurParsingPtr == 'F')
-				mCurParsingPtr++;
+			if (*pEnd == 'f' || *pEnd == 'F')
+				pEnd++;
+
+			mCurParsingPtr = pEnd;
+			return Token(pFirstCh, pEnd - pFirstCh, mCurParsingLOC, isFloat ? Token::kConstFloat : Token::kConstInt);
 		}
-		
-		ret = Token(pFirstCh, mCurParsingPtr - pFirstCh, mCurParsingLOC, isFirstCharNumber ? 
-			(isFloat ? Token::kConstFloat : Token::kConstInt) : 
-			Token::kIdentifier);
+
+	default:
+		// Unrecoginzed character
+		return Token(mCurParsingPtr++, 1, mCurParsingLOC, Token::kUnknown);
 	}
+}
 
-	return ret;
+int CompilingContext::ScanTokens(const char* content)
+{
+	mContentPtr = content;
+	mCurParsingPtr = mContentPtr;
+	mCurParsingLOC = 1;
+
+	// The identifiers are interned as it does for parsing
+	SymbolTable symbols(NULL);
+	mpSymbols = &symbols;
+
+	int tokenCnt = 0;
+	while (1) {
+		std::string errMsg;
+		Token t = ScanForToken(errMsg);
+		if (!errMsg.empty()) {
+			tokenCnt = -1;
+			break;
+		}
+		if (t.IsEOF())
+			break;
+		++tokenCnt;
+	}
+	mpSymbols = NULL;
+	return tokenCnt;
 }
 
 CompilingContext::CompilingContext(const char* content)
@@ -418,6 +850,9 @@ CompilingContext::CompilingContext(const char* content)
 	mContentPtr = content;
 	mCurParsingPtr = mContentPtr;
 	mCurParsingLOC = 0;
+	mpSymbols = NULL;
+	mTokenCursor = 0;
+	mLexErrorLOC = 0;
 	mpCurrentFunc = NULL;
 }
 
@@ -428,14 +863,13 @@ CompilingContext::~CompilingContext()
 
 RootDomain* CompilingContext::Parse(const char* content, CodeDomain* pRefDomain)
 {
-	mBufferedToken.clear();
 	mErrorMessages.clear();
-	mContentPtr = content;
-	mCurParsingPtr = mContentPtr;
-	mCurParsingLOC = 1;
+	RootDomain* rootDomain = new RootDomain(pRefDomain);
+	AST_Arena::Scope arenaScope(rootDomain->GetArena());
+	mpSymbols = rootDomain->GetSymbolTable();
+	Tokenize(content);
 
 	PushStatusCode(kAlllowStructDef | kAlllowFuncDef);
-	RootDomain* rootDomain = new RootDomain(pRefDomain);
 	while (ParseSingleExpression(rootDomain, NULL));
 
 	if (IsEOF() && mErrorMessages.empty()) {
@@ -449,11 +883,10 @@ RootDomain* CompilingContext::Parse(const char* content, CodeDomain* pRefDomain)
 
 bool CompilingContext::ParsePartial(const char* content, CodeDomain* pDomain)
 {
-	mBufferedToken.clear();
 	mErrorMessages.clear();
-	mContentPtr = content;
-	mCurParsingPtr = mContentPtr;
-	mCurParsingLOC = 1;
+	AST_Arena::Scope arenaScope(pDomain->GetArena());
+	mpSymbols = pDomain->GetSymbolTable();
+	Tokenize(content);
 
 	PushStatusCode(kAlllowStructDef | kAlllowFuncDef);
 	while (ParseSingleExpression(pDomain, NULL));
@@ -466,55 +899,62 @@ bool CompilingContext::ParsePartial(const char* content, CodeDomain* pDomain)
 	}
 }
 
+void CompilingContext::Tokenize(const char* content)
+{
+	mContentPtr = content;
+	mCurParsingPtr = mContentPtr;
+	mCurParsingLOC = 1;
+	mTokens.clear();
+	mTokenCursor = 0;
+	mLexErrorMsg.clear();
+	mLexErrorLOC = 0;
+
+	// Most of the tokens are longer than a few characters, so this is usually enough to avoid re-allocation.
+	mTokens.reserve(strlen(content) / 4 + 1);
+	while (1) {
+		std::string errMsg;
+		Token t = ScanForToken(errMsg);
+		if (t.IsValid()) {
+			mTokens.push_back(t);
+		}
+		else {
+			if (!errMsg.empty()) {
+				mLexErrorMsg = errMsg;
+				mLexErrorLOC = mCurParsingLOC;
+			}
+			break;
+		}
+	}
+}
+
 Token CompilingContext::GetNextToken()
 {
 	Token ret = PeekNextToken(0);
 	if (ret.IsValid()) {
-		mBufferedToken.erase(mBufferedToken.begin());
+		++mTokenCursor;
 	}
 	return ret;
 }
 
-Token CompilingContext::PeekNextToken(int next_i)
+const Token& CompilingContext::PeekNextToken(int next_i)
 {
-	int charParsed = 0;
-	int lineParsed = 0;
-
-	int tokenNeeded = 0;
-	if ((int)mBufferedToken.size() <= next_i) 
-		tokenNeeded = next_i -  mBufferedToken.size() + 1;
-	
-	for (int i = 0; i < tokenNeeded; ++i) {
-		std::string errMsg;
-		Token ret = ScanForToken(errMsg);
-
-		if (ret.IsValid()) {
-			mBufferedToken.push_back(ret);
-		}
-		else {
-			if (!errMsg.empty())
-				AddErrorMessage(Token(NULL, 0, mCurParsingLOC, Token::kUnknown), errMsg);
-			break;
-		}
-	}
+	int idx = mTokenCursor + next_i;
+	if (idx < (int)mTokens.size())
+		return mTokens[idx];
 
-	if ((int)mBufferedToken.size() > next_i) {
-		std::list<Token>::iterator it = mBufferedToken.begin();
-		int itCnt = next_i;
-		while (itCnt-- > 0) ++it;
-		return *it;
+	// Report the lexing error only when the parser does reach it
+	if (!mLexErrorMsg.empty()) {
+		AddErrorMessage(Token(NULL, 0, mLexErrorLOC, Token::kUnknown), mLexErrorMsg);
+		mLexErrorMsg.clear();
 	}
-	else 
-		return mErrorMessages.empty() ? Token::sEOF : Token::sInvalid;
+	return mErrorMessages.empty() ? Token::sEOF : Token::sInvalid;
 }
 
 bool IsBuiltInType(const Token& token, TypeDesc* out_type)
 {
-	char tempString[MAX_TOKEN_LENGTH];
-	token.ToAnsiString(tempString);
-	std::hash_map<std::string, TypeDesc>::iterator it = s_BuiltInTypes.find(tempString);
-	if (it != s_BuiltInTypes.end()) {
-		if (out_type) *out_type = it->second;
+	const ReservedWord* pWord = FindReservedWord(token.GetRawData(), token.GetLength());
+	if (pWord && pWord->isType) {
+		if (out_type) *out_type = TypeDesc(pWord->type, pWord->elemCnt, pWord->isInt);
 		return true;
 	}
 	else
@@ -523,11 +963,9 @@ bool IsBuiltInType(const Token& token, TypeDesc* out_type)
 
 bool IsKeyWord(const Token& token, KeyWord* out_key)
 {
-	char tempString[MAX_TOKEN_LENGTH];
-	token.ToAnsiString(tempString);
-	std::hash_map<std::string, KeyWord>::iterator it = s_KeyWords.find(tempString);
-	if (it != s_KeyWords.end()) {
-		if (out_key) *out_key = it->second;
+	const ReservedWord* pWord = FindReservedWord(token.GetRawData(), token.GetLength());
+	if (pWord && !pWord->isType) {
+		if (out_key) *out_key = pWord->keyWord;
 		return true;
 	}
 	else
@@ -597,10 +1035,11 @@ int DataBlock::GetSize()
 	return (int)mData.size();
 }
 
-Exp_StructDef::Exp_StructDef(std::string name, CodeDomain* parentDomain) :
+Exp_StructDef::Exp_StructDef(const Token& name, CodeDomain* parentDomain) :
 	CodeDomain(parentDomain)
 {
-	mStructName = name;
+	mStructName = name.ToStdString();
+	mStructSymbol = name.GetSymbol();
 }
 
 Exp_StructDef::~Exp_StructDef()
@@ -622,11 +1061,11 @@ Exp_StructDef* Exp_StructDef::Parse(CompilingContext& context, CodeDomain* curDo
 		return NULL;
 	}
 
-	if (IsBuiltInType(curT) || IsKeyWord(curT) || curDomain->IsTypeDefined(curT.ToStdString()) || curDomain->IsVariableDefined(curT.ToStdString(), true)) {
+	if (IsBuiltInType(curT) || IsKeyWord(curT) || curDomain->IsTypeDefined(curT.GetSymbol()) || curDomain->IsVariableDefined(curT.GetSymbol(), true)) {
 		context.AddErrorMessage(curT, "Structure name cannot be the built-in type, keyword, user-defined type or previous defined variable name.");
 		return NULL;
 	}
-	std::string structName = curT.ToStdString();
+	Token structName = curT;
 
 	curT = context.GetNextToken();
 	if (!curT.IsValid() || !curT.IsEqual("{")) {
@@ -668,7 +1107,7 @@ void Exp_StructDef::AddVarDefExpression(Exp_VarDef* exp)
 {
 	CodeDomain::AddVarDefExpression(exp);
 	mIdx2ValueDefs[mExpressions.size() - 1] = exp;
-	mElementName2Idx[exp->GetVarName().ToStdString()] = mExpressions.size() - 1;
+	mElementName2Idx[exp->GetVarName().GetSymbol()] = mExpressions.size() - 1;
 }
 
 
@@ -682,6 +1121,11 @@ const std::string& Exp_StructDef::GetStructureName() const
 	return mStructName;
 }
 
+SymbolID Exp_StructDef::GetStructureSymbol() const
+{
+	return mStructSymbol;
+}
+
 VarType Exp_StructDef::GetElementType(int idx, const Exp_StructDef* &outStructDef, int& arraySize) const
 {
 	std::hash_map<int, Exp_VarDef*>::const_iterator it = mIdx2ValueDefs.find(idx);
@@ -695,9 +1139,9 @@ VarType Exp_StructDef::GetElementType(int idx, const Exp_StructDef* &outStructDe
 	}
 }
 
-int Exp_StructDef::GetElementIdxByName(const std::string& name) const
+int Exp_StructDef::GetElementIdxByName(SymbolID name) const
 {
-	std::hash_map<std::string, int>::const_iterator it = mElementName2Idx.find(name);
+	std::hash_map<SymbolID, int>::const_iterator it = mElementName2Idx.find(name);
 	if (it != mElementName2Idx.end())
 		return it->second;
 	else
@@ -829,7 +1273,7 @@ bool Exp_VarDef::Parse(CompilingContext& context, CodeDomain* curDomain, std::ve
 
 	if (!curT.IsValid() || 
 		(!IsBuiltInType(curT, &typeDesc) &&
-		!curDomain->IsTypeDefined(curT.ToStdString()))) {
+		!curDomain->IsTypeDefined(curT.GetSymbol()))) {
 		context.AddErrorMessage(curT, "Invalid token, must be a valid built-in type of user-defined type.");
 		return false;
 	}
@@ -838,7 +1282,7 @@ bool Exp_VarDef::Parse(CompilingContext& context, CodeDomain* curDomain, std::ve
 	VarType varType = typeDesc.type;
 	Exp_StructDef* pStructDef = NULL;
 	if (varType == VarType::kInvalid) {
-		pStructDef = curDomain->GetStructDefineByName(curT.ToStdString());
+		pStructDef = curDomain->GetStructDefineByName(curT.GetSymbol());
 		varType = VarType::kStructure;
 		if (!pStructDef)
 			varType = VarType::kExternType;
@@ -860,12 +1304,12 @@ bool Exp_VarDef::Parse(CompilingContext& context, CodeDomain* curDomain, std::ve
 			context.AddErrorMessage(curT, "The keyword cannot be used as variable.");
 			return false;
 		}
-		if (curDomain->IsTypeDefined(curT.ToStdString())) {
+		if (curDomain->IsTypeDefined(curT.GetSymbol())) {
 			context.AddErrorMessage(curT, "A user-defined type cannot be redefined as variable.");
 			return false;
 		}
 
-		if (curDomain->IsVariableDefined(curT.ToStdString(), false)) {
+		if (curDomain->IsVariableDefined(curT.GetSymbol(), false)) {
 			context.AddErrorMessage(curT, "Variable redefination is not allowed in the same code block.");
 			return false;
 		}
@@ -967,7 +1411,7 @@ bool Exp_VarDef::Parse(CompilingContext& context, CodeDomain* curDomain, std::ve
 
 bool CompilingContext::IsEOF() const
 {
-	return (*mCurParsingPtr == '\0');
+	return mTokenCursor >= (int)mTokens.size() && mLexErrorMsg.empty();
 }
 
 void CompilingContext::PushStatusCode(int code)
@@ -1027,7 +1471,7 @@ bool CompilingContext::ParseSingleExpression(CodeDomain* curDomain, const char*
 
 	if (endT && PeekNextToken(0).IsEqual(endT))
 		return false;
-	else if ((GetStatusCode() & kAllowForExp) && PeekNextToken(0).IsEqual("for")) {
+	else if ((GetStatusCode() & kAllowForExp) && (PeekNextToken(0).IsEqual("for") || PeekNextToken(0).IsEqual("["))) {
 		Exp_For* pFor = Exp_For::Parse(*this, curDomain);
 		if (!pFor) {
 			return false;
@@ -1091,7 +1535,7 @@ bool CompilingContext::ParseSingleExpression(CodeDomain* curDomain, const char*
 		}
 		
 		if (PeekNextToken(0).IsEqual(";")) {
-			curDomain->AddExternalType(curT.ToStdString());
+			curDomain->AddExternalType(curT.GetSymbol());
 			GetNextToken();
 		}
 		else {
@@ -1212,10 +1656,6 @@ CodeDomain::CodeDomain(CodeDomain* parent)
 CodeDomain::~CodeDomain()
 {
 
-	std::vector<Expression*>::iterator it_exp = mExpressions.begin();
-	for (; it_exp != mExpressions.end(); ++it_exp) {
-		delete *it_exp;
-	}
 }
 
 bool CodeDomain::HasReturnExpForAllPaths()
@@ -1242,6 +1682,16 @@ CodeDomain* CodeDomain::GetParent()
 	return mpParentDomain;
 }
 
+SymbolTable* CodeDomain::GetSymbolTable()
+{
+	return mpParentDomain ? mpParentDomain->GetSymbolTable() : NULL;
+}
+
+AST_Arena* CodeDomain::GetArena()
+{
+	return mpParentDomain ? mpParentDomain->GetArena() : NULL;
+}
+
 void CodeDomain::AddValueExpression(Exp_ValueEval* exp)
 {
 	if (exp) {
@@ -1253,7 +1703,7 @@ void CodeDomain::AddStructDefExpression(Exp_StructDef* exp)
 {
 	if (exp) {
 		mExpressions.push_back(exp);
-		mDefinedStructures[exp->GetStructureName()] = exp;
+		mDefinedStructures[exp->GetStructureSymbol()] = exp;
 	}
 }
 
@@ -1261,7 +1711,7 @@ void CodeDomain::AddVarDefExpression(Exp_VarDef* exp)
 {
 	if (exp) {
 		mExpressions.push_back(exp);
-		mDefinedVariables[exp->GetVarName().ToStdString()] = exp;
+		mDefinedVariables[exp->GetVarName().GetSymbol()] = exp;
 	}
 }
 
@@ -1269,7 +1719,7 @@ void CodeDomain::AddFunctionDefExpression(Exp_FunctionDecl* exp)
 {
 	if (exp) {
 		mExpressions.push_back(exp);
-		mDefinedFunctions[exp->GetFunctionName()] = exp;
+		mDefinedFunctions[exp->GetFunctionSymbol()] = exp;
 	}
 }
 
@@ -1294,7 +1744,7 @@ void CodeDomain::AddForExpression(Exp_For* exp)
 	}
 }
 
-bool CodeDomain::AddExternalType(const std::string& typeName)
+bool CodeDomain::AddExternalType(SymbolID typeName)
 {
 	if (mExternalTypes.find(typeName) != mExternalTypes.end())
 		return false;
@@ -1307,10 +1757,10 @@ bool CodeDomain::AddExternalType(const std::string& typeName)
 void CodeDomain::AddDefinedType(Exp_StructDef* pStructDef)
 {
 	if (pStructDef)
-		mDefinedStructures[pStructDef->GetStructureName()] = pStructDef;
+		mDefinedStructures[pStructDef->GetStructureSymbol()] = pStructDef;
 }
 
-bool CodeDomain::IsTypeDefined(const std::string& typeName) const
+bool CodeDomain::IsTypeDefined(SymbolID typeName) const
 {
 	if (mDefinedStructures.find(typeName) == mDefinedStructures.end() && mExternalTypes.find(typeName) == mExternalTypes.end()) 
 		return mpParentDomain ? mpParentDomain->IsTypeDefined(typeName) : false;
@@ -1320,10 +1770,10 @@ bool CodeDomain::IsTypeDefined(const std::string& typeName) const
 
 void CodeDomain::AddDefinedVariable(const Token& t, Exp_VarDef* pDef)
 {
-	mDefinedVariables[t.ToStdString()] = pDef;
+	mDefinedVariables[t.GetSymbol()] = pDef;
 }
 
-bool CodeDomain::IsVariableDefined(const std::string& varName, bool includeParent) const
+bool CodeDomain::IsVariableDefined(SymbolID varName, bool includeParent) const
 {
 	if (mDefinedVariables.find(varName) == mDefinedVariables.end()) {
 		if (includeParent && mpParentDomain) 
@@ -1337,35 +1787,35 @@ bool CodeDomain::IsVariableDefined(const std::string& varName, bool includeParen
 
 void CodeDomain::AddDefinedFunction(Exp_FunctionDecl* pFunc)
 {
-	std::string funcName = pFunc->GetFunctionName();
-	std::hash_map<std::string, Exp_FunctionDecl*>::iterator it = mDefinedFunctions.find(funcName);
+	SymbolID funcName = pFunc->GetFunctionSymbol();
+	std::hash_map<SymbolID, Exp_FunctionDecl*>::iterator it = mDefinedFunctions.find(funcName);
 	if (it == mDefinedFunctions.end())
 		mDefinedFunctions[funcName] = pFunc;
 	else
 		assert(0); 
 }
 
-bool CodeDomain::IsFunctionDefined(const std::string& funcName) const
+bool CodeDomain::IsFunctionDefined(SymbolID funcName) const
 {
-	std::hash_map<std::string, Exp_FunctionDecl*>::const_iterator it = mDefinedFunctions.find(funcName);
+	std::hash_map<SymbolID, Exp_FunctionDecl*>::const_iterator it = mDefinedFunctions.find(funcName);
 	if (it == mDefinedFunctions.end())
 		return mpParentDomain ? mpParentDomain->IsFunctionDefined(funcName) : false;
 	else
 		return  true;
 }
 
-Exp_StructDef* CodeDomain::GetStructDefineByName(const std::string& structName)
+Exp_StructDef* CodeDomain::GetStructDefineByName(SymbolID structName)
 {
-	std::hash_map<std::string, Exp_StructDef*>::iterator it = mDefinedStructures.find(structName);
+	std::hash_map<SymbolID, Exp_StructDef*>::iterator it = mDefinedStructures.find(structName);
 	if (it != mDefinedStructures.end())
 		return it->second;
 	else 
 		return mpParentDomain ? mpParentDomain->GetStructDefineByName(structName) : NULL;
 }
 
-Exp_VarDef* CodeDomain::GetVarDefExpByName(const std::string& varName) const
+Exp_VarDef* CodeDomain::GetVarDefExpByName(SymbolID varName) const
 {
-	std::hash_map<std::string, Exp_VarDef*>::const_iterator it = mDefinedVariables.find(varName);
+	std::hash_map<SymbolID, Exp_VarDef*>::const_iterator it = mDefinedVariables.find(varName);
 	if (it != mDefinedVariables.end())
 		return it->second;
 	else 
@@ -1383,8 +1833,7 @@ Exp_VarDef::Exp_VarDef(VarType type, const Token& var, Exp_ValueEval* pInitValue
 
 Exp_VarDef::~Exp_VarDef()
 {
-	if (mpInitValue)
-		delete mpInitValue;
+
 }
 
 void Exp_VarDef::SetStructDef(const Exp_StructDef* pStruct)
@@ -1423,9 +1872,30 @@ int Exp_VarDef::GetArrayCnt() const
 }
 
 RootDomain::RootDomain(CodeDomain* pRefDomain) :
-	CodeDomain(pRefDomain)
+	CodeDomain(pRefDomain),
+	mSymbols(pRefDomain ? pRefDomain->GetSymbolTable() : NULL)
+{
+
+}
+
+SymbolTable* RootDomain::GetSymbolTable()
+{
+	return &mSymbols;
+}
+
+AST_Arena* RootDomain::GetArena()
+{
+	return &mArena;
+}
+
+void* RootDomain::operator new(size_t size)
 {
+	return ::operator new(size);
+}
 
+void RootDomain::operator delete(void* p)
+{
+	::operator delete(p);
 }
 
 RootDomain::~RootDomain()
@@ -1433,7 +1903,7 @@ RootDomain::~RootDomain()
 
 }
 
-Exp_BinaryOp::Exp_BinaryOp(const std::string& op, Exp_ValueEval* pLeft, Exp_ValueEval* pRight)
+Exp_BinaryOp::Exp_BinaryOp(OpCode op, Exp_ValueEval* pLeft, Exp_ValueEval* pRight)
 {
 	mOperator = op;
 	mpLeftExp = pLeft;
@@ -1442,8 +1912,7 @@ Exp_BinaryOp::Exp_BinaryOp(const std::string& op, Exp_ValueEval* pLeft, Exp_Valu
 
 Exp_BinaryOp::~Exp_BinaryOp()
 {
-	delete mpLeftExp;
-	delete mpRightExp;
+
 }
 
 bool CompilingContext::ExpectAndEat(const char* str)
@@ -1463,7 +1932,7 @@ bool CompilingContext::ExpectTypeAndEat(CodeDomain* curDomain, VarType& outType,
 {
 	TypeDesc retType;
 	Token curT = GetNextToken();
-	if (!IsBuiltInType(curT, &retType) && !curDomain->IsTypeDefined(curT.ToStdString())) {
+	if (!IsBuiltInType(curT, &retType) && !curDomain->IsTypeDefined(curT.GetSymbol())) {
 		AddErrorMessage(curT, "Expect built-in type or a predefined structure.");
 		return false;
 	}
@@ -1471,7 +1940,7 @@ bool CompilingContext::ExpectTypeAndEat(CodeDomain* curDomain, VarType& outType,
 	outStructDef = NULL;
 	if (retType.type == VarType::kInvalid) {
 		outType = VarType::kStructure;
-		outStructDef = curDomain->GetStructDefineByName(curT.ToStdString());
+		outStructDef = curDomain->GetStructDefineByName(curT.GetSymbol());
 		if (!outStructDef)
 			outType = VarType::kExternType;
 	}
@@ -1498,6 +1967,7 @@ Exp_ValueEval* CompilingContext::ParseSimpleExpression(CodeDomain* curDomain)
 	if (curT.GetType() == Token::kIdentifier) {
 		// This identifier must be a already defined variable, built-in type or constant
 		TypeDesc tpDesc;
+		BuiltInFunc builtInFunc;
 		if (IsBuiltInType(curT, &tpDesc) && (IsFloatType(tpDesc.type) || IsIntegerType(tpDesc.type))) {
 			// Parse and return the built-in type initializer
 			if (!ExpectAndEat("(")) return NULL;
@@ -1519,23 +1989,23 @@ Exp_ValueEval* CompilingContext::ParseSimpleExpression(CodeDomain* curDomain)
 				exp[i].release();
 			result.reset(new Exp_BuiltInInitializer(expArray, tpDesc.elemCnt, tpDesc.type));
 		}
-		else if (curDomain->IsVariableDefined(curT.ToStdString(), true)) {
+		else if (curDomain->IsVariableDefined(curT.GetSymbol(), true)) {
 			// Return a value ref expression
-			result.reset(new Exp_VariableRef(curT, curDomain->GetVarDefExpByName(curT.ToStdString())));
+			result.reset(new Exp_VariableRef(curT, curDomain->GetVarDefExpByName(curT.GetSymbol())));
 		}
 		else if (curT.IsEqual("true") ||
 				 curT.IsEqual("false")) {
 			bool value = curT.IsEqual("true"); // Eat the "true" or "false"
 			result.reset(new Exp_TrueOrFalse(value));
 		}
-		else if (curDomain->IsFunctionDefined(curT.ToStdString())) {
+		else if (curDomain->IsFunctionDefined(curT.GetSymbol())) {
 			// This should be a function call
 			if (!PeekNextToken(0).IsEqual("(")) {
 				AddErrorMessage(PeekNextToken(0), "\"(\" is expected.");
 				return NULL;
 			}
 			GetNextToken(); // Eat the "("
-			Exp_FunctionDecl* pFuncDecl = curDomain->GetFunctionDeclByName(curT.ToStdString());
+			Exp_FunctionDecl* pFuncDecl = curDomain->GetFunctionDeclByName(curT.GetSymbol());
 			int argCnt = pFuncDecl->GetArgumentCnt();
 			std::vector<std::auto_ptr<Exp_ValueEval> > argExp(argCnt);
 			for (int i = 0; i < argCnt; ++i) {
@@ -1551,6 +2021,26 @@ Exp_ValueEval* CompilingContext::ParseSimpleExpression(CodeDomain* curDomain)
 				argExpArray[i] = argExp[i].release();
 			}
 			result.reset(new Exp_FunctionCall(pFuncDecl, &argExpArray[0], argCnt));
+			if (mpCurrentFunc)
+				mpCurrentFunc->AddCallee(pFuncDecl);
+		}
+		else if (IsBuiltInFunction(curT, &builtInFunc)) {
+			if (!ExpectAndEat("(")) return NULL;
+			int argCnt = GetBuiltInFuncArgCnt(builtInFunc);
+			std::vector<std::auto_ptr<Exp_ValueEval> > argExp(argCnt);
+			for (int i = 0; i < argCnt; ++i) {
+				argExp[i].reset(ParseComplexExpression(curDomain, (i == (argCnt-1)) ? ")" : ","));
+				if (!argExp[i].get()) {
+					AddErrorMessage(PeekNextToken(0), "Invalid function call.");
+					return NULL;
+				}
+				GetNextToken(); // Eat the ")" or ","
+			}
+			std::vector<Exp_ValueEval*> argExpArray(argCnt);
+			for (int i = 0; i < argCnt; ++i) {
+				argExpArray[i] = argExp[i].release();
+			}
+			result.reset(new Exp_BuiltInFuncCall(builtInFunc, &argExpArray[0], argCnt));
 		}
 		else {
 			AddErrorMessage(curT, "Unexpected token.");
@@ -1562,7 +2052,7 @@ Exp_ValueEval* CompilingContext::ParseSimpleExpression(CodeDomain* curDomain)
 		// Generate a unary operator expression
 		Exp_ValueEval* ret = ParseSimpleExpression(curDomain);
 		if (ret)
-			result.reset(new Exp_UnaryOp(curT.ToStdString(), ret));
+			result.reset(new Exp_UnaryOp(curT.IsEqual("!") ? kOpNot : kOpNeg, ret));
 	}
 	else if (curT.GetType() == Token::kOpenParenthesis) {
 		// This expression starts with "(", so it needs to end up with ")".
@@ -1597,7 +2087,7 @@ Exp_ValueEval* CompilingContext::ParseSimpleExpression(CodeDomain* curDomain)
 				AddErrorMessage(curT, "Unexpected token, identifier is expected.");
 				return NULL;
 			}
-			result.reset(new Exp_DotOp(curT.ToStdString(), result.release()));
+			result.reset(new Exp_DotOp(curT, result.release()));
 		}
 		else {
 			Exp_ValueEval* idx = ParseComplexExpression(curDomain, "]");
@@ -1615,70 +2105,68 @@ Exp_ValueEval* CompilingContext::ParseSimpleExpression(CodeDomain* curDomain)
 	return result.release();
 }
 
-Exp_ValueEval* CompilingContext::ParseComplexExpression(CodeDomain* curDomain, const char* pEndToken0, const char* pEndToken1)
+// Pops the top operator and its two operands, then pushes the combined binary expression back to the operand stack.
+static void _reduceBinaryOp(std::vector<Exp_ValueEval*>& operands, std::vector<const BinaryOpInfo*>& operators)
 {
-	std::auto_ptr<Exp_ValueEval> simpleExp0(ParseSimpleExpression(curDomain));
-	if (!simpleExp0.get()) {
-		// Must have some error message if it failed to parse a simple expression
-		assert(!mErrorMessages.empty()); 
-		return NULL;
-	}
-
-	Exp_ValueEval* ret = NULL;
-	Token curT = PeekNextToken(0);
-	if (curT.IsEqual(pEndToken0) || curT.IsEqual(pEndToken1)) {
-		ret = simpleExp0.release();
-	}
-	else {
-		if (curT.GetType() != Token::kBinaryOp) {
-			AddErrorMessage(curT, "Expect a binary operator.");
-			return NULL;
-		}
-		GetNextToken(); // Eat the binary operator
-
-		int op0_level = curT.GetBinaryOpLevel();
-		std::string op0_str = curT.ToStdString();
+	Exp_ValueEval* pRight = operands.back();
+	operands.pop_back();
+	Exp_ValueEval* pLeft = operands.back();
+	operands.pop_back();
+	operands.push_back(new Exp_BinaryOp(operators.back()->code, pLeft, pRight));
+	operators.pop_back();
+}
 
-		std::auto_ptr<Exp_ValueEval> simpleExp1(ParseSimpleExpression(curDomain));
-		if (!simpleExp1.get()) {
+Exp_ValueEval* CompilingContext::ParseComplexExpression(CodeDomain* curDomain, const char* pEndToken0, const char* pEndToken1)
+{
+	// The operator chain is parsed iteratively with an operand stack and an operator stack, the operators with
+	// higher level are combined first and the operators of the same level are combined from left to right
+	// except the assignment, so there's no recursion for the binary operators no matter how long the chain is.
+	//
+	std::vector<Exp_ValueEval*> operands;
+	std::vector<const BinaryOpInfo*> operators;
+	
+	bool succeed = false;
+	while (1) {
+		Exp_ValueEval* simpleExp = ParseSimpleExpression(curDomain);
+		if (!simpleExp) {
 			// Must have some error message if it failed to parse a simple expression
 			assert(!mErrorMessages.empty()); 
-			return NULL;
+			break;
 		}
+		operands.push_back(simpleExp);
 
-		Token nextT = PeekNextToken(0);
-		// Get the next token to decide if the next binary operator is in high level of priority
-		if (nextT.IsEqual(pEndToken0) || nextT.IsEqual(pEndToken1)) {
-			// we are done for this complex value expression, return it.
-			Exp_BinaryOp* pBinaryOp = new Exp_BinaryOp(op0_str, simpleExp0.release(), simpleExp1.release());
-			ret = pBinaryOp;
+		const Token& curT = PeekNextToken(0);
+		if (curT.IsEqual(pEndToken0) || curT.IsEqual(pEndToken1)) {
+			succeed = true;
+			break;
 		}
-		else if (nextT.GetType() == Token::kBinaryOp) {
 
-			GetNextToken(); // Eat the binary operator
-			int op1_level = nextT.GetBinaryOpLevel();
-			std::string op1_str = nextT.ToStdString();
+		const BinaryOpInfo* pOp = NULL;
+		if (curT.GetType() == Token::kBinaryOp)
+			pOp = FindBinaryOp(curT.GetRawData(), curT.GetLength());
+		if (!pOp) {
+			AddErrorMessage(curT, "Expect a binary operator.");
+			break;
+		}
+		GetNextToken(); // Eat the binary operator
 
-			if (op1_level > op0_level) {
-				Exp_ValueEval* simpleExp2 = ParseComplexExpression(curDomain, pEndToken0, pEndToken1);
-				if (simpleExp2) {
-					Exp_BinaryOp* pBinaryOp1 = new Exp_BinaryOp(op1_str, simpleExp1.release(), simpleExp2);
-					Exp_BinaryOp* pBinaryOp0 = new Exp_BinaryOp(op0_str, simpleExp0.release(), pBinaryOp1);
-					ret = pBinaryOp0;
-				}
-			}
-			else {
-				Exp_ValueEval* simpleExp2 = ParseComplexExpression(curDomain, pEndToken0, pEndToken1);
-				if (simpleExp2) {
-					Exp_BinaryOp* pBinaryOp0 = new Exp_BinaryOp(op0_str, simpleExp0.release(), simpleExp1.release());
-					Exp_BinaryOp* pBinaryOp1 = new Exp_BinaryOp(op1_str, pBinaryOp0, simpleExp2);
-					ret = pBinaryOp1;
-				}
-			}
+		while (!operators.empty() && 
+			(operators.back()->level > pOp->level || (operators.back()->level == pOp->level && !pOp->rightAssoc))) {
+			_reduceBinaryOp(operands, operators);
 		}
+		operators.push_back(pOp);
 	}
 
-	return ret;
+	if (!succeed) {
+		for (int i = 0; i < (int)operands.size(); ++i)
+			delete operands[i];
+		return NULL;
+	}
+
+	while (!operators.empty())
+		_reduceBinaryOp(operands, operators);
+	assert(operands.size() == 1);
+	return operands[0];
 }
 
 Exp_Constant::Exp_Constant(double v, bool f)
@@ -1712,6 +2200,17 @@ bool Exp_Constant::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::ve
 	return true;
 }
 
+// Adds up the speculation costs, -1 if any of them is -1
+static int AddSpeculationCost(int cost0, int cost1)
+{
+	return (cost0 < 0 || cost1 < 0) ? -1 : cost0 + cost1;
+}
+
+int Exp_Constant::GetSpeculationCost() const
+{
+	return 0;
+}
+
 Exp_VariableRef::Exp_VariableRef(Token t, Exp_VarDef* pDef)
 {
 	mVariable = t;
@@ -1743,6 +2242,11 @@ bool Exp_VariableRef::IsAssignable(bool allowSwizzle) const
 	}
 }
 
+int Exp_VariableRef::GetSpeculationCost() const
+{
+	return 1;
+}
+
 const Exp_StructDef* Exp_VariableRef::GetStructDef()
 {
 	if (mpDef) 
@@ -1772,10 +2276,7 @@ Exp_BuiltInInitializer::Exp_BuiltInInitializer(Exp_ValueEval** pExp, int cnt, Va
 
 Exp_BuiltInInitializer::~Exp_BuiltInInitializer()
 {
-	for (int i = 0; i < 4; ++i) {
-		if (mpSubExprs[i])
-			delete mpSubExprs[i];
-	}
+
 }
 
 bool Exp_BuiltInInitializer::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg)
@@ -1816,7 +2317,17 @@ bool Exp_BuiltInInitializer::CheckSemantic(TypeInfo& outType, std::string& errMs
 	return true;
 }
 
-Exp_UnaryOp::Exp_UnaryOp(const std::string& op, Exp_ValueEval* pExp)
+int Exp_BuiltInInitializer::GetSpeculationCost() const
+{
+	int cost = 1;
+	for (int i = 0; i < 4; ++i) {
+		if (mpSubExprs[i])
+			cost = AddSpeculationCost(cost, mpSubExprs[i]->GetSpeculationCost());
+	}
+	return cost;
+}
+
+Exp_UnaryOp::Exp_UnaryOp(OpCode op, Exp_ValueEval* pExp)
 {
 	mOpType = op;
 	mpExpr = pExp;
@@ -1824,8 +2335,7 @@ Exp_UnaryOp::Exp_UnaryOp(const std::string& op, Exp_ValueEval* pExp)
 
 Exp_UnaryOp::~Exp_UnaryOp()
 {
-	if (mpExpr)
-		delete mpExpr;
+
 }
 
 bool Exp_UnaryOp::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg)
@@ -1839,7 +2349,7 @@ bool Exp_UnaryOp::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vec
 		return false;
 	}
 
-	if (mOpType == "!" && outType.type != VarType::kBoolean) {
+	if (mOpType == kOpNot && outType.type != VarType::kBoolean) {
 		errMsg = "\"!\" must be followed with boolean expression.";
 		return false;
 	}
@@ -1848,6 +2358,11 @@ bool Exp_UnaryOp::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vec
 	return true;
 }
 
+int Exp_UnaryOp::GetSpeculationCost() const
+{
+	return AddSpeculationCost(1, mpExpr->GetSpeculationCost());
+}
+
 
 bool Exp_BinaryOp::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg)
 {
@@ -1861,7 +2376,7 @@ bool Exp_BinaryOp::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::ve
 
 	if (leftType.type == VarType::kStructure || rightType.type == VarType::kStructure) {
 		// Only "=" operator can accept structure as the arguments
-		if (mOperator == "=") {
+		if (mOperator == kOpAssign) {
 			if (leftType.pStructDef != rightType.pStructDef) {
 				errMsg = "Cannot assign from different structure.";
 				return false;
@@ -1880,7 +2395,7 @@ bool Exp_BinaryOp::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::ve
 	}
 
 	if (leftType.type == VarType::kExternType || rightType.type == VarType::kExternType) {
-		if (mOperator == "=") {
+		if (mOperator == kOpAssign) {
 
 			if (leftType.type != rightType.type) {
 				errMsg = "Cannot do binary operation between external type and internal type";
@@ -1900,14 +2415,14 @@ bool Exp_BinaryOp::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::ve
 		return false;
 	}
 
-	bool isArithmetric = (mOperator == "+" || mOperator == "-" || mOperator == "*" || mOperator == "/");
-	bool isCompareOp = (mOperator == "==" || mOperator == ">=" || mOperator == ">" || mOperator == "<=" || mOperator == "<");
-	bool isLogicOp = (mOperator == "||" || mOperator == "&&");
-	bool isBitwizeOp = (mOperator == "|" || mOperator == "&");
+	bool isArithmetric = (mOperator >= kOpAdd && mOperator <= kOpDiv);
+	bool isCompareOp = (mOperator >= kOpEqual && mOperator <= kOpLess);
+	bool isLogicOp = (mOperator == kOpLogicOr || mOperator == kOpLogicAnd);
+	bool isBitwizeOp = (mOperator == kOpBitOr || mOperator == kOpBitAnd);
 
 	if (isCompareOp) {
 
-		if (mOperator == "==") {
+		if (mOperator == kOpEqual) {
 			if (leftType.type != rightType.type || leftType.type == VarType::kStructure || rightType.type == VarType::kStructure) {
 				errMsg = "\"==\" operator cannot be performed with structures or two different built-in types.";
 				return false;
@@ -1916,13 +2431,13 @@ bool Exp_BinaryOp::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::ve
 		else {
 			// "greater than" or "less than" operators can only be performed on numerical scalar values
 			if (leftType.type == VarType::kBoolean || rightType.type == VarType::kBoolean) {
-				errMsg = mOperator;
+				errMsg = GetOpCodeString(mOperator);
 				errMsg += " operator cannot be performed with boolean values.";
 				return false;
 			}
 
 			if (TypeElementCnt(leftType.type) > 1 || TypeElementCnt(rightType.type) > 1) {
-				errMsg = mOperator;
+				errMsg = GetOpCodeString(mOperator);
 				errMsg += " operator can only be performed on scalar values.";
 				return false;
 			}
@@ -1936,7 +2451,7 @@ bool Exp_BinaryOp::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::ve
 		return true;
 	}
 
-	if (isArithmetric || isBitwizeOp || mOperator == "=") {
+	if (isArithmetric || isBitwizeOp || mOperator == kOpAssign) {
 
 		// Perform the additional check for bitwize operation
 		if (isBitwizeOp) {
@@ -1962,7 +2477,7 @@ bool Exp_BinaryOp::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::ve
 			}
 		}
 
-		if (mOperator == "=") {
+		if (mOperator == kOpAssign) {
 			if (!mpLeftExp->IsAssignable(true)) {
 				errMsg = "Cannot do assignment with left value.";
 				return false;
@@ -1995,16 +2510,24 @@ bool Exp_BinaryOp::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::ve
 	return false;
 }
 
-Exp_DotOp::Exp_DotOp(const std::string& opStr, Exp_ValueEval* pExp)
+int Exp_BinaryOp::GetSpeculationCost() const
+{
+	// The integer division traps on zero, which the branch may be there to avoid
+	if (mOperator == kOpAssign || (mOperator == kOpDiv && IsIntegerType(GetCachedTypeInfo().type)))
+		return -1;
+	return AddSpeculationCost(1, AddSpeculationCost(mpLeftExp->GetSpeculationCost(), mpRightExp->GetSpeculationCost()));
+}
+
+Exp_DotOp::Exp_DotOp(const Token& opToken, Exp_ValueEval* pExp)
 {
-	mOpStr = opStr;
+	mOpStr = opToken.ToStdString();
+	mOpSymbol = opToken.GetSymbol();
 	mpExp = pExp;
 }
 
 Exp_DotOp::~Exp_DotOp()
 {
-	if (mpExp)
-		delete mpExp;
+
 }
 
 bool Exp_DotOp::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg)
@@ -2018,8 +2541,8 @@ bool Exp_DotOp::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vecto
 	}
 
 	if (parentType.type == VarType::kStructure) {
-		if (parentType.pStructDef->IsVariableDefined(mOpStr, false)) {
-			Exp_VarDef* pDef = parentType.pStructDef->GetVarDefExpByName(mOpStr);
+		if (parentType.pStructDef->IsVariableDefined(mOpSymbol, false)) {
+			Exp_VarDef* pDef = parentType.pStructDef->GetVarDefExpByName(mOpSymbol);
 			assert(pDef);
 			outType.type = pDef->GetVarType();
 			if (outType.type == VarType::kStructure)
@@ -2070,11 +2593,22 @@ bool Exp_DotOp::IsAssignable(bool allowSwizzle) const
 	return GetCachedTypeInfo().assignable;
 }
 
+int Exp_DotOp::GetSpeculationCost() const
+{
+	return AddSpeculationCost(1, mpExp->GetSpeculationCost());
+}
+
+const Exp_ValueEval* Exp_DotOp::GetParentExp() const
+{
+	return mpExp;
+}
+
 Exp_FunctionDecl::Exp_FunctionDecl(CodeDomain* parent) :
 	CodeDomain(parent)
 {
 	mReturnType = VarType::kInvalid;
 	mpRetStruct = NULL;
+	mFuncSymbol = kInvalidSymbol;
 	mHasBody = false;
 }
 
@@ -2088,6 +2622,11 @@ const std::string Exp_FunctionDecl::GetFunctionName() const
 	return mFuncName;
 }
 
+SymbolID Exp_FunctionDecl::GetFunctionSymbol() const
+{
+	return mFuncSymbol;
+}
+
 VarType Exp_FunctionDecl::GetReturnType(const Exp_StructDef* &retStruct)
 {
 	retStruct = mpRetStruct;
@@ -2106,7 +2645,7 @@ Exp_FunctionDecl::ArgDesc* Exp_FunctionDecl::GetArgumentDesc(int idx)
 
 bool Exp_FunctionDecl::HasSamePrototype(const Exp_FunctionDecl& ref) const
 {
-	if (mFuncName != ref.mFuncName)
+	if (mFuncSymbol != ref.mFuncSymbol)
 		return false;
 	if (mReturnType != ref.mReturnType)
 		return false;
@@ -2127,10 +2666,29 @@ bool Exp_FunctionDecl::HasBody() const
 	return mHasBody;
 }
 
+void Exp_FunctionDecl::AddCallee(Exp_FunctionDecl* pCallee)
+{
+	for (int i = 0; i < (int)mCallees.size(); ++i) {
+		if (mCallees[i] == pCallee)
+			return;
+	}
+	mCallees.push_back(pCallee);
+}
+
+int Exp_FunctionDecl::GetCalleeCnt() const
+{
+	return (int)mCallees.size();
+}
+
+Exp_FunctionDecl* Exp_FunctionDecl::GetCallee(int idx)
+{
+	return mCallees[idx];
+}
+
 
-Exp_FunctionDecl* CodeDomain::GetFunctionDeclByName(const std::string& funcName)
+Exp_FunctionDecl* CodeDomain::GetFunctionDeclByName(SymbolID funcName)
 {
-	std::hash_map<std::string, Exp_FunctionDecl*>::iterator it = mDefinedFunctions.find(funcName);
+	std::hash_map<SymbolID, Exp_FunctionDecl*>::iterator it = mDefinedFunctions.find(funcName);
 	if (it != mDefinedFunctions.end())
 		return it->second;
 	else
@@ -2159,8 +2717,9 @@ Exp_FunctionDecl* Exp_FunctionDecl::Parse(CompilingContext& context, CodeDomain*
 	//
 	Token curT = context.GetNextToken();
 	Token funcNameT = curT;
-	bool alreadyDefined = (curDomain->IsFunctionDefined(curT.ToStdString()));
+	bool alreadyDefined = (curDomain->IsFunctionDefined(curT.GetSymbol()));
 	result->mFuncName = curT.ToStdString();
+	result->mFuncSymbol = curT.GetSymbol();
 
 	// The coming tokens should be the function arguments in a pair of brackets
 	// e.g. (Type0 arg0, Type1 arg1)
@@ -2198,7 +2757,7 @@ Exp_FunctionDecl* Exp_FunctionDecl::Parse(CompilingContext& context, CodeDomain*
 
 	Exp_FunctionDecl* pFuncDef = NULL;
 	if (alreadyDefined) {
-		pFuncDef = curDomain->GetFunctionDeclByName(result->mFuncName);
+		pFuncDef = curDomain->GetFunctionDeclByName(result->mFuncSymbol);
 		assert(pFuncDef);
 		if (!result->HasSamePrototype(*pFuncDef)) {
 			context.AddErrorMessage(curT, "Function declared with different prototype.");
@@ -2273,8 +2832,7 @@ Exp_FuncRet::Exp_FuncRet(Exp_FunctionDecl* pFuncDecl, Exp_ValueEval* pRet)
 
 Exp_FuncRet::~Exp_FuncRet()
 {
-	if (mpRetValue)
-		delete mpRetValue;
+
 }
 
 bool Exp_FuncRet::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg)
@@ -2332,6 +2890,11 @@ bool Exp_TrueOrFalse::CheckSemantic(TypeInfo& outType, std::string& errMsg, std:
 	return true;
 }
 
+int Exp_TrueOrFalse::GetSpeculationCost() const
+{
+	return 0;
+}
+
 Exp_ValueEval::Exp_ValueEval()
 {
 	mCachedTypeInfo.type = VarType::kInvalid;
@@ -2362,6 +2925,11 @@ Exp_ValueEval::ValuePtrInfo Exp_ValueEval::GetValuePtr(CG_Context* context) cons
 	return ptrInfo;
 }
 
+int Exp_ValueEval::GetSpeculationCost() const
+{
+	return -1;
+}
+
 Exp_FunctionCall::Exp_FunctionCall(Exp_FunctionDecl* pFuncDef, Exp_ValueEval** ppArgs, int cnt)
 {
 	mpFuncDef = pFuncDef;
@@ -2371,8 +2939,7 @@ Exp_FunctionCall::Exp_FunctionCall(Exp_FunctionDecl* pFuncDef, Exp_ValueEval** p
 
 Exp_FunctionCall::~Exp_FunctionCall()
 {
-	for (int i = 0; i < (int)mInputArgs.size(); ++i) 
-		delete mInputArgs[i];
+
 }
 
 bool Exp_FunctionCall::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg)
@@ -2422,6 +2989,66 @@ bool Exp_FunctionCall::CheckSemantic(TypeInfo& outType, std::string& errMsg, std
 	return true;
 }
 
+Exp_BuiltInFuncCall::Exp_BuiltInFuncCall(BuiltInFunc func, Exp_ValueEval** ppArgs, int cnt)
+{
+	mFunc = func;
+	mArgType = VarType::kFloat;
+	for (int i = 0; i < cnt; ++i) 
+		mInputArgs.push_back(ppArgs[i]);
+}
+
+Exp_BuiltInFuncCall::~Exp_BuiltInFuncCall()
+{
+
+}
+
+bool Exp_BuiltInFuncCall::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg)
+{
+	// The arguments are converted to the widest one, the scalar arguments are broadcast to it
+	int elemCnt = 1;
+	bool isInt = s_BuiltInFuncs[mFunc].keepsInt;
+	for (int i = 0; i < (int)mInputArgs.size(); ++i) {
+		TypeInfo argTypeInfo;
+		if (!mInputArgs[i]->CheckSemantic(argTypeInfo, errMsg, warnMsg))
+			return false;
+		if (argTypeInfo.arraySize > 0 || (!IsFloatType(argTypeInfo.type) && !IsIntegerType(argTypeInfo.type))) {
+			errMsg = GetBuiltInFuncName(mFunc);
+			errMsg += " must take float or integer types.";
+			return false;
+		}
+		int argElemCnt = TypeElementCnt(argTypeInfo.type);
+		if (argElemCnt > 1) {
+			if (elemCnt > 1 && elemCnt != argElemCnt) {
+				errMsg = GetBuiltInFuncName(mFunc);
+				errMsg += " must take the vectors of the same size.";
+				return false;
+			}
+			elemCnt = argElemCnt;
+		}
+		if (!IsIntegerType(argTypeInfo.type))
+			isInt = false;
+	}
+	if (mFunc == kBuiltInCross && elemCnt != 3) {
+		errMsg = "cross must take float3.";
+		return false;
+	}
+	mArgType = MakeType(isInt, elemCnt);
+	outType.type = s_BuiltInFuncs[mFunc].isReduction ? MakeType(isInt, 1) : mArgType;
+	outType.pStructDef = NULL;
+	outType.arraySize = 0;
+	outType.assignable = false;
+	mCachedTypeInfo = outType;
+	return true;
+}
+
+int Exp_BuiltInFuncCall::GetSpeculationCost() const
+{
+	int cost = s_BuiltInFuncs[mFunc].cost;
+	for (int i = 0; i < (int)mInputArgs.size(); ++i)
+		cost = AddSpeculationCost(cost, mInputArgs[i]->GetSpeculationCost());
+	return cost;
+}
+
 Exp_ConstString::Exp_ConstString(const char* pString)
 {
 	mStringPtr = pString;
@@ -2456,8 +3083,7 @@ Exp_Indexer::Exp_Indexer(Exp_ValueEval* pExp, Exp_ValueEval* pIndex)
 
 Exp_Indexer::~Exp_Indexer()
 {
-	delete mpExp;
-	delete mpIndex;
+
 }
 
 bool Exp_Indexer::CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg)
@@ -2501,12 +3127,7 @@ Exp_If::Exp_If(CodeDomain* parent)
 
 Exp_If::~Exp_If()
 {
-	if (mpCondValue)
-		delete mpCondValue;
-	if (mpIfDomain)
-		delete mpIfDomain;
-	if (mpElseDomain)
-		delete mpElseDomain;
+
 }
 
 bool Exp_If::CheckSemantic(Exp_ValueEval::TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg)
@@ -2596,12 +3217,13 @@ Exp_For::Exp_For()
 {
 	mForBody = NULL;
 	mStartStepCond = NULL;
+	mLoopAttr = kLoopAttrNone;
+	mUnrollCount = 0;
 }
 
 Exp_For::~Exp_For()
 {
-	if (mForBody) delete mForBody;
-	if (mStartStepCond) delete mStartStepCond;
+
 }
 
 bool Exp_For::CheckSemantic(Exp_ValueEval::TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg)
@@ -2620,12 +3242,47 @@ bool Exp_For::CheckSemantic(Exp_ValueEval::TypeInfo& outType, std::string& errMs
 Exp_For* Exp_For::Parse(CompilingContext& context, CodeDomain* curDomain)
 {
 	Token curT = context.GetNextToken();
+	LoopAttribute loopAttr = kLoopAttrNone;
+	int unrollCount = 0;
+	if (curT.IsEqual("[")) {
+		// Parse the loop attribute: [loop], [unroll] or [unroll(N)]
+		Token attrT = context.GetNextToken();
+		if (attrT.IsEqual("loop"))
+			loopAttr = kLoopAttrLoop;
+		else if (attrT.IsEqual("unroll")) {
+			loopAttr = kLoopAttrUnroll;
+			if (context.PeekNextToken(0).IsEqual("(")) {
+				context.GetNextToken(); // Eat the "("
+				Token countT = context.GetNextToken();
+				if (countT.GetType() != Token::kConstInt || countT.GetConstValue() < 1) {
+					context.AddErrorMessage(countT, "The unroll count must be a positive integer constant.");
+					return NULL;
+				}
+				unrollCount = (int)countT.GetConstValue();
+				if (!context.ExpectAndEat(")"))
+					return NULL;
+			}
+		}
+		else {
+			context.AddErrorMessage(attrT, "Unknown loop attribute, [loop], [unroll] or [unroll(N)] is expected.");
+			return NULL;
+		}
+		if (!context.ExpectAndEat("]"))
+			return NULL;
+		curT = context.GetNextToken();
+		if (!curT.IsEqual("for")) {
+			context.AddErrorMessage(curT, "The loop attribute must be followed by a for statement.");
+			return NULL;
+		}
+	}
 	if (!curT.IsEqual("for"))
 		return NULL;
 	curT = context.GetNextToken();
 	if (!curT.IsEqual("("))
 		return NULL;
 	std::auto_ptr<Exp_For> result(new Exp_For());
+	result->mLoopAttr = loopAttr;
+	result->mUnrollCount = unrollCount;
 	result->mStartStepCond = new CodeDomain(curDomain);
 	// Parse start expression
 	if (!context.ParseSingleExpression(result->mStartStepCond, ";")) 
@@ -2650,11 +3307,12 @@ Exp_For* Exp_For::Parse(CompilingContext& context, CodeDomain* curDomain)
 		context.AddErrorMessage(curT, "Invalid for step expression.");
 		return NULL;
 	}
-	context.GetNextToken(); // Eat the ending ";"
+	context.GetNextToken(); // Eat the ending ")"
 	result->mStartStepCond->AddValueExpression(stepValue);
 	assert(result->mStartStepCond->GetExpressionCnt() == 3);
 
 	result->mForBody = new CodeDomain(result->mStartStepCond);
+	curT = context.PeekNextToken(0);
 	if (curT.IsEqual("{")) {
 		context.GetNextToken();  // Eat the "{"
 		if (!context.ParseCodeDomain(result->mForBody, "}")) {
@@ -2673,16 +3331,138 @@ Exp_For* Exp_For::Parse(CompilingContext& context, CodeDomain* curDomain)
 	return result.release();
 }
 
+// All the memory from the arena is aligned to this, which is enough for any member of the expressions.
+#define AST_ARENA_ALIGNMENT 16
+#define AST_ARENA_ALIGN(size) (((size) + AST_ARENA_ALIGNMENT - 1) & ~(size_t)(AST_ARENA_ALIGNMENT - 1))
+#define AST_ARENA_BLOCK_SIZE (64 * 1024)
+
+SC_THREAD_LOCAL AST_Arena* AST_Arena::s_pCurrent = NULL;
+
+AST_Arena::Scope::Scope(AST_Arena* pArena)
+{
+	mpPrevArena = s_pCurrent;
+	s_pCurrent = pArena;
+}
+
+AST_Arena::Scope::~Scope()
+{
+	s_pCurrent = mpPrevArena;
+}
+
+AST_Arena::AST_Arena()
+{
+	mpBlocks = NULL;
+	mpNodes = NULL;
+}
+
+AST_Arena::~AST_Arena()
+{
+	DestroyAll();
+}
+
+void* AST_Arena::Alloc(size_t size)
+{
+	size = AST_ARENA_ALIGN(size);
+	if (!mpBlocks || mpBlocks->used + size > mpBlocks->size) {
+		size_t blockSize = size > AST_ARENA_BLOCK_SIZE ? size : AST_ARENA_BLOCK_SIZE;
+		Block* pBlock = (Block*)::operator new(AST_ARENA_ALIGN(sizeof(Block)) + blockSize);
+		pBlock->size = blockSize;
+		pBlock->used = 0;
+		pBlock->pNext = mpBlocks;
+		mpBlocks = pBlock;
+	}
+
+	void* ret = (char*)mpBlocks + AST_ARENA_ALIGN(sizeof(Block)) + mpBlocks->used;
+	mpBlocks->used += size;
+	return ret;
+}
+
+void AST_Arena::LinkNode(NodeHeader* pNode)
+{
+	pNode->pArena = this;
+	pNode->pPrev = NULL;
+	pNode->pNext = mpNodes;
+	if (mpNodes)
+		mpNodes->pPrev = pNode;
+	mpNodes = pNode;
+}
+
+void AST_Arena::UnlinkNode(NodeHeader* pNode)
+{
+	if (pNode->pPrev)
+		pNode->pPrev->pNext = pNode->pNext;
+	else
+		mpNodes = pNode->pNext;
+	if (pNode->pNext)
+		pNode->pNext->pPrev = pNode->pPrev;
+}
+
+void AST_Arena::DestroyAll()
+{
+	// None of the expressions deletes other expressions in its destructor, so the order doesn't matter here.
+	NodeHeader* pNode = mpNodes;
+	while (pNode) {
+		NodeHeader* pNext = pNode->pNext;
+		Expression* pExp = (Expression*)((char*)pNode + AST_ARENA_ALIGN(sizeof(NodeHeader)));
+		pExp->~Expression();
+		pNode = pNext;
+	}
+	mpNodes = NULL;
+
+	while (mpBlocks) {
+		Block* pNext = mpBlocks->pNext;
+		::operator delete(mpBlocks);
+		mpBlocks = pNext;
+	}
+}
+
+void* AST_Arena::AllocNode(size_t size)
+{
+	size_t headerSize = AST_ARENA_ALIGN(sizeof(NodeHeader));
+	NodeHeader* pNode = NULL;
+	if (s_pCurrent) {
+		pNode = (NodeHeader*)s_pCurrent->Alloc(headerSize + size);
+		s_pCurrent->LinkNode(pNode);
+	}
+	else {
+		// Not in any arena scope, this expression is owned by whoever deletes it
+		pNode = (NodeHeader*)::operator new(headerSize + size);
+		pNode->pArena = NULL;
+	}
+	return (char*)pNode + headerSize;
+}
+
+void AST_Arena::FreeNode(void* p)
+{
+	if (!p)
+		return;
+	NodeHeader* pNode = (NodeHeader*)((char*)p - AST_ARENA_ALIGN(sizeof(NodeHeader)));
+	if (pNode->pArena)
+		pNode->pArena->UnlinkNode(pNode);
+	else
+		::operator delete(pNode);
+}
+
+void* Expression::operator new(size_t size)
+{
+	return AST_Arena::AllocNode(size);
+}
+
+void Expression::operator delete(void* p)
+{
+	AST_Arena::FreeNode(p);
+}
+
 #ifdef WANT_MEM_LEAK_CHECK
-std::set<Expression*> Expression::s_instances;
+SC_THREAD_LOCAL int Expression::s_instanceCnt = 0;
 Expression::Expression()
 {
-	s_instances.insert(this);
+	++s_instanceCnt;
 }
 
 Expression::~Expression()
 {
-	s_instances.erase(this);
+	--s_instanceCnt;
 }
 
 #else
@@ -7,7 +7,10 @@
 #include <set>
 #include "parser_defines.h"
 
+// The leak check counts the live expressions, which is only turned on for debug build.
+#if defined(_DEBUG) && !defined(WANT_MEM_LEAK_CHECK)
 #define WANT_MEM_LEAK_CHECK
+#endif
 
 namespace llvm {
 	class Value;
@@ -33,15 +36,98 @@ namespace SC {
 		kFor,
 		kReturn,
 		kTrue,
-		kFalse
+		kFalse,
+		kExtern
+	};
+
+	// The operators are resolved to the opcodes at parsing time, so neither the semantic check nor
+	// the code generation needs to compare the operator strings.
+	enum OpCode {
+		kOpAssign,		// =
+		kOpLogicOr,		// ||
+		kOpLogicAnd,	// &&
+		kOpEqual,		// ==
+		kOpGreaterEqual,// >=
+		kOpLessEqual,	// <=
+		kOpGreater,		// >
+		kOpLess,		// <
+		kOpBitOr,		// |
+		kOpBitAnd,		// &
+		kOpAdd,			// +
+		kOpSub,			// -
+		kOpMul,			// *
+		kOpDiv,			// /
+		kOpNot,			// ! (unary)
+		kOpNeg,			// - (unary)
+		kOpCodeCnt
 	};
 
+	const char* GetOpCodeString(OpCode op);
+
+	// The built-in functions are not declared in KSCL, they take the arguments of any float or integer type(converted
+	// to float except for min, max and mad on integers) and are generated inline instead of being called. The scalar
+	// arguments are broadcast to the vector ones. A function defined with the same name hides them.
+	enum BuiltInFunc {
+		kBuiltInSin,
+		kBuiltInCos,
+		kBuiltInExp,
+		kBuiltInLog,
+		kBuiltInPow,
+		kBuiltInSqrt,
+		kBuiltInFabs,
+		kBuiltInDot,
+		kBuiltInCross,		// float3 only
+		kBuiltInNormalize,
+		kBuiltInLength,
+		kBuiltInLerp,		// lerp(a, b, t) = a + (b - a) * t
+		kBuiltInSaturate,	// clamped to [0, 1]
+		kBuiltInMin,
+		kBuiltInMax,
+		kBuiltInMad,		// mad(a, b, c) = a * b + c, fused if the target has FMA
+		kBuiltInFuncCnt
+	};
+
+	bool IsBuiltInFunction(const Token& token, BuiltInFunc* out_func = NULL);
+	const char* GetBuiltInFuncName(BuiltInFunc func);
+	int GetBuiltInFuncArgCnt(BuiltInFunc func);
+
 	void Initialize_AST_Gen();
 	void Finish_AST_Gen();
 
 	bool IsBuiltInType(const Token& token, TypeDesc* out_type = NULL);
 	bool IsKeyWord(const Token& token, KeyWord* out_key = NULL);
 
+	// The identifiers are interned by the symbol table during lexing, so the symbol tables of the AST and
+	// code generation can be keyed by the integer IDs instead of the strings.
+	typedef int SymbolID;
+	const SymbolID kInvalidSymbol = -1;
+
+	// The symbol table can be chained to a parent table(e.g. the one of the predefined domain), in this case
+	// the names already interned by the parent keep their IDs and the new names get IDs after the parent's.
+	// The parent table must not intern any new name once it has child tables.
+	//
+	class SymbolTable
+	{
+	private:
+		const SymbolTable* mpParent;
+		SymbolID mBaseID;
+		std::vector<std::string> mNames;
+		std::vector<unsigned int> mHashes;
+		std::vector<SymbolID> mBuckets;  // Open addressing hash table of the local symbols
+
+		static unsigned int HashName(const char* p, int len);
+		SymbolID FindWithHash(const char* p, int len, unsigned int hash) const;
+		void InsertToBucket(int localIdx);
+
+	public:
+		SymbolTable(const SymbolTable* pParent);
+
+		SymbolID Intern(const char* p, int len);
+		SymbolID Find(const char* p, int len) const;
+		const std::string& GetName(SymbolID id) const;
+		int GetSymbolCount() const;
+	};
+
 	class Token
 	{
 	public:
@@ -68,18 +154,21 @@ namespace SC {
 		int mNumOfChar;
 		int mLOC;
 		Type mType;
+		SymbolID mSymbol;
 	public:
 		static Token sInvalid;
 		static Token sEOF;
 	public:
 		Token();
-		Token(const char* p, int num, int line, Type tp);
+		Token(const char* p, int num, int line, Type tp, SymbolID symbol = kInvalidSymbol);
 		Token(const Token& ref);
 
 		double GetConstValue() const;
 		int GetBinaryOpLevel() const;
 		Type GetType() const;
 		int GetLOC() const;
+		SymbolID GetSymbol() const;
+		int GetLength() const;
 
 		bool IsValid() const;
 		bool IsEOF() const;
@@ -110,6 +199,55 @@ namespace SC {
 		int GetSize();
 	};
 
+	// The arena allocates the expressions of one RootDomain from large memory blocks, and it destructs all
+	// the remaining expressions then frees the blocks in one step when the RootDomain is deleted. So the expressions
+	// never delete their sub-expressions. An expression deleted before that(e.g. on parsing failure) is only
+	// destructed, its memory is reclaimed with the arena.
+	//
+	class AST_Arena
+	{
+	private:
+		struct Block {
+			Block* pNext;
+			size_t size;
+			size_t used;
+		};
+
+		struct NodeHeader {
+			AST_Arena* pArena;
+			NodeHeader* pPrev;
+			NodeHeader* pNext;
+		};
+
+		Block* mpBlocks;
+		NodeHeader* mpNodes;  // The expressions not yet destructed
+
+		// Each thread parses with its own arena, so the current arena is per-thread.
+		static SC_THREAD_LOCAL AST_Arena* s_pCurrent;
+
+		void* Alloc(size_t size);
+		void LinkNode(NodeHeader* pNode);
+		void UnlinkNode(NodeHeader* pNode);
+
+	public:
+		// The expressions created within the scope are allocated from the arena.
+		class Scope
+		{
+		private:
+			AST_Arena* mpPrevArena;
+		public:
+			Scope(AST_Arena* pArena);
+			~Scope();
+		};
+
+		AST_Arena();
+		~AST_Arena();
+		void DestroyAll();
+
+		static void* AllocNode(size_t size);
+		static void FreeNode(void* p);
+	};
+
 	class Expression
 	{
 	public:
@@ -117,8 +255,12 @@ namespace SC {
 		virtual ~Expression();
 		virtual llvm::Value* GenerateCode(CG_Context* context) const;
 
+		static void* operator new(size_t size);
+		static void operator delete(void* p);
+
 #ifdef WANT_MEM_LEAK_CHECK
-		static std::set<Expression*> s_instances;
+		// Counted per-thread, so the concurrent compiling does not break the check of each other.
+		static SC_THREAD_LOCAL int s_instanceCnt;
 #endif
 	};
 	
@@ -131,10 +273,10 @@ namespace SC {
 	protected:
 		CodeDomain* mpParentDomain;
 
-		std::hash_map<std::string, Exp_StructDef*> mDefinedStructures;
-		std::hash_map<std::string, Exp_VarDef*> mDefinedVariables;
-		std::hash_map<std::string, Exp_FunctionDecl*> mDefinedFunctions;
-		std::hash_set<std::string> mExternalTypes;
+		std::hash_map<SymbolID, Exp_StructDef*> mDefinedStructures;
+		std::hash_map<SymbolID, Exp_VarDef*> mDefinedVariables;
+		std::hash_map<SymbolID, Exp_FunctionDecl*> mDefinedFunctions;
+		std::hash_set<SymbolID> mExternalTypes;
 
 		std::vector<Expression*> mExpressions;
 
@@ -150,6 +292,8 @@ namespace SC {
 		virtual bool HasReturnExpForAllPaths();
 
 		CodeDomain* GetParent();
+		virtual SymbolTable* GetSymbolTable();
+		virtual AST_Arena* GetArena();
 
 		void AddValueExpression(Exp_ValueEval* exp);
 		void AddStructDefExpression(Exp_StructDef* exp);
@@ -158,15 +302,15 @@ namespace SC {
 		void AddDomainExpression(CodeDomain* exp);
 		void AddIfExpression(Exp_If* exp);
 		void AddForExpression(Exp_For* exp);
-		bool AddExternalType(const std::string& typeName);
+		bool AddExternalType(SymbolID typeName);
 
-		bool IsTypeDefined(const std::string& typeName) const;
-		bool IsVariableDefined(const std::string& varName, bool includeParent) const;
-		bool IsFunctionDefined(const std::string& funcName) const;
+		bool IsTypeDefined(SymbolID typeName) const;
+		bool IsVariableDefined(SymbolID varName, bool includeParent) const;
+		bool IsFunctionDefined(SymbolID funcName) const;
 
-		Exp_StructDef* GetStructDefineByName(const std::string& structName);
-		Exp_VarDef* GetVarDefExpByName(const std::string& varName) const;
-		Exp_FunctionDecl* GetFunctionDeclByName(const std::string& funcName);
+		Exp_StructDef* GetStructDefineByName(SymbolID structName);
+		Exp_VarDef* GetVarDefExpByName(SymbolID varName) const;
+		Exp_FunctionDecl* GetFunctionDeclByName(SymbolID funcName);
 		int GetExpressionCnt() const;
 		Expression* GetExpression(int idx);
 	};
@@ -200,10 +344,11 @@ namespace SC {
 	{
 	private:
 		std::string mStructName;
+		SymbolID mStructSymbol;
 		std::hash_map<int, Exp_VarDef*> mIdx2ValueDefs;
-		std::hash_map<std::string, int> mElementName2Idx;
+		std::hash_map<SymbolID, int> mElementName2Idx;
 	public:
-		Exp_StructDef(std::string name, CodeDomain* parentDomain);
+		Exp_StructDef(const Token& name, CodeDomain* parentDomain);
 		virtual ~Exp_StructDef();
 		virtual llvm::Value* GenerateCode(CG_Context* context) const;
 		virtual void AddVarDefExpression(Exp_VarDef* exp);
@@ -211,8 +356,9 @@ namespace SC {
 		int GetStructSize() const;
 		int GetElementCount() const;
 		const std::string& GetStructureName() const;
+		SymbolID GetStructureSymbol() const;
 		VarType GetElementType(int idx, const Exp_StructDef* &outStructDef, int& arraySize) const;
-		int GetElementIdxByName(const std::string& name) const;
+		int GetElementIdxByName(SymbolID name) const;
 
 		void ConvertToDescription(KSC_StructDesc& ref, CG_Context& ctx) const;
 
@@ -246,6 +392,10 @@ namespace SC {
 		virtual bool IsAssignable(bool allowSwizzle) const;
 		virtual void GenerateAssignCode(CG_Context* context, llvm::Value* pValue) const;
 		virtual ValuePtrInfo GetValuePtr(CG_Context* context) const;
+		// The cost of evaluating the expression speculatively(when its value may not be needed) in simple operations,
+		// for the code generation to replace the branches with selects. It is -1 if the expression has side effects or
+		// may trap, e.g. the assignment, the function call, the integer division or the array indexing.
+		virtual int GetSpeculationCost() const;
 
 	protected:
 		TypeInfo mCachedTypeInfo;
@@ -265,6 +415,7 @@ namespace SC {
 		double GetValue() const;
 		bool IsFloat() const;
 		virtual bool CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg);
+		virtual int GetSpeculationCost() const;
 	};
 
 	class Exp_TrueOrFalse : public Exp_ValueEval
@@ -278,6 +429,7 @@ namespace SC {
 
 		bool GetValue() const;
 		virtual bool CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg);
+		virtual int GetSpeculationCost() const;
 	};
 
 	class Exp_VariableRef : public Exp_ValueEval
@@ -297,6 +449,7 @@ namespace SC {
 		virtual bool CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg);
 		virtual bool IsAssignable(bool allowSwizzle) const;
 		virtual void GenerateAssignCode(CG_Context* context, llvm::Value* pValue) const;
+		virtual int GetSpeculationCost() const;
 	};
 
 	class Exp_BuiltInInitializer : public Exp_ValueEval
@@ -311,34 +464,46 @@ namespace SC {
 		virtual llvm::Value* GenerateCode(CG_Context* context) const;
 
 		virtual bool CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg);
+		virtual int GetSpeculationCost() const;
 	};
 
 	class Exp_UnaryOp : public Exp_ValueEval
 	{
 	private:
-		std::string mOpType;
+		OpCode mOpType;
 		Exp_ValueEval* mpExpr;
 
 	public:
-		Exp_UnaryOp(const std::string& op, Exp_ValueEval* pExp);
+		Exp_UnaryOp(OpCode op, Exp_ValueEval* pExp);
 		virtual ~Exp_UnaryOp();
 		virtual llvm::Value* GenerateCode(CG_Context* context) const;
 		virtual bool CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg);
+		virtual int GetSpeculationCost() const;
 	};
 
 	class Exp_BinaryOp : public Exp_ValueEval
 	{
 	private:
-		std::string mOperator;
+		OpCode mOperator;
 		Exp_ValueEval* mpLeftExp;
 		Exp_ValueEval* mpRightExp;
 
+		// "&&" and "||" evaluate the right side only if the left side doesn't decide the result
+		llvm::Value* GenerateShortCircuitCode(CG_Context* context) const;
+
 	public:
-		Exp_BinaryOp(const std::string& op, Exp_ValueEval* pLeft, Exp_ValueEval* pRight);
+		Exp_BinaryOp(OpCode op, Exp_ValueEval* pLeft, Exp_ValueEval* pRight);
 		virtual ~Exp_BinaryOp();
 		virtual llvm::Value* GenerateCode(CG_Context* context) const;
 
 		virtual bool CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg);
+		virtual int GetSpeculationCost() const;
+
+		// The cost of doing the assignment with a select for the if-conversion, -1 if it's not an assignment to a local
+		// variable(or its member or swizzle) or the value can't be evaluated speculatively.
+		int GetSelectAssignCost(CG_Context* context) const;
+		// The assignment takes effect only if the condition equals to "assignOnTrue".
+		void GenerateSelectAssignCode(CG_Context* context, llvm::Value* pCond, bool assignOnTrue) const;
 	};
 
 	// A DotOp is either to access the structure member or to perform swizzle for a built-in type
@@ -347,9 +512,10 @@ namespace SC {
 	{
 	private:
 		std::string mOpStr;
+		SymbolID mOpSymbol;
 		Exp_ValueEval* mpExp;
 	public:
-		Exp_DotOp(const std::string& opStr, Exp_ValueEval* pExp);
+		Exp_DotOp(const Token& opToken, Exp_ValueEval* pExp);
 		virtual ~Exp_DotOp();
 		virtual llvm::Value* GenerateCode(CG_Context* context) const;
 		virtual void GenerateAssignCode(CG_Context* context, llvm::Value* pValue) const;
@@ -358,6 +524,8 @@ namespace SC {
 		virtual bool IsAssignable(bool allowSwizzle) const;
 
 		virtual ValuePtrInfo GetValuePtr(CG_Context* context) const;
+		virtual int GetSpeculationCost() const;
+		const Exp_ValueEval* GetParentExp() const;
 	};
 
 	class Exp_Indexer : public Exp_ValueEval
@@ -394,20 +562,29 @@ namespace SC {
 		VarType mReturnType;
 		const Exp_StructDef* mpRetStruct;
 		std::string mFuncName;
+		SymbolID mFuncSymbol;
 		std::vector<ArgDesc> mArgments;
 		bool mHasBody;
+		// The functions called in the body, it is the call graph to generate the code on demand.
+		std::vector<Exp_FunctionDecl*> mCallees;
 
 	public:
 		Exp_FunctionDecl(CodeDomain* parent);
 		virtual ~Exp_FunctionDecl();
 		virtual llvm::Value* GenerateCode(CG_Context* context) const;
+		llvm::Function* GeneratePrototype(CG_Context* context) const;
+		void GenerateBody(CG_Context* context, llvm::Function* F) const;
 
 		const std::string GetFunctionName() const;
+		SymbolID GetFunctionSymbol() const;
 		VarType GetReturnType(const Exp_StructDef* &retStruct);
 		int GetArgumentCnt() const;
 		ArgDesc* GetArgumentDesc(int idx);
 		bool HasSamePrototype(const Exp_FunctionDecl& ref) const;
 		bool HasBody() const;
+		void AddCallee(Exp_FunctionDecl* pCallee);
+		int GetCalleeCnt() const;
+		Exp_FunctionDecl* GetCallee(int idx);
 		void ConvertToDescription(KSC_FunctionDesc& desc, CG_Context& ctx);
 
 		static Exp_FunctionDecl* Parse(CompilingContext& context, CodeDomain* curDomain);
@@ -439,6 +616,22 @@ namespace SC {
 		virtual bool CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg);
 	};
 
+	class Exp_BuiltInFuncCall : public Exp_ValueEval
+	{
+	private:
+		std::vector<Exp_ValueEval*> mInputArgs;
+		BuiltInFunc mFunc;
+		// The type all the arguments are converted to
+		VarType mArgType;
+	public:
+		Exp_BuiltInFuncCall(BuiltInFunc func, Exp_ValueEval** ppArgs, int cnt);
+		virtual ~Exp_BuiltInFuncCall();
+		virtual llvm::Value* GenerateCode(CG_Context* context) const;
+
+		virtual bool CheckSemantic(TypeInfo& outType, std::string& errMsg, std::vector<std::string>& warnMsg);
+		virtual int GetSpeculationCost() const;
+	};
+
 	class Exp_ConstString : public Exp_ValueEval
 	{
 	private:
@@ -459,6 +652,10 @@ namespace SC {
 		CodeDomain* mpIfDomain;
 		CodeDomain* mpElseDomain;
 		Exp_ValueEval* mpCondValue;
+
+		// The if-conversion: the branches of only a few assignments to the local variables with the values that can be
+		// evaluated speculatively are done with selects instead, so the loops stay free of branches for the vectorizer.
+		bool IsSelectConvertible(CG_Context* context) const;
 	public:
 		Exp_If(CodeDomain* parent);
 		virtual ~Exp_If();
@@ -470,9 +667,21 @@ namespace SC {
 
 	class Exp_For : public Expression
 	{
+	public:
+		// The attribute written before "for", e.g. "[unroll(4)] for (...)". Only [unroll(N)] is enforced, by the code
+		// generation. [loop] and [unroll] are the hints of the loop metadata, which LLVM 3.2 ignores, so they are no-ops
+		// with it.
+		//
+		enum LoopAttribute {
+			kLoopAttrNone,
+			kLoopAttrLoop,		// [loop], hinted not to be unrolled
+			kLoopAttrUnroll		// [unroll] hinted to be fully unrolled, [unroll(N)] N copies of the body
+		};
 	private:
 		CodeDomain* mForBody;
 		CodeDomain* mStartStepCond;
+		LoopAttribute mLoopAttr;
+		int mUnrollCount;
 	public:
 		Exp_For();
 		virtual ~Exp_For();
@@ -485,11 +694,28 @@ namespace SC {
 
 	class RootDomain : public CodeDomain
 	{
+	private:
+		SymbolTable mSymbols;
+		AST_Arena mArena;
 	public:
 		RootDomain(CodeDomain* pRefDomain);
 		virtual ~RootDomain();
-
-		bool CompileToIR(CG_Context* pPredefine, KSC_ModuleDesc& mouduleDesc);
+		virtual SymbolTable* GetSymbolTable();
+		virtual AST_Arena* GetArena();
+
+		// The root domain owns the arena of its expressions, so itself is allocated from the heap.
+		static void* operator new(size_t size);
+		static void operator delete(void* p);
+
+		// In lazy mode only the structures and the descriptions of the functions are generated, the code generation 
+		// context is kept in the module description for the functions to be compiled later.
+		bool CompileToIR(KSC_ModuleDesc& mouduleDesc, bool lazyCodeGen);
+		// Generates the code of the function and all the functions it calls directly or indirectly, 
+		// the functions whose code is already generated are skipped. The newly generated functions are returned.
+		bool CompileFunctionToIR(KSC_FunctionDesc& funcDesc, KSC_ModuleDesc& mouduleDesc, std::vector<llvm::Function*>& newFuncs);
+		// Removes the functions generated by CompileFunctionToIR which failed to compile, verify or optimize,
+		// so the next lookup generates them again instead of taking the broken code.
+		void DiscardFunctionIR(KSC_ModuleDesc& mouduleDesc, const std::vector<llvm::Function*>& funcs);
 	};
 
 
@@ -511,9 +737,16 @@ namespace SC {
 		const char* mContentPtr;
 		const char* mCurParsingPtr;
 		int mCurParsingLOC;
+		SymbolTable* mpSymbols;
 
 
-		std::list<Token> mBufferedToken;
+		// The whole content is tokenized before parsing, the parser consumes the tokens by moving the cursor.
+		// If the lexing fails, the tokens before the failure are still kept and the error is reported
+		// when the parser reaches it.
+		std::vector<Token> mTokens;
+		int mTokenCursor;
+		std::string mLexErrorMsg;
+		int mLexErrorLOC;
 		std::list<std::pair<Token, std::string> > mErrorMessages;
 		std::list<std::pair<Token, std::string> > mWarningMessages;
 		std::list<std::string> mConstStrings;
@@ -529,6 +762,7 @@ namespace SC {
 		bool IsIfExpPartten();
 		
 		Token ScanForToken(std::string& errorMsg);
+		void Tokenize(const char* content);
 
 	public:
 		CompilingContext(const char* content);
@@ -542,10 +776,12 @@ namespace SC {
 		bool IsEOF() const;
 
 		Token GetNextToken();
-		Token PeekNextToken(int next_i);
+		const Token& PeekNextToken(int next_i);
 		bool ExpectAndEat(const char* str);
 		bool ExpectTypeAndEat(CodeDomain* curDomain, VarType& outType, const Exp_StructDef*& outStructDef);
 
+		// Only scans the content for tokens without parsing, returns the token count or -1 on lexing error.
+		int ScanTokens(const char* content);
 		RootDomain* Parse(const char* content, CodeDomain* pRefDomain);
 		bool ParsePartial(const char* content, CodeDomain* pDomain);
 
@@ -138,11 +138,13 @@ int TypeSize(VarType type)
 
 VarType MakeType(bool I_or_F, int elemCnt)
 {
+	// The 8-element types follow the 4-element ones
+	int typeOffset = (elemCnt == 8) ? 4 : elemCnt - 1;
 	if (I_or_F) {
-		return VarType(VarType::kInt + elemCnt - 1);
+		return VarType(VarType::kInt + typeOffset);
 	}
 	else {
-		return VarType(VarType::kFloat + elemCnt - 1);
+		return VarType(VarType::kFloat + typeOffset);
 	}
 }
 
@@ -223,6 +225,16 @@ KSC_StructDesc::~KSC_StructDesc()
 	}
 }
 
+KSC_ModuleDesc::KSC_ModuleDesc()
+{
+	mOptLevel = 2;
+	mRefCnt = 1;
+	mLazyCodeGen = false;
+	mpSession = NULL;
+	mpRootDomain = NULL;
+	mpCG_Ctx = NULL;
+}
+
 KSC_ModuleDesc::~KSC_ModuleDesc()
 {
 	{
@@ -238,6 +250,22 @@ KSC_ModuleDesc::~KSC_ModuleDesc()
 			delete it->second;
 		}
 	}
+
+	delete mpCG_Ctx;
+	delete mpRootDomain;
+	delete mpSession;
+}
+
+KSC_FunctionDesc::KSC_FunctionDesc()
+{
+	F = NULL;
+	mpModule = NULL;
+	mpFuncDecl = NULL;
+	mpWrapperF = NULL;
+	mpNativePtr = NULL;
+	mpBatchPtr = NULL;
+	for (int i = 0; i < 3; ++i)
+		mpSIMDPtrs[i] = NULL;
 }
 
 KSC_FunctionDesc::~KSC_FunctionDesc()
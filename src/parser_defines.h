@@ -1,5 +1,13 @@
 #pragma once
 #define MAX_TOKEN_LENGTH 100
+
+// The storage class of the per-thread variables, only the POD types are allowed.
+#ifdef _MSC_VER
+#define SC_THREAD_LOCAL __declspec(thread)
+#else
+#define SC_THREAD_LOCAL __thread
+#endif
+
 #include "SC_API.h"
 #include <vector>
 #include <hash_map>
@@ -10,6 +18,11 @@ namespace llvm {
 
 namespace SC {
 
+	class RootDomain;
+	class Exp_FunctionDecl;
+	class CG_Context;
+	class CG_Session;
+
 	bool IsBuiltInType(VarType type);
 	bool IsFloatType(VarType type);
 	bool IsIntegerType(VarType type);
@@ -37,24 +50,53 @@ public:
 	std::hash_map<std::string, MemberInfo> mMemberIndices;
 };
 
+class KSC_ModuleDesc;
+
 class KSC_FunctionDesc
 {
 public:
+	KSC_FunctionDesc();
 	~KSC_FunctionDesc();
 
 	std::vector<KSC_TypeInfo> mArgumentTypes;
 	std::vector<std::string> mArgTypeStrings;
 	llvm::Function* F;
 	std::vector<int> needJITPacked;
-
+	KSC_ModuleDesc* mpModule;
+	// The AST of the function, which is used to generate the code on demand in lazy mode.
+	SC::Exp_FunctionDecl* mpFuncDecl;
+	// The wrapper converting the arguments from the host layout(NULL if it's not needed) and the JIT-ed
+	// function pointer returned to the host, they are created on the first KSC_GetFunctionPtr call.
+	llvm::Function* mpWrapperF;
+	void* mpNativePtr;
+	// The JIT-ed batch function, created on the first KSC_GetBatchFunctionPtr call.
+	void* mpBatchPtr;
+	// The JIT-ed SIMD functions of 4, 8 and 16 lanes, created on the first KSC_GetSIMDFunctionPtr call of each width.
+	void* mpSIMDPtrs[3];
 };
 
 class KSC_ModuleDesc
 {
 public:
+	KSC_ModuleDesc();
 	~KSC_ModuleDesc();
 
 	std::hash_map<std::string, KSC_StructDesc*> mGlobalStructures;
 	std::hash_map<std::string, KSC_FunctionDesc*> mFunctionDesc;
+	int mOptLevel;
+	// The identical KSC_Compile requests share the module, it is released when the last reference is released.
+	int mRefCnt;
+	std::string mSharedKey;
+	// The LLVM context, llvm module and execution engine of this module, the IR and the machine code are freed with it.
+	SC::CG_Session* mpSession;
+
+	// In lazy mode the code of the functions is generated on the first lookup, so the module keeps
+	// the source code, the AST and the code generation context alive until it is destroyed.
+	// The AST tokens point to the source code, so it is a copy owned by the module.
+	//
+	bool mLazyCodeGen;
+	std::string mSourceCode;
+	SC::RootDomain* mpRootDomain;
+	SC::CG_Context* mpCG_Ctx;
 
 };
\ No newline at end of file
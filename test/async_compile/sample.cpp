@@ -0,0 +1,102 @@
+// Compiles the modules in background with KSC_CompileAsync and collects them by KSC_WaitModule and KSC_PollModule.
+// The callback of each job is invoked once, the job of the broken source reports the error.
+//
+
+#include <stdio.h>
+#include "SC_API.h"
+#include <string.h>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+static char* ReadFile(const char* fileName)
+{
+	FILE* f = NULL;
+	fopen_s(&f, fileName, "r");
+	if (f == NULL)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char* content = new char[len + 1];
+	size_t totalLen = fread(content, 1, len, f);
+	content[totalLen] = '\0';
+	fclose(f);
+	return content;
+}
+
+static std::atomic<int> s_callbackCnt(0);
+static std::atomic<int> s_failedCallbackCnt(0);
+
+static void OnCompiled(ModuleHandle hModule, void* userData)
+{
+	++s_callbackCnt;
+	if (!hModule)
+		++s_failedCallbackCnt;
+}
+
+typedef int (*PFN_Scale)(int x);
+
+static bool CheckModule(ModuleHandle hModule, int jobIdx)
+{
+	PFN_Scale Scale = hModule ? (PFN_Scale)KSC_GetFunctionPtr(KSC_GetFunctionHandleByName("Scale", hModule)) : NULL;
+	if (!Scale || Scale(jobIdx) != jobIdx * 3) {
+		printf("Job %d failed: %s\n", jobIdx, KSC_GetLastErrorMsg());
+		return false;
+	}
+	return KSC_ReleaseModule(hModule);
+}
+
+int main(int argc, char* argv[])
+{
+	KSC_Initialize();
+	char* content = ReadFile("async_compile.ls");
+	if (!content)
+		return -1;
+
+	const int jobCnt = 8;
+	CompileJobHandle hJobs[jobCnt];
+	for (int i = 0; i < jobCnt; ++i) {
+		char prefix[32];
+		sprintf_s(prefix, "// Job %d\n", i);
+		std::string source = std::string(prefix) + content;
+		// The later jobs have higher priority, the order of finishing doesn't matter to the results
+		hJobs[i] = KSC_CompileAsync(source.c_str(), OnCompiled, NULL, i);
+		if (!hJobs[i]) {
+			printf("Failed to submit job %d: %s\n", i, KSC_GetLastErrorMsg());
+			return -1;
+		}
+	}
+	CompileJobHandle hBrokenJob = KSC_CompileAsync("int Broken(int x) { return x +; }", OnCompiled);
+
+	// Half of the jobs are waited for and the other half are polled
+	bool passed = true;
+	for (int i = 0; i < jobCnt / 2; ++i)
+		passed = CheckModule(KSC_WaitModule(hJobs[i]), i) && passed;
+	for (int i = jobCnt / 2; i < jobCnt; ++i) {
+		ModuleHandle hModule = NULL;
+		while (!KSC_PollModule(hJobs[i], &hModule))
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		passed = CheckModule(hModule, i) && passed;
+	}
+
+	if (KSC_WaitModule(hBrokenJob)) {
+		printf("The broken source is compiled.\n");
+		passed = false;
+	}
+	else
+		printf("Broken source: %s\n", KSC_GetLastErrorMsg());
+
+	// All the callbacks are invoked before the jobs are marked done
+	if (s_callbackCnt != jobCnt + 1 || s_failedCallbackCnt != 1) {
+		printf("%d callbacks with %d failures, expected %d with 1.\n", (int)s_callbackCnt, (int)s_failedCallbackCnt, jobCnt + 1);
+		passed = false;
+	}
+
+	delete[] content;
+	printf(passed ? "Passed.\n" : "Failed.\n");
+	KSC_Destory();
+	return passed ? 0 : -1;
+}
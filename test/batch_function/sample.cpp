@@ -0,0 +1,140 @@
+// Runs a KSCL function over a batch of samples with one call and compares it with calling the function per sample.
+// The SIMD version runs 8 samples at once, its sample count is not a multiple of 8 so the last group is partial.
+// The dispatched version runs the batch function on the worker threads.
+//
+
+#include <stdio.h>
+#include "SC_API.h"
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+struct Sample
+{
+	float normal[3];	// float3
+	float lightDir[3];	// float3
+};
+
+int main(int argc, char* argv[])
+{
+	// Take the best ISA level of the host, the SIMD functions get the widest vectors it has
+	const char* isaLevel = KSC_SetTargetISALevels("avx512,avx2,avx,sse4.2,sse2");
+	printf("Target ISA level: %s\n", isaLevel ? isaLevel : KSC_GetLastErrorMsg());
+	KSC_Initialize();
+
+	FILE* f = NULL;
+	fopen_s(&f, "batch_function.ls", "r");
+	if (f == NULL)
+		return -1;
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char* content = new char[len + 1];
+	char* line = content;
+	size_t totalLen = 0;
+
+	while (fgets(line, len, f) != NULL) {
+		size_t lineLen = strlen(line);
+		line += lineLen;
+		totalLen += lineLen;
+	}
+	fclose(f);
+
+	if (totalLen == 0)
+		return -1;
+	else {
+		content[totalLen] = '\0';
+
+		ModuleHandle hModule = KSC_Compile(content);
+		if (!hModule) {
+			printf(KSC_GetLastErrorMsg());
+			return -1;
+		}
+
+		FunctionHandle hFunc = KSC_GetFunctionHandleByName("Lambert", hModule);
+		typedef float (*PFN_Lambert)(float* normal, float* lightDir, float intensity);
+		PFN_Lambert Lambert = (PFN_Lambert)KSC_GetFunctionPtr(hFunc);
+		KSC_BatchFunction LambertBatch = (KSC_BatchFunction)KSC_GetBatchFunctionPtr(hFunc);
+		KSC_BatchFunction LambertSIMD = (KSC_BatchFunction)KSC_GetSIMDFunctionPtr(hFunc, 8);
+		if (!Lambert || !LambertBatch || !LambertSIMD) {
+			printf(KSC_GetLastErrorMsg());
+			return -1;
+		}
+
+		const int sampleCnt = 1024 * 1024;
+		Sample* samples = new Sample[sampleCnt];
+		for (int i = 0; i < sampleCnt; ++i) {
+			float angle = (float)i / sampleCnt * 6.28f;
+			samples[i].normal[0] = cosf(angle);
+			samples[i].normal[1] = sinf(angle);
+			samples[i].normal[2] = 0.0f;
+			samples[i].lightDir[0] = 0.6f;
+			samples[i].lightDir[1] = 0.8f;
+			samples[i].lightDir[2] = 0.0f;
+		}
+		float intensity = 2.0f;
+		float* results = new float[sampleCnt];
+		float* batchResults = new float[sampleCnt];
+		float* simdResults = new float[sampleCnt];
+		float* dispatchResults = new float[sampleCnt];
+
+		clock_t startTime = clock();
+		for (int i = 0; i < sampleCnt; ++i)
+			results[i] = Lambert(samples[i].normal, samples[i].lightDir, intensity);
+		clock_t perCallTime = clock() - startTime;
+
+		// The intensity is uniform for all the samples, so its stride is zero
+		void* argPtrs[3] = {samples[0].normal, samples[0].lightDir, &intensity};
+		int argStrides[3] = {sizeof(Sample), sizeof(Sample), 0};
+		startTime = clock();
+		LambertBatch(argPtrs, argStrides, batchResults, sizeof(float), sampleCnt);
+		clock_t batchTime = clock() - startTime;
+
+		const int simdSampleCnt = sampleCnt - 3;
+		simdResults[simdSampleCnt] = -1.0f;
+		startTime = clock();
+		LambertSIMD(argPtrs, argStrides, simdResults, sizeof(float), simdSampleCnt);
+		clock_t simdTime = clock() - startTime;
+
+		startTime = clock();
+		if (!KSC_Dispatch(hFunc, argPtrs, argStrides, dispatchResults, sizeof(float), sampleCnt)) {
+			printf(KSC_GetLastErrorMsg());
+			return -1;
+		}
+		clock_t dispatchTime = clock() - startTime;
+
+		for (int i = 0; i < sampleCnt; ++i) {
+			if (fabsf(results[i] - batchResults[i]) > 1e-5f) {
+				printf("Sample %d mismatches: %f vs %f.\n", i, results[i], batchResults[i]);
+				return -1;
+			}
+			if (fabsf(results[i] - dispatchResults[i]) > 1e-5f) {
+				printf("Dispatched sample %d mismatches: %f vs %f.\n", i, results[i], dispatchResults[i]);
+				return -1;
+			}
+			if (i < simdSampleCnt && fabsf(results[i] - simdResults[i]) > 1e-5f) {
+				printf("SIMD sample %d mismatches: %f vs %f.\n", i, results[i], simdResults[i]);
+				return -1;
+			}
+		}
+		// Nothing is written past the partial group
+		if (simdResults[simdSampleCnt] != -1.0f) {
+			printf("SIMD function writes past the end.\n");
+			return -1;
+		}
+		printf("Per-call: %.3f s, batch: %.3f s, SIMD: %.3f s, dispatched: %.3f s for %d samples.\n", 
+			double(perCallTime) / CLOCKS_PER_SEC, double(batchTime) / CLOCKS_PER_SEC, double(simdTime) / CLOCKS_PER_SEC, 
+			double(dispatchTime) / CLOCKS_PER_SEC, sampleCnt);
+
+		delete[] samples;
+		delete[] results;
+		delete[] batchResults;
+		delete[] simdResults;
+		delete[] dispatchResults;
+	}
+	delete[] content;
+	KSC_Destory();
+
+	return 0;
+}
@@ -0,0 +1,45 @@
+; The host functions linked into the KSCL modules by KSC_AddExternalBitcode, they are what clang emits for the C code
+; in the comments.
+
+; float ScaleAndBias(float x, float scale) { return x * scale + 1.0f; }
+define float @ScaleAndBias(float %x, float %scale) nounwind readnone {
+entry:
+  %mul = fmul float %x, %scale
+  %add = fadd float %mul, 1.000000e+00
+  ret float %add
+}
+
+; int CountBits(int x) { return __builtin_popcount(x); }
+define i32 @CountBits(i32 %x) nounwind readnone {
+entry:
+  %cnt = call i32 @llvm.ctpop.i32(i32 %x)
+  ret i32 %cnt
+}
+
+declare i32 @llvm.ctpop.i32(i32) nounwind readnone
+
+; void AccumulateInto(float* sum, float x) { *sum += x; }
+define void @AccumulateInto(float* %sum, float %x) nounwind {
+entry:
+  %old = load float* %sum, align 4
+  %new = fadd float %old, %x
+  store float %new, float* %sum, align 4
+  ret void
+}
+
+; float4 Scale4(float4 v, float s) { return v * s; }
+define <4 x float> @Scale4(<4 x float> %v, float %s) nounwind readnone {
+entry:
+  %ins = insertelement <4 x float> undef, float %s, i32 0
+  %splat = shufflevector <4 x float> %ins, <4 x float> undef, <4 x i32> zeroinitializer
+  %mul = fmul <4 x float> %v, %splat
+  ret <4 x float> %mul
+}
+
+; int Mismatched(int x) { return x + 1; }
+; KSCL declares it on float, so it is not linked and the host function of the same name is called instead.
+define i32 @Mismatched(i32 %x) nounwind readnone {
+entry:
+  %add = add nsw i32 %x, 1
+  ret i32 %add
+}
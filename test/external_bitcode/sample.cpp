@@ -0,0 +1,85 @@
+// Links the host functions in LLVM bitcode(see host_funcs.ll) into the KSCL module and calls them from KSCL, the
+// function declared with another type than its bitcode falls back to the function pointer of the host.
+//
+
+#include <stdio.h>
+#include "SC_API.h"
+#include <string.h>
+
+// Registered as "Mismatched" by pointer, the bitcode version returns x + 1 on int instead
+static float HostMismatched(float x)
+{
+	return x * 2.0f;
+}
+
+static char* ReadFile(const char* fileName, const char* mode, size_t& len)
+{
+	FILE* f = NULL;
+	fopen_s(&f, fileName, mode);
+	if (f == NULL)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	long fileLen = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char* content = new char[fileLen + 1];
+	len = fread(content, 1, fileLen, f);
+	content[len] = '\0';
+	fclose(f);
+	return content;
+}
+
+static bool CheckValue(const char* what, float value, float expected)
+{
+	bool passed = value == expected;
+	printf("%s: %g, expected %g - %s\n", what, value, expected, passed ? "passed" : "FAILED");
+	return passed;
+}
+
+int main(int argc, char* argv[])
+{
+	KSC_Initialize();
+
+	// The garbage is rejected before anything is linked
+	const char garbage[] = "not bitcode";
+	if (KSC_AddExternalBitcode(garbage, sizeof(garbage))) {
+		printf("The invalid bitcode is accepted.\n");
+		return -1;
+	}
+	printf("%s\n", KSC_GetLastErrorMsg());
+
+	size_t bcLen = 0;
+	char* bitcode = ReadFile("host_funcs.bc", "rb", bcLen);
+	if (!bitcode || !KSC_AddExternalBitcode(bitcode, bcLen)) {
+		printf(bitcode ? KSC_GetLastErrorMsg() : "Failed to read host_funcs.bc.\n");
+		return -1;
+	}
+	delete[] bitcode;
+	KSC_AddExternalFunction("Mismatched", (void*)HostMismatched);
+
+	size_t srcLen = 0;
+	char* content = ReadFile("external_bitcode.ls", "r", srcLen);
+	if (!content || srcLen == 0)
+		return -1;
+
+	ModuleHandle hModule = KSC_Compile(content);
+	delete[] content;
+	if (!hModule) {
+		printf(KSC_GetLastErrorMsg());
+		return -1;
+	}
+
+	float (*ComputeScalars)(float x) = (float (*)(float))KSC_GetFunctionPtr(KSC_GetFunctionHandleByName("ComputeScalars", hModule));
+	float (*ScaleVector)(float s) = (float (*)(float))KSC_GetFunctionPtr(KSC_GetFunctionHandleByName("ScaleVector", hModule));
+	float (*CallMismatched)(float x) = (float (*)(float))KSC_GetFunctionPtr(KSC_GetFunctionHandleByName("CallMismatched", hModule));
+	if (!ComputeScalars || !ScaleVector || !CallMismatched) {
+		printf(KSC_GetLastErrorMsg());
+		return -1;
+	}
+
+	// (1.5 * 2 + 1) accumulated 4 times plus the 8 bits of 255
+	bool passed = CheckValue("ComputeScalars(1.5)", ComputeScalars(1.5f), 24.0f);
+	passed = CheckValue("ScaleVector(0.5)", ScaleVector(0.5f), 2.0f) && passed;
+	passed = CheckValue("CallMismatched(3.0)", CallMismatched(3.0f), 6.0f) && passed;
+	return passed ? 0 : -1;
+}
@@ -49,6 +49,22 @@ int main(int argc, char* argv[])
 		PFN_factorial factorial = (PFN_factorial)KSC_GetFunctionPtr(hFunc);
 		int result = factorial(9);
 		printf("result is %d\n", result);
+
+		typedef int (*PFN_loop)(int cnt);
+		PFN_loop countUp = (PFN_loop)KSC_GetFunctionPtr(KSC_GetFunctionHandleByName("countUp", hModule));
+		PFN_loop sumUnrolled = (PFN_loop)KSC_GetFunctionPtr(KSC_GetFunctionHandleByName("sumUnrolled", hModule));
+		PFN_loop sumRolled = (PFN_loop)KSC_GetFunctionPtr(KSC_GetFunctionHandleByName("sumRolled", hModule));
+		if (countUp(0) != 0 || countUp(5) != 5) {
+			printf("countUp is wrong: %d %d\n", countUp(0), countUp(5));
+			return -1;
+		}
+		for (int cnt = 0; cnt < 10; ++cnt) {
+			int expected = cnt * (cnt - 1) / 2;
+			if (sumUnrolled(cnt) != expected || sumRolled(cnt) != expected) {
+				printf("Loop sum of %d is wrong: %d %d\n", cnt, sumUnrolled(cnt), sumRolled(cnt));
+				return -1;
+			}
+		}
 	}
 	
 
@@ -12,9 +12,17 @@ void CompareTwoInt(int a, int b)
 }
 
 
+// The shared code is JIT-ed by the global engine, the scalar built-in math in it becomes the calls to the C runtime.
+// test_05 calls it from the module.
+static const char* s_sharedCode = 
+	"float SharedMath(float x)\n"
+	"{\n"
+	"	return sin(x) + cos(x) + exp(x) + log(x + 2.0) + pow(x, 2.5);\n"
+	"}\n";
+
 int main(int argc, char* argv[])
 {
-	KSC_Initialize();
+	KSC_Initialize(s_sharedCode);
 	KSC_AddExternalFunction("CompareTwoInt", CompareTwoInt);
 
 	FILE* f = NULL;
@@ -0,0 +1,76 @@
+// Measures the throughput of KSC lexer in MB/s.
+//
+
+#include <stdio.h>
+#include "SC_API.h"
+#include <string.h>
+#include <time.h>
+
+int main(int argc, char* argv[])
+{
+	KSC_Initialize();
+
+	FILE* f = NULL;
+	fopen_s(&f, "lexer_throughput.ls", "r");
+	if (f == NULL)
+		return -1;
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char* content = new char[len + 1];
+	char* line = content;
+	size_t totalLen = 0;
+
+	while (fgets(line, len, f) != NULL) {
+		size_t lineLen = strlen(line);
+		line += lineLen;
+		totalLen += lineLen;
+	}
+	fclose(f);
+
+	if (totalLen == 0)
+		return -1;
+	else {
+		content[totalLen] = '\0';
+
+		// Make sure the sample code is valid before measuring the lexer
+		ModuleHandle hModule = KSC_Compile(content);
+		if (!hModule) {
+			printf(KSC_GetLastErrorMsg());
+			return -1;
+		}
+
+		// Replicate the sample code to make a source of at least 8MB
+		const size_t minBufferSize = 8 * 1024 * 1024;
+		size_t repeatCnt = minBufferSize / totalLen + 1;
+		size_t bufferSize = repeatCnt * totalLen;
+		char* buffer = new char[bufferSize + 1];
+		for (size_t i = 0; i < repeatCnt; ++i)
+			memcpy(buffer + i * totalLen, content, totalLen);
+		buffer[bufferSize] = '\0';
+
+		const int passCnt = 10;
+		int tokenCnt = 0;
+		clock_t startTime = clock();
+		for (int i = 0; i < passCnt; ++i) {
+			tokenCnt = KSC_ScanTokens(buffer);
+			if (tokenCnt < 0) {
+				printf(KSC_GetLastErrorMsg());
+				return -1;
+			}
+		}
+		clock_t endTime = clock();
+
+		double seconds = double(endTime - startTime) / CLOCKS_PER_SEC;
+		double megaBytes = double(bufferSize) * passCnt / (1024.0 * 1024.0);
+		printf("Scanned %d tokens in %.2f MB per pass.\n", tokenCnt, double(bufferSize) / (1024.0 * 1024.0));
+		if (seconds > 0.0)
+			printf("Lexer throughput is %.2f MB/s\n", megaBytes / seconds);
+
+		delete[] buffer;
+	}
+	delete[] content;
+
+	return 0;
+}
@@ -0,0 +1,148 @@
+// Compiles the same source code in new sessions with the on-disk module cache enabled. The first compiling stores the
+// module, the next one loads it without writing the files again. The broken bitcode and the reflection data of another
+// source(i.e. the key collides) are not taken, the module is compiled and stored again.
+//
+
+#include <stdio.h>
+#include "SC_API.h"
+#include <string.h>
+#include <string>
+#include <io.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/utime.h>
+
+static const char* s_cacheDir = "ksc_cache_test";
+// The time stamp of the cached files set by the test, it is kept if the files are not written again
+static const time_t s_oldTime = 1000000000;
+
+static char* ReadFile(const char* fileName, const char* mode, size_t& len)
+{
+	FILE* f = NULL;
+	fopen_s(&f, fileName, mode);
+	if (f == NULL)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	long fileLen = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char* content = new char[fileLen + 1];
+	len = fread(content, 1, fileLen, f);
+	content[len] = '\0';
+	fclose(f);
+	return content;
+}
+
+static bool WriteFile(const std::string& fileName, const char* mode, const char* data, size_t len)
+{
+	FILE* f = NULL;
+	fopen_s(&f, fileName.c_str(), mode);
+	if (f == NULL)
+		return false;
+	bool succeeded = fwrite(data, 1, len, f) == len;
+	fclose(f);
+	return succeeded;
+}
+
+// Returns the count of the cached files with the extension, "path" is set to the first one.
+static int FindCacheFiles(const char* ext, std::string& path)
+{
+	int fileCnt = 0;
+	_finddata_t fileInfo;
+	std::string pattern = std::string(s_cacheDir) + "/*" + ext;
+	intptr_t hFind = _findfirst(pattern.c_str(), &fileInfo);
+	if (hFind == -1)
+		return 0;
+	do {
+		if (fileCnt++ == 0)
+			path = std::string(s_cacheDir) + "/" + fileInfo.name;
+	} while (_findnext(hFind, &fileInfo) == 0);
+	_findclose(hFind);
+	return fileCnt;
+}
+
+static void ClearCache()
+{
+	std::string path;
+	while (FindCacheFiles(".*", path) > 0)
+		remove(path.c_str());
+}
+
+static void SetOldTime(const std::string& path)
+{
+	_utimbuf times = {s_oldTime, s_oldTime};
+	_utime(path.c_str(), &times);
+}
+
+static bool HasOldTime(const std::string& path)
+{
+	struct _stat fileStat;
+	return _stat(path.c_str(), &fileStat) == 0 && fileStat.st_mtime == s_oldTime;
+}
+
+// Compiles the source code in a new session, so the module is not shared with the ones compiled before.
+static bool CompileInNewSession(const char* sourceCode)
+{
+	KSC_Initialize();
+	KSC_SetCacheDirectory(s_cacheDir);
+	ModuleHandle hModule = KSC_Compile(sourceCode);
+	typedef int (*PFN_Scale)(int x);
+	PFN_Scale Scale = hModule ? (PFN_Scale)KSC_GetFunctionPtr(KSC_GetFunctionHandleByName("Scale", hModule)) : NULL;
+	bool succeeded = Scale && Scale(5) == 15;
+	if (!succeeded)
+		printf("Failed to compile: %s\n", KSC_GetLastErrorMsg());
+	KSC_Destory();
+	return succeeded;
+}
+
+static bool Check(bool condition, const char* what)
+{
+	printf("%s - %s\n", what, condition ? "passed" : "FAILED");
+	return condition;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t len = 0;
+	char* content = ReadFile("module_cache.ls", "r", len);
+	if (!content)
+		return -1;
+
+	// The cache miss stores one module
+	KSC_Initialize();
+	KSC_SetCacheDirectory(s_cacheDir);
+	KSC_Destory();
+	ClearCache();
+	std::string bcPath, ksdPath;
+	bool passed = Check(CompileInNewSession(content) && FindCacheFiles(".bc", bcPath) == 1 && FindCacheFiles(".ksd", ksdPath) == 1,
+		"Miss stores the module");
+
+	// The cache hit leaves the files as they are
+	SetOldTime(bcPath);
+	SetOldTime(ksdPath);
+	passed = Check(CompileInNewSession(content) && HasOldTime(bcPath) && HasOldTime(ksdPath), "Hit loads the module") && passed;
+
+	// The broken bitcode is compiled and stored again
+	const char garbage[] = "not bitcode";
+	WriteFile(bcPath, "wb", garbage, sizeof(garbage));
+	SetOldTime(bcPath);
+	passed = Check(CompileInNewSession(content) && !HasOldTime(bcPath), "Broken bitcode is replaced") && passed;
+
+	// The reflection data of another source with the same key is not taken
+	size_t ksdLen = 0;
+	char* ksd = ReadFile(ksdPath.c_str(), "r", ksdLen);
+	const char* rest = ksd ? strchr(ksd, '\n') : NULL;
+	std::string otherKsd = std::string("0:0000000000000000") + (rest ? rest : "\n");
+	delete[] ksd;
+	WriteFile(ksdPath, "w", otherKsd.c_str(), otherKsd.size());
+	SetOldTime(ksdPath);
+	passed = Check(CompileInNewSession(content) && !HasOldTime(ksdPath), "Colliding entry is replaced") && passed;
+
+	// Another source is another module
+	std::string otherSource = std::string("// Another module\n") + content;
+	passed = Check(CompileInNewSession(otherSource.c_str()) && FindCacheFiles(".bc", bcPath) == 2, "Other source is stored apart") && passed;
+
+	ClearCache();
+	delete[] content;
+	return passed ? 0 : -1;
+}
@@ -0,0 +1,86 @@
+// Compiles and releases the modules one after another, each module has its own LLVM module and engine so releasing one
+// leaves the others working. The released handle is rejected afterwards.
+//
+
+#include <stdio.h>
+#include "SC_API.h"
+#include <string.h>
+
+static char* ReadFile(const char* fileName)
+{
+	FILE* f = NULL;
+	fopen_s(&f, fileName, "r");
+	if (f == NULL)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char* content = new char[len + 1];
+	size_t totalLen = fread(content, 1, len, f);
+	content[totalLen] = '\0';
+	fclose(f);
+	return content;
+}
+
+typedef int (*PFN_Scale)(int x);
+
+static PFN_Scale GetScale(ModuleHandle hModule)
+{
+	return (PFN_Scale)KSC_GetFunctionPtr(KSC_GetFunctionHandleByName("Scale", hModule));
+}
+
+int main(int argc, char* argv[])
+{
+	KSC_Initialize();
+	char* content = ReadFile("module_release.ls");
+	if (!content)
+		return -1;
+
+	// The modules differ in the optimization level, so they are not shared
+	ModuleHandle hModule0 = KSC_Compile(content, 0);
+	ModuleHandle hModule2 = KSC_Compile(content, 2);
+	if (!hModule0 || !hModule2 || hModule0 == hModule2) {
+		printf("Failed to compile: %s\n", KSC_GetLastErrorMsg());
+		return -1;
+	}
+	PFN_Scale Scale0 = GetScale(hModule0);
+	PFN_Scale Scale2 = GetScale(hModule2);
+	if (!Scale0 || !Scale2 || Scale0(5) != 15 || Scale2(5) != 15) {
+		printf("The compiled functions are wrong.\n");
+		return -1;
+	}
+
+	// Releasing one module leaves the other one working
+	if (!KSC_ReleaseModule(hModule0)) {
+		printf("Failed to release the module: %s\n", KSC_GetLastErrorMsg());
+		return -1;
+	}
+	if (Scale2(7) != 21) {
+		printf("The remaining module is broken by the release of the other one.\n");
+		return -1;
+	}
+
+	// The released handle is invalid
+	if (KSC_ReleaseModule(hModule0)) {
+		printf("The released module is released again.\n");
+		return -1;
+	}
+	printf("Releasing again: %s\n", KSC_GetLastErrorMsg());
+
+	// Compiling again after the release gives a new working module
+	for (int i = 0; i < 16; ++i) {
+		ModuleHandle hModule = KSC_Compile(content, 0);
+		PFN_Scale Scale = hModule ? GetScale(hModule) : NULL;
+		if (!Scale || Scale(i) != i * 3 || !KSC_ReleaseModule(hModule)) {
+			printf("Failed to compile and release the module %d.\n", i);
+			return -1;
+		}
+	}
+
+	KSC_ReleaseModule(hModule2);
+	delete[] content;
+	printf("Passed.\n");
+	KSC_Destory();
+	return 0;
+}
@@ -0,0 +1,96 @@
+// Compiles the same source code several times, from one thread and from several threads at once. The requests with the
+// same options get the same reference-counted module, which lives until the last reference is released.
+//
+
+#include <stdio.h>
+#include "SC_API.h"
+#include <string.h>
+#include <thread>
+
+static char* ReadFile(const char* fileName)
+{
+	FILE* f = NULL;
+	fopen_s(&f, fileName, "r");
+	if (f == NULL)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char* content = new char[len + 1];
+	size_t totalLen = fread(content, 1, len, f);
+	content[totalLen] = '\0';
+	fclose(f);
+	return content;
+}
+
+typedef int (*PFN_Scale)(int x);
+
+static PFN_Scale GetScale(ModuleHandle hModule)
+{
+	return (PFN_Scale)KSC_GetFunctionPtr(KSC_GetFunctionHandleByName("Scale", hModule));
+}
+
+int main(int argc, char* argv[])
+{
+	KSC_Initialize();
+	char* content = ReadFile("shared_module.ls");
+	if (!content)
+		return -1;
+
+	ModuleHandle hFirst = KSC_Compile(content);
+	ModuleHandle hSecond = KSC_Compile(content);
+	ModuleHandle hOtherLevel = KSC_Compile(content, 0);
+	if (!hFirst || hFirst != hSecond || !hOtherLevel || hOtherLevel == hFirst) {
+		printf("The modules are not shared by the same options only.\n");
+		return -1;
+	}
+
+	// The concurrent requests wait for one compiling, they all get the same module
+	const int threadCnt = 4;
+	const char* newSource = "int Scale(int x) { return x * 5; }";
+	ModuleHandle hModules[threadCnt];
+	std::thread* threads[threadCnt];
+	for (int i = 0; i < threadCnt; ++i)
+		threads[i] = new std::thread([&hModules, newSource, i]() { hModules[i] = KSC_Compile(newSource); });
+	for (int i = 0; i < threadCnt; ++i) {
+		threads[i]->join();
+		delete threads[i];
+	}
+	for (int i = 0; i < threadCnt; ++i) {
+		if (!hModules[i] || hModules[i] != hModules[0]) {
+			printf("The concurrent requests get different modules.\n");
+			return -1;
+		}
+	}
+	if (GetScale(hModules[0])(2) != 10) {
+		printf("The concurrently compiled module is wrong.\n");
+		return -1;
+	}
+
+	// Each request holds one reference, the module works until the last one is released
+	PFN_Scale Scale = GetScale(hFirst);
+	if (!KSC_ReleaseModule(hFirst) || !Scale || Scale(4) != 12) {
+		printf("The shared module is destroyed by the first release.\n");
+		return -1;
+	}
+	if (!KSC_ReleaseModule(hSecond) || KSC_ReleaseModule(hSecond)) {
+		printf("The shared module is not destroyed by the last release.\n");
+		return -1;
+	}
+	// Compiling it again after the last release gives a new module
+	ModuleHandle hAgain = KSC_Compile(content);
+	if (!hAgain || GetScale(hAgain)(4) != 12) {
+		printf("Failed to compile the released module again.\n");
+		return -1;
+	}
+
+	KSC_ReleaseModule(hAgain);
+	KSC_ReleaseModule(hOtherLevel);
+	for (int i = 0; i < threadCnt; ++i)
+		KSC_ReleaseModule(hModules[i]);
+	delete[] content;
+	printf("Passed.\n");
+	KSC_Destory();
+	return 0;
+}
@@ -0,0 +1,127 @@
+// Compares the shading written with the vector built-in functions against the same shading written by hand, both run
+// over a batch of samples by the batch and the SIMD functions, the results must match and the time of each is printed.
+//
+
+#include <stdio.h>
+#include "SC_API.h"
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+struct Sample
+{
+	float normal[3];	// float3
+	float lightDir[3];	// float3
+	float viewDir[3];	// float3
+};
+
+static bool RunShading(const char* funcName, ModuleHandle hModule, Sample* samples, float ambient, float* batchResults, 
+	float* simdResults, int sampleCnt)
+{
+	FunctionHandle hFunc = KSC_GetFunctionHandleByName(funcName, hModule);
+	KSC_BatchFunction batchFunc = (KSC_BatchFunction)KSC_GetBatchFunctionPtr(hFunc);
+	KSC_BatchFunction simdFunc = (KSC_BatchFunction)KSC_GetSIMDFunctionPtr(hFunc, 8);
+	if (!batchFunc || !simdFunc) {
+		printf(KSC_GetLastErrorMsg());
+		return false;
+	}
+
+	// The ambient is uniform for all the samples, so its stride is zero
+	void* argPtrs[4] = {samples[0].normal, samples[0].lightDir, samples[0].viewDir, &ambient};
+	int argStrides[4] = {sizeof(Sample), sizeof(Sample), sizeof(Sample), 0};
+	clock_t startTime = clock();
+	batchFunc(argPtrs, argStrides, batchResults, sizeof(float), sampleCnt);
+	clock_t batchTime = clock() - startTime;
+
+	startTime = clock();
+	simdFunc(argPtrs, argStrides, simdResults, sizeof(float), sampleCnt);
+	clock_t simdTime = clock() - startTime;
+
+	printf("%s - batch: %.3f s, SIMD: %.3f s for %d samples.\n", funcName, 
+		double(batchTime) / CLOCKS_PER_SEC, double(simdTime) / CLOCKS_PER_SEC, sampleCnt);
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	// Take the best ISA level of the host, mad becomes FMA on the AVX2 hosts
+	const char* isaLevel = KSC_SetTargetISALevels("avx512,avx2,avx,sse4.2,sse2");
+	printf("Target ISA level: %s\n", isaLevel ? isaLevel : KSC_GetLastErrorMsg());
+	KSC_Initialize();
+
+	FILE* f = NULL;
+	fopen_s(&f, "vector_builtins.ls", "r");
+	if (f == NULL)
+		return -1;
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char* content = new char[len + 1];
+	char* line = content;
+	size_t totalLen = 0;
+
+	while (fgets(line, len, f) != NULL) {
+		size_t lineLen = strlen(line);
+		line += lineLen;
+		totalLen += lineLen;
+	}
+	fclose(f);
+
+	if (totalLen == 0)
+		return -1;
+	else {
+		content[totalLen] = '\0';
+
+		ModuleHandle hModule = KSC_Compile(content);
+		if (!hModule) {
+			printf(KSC_GetLastErrorMsg());
+			return -1;
+		}
+
+		const int sampleCnt = 1024 * 1024;
+		Sample* samples = new Sample[sampleCnt];
+		for (int i = 0; i < sampleCnt; ++i) {
+			float angle = (float)i / sampleCnt * 6.28f;
+			samples[i].normal[0] = 2.0f * cosf(angle);
+			samples[i].normal[1] = 2.0f * sinf(angle);
+			samples[i].normal[2] = 0.5f;
+			samples[i].lightDir[0] = 0.6f;
+			samples[i].lightDir[1] = 0.8f;
+			samples[i].lightDir[2] = 0.0f;
+			samples[i].viewDir[0] = 0.0f;
+			samples[i].viewDir[1] = sinf(angle * 3.0f);
+			samples[i].viewDir[2] = cosf(angle * 3.0f);
+		}
+		float ambient = 0.1f;
+		float* builtInResults = new float[sampleCnt];
+		float* builtInSIMDResults = new float[sampleCnt];
+		float* byHandResults = new float[sampleCnt];
+		float* byHandSIMDResults = new float[sampleCnt];
+
+		if (!RunShading("ShadeBuiltIn", hModule, samples, ambient, builtInResults, builtInSIMDResults, sampleCnt) ||
+			!RunShading("ShadeByHand", hModule, samples, ambient, byHandResults, byHandSIMDResults, sampleCnt))
+			return -1;
+
+		// The FMA of mad rounds differently from the separate multiply and add
+		for (int i = 0; i < sampleCnt; ++i) {
+			if (fabsf(builtInResults[i] - byHandResults[i]) > 1e-5f) {
+				printf("Sample %d mismatches: %f vs %f.\n", i, builtInResults[i], byHandResults[i]);
+				return -1;
+			}
+			if (fabsf(builtInSIMDResults[i] - byHandSIMDResults[i]) > 1e-5f) {
+				printf("SIMD sample %d mismatches: %f vs %f.\n", i, builtInSIMDResults[i], byHandSIMDResults[i]);
+				return -1;
+			}
+		}
+
+		delete[] samples;
+		delete[] builtInResults;
+		delete[] builtInSIMDResults;
+		delete[] byHandResults;
+		delete[] byHandSIMDResults;
+	}
+	delete[] content;
+
+	return 0;
+}